@@ -14,6 +14,10 @@ static const unsigned int MAX_BLOCK_SIZE = 32;
 
 static const unsigned int MAX_BLOCK_COUNT_PER_REQUEST = 4 * 4 * 4;
 
+// Mesh blocks needing an update are grouped in cubic regions of this size (in mesh blocks), which can be meshed in a
+// single task when enough of them are pending.
+static const unsigned int MESH_BATCH_REGION_SIZE = 2;
+
 // 24 should be largely enough.
 // With a block size of 32 voxels, and if 1 voxel is 1m large,
 // then the largest blocks will span 268,435.456 kilometers, which is roughly 20 times Earth's diameter.
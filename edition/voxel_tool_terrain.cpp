@@ -223,7 +223,7 @@ Variant VoxelToolTerrain::get_voxel_metadata(Vector3i pos) const {
 	VoxelDataMap &map = _terrain->get_storage();
 	VoxelDataBlock *block = map.get_block(map.voxel_to_block(pos));
 	ERR_FAIL_COND_V_MSG(block == nullptr, Variant(), "Area not editable");
-	RWLockRead lock(block->get_voxels().get_lock());
+	RWLockRead lock(block->get_voxels_const().get_lock());
 	const VoxelMetadata *meta = block->get_voxels_const().get_voxel_metadata(map.to_local(pos));
 	if (meta == nullptr) {
 		return Variant();
@@ -276,7 +276,7 @@ void VoxelToolTerrain::run_blocky_random_tick_static(VoxelDataMap &map, Box3i vo
 		if (block != nullptr) {
 			// Doing ONLY reads here.
 			{
-				RWLockRead lock(block->get_voxels().get_lock());
+				RWLockRead lock(block->get_voxels_const().get_lock());
 				const VoxelBufferInternal &voxels = block->get_voxels_const();
 
 				if (voxels.get_channel_compression(channel) == VoxelBufferInternal::COMPRESSION_UNIFORM) {
@@ -395,7 +395,7 @@ void VoxelToolTerrain::for_each_voxel_metadata_in_area(AABB voxel_area, const Ca
 		const Box3i rel_voxel_box(voxel_box.pos - block_origin, voxel_box.size);
 		// TODO Worth it locking blocks for metadata?
 
-		block->get_voxels().for_each_voxel_metadata_in_area(
+		block->get_voxels_const().for_each_voxel_metadata_in_area(
 				rel_voxel_box, [&callback, block_origin](Vector3i rel_pos, const VoxelMetadata &meta) {
 					Variant v = gd::get_as_variant(meta);
 					const Variant key = rel_pos + block_origin;
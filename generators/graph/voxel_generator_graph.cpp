@@ -554,9 +554,8 @@ static void fill_zx_sdf_slice(const VoxelGraphRuntime::Buffer &sdf_buffer, Voxel
 		int ry) {
 	ZN_PROFILE_SCOPE_NAMED("Copy SDF to block");
 
-	if (out_buffer.get_channel_compression(channel) != VoxelBufferInternal::COMPRESSION_NONE) {
-		out_buffer.decompress_channel(channel);
-	}
+	// Also makes sure data is not shared with another buffer before we write into it
+	out_buffer.decompress_channel(channel);
 	Span<uint8_t> channel_bytes;
 	ERR_FAIL_COND(!out_buffer.get_channel_raw(channel, channel_bytes));
 	const Vector3i buffer_size = out_buffer.get_size();
@@ -608,9 +607,8 @@ static void fill_zx_integer_slice(const VoxelGraphRuntime::Buffer &src_buffer, V
 		unsigned int channel, VoxelBufferInternal::Depth channel_depth, Vector3i rmin, Vector3i rmax, int ry) {
 	ZN_PROFILE_SCOPE_NAMED("Copy integer data to block");
 
-	if (out_buffer.get_channel_compression(channel) != VoxelBufferInternal::COMPRESSION_NONE) {
-		out_buffer.decompress_channel(channel);
-	}
+	// Also makes sure data is not shared with another buffer before we write into it
+	out_buffer.decompress_channel(channel);
 	Span<uint8_t> channel_bytes;
 	ERR_FAIL_COND(!out_buffer.get_channel_raw(channel, channel_bytes));
 	const Vector3i buffer_size = out_buffer.get_size();
@@ -331,15 +331,16 @@ void build_regular_mesh(Span<const Sdf_T> sdf_data, TextureIndicesData texture_i
 	// Get direct representation of the isolevel (not always zero since we are not using signed integers yet)
 	const Sdf_T isolevel = get_isolevel<Sdf_T>();
 
-	// Iterate all cells with padding (expected to be neighbors)
+	// Iterate all cells with padding (expected to be neighbors).
+	// Iteration follows the ZXY layout of the data, so consecutive cells read consecutive memory.
+	// The vertex reuse cache holds full Z slices, so preceding cells along X and Y are always available.
 	Vector3i pos;
 	for (pos.z = min_pos.z; pos.z < max_pos.z; ++pos.z) {
-		for (pos.y = min_pos.y; pos.y < max_pos.y; ++pos.y) {
-			// TODO Optimization: change iteration to be ZXY? (Data is laid out with Y as deepest coordinate)
+		for (pos.x = min_pos.x; pos.x < max_pos.x; ++pos.x) {
 			unsigned int data_index =
-					Vector3iUtil::get_zxy_index(Vector3i(min_pos.x, pos.y, pos.z), block_size_with_padding);
+					Vector3iUtil::get_zxy_index(Vector3i(pos.x, min_pos.y, pos.z), block_size_with_padding);
 
-			for (pos.x = min_pos.x; pos.x < max_pos.x; ++pos.x, data_index += block_size_with_padding.y) {
+			for (pos.y = min_pos.y; pos.y < max_pos.y; ++pos.y, ++data_index) {
 				{
 					// The chosen comparison here is very important. This relates to case selections where 4 samples
 					// are equal to the isolevel and 4 others are above or below:
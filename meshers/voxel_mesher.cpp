@@ -1,6 +1,9 @@
 #include "voxel_mesher.h"
 #include "../storage/voxel_buffer_gd.h"
 #include "../util/godot/funcs.h"
+#include "../util/profiling.h"
+
+#include <scene/resources/concave_polygon_shape_3d.h>
 
 namespace zylann::voxel {
 
@@ -48,6 +51,47 @@ Ref<Mesh> VoxelMesher::build_mesh(Ref<gd::VoxelBuffer> voxels, TypedArray<Materi
 	return mesh;
 }
 
+PackedVector3Array VoxelMesher::build_collision_faces(const Output &output) {
+	ZN_PROFILE_SCOPE();
+
+	const Output::CollisionSurface &collision_surface = output.collision_surface;
+	if (collision_surface.positions.size() > 0) {
+		return deindex_concave_polygon_faces(to_span(collision_surface.positions), to_span(collision_surface.indices));
+	}
+
+	std::vector<Array> render_surfaces;
+	for (unsigned int i = 0; i < output.surfaces.size(); ++i) {
+		const Array &arrays = output.surfaces[i].arrays;
+		if (!arrays.is_empty() && is_surface_triangulated(arrays)) {
+			render_surfaces.push_back(arrays);
+		}
+	}
+	if (render_surfaces.size() == 0) {
+		return PackedVector3Array();
+	}
+	return deindex_concave_polygon_faces(to_span_const(render_surfaces));
+}
+
+Ref<Shape3D> VoxelMesher::build_collision_shape(const Output &output) {
+	return create_concave_polygon_shape(build_collision_faces(output));
+}
+
+unsigned int VoxelMesher::get_triangle_count(const Output &output) {
+	if (output.primitive_type != Mesh::PRIMITIVE_TRIANGLES) {
+		return 0;
+	}
+	unsigned int count = 0;
+	for (unsigned int i = 0; i < output.surfaces.size(); ++i) {
+		const Array &arrays = output.surfaces[i].arrays;
+		if (arrays.is_empty()) {
+			continue;
+		}
+		const PackedInt32Array indices = arrays[Mesh::ARRAY_INDEX];
+		count += indices.size() / 3;
+	}
+	return count;
+}
+
 void VoxelMesher::build(Output &output, const Input &input) {
 	ERR_PRINT("Not implemented");
 }
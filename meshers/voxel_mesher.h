@@ -7,6 +7,8 @@
 #include <scene/resources/mesh.h>
 #include <vector>
 
+class Shape3D;
+
 namespace zylann::voxel {
 
 namespace gd {
@@ -63,6 +65,18 @@ public:
 	// Builds a mesh from the given voxels. This function is simplified to be used by the script API.
 	Ref<Mesh> build_mesh(Ref<gd::VoxelBuffer> voxels, TypedArray<Material> materials);
 
+	// Builds collision faces from the result of `build`, in the format of `ConcavePolygonShape3D::set_faces`. Uses
+	// `collision_surface` if it isn't empty, otherwise the render surfaces. Returns an empty array if there are no
+	// triangles. Can be called from a thread.
+	static PackedVector3Array build_collision_faces(const Output &output);
+
+	// Same as `build_collision_faces`, but also creates the shape. Returns null if there are no triangles. Creating the
+	// shape resource must be done on the main thread.
+	static Ref<Shape3D> build_collision_shape(const Output &output);
+
+	// Counts triangles of the render surfaces from the result of `build`, not including transition surfaces.
+	static unsigned int get_triangle_count(const Output &output);
+
 	// Gets how many neighbor voxels need to be accessed around the meshed area, toward negative axes.
 	// If this is not respected, the mesher might produce seams at the edges, or an error
 	unsigned int get_minimum_padding() const;
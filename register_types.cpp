@@ -64,7 +64,7 @@
 #endif
 #endif // TOOLS_ENABLED
 
-#ifdef VOXEL_RUN_TESTS
+#if defined(VOXEL_RUN_TESTS) || defined(VOXEL_RUN_BENCHMARKS)
 #include "tests/tests.h"
 #endif
 
@@ -175,6 +175,9 @@ void initialize_voxel_module(ModuleInitializationLevel p_level) {
 #ifdef VOXEL_RUN_TESTS
 		zylann::voxel::tests::run_voxel_tests();
 #endif
+#ifdef VOXEL_RUN_BENCHMARKS
+		zylann::voxel::tests::run_voxel_benchmarks();
+#endif
 
 		// Compatibility with older version
 		ClassDB::add_compatibility_class("VoxelLibrary", "VoxelBlockyLibrary");
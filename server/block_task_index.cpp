@@ -0,0 +1,26 @@
+#include "block_task_index.h"
+#include "../util/memory.h"
+
+namespace zylann::voxel {
+
+std::shared_ptr<BlockTaskIndex::Slot> BlockTaskIndex::add(const Key &key) {
+	std::shared_ptr<Slot> slot = make_shared_instance<Slot>();
+	MutexLock lock(_mutex);
+	std::shared_ptr<Slot> &current_slot = _slots[key];
+	if (current_slot != nullptr) {
+		current_slot->superseded = true;
+		++_superseded_count;
+	}
+	current_slot = slot;
+	return slot;
+}
+
+void BlockTaskIndex::remove(const Key &key, const std::shared_ptr<Slot> &slot) {
+	MutexLock lock(_mutex);
+	auto it = _slots.find(key);
+	if (it != _slots.end() && it->second == slot) {
+		_slots.erase(it);
+	}
+}
+
+} // namespace zylann::voxel
@@ -0,0 +1,74 @@
+#ifndef VOXEL_BLOCK_TASK_INDEX_H
+#define VOXEL_BLOCK_TASK_INDEX_H
+
+#include "../util/math/vector3i.h"
+#include "../util/thread/mutex.h"
+
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+
+namespace zylann::voxel {
+
+// Keeps track of the latest request made for a given block and kind of task. When a block is requested again before
+// the previous task completed, for example while it is being sculpted continuously, the previous request gets
+// cancelled: a queued task is skipped by the thread pool, and a running task stops as soon as it can.
+// Thread-safe.
+class BlockTaskIndex {
+public:
+	enum TaskKind { //
+		TASK_MESH = 0,
+		TASK_KIND_COUNT
+	};
+
+	struct Key {
+		uint32_t volume_id;
+		Vector3i position;
+		uint8_t lod;
+		uint8_t kind;
+
+		inline bool operator==(const Key &other) const {
+			return volume_id == other.volume_id && position == other.position && lod == other.lod &&
+					kind == other.kind;
+		}
+	};
+
+	struct KeyHasher {
+		inline size_t operator()(const Key &key) const {
+			uint32_t hash = Vector3iHasher::hash(key.position);
+			hash = hash_djb2_one_32(key.volume_id, hash);
+			return hash_djb2_one_32(key.lod | (key.kind << 8), hash);
+		}
+	};
+
+	// Shared between the index and the task handling a request
+	struct Slot {
+		// Set when a newer request was made for the same block. The task should not do the work, or stop as soon as
+		// possible, and not report results for that block.
+		std::atomic_bool superseded;
+
+		Slot() : superseded(false) {}
+	};
+
+	BlockTaskIndex() : _superseded_count(0) {}
+
+	// Registers a new request, superseding the previous one for the same key if any.
+	// The returned slot must be given to the task, which must call `remove` once done with it.
+	std::shared_ptr<Slot> add(const Key &key);
+
+	// Forgets a request, unless it was superseded by a newer one.
+	void remove(const Key &key, const std::shared_ptr<Slot> &slot);
+
+	unsigned int get_superseded_count() const {
+		return _superseded_count;
+	}
+
+private:
+	std::unordered_map<Key, std::shared_ptr<Slot>, KeyHasher> _slots;
+	BinaryMutex _mutex;
+	std::atomic_uint32_t _superseded_count;
+};
+
+} // namespace zylann::voxel
+
+#endif // VOXEL_BLOCK_TASK_INDEX_H
@@ -13,7 +13,7 @@ namespace {
 std::atomic_int g_debug_generate_tasks_count;
 }
 
-GenerateBlockTask::GenerateBlockTask() {
+GenerateBlockTask::GenerateBlockTask() : _creation_time_usec(TaskStats::get_time_usec()) {
 	++g_debug_generate_tasks_count;
 }
 
@@ -27,6 +27,7 @@ int GenerateBlockTask::debug_get_running_count() {
 
 void GenerateBlockTask::run(zylann::ThreadedTaskContext ctx) {
 	ZN_PROFILE_SCOPE();
+	TaskStats::RunScope stats_scope(TaskStats::TASK_GENERATE, _creation_time_usec);
 
 	CRASH_COND(stream_dependency == nullptr);
 	Ref<VoxelGenerator> generator = stream_dependency->generator;
@@ -43,6 +44,14 @@ void GenerateBlockTask::run(zylann::ThreadedTaskContext ctx) {
 	const VoxelGenerator::Result result = generator->generate_block(query_data);
 	max_lod_hint = result.max_lod_hint;
 
+	// Blocks can remain loaded for a long time, keep them small
+	voxels->compress_palette_channels();
+	const float sdf_max_error = VoxelServer::get_singleton().get_sdf_quantization_max_error();
+	if (sdf_max_error > 0.f) {
+		voxels->compress_sdf_channel(sdf_max_error);
+	}
+	stats_scope.output_size = voxels->get_memory_usage();
+
 	if (stream_dependency->valid) {
 		Ref<VoxelStream> stream = stream_dependency->stream;
 
@@ -81,6 +90,7 @@ bool GenerateBlockTask::is_cancelled() {
 
 void GenerateBlockTask::apply_result() {
 	bool aborted = true;
+	bool delivered = false;
 
 	if (VoxelServer::get_singleton().is_volume_valid(volume_id)) {
 		// TODO Comparing pointer may not be guaranteed
@@ -101,6 +111,7 @@ void GenerateBlockTask::apply_result() {
 			callbacks.data_output_callback(callbacks.data, o);
 
 			aborted = !has_run;
+			delivered = true;
 		}
 
 	} else {
@@ -108,6 +119,13 @@ void GenerateBlockTask::apply_result() {
 		ZN_PRINT_VERBOSE("Gemerated data request response came back but volume wasn't found");
 	}
 
+	TaskStats &stats = VoxelServer::get_singleton().get_task_stats();
+	if (!has_run) {
+		stats.record_cancelled(TaskStats::TASK_GENERATE);
+	} else if (!delivered) {
+		stats.record_dropped(TaskStats::TASK_GENERATE);
+	}
+
 	// TODO We could complete earlier inside run() if we had access to the data structure to write the block into.
 	// This would reduce latency a little. The rest of things the terrain needs to do with the generated block could
 	// run later.
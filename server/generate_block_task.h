@@ -32,6 +32,9 @@ public:
 	PriorityDependency priority_dependency;
 	std::shared_ptr<StreamingDependency> stream_dependency;
 	std::shared_ptr<AsyncDependencyTracker> tracker;
+
+private:
+	uint64_t _creation_time_usec;
 };
 
 } // namespace zylann::voxel
@@ -12,6 +12,7 @@ void LoadAllBlocksDataTask::run(zylann::ThreadedTaskContext ctx) {
 	CRASH_COND(stream_dependency == nullptr);
 	Ref<VoxelStream> stream = stream_dependency->stream;
 	CRASH_COND(stream.is_null());
+	VoxelStream::AccessLock stream_access(*stream.ptr());
 
 	stream->load_all_blocks(_result);
 
@@ -22,7 +22,8 @@ LoadBlockDataTask::LoadBlockDataTask(uint32_t p_volume_id, Vector3i p_block_pos,
 		_block_size(p_block_size),
 		_request_instances(p_request_instances),
 		//_request_voxels(true),
-		_stream_dependency(p_stream_dependency) {
+		_stream_dependency(p_stream_dependency),
+		_creation_time_usec(TaskStats::get_time_usec()) {
 	//
 	++g_debug_load_block_tasks_count;
 }
@@ -37,10 +38,12 @@ int LoadBlockDataTask::debug_get_running_count() {
 
 void LoadBlockDataTask::run(zylann::ThreadedTaskContext ctx) {
 	ZN_PROFILE_SCOPE();
+	TaskStats::RunScope stats_scope(TaskStats::TASK_LOAD, _creation_time_usec);
 
 	CRASH_COND(_stream_dependency == nullptr);
 	Ref<VoxelStream> stream = _stream_dependency->stream;
 	CRASH_COND(stream.is_null());
+	VoxelStream::AccessLock stream_access(*stream.ptr());
 
 	const Vector3i origin_in_voxels = (_position << _lod) * _block_size;
 
@@ -60,6 +63,15 @@ void LoadBlockDataTask::run(zylann::ThreadedTaskContext ctx) {
 	if (voxel_query_data.result == VoxelStream::RESULT_ERROR) {
 		ERR_PRINT("Error loading voxel block");
 
+	} else if (voxel_query_data.result == VoxelStream::RESULT_BLOCK_FOUND) {
+		// Blocks can remain loaded for a long time, keep them small
+		_voxels->compress_palette_channels();
+		const float sdf_max_error = VoxelServer::get_singleton().get_sdf_quantization_max_error();
+		if (sdf_max_error > 0.f) {
+			_voxels->compress_sdf_channel(sdf_max_error);
+		}
+		stats_scope.output_size = _voxels->get_memory_usage();
+
 	} else if (voxel_query_data.result == VoxelStream::RESULT_BLOCK_NOT_FOUND) {
 		Ref<VoxelGenerator> generator = _stream_dependency->generator;
 
@@ -117,6 +129,8 @@ bool LoadBlockDataTask::is_cancelled() {
 }
 
 void LoadBlockDataTask::apply_result() {
+	bool delivered = false;
+
 	if (VoxelServer::get_singleton().is_volume_valid(_volume_id)) {
 		// TODO Comparing pointer may not be guaranteed
 		// The request response must match the dependency it would have been requested with.
@@ -135,12 +149,24 @@ void LoadBlockDataTask::apply_result() {
 			VoxelServer::VolumeCallbacks callbacks = VoxelServer::get_singleton().get_volume_callbacks(_volume_id);
 			CRASH_COND(callbacks.data_output_callback == nullptr);
 			callbacks.data_output_callback(callbacks.data, o);
+			delivered = true;
+
+		} else if (_fallback_on_generator) {
+			// The generator task will provide the result
+			delivered = true;
 		}
 
 	} else {
 		// This can happen if the user removes the volume while requests are still about to return
 		ZN_PRINT_VERBOSE("Stream data request response came back but volume wasn't found");
 	}
+
+	TaskStats &stats = VoxelServer::get_singleton().get_task_stats();
+	if (!_has_run) {
+		stats.record_cancelled(TaskStats::TASK_LOAD);
+	} else if (!delivered) {
+		stats.record_dropped(TaskStats::TASK_LOAD);
+	}
 }
 
 } // namespace zylann::voxel
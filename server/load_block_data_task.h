@@ -38,6 +38,7 @@ private:
 	bool _max_lod_hint = false;
 	bool _fallback_on_generator = false;
 	std::shared_ptr<StreamingDependency> _stream_dependency;
+	uint64_t _creation_time_usec;
 };
 
 } // namespace zylann::voxel
@@ -0,0 +1,27 @@
+#include "lod_downscale_task.h"
+#include "../util/profiling.h"
+
+namespace zylann::voxel {
+
+LodDownscaleTask::LodDownscaleTask(std::vector<Item> &&p_items, const DownscaleFilters &p_filters) :
+		_items(std::move(p_items)), _filters(p_filters) {}
+
+void LodDownscaleTask::run(ThreadedTaskContext ctx) {
+	ZN_PROFILE_SCOPE();
+	run_items(to_span_const(_items), _filters);
+	_items.clear();
+}
+
+void LodDownscaleTask::run_items(Span<const Item> items, const DownscaleFilters &filters) {
+	for (unsigned int i = 0; i < items.size(); ++i) {
+		const Item &item = items[i];
+		ZN_ASSERT_CONTINUE(item.src != nullptr);
+		ZN_ASSERT_CONTINUE(item.dst != nullptr);
+		// Source and destination are different blocks, and blocks are always locked in increasing LOD order
+		RWLockRead src_lock(item.src->get_lock());
+		RWLockWrite dst_lock(item.dst->get_lock());
+		downscale_voxels(*item.src, *item.dst, Vector3i(), item.src->get_size(), item.dst_min, filters);
+	}
+}
+
+} // namespace zylann::voxel
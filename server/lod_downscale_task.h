@@ -0,0 +1,40 @@
+#ifndef LOD_DOWNSCALE_TASK_H
+#define LOD_DOWNSCALE_TASK_H
+
+#include "../storage/voxel_downscale.h"
+#include "../util/tasks/threaded_task.h"
+
+#include <memory>
+#include <vector>
+
+namespace zylann::voxel {
+
+// Propagates edits to lower levels of detail, for a whole sub-tree of blocks at once.
+// Sub-trees don't share any block, so several of these tasks can run in parallel.
+// Completion can be tracked by scheduling them with an `AsyncDependencyTracker`.
+class LodDownscaleTask : public IThreadedTask {
+public:
+	struct Item {
+		std::shared_ptr<VoxelBufferInternal> src;
+		std::shared_ptr<VoxelBufferInternal> dst;
+		// Where the source block lands in the destination block, in voxels
+		Vector3i dst_min;
+	};
+
+	// Items must be sorted by increasing LOD index, so every block is updated before being used as a source.
+	LodDownscaleTask(std::vector<Item> &&p_items, const DownscaleFilters &p_filters);
+
+	void run(ThreadedTaskContext ctx) override;
+	void apply_result() override {}
+
+	// Downscales items on the calling thread
+	static void run_items(Span<const Item> items, const DownscaleFilters &filters);
+
+private:
+	std::vector<Item> _items;
+	DownscaleFilters _filters;
+};
+
+} // namespace zylann::voxel
+
+#endif // LOD_DOWNSCALE_TASK_H
@@ -0,0 +1,169 @@
+#include "mesh_block_batch_task.h"
+#include "../util/log.h"
+#include "../util/profiling.h"
+#include "mesh_block_task.h"
+#include "voxel_server.h"
+
+#include <limits>
+
+namespace zylann::voxel {
+
+MeshBlockBatchTask::MeshBlockBatchTask() : _creation_time_usec(TaskStats::get_time_usec()) {}
+
+void MeshBlockBatchTask::run(zylann::ThreadedTaskContext ctx) {
+	ZN_PROFILE_SCOPE();
+	CRASH_COND(meshing_dependency == nullptr);
+
+	Ref<VoxelMesher> mesher = meshing_dependency->mesher;
+	CRASH_COND(mesher.is_null());
+	const unsigned int min_padding = mesher->get_minimum_padding();
+	const unsigned int max_padding = mesher->get_maximum_padding();
+	const int channels_mask = mesher->get_used_channels_mask();
+
+	// Gather voxels of the whole region once. Data blocks are only locked here.
+	VoxelBufferInternal region_voxels;
+	// Blocks are measured individually, so they can be compared with blocks meshed one by one. Gathering voxels counts
+	// as latency.
+	copy_block_and_neighbors(to_span(blocks), region_voxels, min_padding, max_padding, channels_mask,
+			meshing_dependency->generator, data_block_size, lod, region_origin * (int(mesh_block_size) << lod));
+
+	unsigned int channels_count = 0;
+	const FixedArray<uint8_t, VoxelBufferInternal::MAX_CHANNELS> channels =
+			VoxelBufferInternal::mask_to_channels_list(channels_mask, channels_count);
+
+	const Vector3i padded_mesh_block_size = Vector3iUtil::create(mesh_block_size + min_padding + max_padding);
+	const Box3i region_box(Vector3i(), Vector3iUtil::create(region_size));
+
+	for (unsigned int item_index = 0; item_index < items.size(); ++item_index) {
+		Item &item = items[item_index];
+		if (item.too_far || item.is_superseded()) {
+			continue;
+		}
+
+		const Vector3i rpos = item.position - region_origin;
+		ERR_CONTINUE(!region_box.contains(rpos));
+
+		const uint64_t start_time_usec = TaskStats::get_time_usec();
+
+		// TODO Cache?
+		VoxelBufferInternal voxels;
+		{
+			ZN_PROFILE_SCOPE_NAMED("Extract");
+			voxels.create(padded_mesh_block_size);
+			for (unsigned int ci = 0; ci < VoxelBufferInternal::MAX_CHANNELS; ++ci) {
+				voxels.set_channel_depth(ci, region_voxels.get_channel_depth(ci));
+			}
+			// The region buffer starts with padding, so each mesh block with its own padding starts at a multiple of
+			// the mesh block size
+			const Vector3i src_min = rpos * int(mesh_block_size);
+			const Vector3i src_max = src_min + padded_mesh_block_size;
+			for (unsigned int ci = 0; ci < channels_count; ++ci) {
+				voxels.copy_from(region_voxels, src_min, src_max, Vector3i(), channels[ci]);
+			}
+		}
+
+		const Vector3i origin_in_voxels = item.position * (int(mesh_block_size) << lod);
+
+		const VoxelMesher::Input input = { voxels, meshing_dependency->generator.ptr(), data.get(), origin_in_voxels,
+			lod, collision_hint };
+		mesher->build(item.surfaces_output, input);
+
+		if (collision_hint && !item.is_superseded()) {
+			item.collision_faces = VoxelMesher::build_collision_faces(item.surfaces_output);
+		}
+
+		item.has_run = true;
+
+		VoxelServer::get_singleton().get_task_stats().record_run(TaskStats::TASK_MESH, _creation_time_usec,
+				start_time_usec, TaskStats::get_time_usec(), VoxelMesher::get_triangle_count(item.surfaces_output));
+	}
+}
+
+int MeshBlockBatchTask::get_priority() {
+	// The batch runs as early as its most important block
+	int priority = std::numeric_limits<int>::max();
+	for (unsigned int i = 0; i < items.size(); ++i) {
+		Item &item = items[i];
+		float closest_viewer_distance_sq;
+		priority = math::min(priority, item.priority_dependency.evaluate(lod, &closest_viewer_distance_sq));
+		item.too_far = closest_viewer_distance_sq > item.priority_dependency.drop_distance_squared;
+	}
+	return priority;
+}
+
+bool MeshBlockBatchTask::is_cancelled() {
+	if (!meshing_dependency->valid) {
+		return true;
+	}
+	for (unsigned int i = 0; i < items.size(); ++i) {
+		const Item &item = items[i];
+		if (!item.too_far && !item.is_superseded()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void MeshBlockBatchTask::apply_result() {
+	BlockTaskIndex &task_index = VoxelServer::get_singleton().get_block_task_index();
+	for (unsigned int i = 0; i < items.size(); ++i) {
+		const Item &item = items[i];
+		if (item.index_slot != nullptr) {
+			task_index.remove(
+					BlockTaskIndex::Key{ volume_id, item.position, lod, BlockTaskIndex::TASK_MESH }, item.index_slot);
+		}
+	}
+
+	// Superseded items don't report a result either way
+	TaskStats &stats = VoxelServer::get_singleton().get_task_stats();
+	const bool delivered = VoxelServer::get_singleton().is_volume_valid(volume_id) && meshing_dependency->valid;
+	for (unsigned int i = 0; i < items.size(); ++i) {
+		const Item &item = items[i];
+		if (!item.has_run) {
+			stats.record_cancelled(TaskStats::TASK_MESH);
+		} else if (!delivered || item.is_superseded()) {
+			stats.record_dropped(TaskStats::TASK_MESH);
+		}
+	}
+
+	if (!VoxelServer::get_singleton().is_volume_valid(volume_id)) {
+		// This can happen if the user removes the volume while requests are still about to return
+		ZN_PRINT_VERBOSE("Mesh batch request response came back but volume wasn't found");
+		return;
+	}
+	// The request response must match the dependency it would have been requested with.
+	// If it doesn't match, we are no longer interested in the result.
+	if (!meshing_dependency->valid) {
+		return;
+	}
+
+	VoxelServer::VolumeCallbacks callbacks = VoxelServer::get_singleton().get_volume_callbacks(volume_id);
+	ERR_FAIL_COND(callbacks.mesh_output_callback == nullptr);
+	ERR_FAIL_COND(callbacks.data == nullptr);
+
+	for (unsigned int i = 0; i < items.size(); ++i) {
+		Item &item = items[i];
+		if (item.is_superseded()) {
+			// The newer request will provide the result
+			continue;
+		}
+
+		VoxelServer::BlockMeshOutput o;
+		if (item.has_run) {
+			o.type = VoxelServer::BlockMeshOutput::TYPE_MESHED;
+		} else {
+			o.type = VoxelServer::BlockMeshOutput::TYPE_DROPPED;
+		}
+
+		o.position = item.position;
+		o.lod = lod;
+		o.surfaces = std::move(item.surfaces_output);
+		o.priority = item.priority_dependency.evaluate(lod, nullptr);
+		o.collision_faces = item.collision_faces;
+		o.has_collision_faces = item.has_run && collision_hint;
+
+		callbacks.mesh_output_callback(callbacks.data, o);
+	}
+}
+
+} // namespace zylann::voxel
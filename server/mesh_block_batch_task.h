@@ -0,0 +1,65 @@
+#ifndef VOXEL_MESH_BLOCK_BATCH_TASK_H
+#define VOXEL_MESH_BLOCK_BATCH_TASK_H
+
+#include "../storage/voxel_buffer_internal.h"
+#include "../util/tasks/threaded_task.h"
+#include "block_task_index.h"
+#include "meshing_dependency.h"
+#include "priority_dependency.h"
+
+#include <memory>
+#include <vector>
+
+namespace zylann::voxel {
+
+struct VoxelDataLodMap;
+
+// Asynchronous task generating meshes for several mesh blocks of a cubic region, in a particular volume.
+// Voxels of the region and its neighbors are gathered once, instead of once per mesh block, which saves copies and
+// locking when many blocks close to each other need a mesh at the same time. Results are returned one mesh block at a
+// time, like `MeshBlockTask`.
+class MeshBlockBatchTask : public IThreadedTask {
+public:
+	struct Item {
+		Vector3i position; // In mesh blocks of the specified lod
+		PriorityDependency priority_dependency;
+		// Optional, set when the request was registered in `BlockTaskIndex` with `TASK_MESH`
+		std::shared_ptr<BlockTaskIndex::Slot> index_slot;
+		VoxelMesher::Output surfaces_output;
+		PackedVector3Array collision_faces;
+		bool has_run = false;
+		bool too_far = false;
+
+		inline bool is_superseded() const {
+			return index_slot != nullptr && index_slot->superseded;
+		}
+	};
+
+	MeshBlockBatchTask();
+
+	void run(ThreadedTaskContext ctx) override;
+	int get_priority() override;
+	bool is_cancelled() override;
+	void apply_result() override;
+
+	// Cube of data blocks covering the region, with one block of margin on each side. Ordered ZXY.
+	std::vector<std::shared_ptr<VoxelBufferInternal>> blocks;
+	// Mesh blocks to build. They must be inside the region.
+	std::vector<Item> items;
+	Vector3i region_origin; // In mesh blocks of the specified lod
+	uint32_t volume_id;
+	uint8_t lod;
+	uint8_t region_size; // In mesh blocks
+	uint8_t data_block_size;
+	uint8_t mesh_block_size;
+	bool collision_hint;
+	std::shared_ptr<MeshingDependency> meshing_dependency;
+	std::shared_ptr<VoxelDataLodMap> data;
+
+private:
+	uint64_t _creation_time_usec;
+};
+
+} // namespace zylann::voxel
+
+#endif // VOXEL_MESH_BLOCK_BATCH_TASK_H
@@ -5,12 +5,9 @@
 
 namespace zylann::voxel {
 
-// Takes a list of blocks and interprets it as a cube of blocks centered around the area we want to create a mesh from.
-// Voxels from central blocks are copied, and part of side blocks are also copied so we get a temporary buffer
-// which includes enough neighbors for the mesher to avoid doing bound checks.
-static void copy_block_and_neighbors(Span<std::shared_ptr<VoxelBufferInternal>> blocks, VoxelBufferInternal &dst,
+void copy_block_and_neighbors(Span<std::shared_ptr<VoxelBufferInternal>> blocks, VoxelBufferInternal &dst,
 		int min_padding, int max_padding, int channels_mask, Ref<VoxelGenerator> generator, int data_block_size,
-		uint8_t lod_index, Vector3i mesh_block_pos) {
+		uint8_t lod_index, Vector3i origin_in_voxels) {
 	ZN_PROFILE_SCOPE();
 
 	// Extract wanted channels in a list
@@ -19,20 +16,13 @@ static void copy_block_and_neighbors(Span<std::shared_ptr<VoxelBufferInternal>>
 			VoxelBufferInternal::mask_to_channels_list(channels_mask, channels_count);
 
 	// Determine size of the cube of blocks
-	int edge_size;
-	int mesh_block_size_factor;
-	switch (blocks.size()) {
-		case 3 * 3 * 3:
-			edge_size = 3;
-			mesh_block_size_factor = 1;
-			break;
-		case 4 * 4 * 4:
-			edge_size = 4;
-			mesh_block_size_factor = 2;
-			break;
-		default:
-			ERR_FAIL_MSG("Unsupported block count");
+	int edge_size = 3;
+	while (edge_size * edge_size * edge_size < int(blocks.size())) {
+		++edge_size;
 	}
+	ERR_FAIL_COND_MSG(edge_size * edge_size * edge_size != int(blocks.size()), "Unsupported block count");
+	// Size of the area to copy without padding, in data blocks
+	const int area_size_in_blocks = edge_size - 2;
 
 	// Pick anchor block, usually within the central part of the cube (that block must be valid)
 	const unsigned int anchor_buffer_index = edge_size * edge_size + edge_size + 1;
@@ -43,10 +33,10 @@ static void copy_block_and_neighbors(Span<std::shared_ptr<VoxelBufferInternal>>
 		ERR_FAIL_COND_MSG(
 				Vector3iUtil::all_members_equal(central_buffer->get_size()) == false, "Central buffer must be cubic");
 	}
-	const int mesh_block_size = data_block_size * mesh_block_size_factor;
-	const int padded_mesh_block_size = mesh_block_size + min_padding + max_padding;
+	const int area_size = data_block_size * area_size_in_blocks;
+	const int padded_area_size = area_size + min_padding + max_padding;
 
-	dst.create(padded_mesh_block_size, padded_mesh_block_size, padded_mesh_block_size);
+	dst.create(padded_area_size, padded_area_size, padded_area_size);
 
 	// TODO Need to provide format differently, this won't work in full load mode where areas are generated on the fly
 	// for (unsigned int ci = 0; ci < channels.size(); ++ci) {
@@ -65,7 +55,7 @@ static void copy_block_and_neighbors(Span<std::shared_ptr<VoxelBufferInternal>>
 	}
 
 	const Vector3i min_pos = -Vector3iUtil::create(min_padding);
-	const Vector3i max_pos = Vector3iUtil::create(mesh_block_size + max_padding);
+	const Vector3i max_pos = Vector3iUtil::create(area_size + max_padding);
 
 	std::vector<Box3i> boxes_to_generate;
 	const Box3i mesh_data_box = Box3i::from_min_max(min_pos, max_pos);
@@ -123,8 +113,6 @@ static void copy_block_and_neighbors(Span<std::shared_ptr<VoxelBufferInternal>>
 		ZN_PROFILE_SCOPE_NAMED("Generate");
 		VoxelBufferInternal generated_voxels;
 
-		const Vector3i origin_in_voxels = mesh_block_pos * (mesh_block_size_factor * data_block_size << lod_index);
-
 		for (unsigned int i = 0; i < boxes_to_generate.size(); ++i) {
 			const Box3i &box = boxes_to_generate[i];
 			//print_line(String("size={0}").format(varray(box.size.to_vec3())));
@@ -148,7 +136,7 @@ namespace {
 std::atomic_int g_debug_mesh_tasks_count;
 } //namespace
 
-MeshBlockTask::MeshBlockTask() {
+MeshBlockTask::MeshBlockTask() : _creation_time_usec(TaskStats::get_time_usec()) {
 	++g_debug_mesh_tasks_count;
 }
 
@@ -162,6 +150,7 @@ int MeshBlockTask::debug_get_running_count() {
 
 void MeshBlockTask::run(zylann::ThreadedTaskContext ctx) {
 	ZN_PROFILE_SCOPE();
+	TaskStats::RunScope stats_scope(TaskStats::TASK_MESH, _creation_time_usec);
 	CRASH_COND(meshing_dependency == nullptr);
 
 	Ref<VoxelMesher> mesher = meshing_dependency->mesher;
@@ -169,16 +158,30 @@ void MeshBlockTask::run(zylann::ThreadedTaskContext ctx) {
 	const unsigned int min_padding = mesher->get_minimum_padding();
 	const unsigned int max_padding = mesher->get_maximum_padding();
 
+	// Mesh blocks span one data block, or two when given a 4x4x4 grid of blocks
+	const int mesh_block_size = int(data_block_size) * (blocks_count == 4 * 4 * 4 ? 2 : 1);
+	const Vector3i origin_in_voxels = position * (mesh_block_size << lod);
+
 	// TODO Cache?
 	VoxelBufferInternal voxels;
 	copy_block_and_neighbors(to_span(blocks, blocks_count), voxels, min_padding, max_padding,
-			mesher->get_used_channels_mask(), meshing_dependency->generator, data_block_size, lod, position);
+			mesher->get_used_channels_mask(), meshing_dependency->generator, data_block_size, lod, origin_in_voxels);
 
-	const Vector3i origin_in_voxels = position * (int(data_block_size) << lod);
+	if (is_superseded()) {
+		// A newer request was made for the same block while we were gathering voxels
+		return;
+	}
 
 	const VoxelMesher::Input input = { voxels, meshing_dependency->generator.ptr(), data.get(), origin_in_voxels, lod,
 		collision_hint };
 	mesher->build(_surfaces_output, input);
+	stats_scope.output_size = VoxelMesher::get_triangle_count(_surfaces_output);
+
+	if (collision_hint && !is_superseded()) {
+		// Doing this here saves a lot of time on the main thread, especially with large smooth meshes.
+		// Only the faces are built, the shape resource is created on the main thread.
+		_collision_faces = VoxelMesher::build_collision_faces(_surfaces_output);
+	}
 
 	_has_run = true;
 }
@@ -191,10 +194,30 @@ int MeshBlockTask::get_priority() {
 }
 
 bool MeshBlockTask::is_cancelled() {
-	return !meshing_dependency->valid || _too_far;
+	return !meshing_dependency->valid || _too_far || is_superseded();
 }
 
 void MeshBlockTask::apply_result() {
+	TaskStats &stats = VoxelServer::get_singleton().get_task_stats();
+
+	if (index_slot != nullptr) {
+		VoxelServer::get_singleton().get_block_task_index().remove(
+				BlockTaskIndex::Key{ volume_id, position, lod, BlockTaskIndex::TASK_MESH }, index_slot);
+		if (index_slot->superseded) {
+			// The newer request will provide the result
+			if (_has_run) {
+				stats.record_dropped(TaskStats::TASK_MESH);
+			} else {
+				stats.record_cancelled(TaskStats::TASK_MESH);
+			}
+			return;
+		}
+	}
+
+	if (!_has_run) {
+		stats.record_cancelled(TaskStats::TASK_MESH);
+	}
+
 	if (VoxelServer::get_singleton().is_volume_valid(volume_id)) {
 		// The request response must match the dependency it would have been requested with.
 		// If it doesn't match, we are no longer interested in the result.
@@ -212,16 +235,25 @@ void MeshBlockTask::apply_result() {
 			o.position = position;
 			o.lod = lod;
 			o.surfaces = std::move(_surfaces_output);
+			o.priority = priority_dependency.evaluate(lod, nullptr);
+			o.collision_faces = _collision_faces;
+			o.has_collision_faces = _has_run && collision_hint;
 
 			VoxelServer::VolumeCallbacks callbacks = VoxelServer::get_singleton().get_volume_callbacks(volume_id);
 			ERR_FAIL_COND(callbacks.mesh_output_callback == nullptr);
 			ERR_FAIL_COND(callbacks.data == nullptr);
 			callbacks.mesh_output_callback(callbacks.data, o);
+
+		} else if (_has_run) {
+			stats.record_dropped(TaskStats::TASK_MESH);
 		}
 
 	} else {
 		// This can happen if the user removes the volume while requests are still about to return
 		ZN_PRINT_VERBOSE("Mesh request response came back but volume wasn't found");
+		if (_has_run) {
+			stats.record_dropped(TaskStats::TASK_MESH);
+		}
 	}
 }
 
@@ -4,11 +4,21 @@
 #include "../constants/voxel_constants.h"
 #include "../storage/voxel_buffer_internal.h"
 #include "../util/tasks/threaded_task.h"
+#include "block_task_index.h"
 #include "meshing_dependency.h"
 #include "priority_dependency.h"
 
 namespace zylann::voxel {
 
+// Takes a list of blocks and interprets it as a cube of blocks centered around the area we want to create meshes from.
+// The cube has one block of margin on each side, and blocks are ordered ZXY. Voxels from central blocks are copied,
+// and part of side blocks are also copied so we get a temporary buffer which includes enough neighbors for the mesher
+// to avoid doing bound checks. Missing blocks are generated if a generator is provided.
+// `origin_in_voxels` is the position of the area at LOD0.
+void copy_block_and_neighbors(Span<std::shared_ptr<VoxelBufferInternal>> blocks, VoxelBufferInternal &dst,
+		int min_padding, int max_padding, int channels_mask, Ref<VoxelGenerator> generator, int data_block_size,
+		uint8_t lod_index, Vector3i origin_in_voxels);
+
 // Asynchronous task generating a mesh from voxel blocks and their neighbors, in a particular volume
 class MeshBlockTask : public IThreadedTask {
 public:
@@ -35,11 +45,19 @@ public:
 	PriorityDependency priority_dependency;
 	std::shared_ptr<MeshingDependency> meshing_dependency;
 	std::shared_ptr<VoxelDataLodMap> data;
+	// Optional, set when the request was registered in `BlockTaskIndex` with `TASK_MESH`
+	std::shared_ptr<BlockTaskIndex::Slot> index_slot;
 
 private:
+	inline bool is_superseded() const {
+		return index_slot != nullptr && index_slot->superseded;
+	}
+
 	bool _has_run = false;
 	bool _too_far = false;
 	VoxelMesher::Output _surfaces_output;
+	PackedVector3Array _collision_faces;
+	uint64_t _creation_time_usec;
 };
 
 } // namespace zylann::voxel
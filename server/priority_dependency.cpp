@@ -6,20 +6,29 @@ namespace zylann::voxel {
 int PriorityDependency::evaluate(uint8_t lod_index, float *out_closest_distance_sq) {
 	ERR_FAIL_COND_V(shared == nullptr, 0);
 
-	const std::vector<Vector3> &viewer_positions = shared->viewers;
-	const Vector3 block_position = world_position;
-
-	float closest_distance_sq = 99999.f;
-	if (viewer_positions.size() == 0) {
-		// Assume origin
-		closest_distance_sq = block_position.length_squared();
-	} else {
-		for (size_t i = 0; i < viewer_positions.size(); ++i) {
-			float d = viewer_positions[i].distance_squared_to(block_position);
-			if (d < closest_distance_sq) {
-				closest_distance_sq = d;
+	const uint32_t version = shared->version;
+	float closest_distance_sq = cached_closest_distance_sq;
+
+	if (!has_cache || version != cached_version) {
+		const std::vector<Vector3> &viewer_positions = shared->viewers;
+		const Vector3 block_position = world_position;
+
+		closest_distance_sq = 99999.f;
+		if (viewer_positions.size() == 0) {
+			// Assume origin
+			closest_distance_sq = block_position.length_squared();
+		} else {
+			for (size_t i = 0; i < viewer_positions.size(); ++i) {
+				float d = viewer_positions[i].distance_squared_to(block_position);
+				if (d < closest_distance_sq) {
+					closest_distance_sq = d;
+				}
 			}
 		}
+
+		cached_closest_distance_sq = closest_distance_sq;
+		cached_version = version;
+		has_cache = true;
 	}
 
 	if (out_closest_distance_sq != nullptr) {
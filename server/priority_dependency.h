@@ -2,6 +2,7 @@
 #define PRIORITY_DEPENDENCY_H
 
 #include <core/math/vector3.h>
+#include <atomic>
 #include <memory>
 #include <vector>
 
@@ -18,6 +19,14 @@ struct PriorityDependency {
 		// while old tasks will keep referencing the previous version.
 		std::vector<Vector3> viewers;
 		float highest_view_distance = 999999;
+		// Incremented every time the data above changes. Viewer positions are only updated when they move further
+		// than `VIEWER_MOVE_THRESHOLD`, so tasks don't need to re-evaluate their priority every time a viewer moves a
+		// little.
+		std::atomic_uint32_t version;
+
+		static constexpr float VIEWER_MOVE_THRESHOLD = 8.f;
+
+		ViewersData() : version(0) {}
 	};
 
 	std::shared_ptr<ViewersData> shared;
@@ -28,6 +37,11 @@ struct PriorityDependency {
 	// If the closest viewer is further away than this distance, the request can be cancelled as not worth it
 	float drop_distance_squared;
 
+	// Cached from the last evaluation, so it only gets recalculated when viewers data changes
+	float cached_closest_distance_sq = 0.f;
+	uint32_t cached_version = 0;
+	bool has_cache = false;
+
 	int evaluate(uint8_t lod_index, float *out_closest_distance_sq);
 };
 
@@ -21,7 +21,8 @@ SaveBlockDataTask::SaveBlockDataTask(uint32_t p_volume_id, Vector3i p_block_pos,
 		_block_size(p_block_size),
 		_save_instances(false),
 		_save_voxels(true),
-		_stream_dependency(p_stream_dependency) {
+		_stream_dependency(p_stream_dependency),
+		_creation_time_usec(TaskStats::get_time_usec()) {
 	//
 	++g_debug_save_block_tasks_count;
 }
@@ -35,7 +36,8 @@ SaveBlockDataTask::SaveBlockDataTask(uint32_t p_volume_id, Vector3i p_block_pos,
 		_block_size(p_block_size),
 		_save_instances(true),
 		_save_voxels(false),
-		_stream_dependency(p_stream_dependency) {
+		_stream_dependency(p_stream_dependency),
+		_creation_time_usec(TaskStats::get_time_usec()) {
 	//
 	++g_debug_save_block_tasks_count;
 }
@@ -50,21 +52,24 @@ int SaveBlockDataTask::debug_get_running_count() {
 
 void SaveBlockDataTask::run(zylann::ThreadedTaskContext ctx) {
 	ZN_PROFILE_SCOPE();
+	// Saves are never cancelled nor dropped, their result only matters to the stream
+	TaskStats::RunScope stats_scope(TaskStats::TASK_SAVE, _creation_time_usec);
 
 	CRASH_COND(_stream_dependency == nullptr);
 	Ref<VoxelStream> stream = _stream_dependency->stream;
 	CRASH_COND(stream.is_null());
+	VoxelStream::AccessLock stream_access(*stream.ptr());
 
 	if (_save_voxels) {
 		ERR_FAIL_COND(_voxels == nullptr);
 		VoxelBufferInternal voxels_copy;
 		{
 			RWLockRead lock(_voxels->get_lock());
-			// TODO Optimization: is that copy necessary? It's possible it was already done while issuing the
-			// request
+			// This is cheap, dense channel data is shared with the original until one of them gets modified
 			_voxels->duplicate_to(voxels_copy, true);
 		}
 		_voxels = nullptr;
+		stats_scope.output_size = voxels_copy.get_memory_usage();
 		const Vector3i origin_in_voxels = (_position << _lod) * _block_size;
 		VoxelStream::VoxelQueryData q{ voxels_copy, origin_in_voxels, _lod };
 		stream->save_voxel_block(q);
@@ -37,6 +37,7 @@ private:
 	bool _save_instances = false;
 	bool _save_voxels = false;
 	std::shared_ptr<StreamingDependency> _stream_dependency;
+	uint64_t _creation_time_usec;
 };
 
 } // namespace zylann::voxel
@@ -0,0 +1,150 @@
+#include "task_stats.h"
+#include "../util/errors.h"
+#include "../util/string_funcs.h"
+#include "voxel_server.h"
+
+#include <core/io/file_access.h>
+#include <core/os/time.h>
+
+namespace zylann::voxel {
+
+namespace {
+std::atomic_uint32_t g_next_trace_thread_id(0);
+// Short ids are easier to read in trace viewers than native thread ids
+thread_local uint32_t tls_trace_thread_id = g_next_trace_thread_id++;
+} // namespace
+
+const char *TaskStats::get_task_type_name(TaskType type) {
+	switch (type) {
+		case TASK_GENERATE:
+			return "generate";
+		case TASK_LOAD:
+			return "load";
+		case TASK_SAVE:
+			return "save";
+		case TASK_MESH:
+			return "mesh";
+		default:
+			ZN_PRINT_ERROR("Unknown task type");
+			return "unknown";
+	}
+}
+
+TaskStats::RunScope::RunScope(TaskType type, uint64_t creation_time_usec) :
+		_creation_time_usec(creation_time_usec), _start_time_usec(get_time_usec()), _type(type) {}
+
+TaskStats::RunScope::~RunScope() {
+	VoxelServer::get_singleton().get_task_stats().record_run(
+			_type, _creation_time_usec, _start_time_usec, get_time_usec(), output_size);
+}
+
+TaskStats::TaskStats() : _tracing_enabled(false) {}
+
+uint64_t TaskStats::get_time_usec() {
+	return Time::get_singleton()->get_ticks_usec();
+}
+
+void TaskStats::record_run(TaskType type, uint64_t creation_time_usec, uint64_t start_time_usec,
+		uint64_t end_time_usec, uint64_t output_size) {
+	ZN_ASSERT_RETURN(type < TASK_TYPE_COUNT);
+	TypeStats &ts = _type_stats[type];
+	ts.queue_latency_usec.add(start_time_usec - creation_time_usec);
+	ts.run_time_usec.add(end_time_usec - start_time_usec);
+	ts.output_size.add(output_size);
+	++ts.run_count;
+
+	if (_tracing_enabled) {
+		MutexLock lock(_trace_mutex);
+		if (_trace_events.size() > 0) {
+			TraceEvent &e = _trace_events[_trace_event_count % _trace_events.size()];
+			e.start_time_usec = start_time_usec;
+			e.duration_usec = end_time_usec - start_time_usec;
+			e.thread_id = tls_trace_thread_id;
+			e.type = type;
+			++_trace_event_count;
+		}
+	}
+}
+
+void TaskStats::record_cancelled(TaskType type) {
+	ZN_ASSERT_RETURN(type < TASK_TYPE_COUNT);
+	++_type_stats[type].cancelled_count;
+}
+
+void TaskStats::record_dropped(TaskType type) {
+	ZN_ASSERT_RETURN(type < TASK_TYPE_COUNT);
+	++_type_stats[type].dropped_count;
+}
+
+const TaskStats::TypeStats &TaskStats::get_type_stats(TaskType type) const {
+	ZN_ASSERT(type < TASK_TYPE_COUNT);
+	return _type_stats[type];
+}
+
+void TaskStats::reset() {
+	for (unsigned int i = 0; i < _type_stats.size(); ++i) {
+		TypeStats &ts = _type_stats[i];
+		ts.queue_latency_usec.reset();
+		ts.run_time_usec.reset();
+		ts.output_size.reset();
+		ts.run_count = 0;
+		ts.cancelled_count = 0;
+		ts.dropped_count = 0;
+	}
+}
+
+void TaskStats::set_tracing_enabled(bool enabled, unsigned int capacity) {
+	MutexLock lock(_trace_mutex);
+	_trace_event_count = 0;
+	if (enabled) {
+		ZN_ASSERT_RETURN(capacity > 0);
+		_trace_events.resize(capacity);
+	} else {
+		_trace_events.clear();
+		_trace_events.shrink_to_fit();
+	}
+	_tracing_enabled = enabled;
+}
+
+bool TaskStats::is_tracing_enabled() const {
+	return _tracing_enabled;
+}
+
+bool TaskStats::dump_trace(const String &fpath) {
+	// Copy events so tasks don't wait for the file to be written
+	std::vector<TraceEvent> events;
+	{
+		MutexLock lock(_trace_mutex);
+		if (_trace_event_count <= _trace_events.size()) {
+			events.assign(_trace_events.begin(), _trace_events.begin() + _trace_event_count);
+		} else {
+			// Oldest first
+			const size_t split = _trace_event_count % _trace_events.size();
+			events.assign(_trace_events.begin() + split, _trace_events.end());
+			events.insert(events.end(), _trace_events.begin(), _trace_events.begin() + split);
+		}
+	}
+
+	Error err;
+	Ref<FileAccess> f = FileAccess::open(fpath, FileAccess::WRITE, &err);
+	if (f.is_null()) {
+		ERR_PRINT(String("Could not write task trace to {0}: error {1}").format(varray(fpath, err)));
+		return false;
+	}
+
+	// https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+	f->store_string("{\"traceEvents\":[\n");
+	for (size_t i = 0; i < events.size(); ++i) {
+		const TraceEvent &e = events[i];
+		const std::string line =
+				format("{\"name\":\"{}\",\"cat\":\"voxel\",\"ph\":\"X\",\"pid\":0,\"tid\":{},\"ts\":{},\"dur\":{}}{}\n",
+						get_task_type_name(e.type), e.thread_id, e.start_time_usec, e.duration_usec,
+						i + 1 < events.size() ? "," : "");
+		f->store_string(String::utf8(line.c_str()));
+	}
+	f->store_string("],\"displayTimeUnit\":\"ms\"}\n");
+
+	return true;
+}
+
+} // namespace zylann::voxel
@@ -0,0 +1,100 @@
+#ifndef VOXEL_TASK_STATS_H
+#define VOXEL_TASK_STATS_H
+
+#include "../util/fixed_array.h"
+#include "../util/log2_histogram.h"
+#include "../util/thread/mutex.h"
+
+#include <atomic>
+#include <vector>
+
+class String;
+
+namespace zylann::voxel {
+
+// Measures tasks of VoxelServer, grouped by type. Cheap enough to always be on.
+// Optionally, the last runs can be recorded in a ring buffer and written as a Chrome trace, which can be opened in
+// `chrome://tracing` or Perfetto, without needing a profiler build.
+class TaskStats {
+public:
+	enum TaskType { //
+		TASK_GENERATE = 0,
+		TASK_LOAD,
+		TASK_SAVE,
+		TASK_MESH,
+		TASK_TYPE_COUNT
+	};
+
+	static const char *get_task_type_name(TaskType type);
+
+	struct TypeStats {
+		// Time from creation of the task to when it started running
+		Log2Histogram queue_latency_usec;
+		Log2Histogram run_time_usec;
+		// Bytes of voxel data for data tasks, triangles for meshing
+		Log2Histogram output_size;
+		std::atomic_uint32_t run_count;
+		// Skipped by the thread pool without running, because they became too far, their volume changed, or a newer
+		// task replaced them
+		std::atomic_uint32_t cancelled_count;
+		// Ran, but their result was discarded when they returned
+		std::atomic_uint32_t dropped_count;
+
+		TypeStats() : run_count(0), cancelled_count(0), dropped_count(0) {}
+	};
+
+	// Measures one run of a task. Create it at the beginning of `run()`, it records when it goes out of scope.
+	class RunScope {
+	public:
+		RunScope(TaskType type, uint64_t creation_time_usec);
+		~RunScope();
+
+		uint64_t output_size = 0;
+
+	private:
+		uint64_t _creation_time_usec;
+		uint64_t _start_time_usec;
+		TaskType _type;
+	};
+
+	static const unsigned int DEFAULT_TRACE_CAPACITY = 65536;
+
+	TaskStats();
+
+	static uint64_t get_time_usec();
+
+	// Thread-safe
+	void record_run(TaskType type, uint64_t creation_time_usec, uint64_t start_time_usec, uint64_t end_time_usec,
+			uint64_t output_size);
+	void record_cancelled(TaskType type);
+	void record_dropped(TaskType type);
+
+	const TypeStats &get_type_stats(TaskType type) const;
+	void reset();
+
+	// Keeps the last `capacity` task runs in memory. Clears previously recorded ones.
+	void set_tracing_enabled(bool enabled, unsigned int capacity = DEFAULT_TRACE_CAPACITY);
+	bool is_tracing_enabled() const;
+	// Writes recorded runs in Chrome's trace event JSON format
+	bool dump_trace(const String &fpath);
+
+private:
+	struct TraceEvent {
+		uint64_t start_time_usec;
+		uint32_t duration_usec;
+		uint32_t thread_id;
+		TaskType type;
+	};
+
+	FixedArray<TypeStats, TASK_TYPE_COUNT> _type_stats;
+
+	std::atomic_bool _tracing_enabled;
+	std::vector<TraceEvent> _trace_events;
+	// Total number of events recorded in the ring buffer since it was enabled
+	uint64_t _trace_event_count = 0;
+	BinaryMutex _trace_mutex;
+};
+
+} // namespace zylann::voxel
+
+#endif // VOXEL_TASK_STATS_H
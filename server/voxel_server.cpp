@@ -12,6 +12,7 @@
 #include "save_block_data_task.h"
 
 #include <core/config/project_settings.h>
+#include <core/os/time.h>
 
 namespace zylann::voxel {
 
@@ -33,14 +34,14 @@ void VoxelServer::destroy_singleton() {
 	g_voxel_server = nullptr;
 }
 
-VoxelServer::VoxelServer() {
+VoxelServer::VoxelServer() : _priority_epoch(0) {
 	CRASH_COND(ProjectSettings::get_singleton() == nullptr);
 
 	const int hw_threads_hint = Thread::get_hardware_concurrency();
 	ZN_PRINT_VERBOSE(format("Voxel: HW threads hint: {}", hw_threads_hint));
 
 	// Compute thread count for general pool.
-	// Note that the I/O thread counts as one used thread and will always be present.
+	// Note that I/O threads count as one used thread, since they spend most of their time waiting for files.
 
 	// "RST" means changing the property requires an editor restart (or game restart)
 	GLOBAL_DEF_RST("voxel/threads/count/minimum", 1);
@@ -55,6 +56,19 @@ VoxelServer::VoxelServer() {
 	ProjectSettings::get_singleton()->set_custom_property_info("voxel/threads/count/ratio_over_max",
 			PropertyInfo(Variant::FLOAT, "voxel/threads/count/ratio_over_max", PROPERTY_HINT_RANGE, "0,1,0.1"));
 
+	GLOBAL_DEF_RST("voxel/threads/count/streaming", 2);
+	ProjectSettings::get_singleton()->set_custom_property_info("voxel/threads/count/streaming",
+			PropertyInfo(Variant::INT, "voxel/threads/count/streaming", PROPERTY_HINT_RANGE, "1,16"));
+
+	GLOBAL_DEF_RST("voxel/threads/affinity", zylann::ThreadedTaskRunner::AFFINITY_NONE);
+	ProjectSettings::get_singleton()->set_custom_property_info("voxel/threads/affinity",
+			PropertyInfo(Variant::INT, "voxel/threads/affinity", PROPERTY_HINT_ENUM, "None,NUMA nodes,CPUs"));
+
+	// Bit `i` allows NUMA node `i`. 0 allows all of them.
+	GLOBAL_DEF_RST("voxel/threads/numa_node_mask", 0);
+	ProjectSettings::get_singleton()->set_custom_property_info("voxel/threads/numa_node_mask",
+			PropertyInfo(Variant::INT, "voxel/threads/numa_node_mask", PROPERTY_HINT_RANGE, "0,255"));
+
 	GLOBAL_DEF_RST("voxel/threads/main/time_budget_ms", 8);
 	ProjectSettings::get_singleton()->set_custom_property_info("voxel/threads/main/time_budget_ms",
 			PropertyInfo(Variant::INT, "voxel/threads/main/time_budget_ms", PROPERTY_HINT_RANGE, "0,1000"));
@@ -62,6 +76,52 @@ VoxelServer::VoxelServer() {
 	_main_thread_time_budget_usec =
 			1000 * int(ProjectSettings::get_singleton()->get("voxel/threads/main/time_budget_ms"));
 
+	// Shares of the main thread time budget, relative to each other
+	{
+		struct BudgetRatioSetting {
+			const char *name;
+			float default_value;
+			MainThreadTaskKind kind;
+		};
+		const BudgetRatioSetting budget_ratio_settings[] = {
+			{ "voxel/threads/main/budget_ratio_meshes", 0.5f, MAIN_THREAD_TASK_MESH },
+			{ "voxel/threads/main/budget_ratio_colliders", 0.25f, MAIN_THREAD_TASK_COLLIDER },
+			{ "voxel/threads/main/budget_ratio_instancers", 0.15f, MAIN_THREAD_TASK_INSTANCER },
+			{ "voxel/threads/main/budget_ratio_other", 0.1f, MAIN_THREAD_TASK_OTHER }
+		};
+		for (const BudgetRatioSetting &setting : budget_ratio_settings) {
+			GLOBAL_DEF_RST(setting.name, setting.default_value);
+			ProjectSettings::get_singleton()->set_custom_property_info(
+					setting.name, PropertyInfo(Variant::FLOAT, setting.name, PROPERTY_HINT_RANGE, "0,1,0.01"));
+			_time_spread_task_runner.set_kind_budget_ratio(
+					setting.kind, float(ProjectSettings::get_singleton()->get(setting.name)));
+		}
+	}
+
+	GLOBAL_DEF_RST("voxel/memory/budget_mb", 0);
+	ProjectSettings::get_singleton()->set_custom_property_info("voxel/memory/budget_mb",
+			PropertyInfo(Variant::INT, "voxel/memory/budget_mb", PROPERTY_HINT_RANGE, "0,65536"));
+
+	GLOBAL_DEF_RST("voxel/memory/size_class_budget_mb", 0);
+	ProjectSettings::get_singleton()->set_custom_property_info("voxel/memory/size_class_budget_mb",
+			PropertyInfo(Variant::INT, "voxel/memory/size_class_budget_mb", PROPERTY_HINT_RANGE, "0,65536"));
+
+	GLOBAL_DEF_RST("voxel/storage/sdf_quantization_max_error", 0.f);
+	ProjectSettings::get_singleton()->set_custom_property_info("voxel/storage/sdf_quantization_max_error",
+			PropertyInfo(Variant::FLOAT, "voxel/storage/sdf_quantization_max_error", PROPERTY_HINT_RANGE, "0,1,0.01"));
+
+	_sdf_quantization_max_error =
+			math::max(0.f, float(ProjectSettings::get_singleton()->get("voxel/storage/sdf_quantization_max_error")));
+
+	{
+		const size_t mb = 1024 * 1024;
+		VoxelMemoryPool &memory_pool = VoxelMemoryPool::get_singleton();
+		memory_pool.set_memory_budget(
+				mb * math::max(0, int(ProjectSettings::get_singleton()->get("voxel/memory/budget_mb"))));
+		memory_pool.set_pools_memory_budget(
+				mb * math::max(0, int(ProjectSettings::get_singleton()->get("voxel/memory/size_class_budget_mb"))));
+	}
+
 	const int minimum_thread_count =
 			math::max(1, int(ProjectSettings::get_singleton()->get("voxel/threads/count/minimum")));
 
@@ -74,7 +134,7 @@ VoxelServer::VoxelServer() {
 			math::clamp(float(ProjectSettings::get_singleton()->get("voxel/threads/count/ratio_over_max")), 0.f, 1.f);
 
 	const int maximum_thread_count = math::max(hw_threads_hint - thread_count_margin, minimum_thread_count);
-	// `-1` is for the stream thread
+	// `-1` is for stream threads
 	const int thread_count_by_ratio = int(Math::round(float(threads_ratio) * hw_threads_hint)) - 1;
 	const int thread_count = math::clamp(thread_count_by_ratio, minimum_thread_count, maximum_thread_count);
 	ZN_PRINT_VERBOSE(format("Voxel: automatic thread count set to {}", thread_count));
@@ -83,19 +143,42 @@ VoxelServer::VoxelServer() {
 		WARN_PRINT("Configured thread count exceeds hardware thread count. Performance may not be optimal");
 	}
 
-	// I/O can't be more than 1 thread. File access with more threads isn't worth it.
-	// This thread isn't configurable at the moment.
+	// Streams which don't support concurrent access are only used by one of these threads at a time, others can
+	// still work on other streams meanwhile.
+	const int streaming_thread_count =
+			math::max(1, int(ProjectSettings::get_singleton()->get("voxel/threads/count/streaming")));
+	ZN_PRINT_VERBOSE(format("Voxel: streaming thread count set to {}", streaming_thread_count));
+
+	const int affinity_setting = ProjectSettings::get_singleton()->get("voxel/threads/affinity");
+	const zylann::ThreadedTaskRunner::AffinityMode affinity_mode =
+			affinity_setting >= 0 && affinity_setting < zylann::ThreadedTaskRunner::AFFINITY_MODE_COUNT
+			? zylann::ThreadedTaskRunner::AffinityMode(affinity_setting)
+			: zylann::ThreadedTaskRunner::AFFINITY_NONE;
+	const uint32_t numa_node_mask =
+			math::max(0, int(ProjectSettings::get_singleton()->get("voxel/threads/numa_node_mask")));
+	ZN_PRINT_VERBOSE(format("Voxel: {} NUMA nodes, thread affinity mode {}", Thread::get_numa_node_count(),
+			int(affinity_mode)));
+
 	_streaming_thread_pool.set_name("Voxel streaming");
-	_streaming_thread_pool.set_thread_count(1);
+	// Streaming threads mostly wait for I/O, pinning them to single CPUs would not help. Keeping them on the node of
+	// the memory they fill still does.
+	_streaming_thread_pool.set_affinity(affinity_mode == zylann::ThreadedTaskRunner::AFFINITY_NONE
+					? zylann::ThreadedTaskRunner::AFFINITY_NONE
+					: zylann::ThreadedTaskRunner::AFFINITY_NUMA_NODES,
+			numa_node_mask);
+	_streaming_thread_pool.set_thread_count(streaming_thread_count);
 	_streaming_thread_pool.set_priority_update_period(300);
 	// Batching is only to give a chance for file I/O tasks to be grouped and reduce open/close calls.
 	// But in the end it might be better to move this idea to the tasks themselves?
 	_streaming_thread_pool.set_batch_count(16);
+	_streaming_thread_pool.set_priority_epoch(&_priority_epoch);
 
 	_general_thread_pool.set_name("Voxel general");
+	_general_thread_pool.set_affinity(affinity_mode, numa_node_mask);
 	_general_thread_pool.set_thread_count(thread_count);
 	_general_thread_pool.set_priority_update_period(200);
 	_general_thread_pool.set_batch_count(1);
+	_general_thread_pool.set_priority_epoch(&_priority_epoch);
 
 	// Init world
 	_world.shared_priority_dependency = make_shared_instance<PriorityDependency::ViewersData>();
@@ -279,6 +362,8 @@ void VoxelServer::request_block_mesh(uint32_t volume_id, const BlockMeshInput &i
 	task->collision_hint = input.collision_hint;
 	task->meshing_dependency = volume.meshing_dependency;
 	task->data_block_size = volume.data_block_size;
+	task->index_slot = _block_task_index.add(
+			BlockTaskIndex::Key{ volume_id, input.render_block_position, input.lod, BlockTaskIndex::TASK_MESH });
 
 	init_priority_dependency(
 			task->priority_dependency, input.render_block_position, input.lod, volume, volume.render_block_size);
@@ -472,8 +557,9 @@ bool VoxelServer::viewer_exists(uint32_t viewer_id) const {
 	return _world.viewers.is_valid(viewer_id);
 }
 
-void VoxelServer::push_main_thread_time_spread_task(zylann::ITimeSpreadTask *task) {
-	_time_spread_task_runner.push(task);
+void VoxelServer::push_main_thread_time_spread_task(
+		zylann::ITimeSpreadTask *task, MainThreadTaskKind kind, int priority) {
+	_time_spread_task_runner.push(task, kind, priority);
 }
 
 void VoxelServer::push_main_thread_progressive_task(zylann::IProgressiveTask *task) {
@@ -492,6 +578,11 @@ void VoxelServer::push_async_tasks(Span<zylann::IThreadedTask *> tasks) {
 	_general_thread_pool.enqueue(tasks);
 }
 
+void VoxelServer::push_async_tasks(
+		Span<zylann::IThreadedTask *> tasks, std::shared_ptr<zylann::AsyncDependencyTracker> tracker) {
+	_general_thread_pool.enqueue(tasks, tracker);
+}
+
 void VoxelServer::push_async_io_task(zylann::IThreadedTask *task) {
 	_streaming_thread_pool.enqueue(task);
 }
@@ -500,6 +591,11 @@ void VoxelServer::push_async_io_tasks(Span<zylann::IThreadedTask *> tasks) {
 	_streaming_thread_pool.enqueue(tasks);
 }
 
+void VoxelServer::push_async_io_tasks(
+		Span<zylann::IThreadedTask *> tasks, std::shared_ptr<zylann::AsyncDependencyTracker> tracker) {
+	_streaming_thread_pool.enqueue(tasks, tracker);
+}
+
 void VoxelServer::process() {
 	ZN_PROFILE_SCOPE();
 	ZN_PROFILE_PLOT("Static memory usage", int64_t(OS::get_singleton()->get_static_memory_usage()));
@@ -524,18 +620,38 @@ void VoxelServer::process() {
 
 	_progressive_task_runner.process();
 
+	// Release free voxel memory exceeding budgets.
+	// Not done every frame, blocks remaining unused over this period are considered idle.
+	{
+		static const uint64_t MEMORY_TRIM_PERIOD_MSEC = 1000;
+		const uint64_t now = Time::get_singleton()->get_ticks_msec();
+		if (now - _last_memory_trim_time_msec >= MEMORY_TRIM_PERIOD_MSEC) {
+			_last_memory_trim_time_msec = now;
+			VoxelMemoryPool::get_singleton().trim();
+		}
+	}
+
 	// Update viewer dependencies
 	{
+		bool changed = false;
 		const size_t viewer_count = _world.viewers.count();
 		if (_world.shared_priority_dependency->viewers.size() != viewer_count) {
 			// TODO We can avoid the invalidation by using an atomic size or memory barrier?
 			_world.shared_priority_dependency = make_shared_instance<PriorityDependency::ViewersData>();
 			_world.shared_priority_dependency->viewers.resize(viewer_count);
+			changed = true;
 		}
+		PriorityDependency::ViewersData &viewers_data = *_world.shared_priority_dependency;
+		// Small moves are ignored, so priorities of queued tasks don't have to be evaluated again
+		const float move_threshold_sq = math::squared(PriorityDependency::ViewersData::VIEWER_MOVE_THRESHOLD);
 		size_t i = 0;
 		unsigned int max_distance = 0;
-		_world.viewers.for_each([&i, &max_distance, this](Viewer &viewer) {
-			_world.shared_priority_dependency->viewers[i] = viewer.world_position;
+		_world.viewers.for_each([&i, &max_distance, &changed, &viewers_data, move_threshold_sq](Viewer &viewer) {
+			Vector3 &position = viewers_data.viewers[i];
+			if (changed || position.distance_squared_to(viewer.world_position) > move_threshold_sq) {
+				position = viewer.world_position;
+				changed = true;
+			}
 			if (viewer.view_distance > max_distance) {
 				max_distance = viewer.view_distance;
 			}
@@ -544,7 +660,15 @@ void VoxelServer::process() {
 		// Cancel distance is increased because of two reasons:
 		// - Some volumes use a cubic area which has higher distances on their corners
 		// - Hysteresis is needed to reduce ping-pong
-		_world.shared_priority_dependency->highest_view_distance = max_distance * 2;
+		const float highest_view_distance = max_distance * 2;
+		if (viewers_data.highest_view_distance != highest_view_distance) {
+			viewers_data.highest_view_distance = highest_view_distance;
+			changed = true;
+		}
+		if (changed) {
+			++viewers_data.version;
+			++_priority_epoch;
+		}
 	}
 }
 
@@ -567,6 +691,17 @@ static VoxelServer::Stats::ThreadPoolStats debug_get_pool_stats(const zylann::Th
 	return d;
 }
 
+static Dictionary histogram_to_dict(const Log2Histogram::Snapshot &h) {
+	Dictionary d;
+	d["count"] = h.count;
+	d["mean"] = h.get_mean();
+	d["p50"] = h.get_percentile(0.5f);
+	d["p90"] = h.get_percentile(0.9f);
+	d["p99"] = h.get_percentile(0.99f);
+	d["max"] = h.max;
+	return d;
+}
+
 Dictionary VoxelServer::Stats::to_dict() {
 	Dictionary pools;
 	pools["streaming"] = streaming.to_dict();
@@ -576,17 +711,65 @@ Dictionary VoxelServer::Stats::to_dict() {
 	tasks["streaming"] = streaming_tasks;
 	tasks["generation"] = generation_tasks;
 	tasks["meshing"] = meshing_tasks;
+	tasks["meshing_superseded"] = superseded_meshing_tasks;
 	tasks["main_thread"] = main_thread_tasks;
 
+	Dictionary task_types_dict;
+	for (unsigned int i = 0; i < task_types.size(); ++i) {
+		const TaskTypeStats &ts = task_types[i];
+		Dictionary td;
+		td["runs"] = ts.runs;
+		td["cancelled"] = ts.cancelled;
+		td["dropped"] = ts.dropped;
+		td["queue_latency_usec"] = histogram_to_dict(ts.queue_latency_usec);
+		td["run_time_usec"] = histogram_to_dict(ts.run_time_usec);
+		td[i == TaskStats::TASK_MESH ? "output_triangles" : "output_bytes"] = histogram_to_dict(ts.output_size);
+		task_types_dict[TaskStats::get_task_type_name(TaskStats::TaskType(i))] = td;
+	}
+
+	const char *kind_names[MAIN_THREAD_TASK_KIND_COUNT] = { "meshes", "colliders", "instancers", "other" };
+	Dictionary main_thread;
+	main_thread["time_budget_usec"] = main_thread_time_budget_usec;
+	for (unsigned int i = 0; i < main_thread_task_kinds.size(); ++i) {
+		main_thread[kind_names[i]] = main_thread_task_kinds[i].to_dict();
+	}
+
 	// This part is additional for scripts because VoxelMemoryPool is not exposed
 	Dictionary mem;
-	mem["voxel_total"] = ZN_SIZE_T_TO_VARIANT(VoxelMemoryPool::get_singleton().debug_get_total_memory());
-	mem["voxel_used"] = ZN_SIZE_T_TO_VARIANT(VoxelMemoryPool::get_singleton().debug_get_used_memory());
+	mem["voxel_total"] = ZN_SIZE_T_TO_VARIANT(memory_pool.total_memory);
+	mem["voxel_used"] = ZN_SIZE_T_TO_VARIANT(memory_pool.used_memory);
+	mem["voxel_peak"] = ZN_SIZE_T_TO_VARIANT(memory_pool.peak_total_memory);
+	mem["voxel_budget"] = ZN_SIZE_T_TO_VARIANT(memory_pool.memory_budget);
 	mem["block_count"] = VoxelMemoryPool::get_singleton().debug_get_used_blocks();
+	mem["numa_nodes"] = memory_pool.numa_node_count;
+
+	Array size_classes;
+	for (unsigned int i = 0; i < memory_pool.pools.size(); ++i) {
+		const VoxelMemoryPool::PoolStats &ps = memory_pool.pools[i];
+		if (ps.total_blocks == 0 && ps.hits == 0 && ps.misses == 0) {
+			// Never used
+			continue;
+		}
+		Dictionary sc;
+		sc["block_size"] = ZN_SIZE_T_TO_VARIANT(ps.block_size);
+		sc["total_blocks"] = ps.total_blocks;
+		sc["used_blocks"] = ps.used_blocks;
+		sc["peak_used_blocks"] = ps.peak_used_blocks;
+		sc["free_blocks"] = ps.free_blocks;
+		sc["hits"] = ps.hits;
+		sc["misses"] = ps.misses;
+		sc["trimmed_blocks"] = ps.trimmed_blocks;
+		sc["remote_recycles"] = ps.remote_recycles;
+		sc["budget"] = ZN_SIZE_T_TO_VARIANT(ps.memory_budget);
+		size_classes.append(sc);
+	}
+	mem["size_classes"] = size_classes;
 
 	Dictionary d;
 	d["thread_pools"] = pools;
 	d["tasks"] = tasks;
+	d["task_types"] = task_types_dict;
+	d["main_thread"] = main_thread;
 	d["memory_pools"] = mem;
 	return d;
 }
@@ -596,9 +779,31 @@ VoxelServer::Stats VoxelServer::get_stats() const {
 	s.streaming = debug_get_pool_stats(_streaming_thread_pool);
 	s.general = debug_get_pool_stats(_general_thread_pool);
 	s.generation_tasks = GenerateBlockTask::debug_get_running_count();
-	s.meshing_tasks = GenerateBlockTask::debug_get_running_count();
+	s.meshing_tasks = MeshBlockTask::debug_get_running_count();
+	s.superseded_meshing_tasks = _block_task_index.get_superseded_count();
 	s.streaming_tasks = LoadBlockDataTask::debug_get_running_count() + SaveBlockDataTask::debug_get_running_count();
 	s.main_thread_tasks = _time_spread_task_runner.get_pending_count() + _progressive_task_runner.get_pending_count();
+	s.main_thread_time_budget_usec = _main_thread_time_budget_usec;
+	for (unsigned int i = 0; i < s.main_thread_task_kinds.size(); ++i) {
+		const zylann::TimeSpreadTaskRunner::KindStats ks = _time_spread_task_runner.get_kind_stats(i);
+		Stats::MainThreadTaskStats &ts = s.main_thread_task_kinds[i];
+		ts.budget_usec = ks.budget_usec;
+		ts.spent_usec = ks.spent_usec;
+		ts.processed_tasks = ks.processed_count;
+		ts.pending_tasks = ks.pending_count;
+		ts.average_cost_usec = ks.average_cost_usec;
+	}
+	for (unsigned int i = 0; i < s.task_types.size(); ++i) {
+		const TaskStats::TypeStats &src = _task_stats.get_type_stats(TaskStats::TaskType(i));
+		Stats::TaskTypeStats &dst = s.task_types[i];
+		dst.queue_latency_usec = src.queue_latency_usec.get_snapshot();
+		dst.run_time_usec = src.run_time_usec.get_snapshot();
+		dst.output_size = src.output_size.get_snapshot();
+		dst.runs = src.run_count;
+		dst.cancelled = src.cancelled_count;
+		dst.dropped = src.dropped_count;
+	}
+	s.memory_pool = VoxelMemoryPool::get_singleton().get_stats();
 	return s;
 }
 
@@ -4,15 +4,18 @@
 #include "../constants/voxel_constants.h"
 #include "../generators/voxel_generator.h"
 #include "../meshers/blocky/voxel_mesher_blocky.h"
+#include "../storage/voxel_memory_pool.h"
 #include "../streams/voxel_stream.h"
 #include "../util/file_locker.h"
 #include "../util/struct_db.h"
 #include "../util/tasks/progressive_task_runner.h"
 #include "../util/tasks/threaded_task_runner.h"
 #include "../util/tasks/time_spread_task_runner.h"
+#include "block_task_index.h"
 #include "meshing_dependency.h"
 #include "priority_dependency.h"
 #include "streaming_dependency.h"
+#include "task_stats.h"
 
 #include <memory>
 
@@ -36,6 +39,13 @@ public:
 		VoxelMesher::Output surfaces;
 		Vector3i position;
 		uint8_t lod;
+		// Priority the meshing task had when it completed, lower values being more important.
+		// Can be used to order work that follows on the main thread.
+		int priority = 0;
+		// Collision faces built by the meshing thread, when it was requested with `collision_hint`, in the format of
+		// `ConcavePolygonShape3D::set_faces`. Empty if the mesh has no triangles.
+		PackedVector3Array collision_faces;
+		bool has_collision_faces = false;
 	};
 
 	struct BlockDataOutput {
@@ -62,6 +72,7 @@ public:
 		unsigned int data_blocks_count = 0;
 		Vector3i render_block_position;
 		uint8_t lod = 0;
+		// If true, collision faces will also be built by the meshing thread
 		bool collision_hint = false;
 	};
 
@@ -152,19 +163,45 @@ public:
 		_world.viewers.for_each_with_id(f);
 	}
 
-	void push_main_thread_time_spread_task(ITimeSpreadTask *task);
+	// Kinds of main thread tasks, each having their own share of the time budget
+	enum MainThreadTaskKind {
+		// Uploading meshes to the renderer
+		MAIN_THREAD_TASK_MESH = 0,
+		// Building collision shapes
+		MAIN_THREAD_TASK_COLLIDER,
+		// Creating instances on top of meshes
+		MAIN_THREAD_TASK_INSTANCER,
+		// Anything else, like freeing resources
+		MAIN_THREAD_TASK_OTHER,
+		MAIN_THREAD_TASK_KIND_COUNT
+	};
+
+	// Tasks with the lowest priority value run first among those of the same kind.
+	void push_main_thread_time_spread_task(
+			ITimeSpreadTask *task, MainThreadTaskKind kind = MAIN_THREAD_TASK_OTHER, int priority = 0);
 	int get_main_thread_time_budget_usec() const;
 
 	void push_main_thread_progressive_task(IProgressiveTask *task);
 
+	// Thread-safe.
+	// Maximum error SDF quantization may introduce in generated or loaded blocks, in voxels. 0 means disabled.
+	float get_sdf_quantization_max_error() const {
+		return _sdf_quantization_max_error;
+	}
+
 	// Thread-safe.
 	void push_async_task(IThreadedTask *task);
 	// Thread-safe.
 	void push_async_tasks(Span<IThreadedTask *> tasks);
 	// Thread-safe.
+	// Tasks will notify `tracker` when they complete, so tasks depending on them can be scheduled from a worker thread.
+	void push_async_tasks(Span<IThreadedTask *> tasks, std::shared_ptr<AsyncDependencyTracker> tracker);
+	// Thread-safe.
 	void push_async_io_task(IThreadedTask *task);
 	// Thread-safe.
 	void push_async_io_tasks(Span<IThreadedTask *> tasks);
+	// Thread-safe.
+	void push_async_io_tasks(Span<IThreadedTask *> tasks, std::shared_ptr<AsyncDependencyTracker> tracker);
 
 	// Gets by how much voxels must be padded with neighbors in order to be polygonized properly
 	// void get_min_max_block_padding(
@@ -174,6 +211,17 @@ public:
 	void process();
 	void wait_and_clear_all_tasks(bool warn);
 
+	// Thread-safe.
+	// Tasks working on specific blocks can register there, so newer requests for the same block cancel older ones.
+	inline BlockTaskIndex &get_block_task_index() {
+		return _block_task_index;
+	}
+
+	// Thread-safe.
+	inline TaskStats &get_task_stats() {
+		return _task_stats;
+	}
+
 	inline FileLocker &get_file_locker() {
 		return _file_locker;
 	}
@@ -186,6 +234,24 @@ public:
 	}
 
 	struct Stats {
+		struct MainThreadTaskStats {
+			unsigned int budget_usec;
+			unsigned int spent_usec;
+			unsigned int processed_tasks;
+			unsigned int pending_tasks;
+			float average_cost_usec;
+
+			Dictionary to_dict() {
+				Dictionary d;
+				d["budget_usec"] = budget_usec;
+				d["spent_usec"] = spent_usec;
+				d["processed_tasks"] = processed_tasks;
+				d["pending_tasks"] = pending_tasks;
+				d["average_cost_usec"] = average_cost_usec;
+				return d;
+			}
+		};
+
 		struct ThreadPoolStats {
 			unsigned int thread_count;
 			unsigned int active_threads;
@@ -200,12 +266,27 @@ public:
 			}
 		};
 
+		struct TaskTypeStats {
+			Log2Histogram::Snapshot queue_latency_usec;
+			Log2Histogram::Snapshot run_time_usec;
+			Log2Histogram::Snapshot output_size;
+			unsigned int runs;
+			unsigned int cancelled;
+			unsigned int dropped;
+		};
+
 		ThreadPoolStats streaming;
 		ThreadPoolStats general;
 		int generation_tasks;
 		int streaming_tasks;
 		int meshing_tasks;
+		// Meshing requests cancelled because a newer one was made for the same block
+		int superseded_meshing_tasks;
 		int main_thread_tasks;
+		int main_thread_time_budget_usec;
+		FixedArray<MainThreadTaskStats, MAIN_THREAD_TASK_KIND_COUNT> main_thread_task_kinds;
+		FixedArray<TaskTypeStats, TaskStats::TASK_TYPE_COUNT> task_types;
+		VoxelMemoryPool::Stats memory_pool;
 
 		Dictionary to_dict();
 	};
@@ -253,6 +334,10 @@ private:
 	// TODO multi-world support in the future
 	World _world;
 
+	// Incremented when viewers changed enough for task priorities to be re-evaluated.
+	// Declared before thread pools since they read it.
+	std::atomic_uint32_t _priority_epoch;
+
 	// Pool specialized in file I/O
 	ThreadedTaskRunner _streaming_thread_pool;
 	// Pool for every other task
@@ -262,6 +347,15 @@ private:
 	int _main_thread_time_budget_usec = 8000;
 	ProgressiveTaskRunner _progressive_task_runner;
 
+	BlockTaskIndex _block_task_index;
+	TaskStats _task_stats;
+
+	// Only set on construction
+	float _sdf_quantization_max_error = 0.f;
+
+	// Free voxel memory gets released periodically if it exceeds budgets
+	uint64_t _last_memory_trim_time_msec = 0;
+
 	FileLocker _file_locker;
 };
 
@@ -302,18 +396,33 @@ public:
 		_io_tasks.push_back(task);
 	}
 
+	// Pushes a group of tasks which will notify `tracker` when they complete
+	inline void push_main_tasks(std::vector<IThreadedTask *> &&tasks, std::shared_ptr<AsyncDependencyTracker> tracker) {
+		_tracked_main_tasks.push_back(TrackedTasks{ std::move(tasks), tracker });
+	}
+
 	inline void flush() {
 		VoxelServer::get_singleton().push_async_tasks(to_span(_main_tasks));
 		VoxelServer::get_singleton().push_async_io_tasks(to_span(_io_tasks));
+		for (TrackedTasks &tracked_tasks : _tracked_main_tasks) {
+			VoxelServer::get_singleton().push_async_tasks(to_span(tracked_tasks.tasks), tracked_tasks.tracker);
+		}
 		_main_tasks.clear();
 		_io_tasks.clear();
+		_tracked_main_tasks.clear();
 	}
 
 	// No destructor! This does not take ownership, it is only a helper. Flush should be called after each use.
 
 private:
+	struct TrackedTasks {
+		std::vector<IThreadedTask *> tasks;
+		std::shared_ptr<AsyncDependencyTracker> tracker;
+	};
+
 	std::vector<IThreadedTask *> _main_tasks;
 	std::vector<IThreadedTask *> _io_tasks;
+	std::vector<TrackedTasks> _tracked_main_tasks;
 };
 
 } // namespace zylann::voxel
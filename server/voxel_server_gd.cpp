@@ -41,6 +41,20 @@ void VoxelServer::schedule_task(Ref<ZN_ThreadedTask> task) {
 	zylann::voxel::VoxelServer::get_singleton().push_async_task(task->create_task());
 }
 
+void VoxelServer::set_task_tracing_enabled(bool enabled) {
+	zylann::voxel::VoxelServer::get_singleton().get_task_stats().set_tracing_enabled(enabled);
+}
+
+bool VoxelServer::is_task_tracing_enabled() const {
+	return zylann::voxel::VoxelServer::get_singleton().get_task_stats().is_tracing_enabled();
+}
+
+Error VoxelServer::dump_task_trace(String fpath) {
+	TaskStats &stats = zylann::voxel::VoxelServer::get_singleton().get_task_stats();
+	ERR_FAIL_COND_V_MSG(!stats.is_tracing_enabled(), ERR_UNCONFIGURED, "Task tracing is not enabled");
+	return stats.dump_trace(fpath) ? OK : ERR_CANT_CREATE;
+}
+
 void VoxelServer::_on_rendering_server_frame_post_draw() {
 #ifdef ZN_PROFILER_ENABLED
 	ZN_PROFILE_MARK_FRAME();
@@ -49,6 +63,10 @@ void VoxelServer::_on_rendering_server_frame_post_draw() {
 
 void VoxelServer::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("get_stats"), &VoxelServer::get_stats);
+
+	ClassDB::bind_method(D_METHOD("set_task_tracing_enabled", "enabled"), &VoxelServer::set_task_tracing_enabled);
+	ClassDB::bind_method(D_METHOD("is_task_tracing_enabled"), &VoxelServer::is_task_tracing_enabled);
+	ClassDB::bind_method(D_METHOD("dump_task_trace", "path"), &VoxelServer::dump_task_trace);
 }
 
 } // namespace zylann::voxel::gd
@@ -18,6 +18,10 @@ public:
 	Dictionary get_stats() const;
 	void schedule_task(Ref<ZN_ThreadedTask> task);
 
+	void set_task_tracing_enabled(bool enabled);
+	bool is_task_tracing_enabled() const;
+	Error dump_task_trace(String fpath);
+
 	VoxelServer();
 
 	static VoxelServer *get_singleton();
@@ -331,6 +331,8 @@ void VoxelBuffer::_bind_methods() {
 
 	BIND_ENUM_CONSTANT(COMPRESSION_NONE);
 	BIND_ENUM_CONSTANT(COMPRESSION_UNIFORM);
+	BIND_ENUM_CONSTANT(COMPRESSION_PALETTE);
+	BIND_ENUM_CONSTANT(COMPRESSION_QUANTIZED);
 	BIND_ENUM_CONSTANT(COMPRESSION_COUNT);
 
 	BIND_CONSTANT(MAX_SIZE);
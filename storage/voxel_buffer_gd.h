@@ -38,6 +38,8 @@ public:
 	enum Compression {
 		COMPRESSION_NONE = VoxelBufferInternal::COMPRESSION_NONE,
 		COMPRESSION_UNIFORM = VoxelBufferInternal::COMPRESSION_UNIFORM,
+		COMPRESSION_PALETTE = VoxelBufferInternal::COMPRESSION_PALETTE,
+		COMPRESSION_QUANTIZED = VoxelBufferInternal::COMPRESSION_QUANTIZED,
 		//COMPRESSION_RLE,
 		COMPRESSION_COUNT = VoxelBufferInternal::COMPRESSION_COUNT
 	};
@@ -6,6 +6,7 @@
 
 #include "../util/container_funcs.h"
 #include "../util/profiling.h"
+#include "../util/simd_kernels.h"
 #include "../util/string_funcs.h"
 #include "voxel_buffer_internal.h"
 
@@ -30,6 +31,149 @@ inline void free_channel_data(uint8_t *data, uint32_t size) {
 #endif
 }
 
+// Dense channel data can be shared between copies. Its reference count is stored right before it, in the same
+// allocation, so it doesn't cost another allocation nor another cache line.
+#ifdef VOXEL_BUFFER_USE_MEMORY_POOL
+static_assert(sizeof(std::atomic_uint32_t) <= VoxelMemoryPool::BLOCK_USER_HEADER_SIZE);
+#else
+static const size_t CHANNEL_DATA_HEADER_SIZE = 16;
+#endif
+
+inline uint8_t *allocate_shared_channel_data(size_t size, std::atomic_uint32_t *&out_refcount) {
+#ifdef VOXEL_BUFFER_USE_MEMORY_POOL
+	// Pooled blocks have room for it in their header, so it doesn't make them use a larger size class
+	uint8_t *data = VoxelMemoryPool::get_singleton().allocate(size);
+	if (data == nullptr) {
+		return nullptr;
+	}
+	out_refcount = new (VoxelMemoryPool::get_block_user_header(data)) std::atomic_uint32_t(1);
+#else
+	uint8_t *mem = (uint8_t *)memalloc(CHANNEL_DATA_HEADER_SIZE + size * sizeof(uint8_t));
+	if (mem == nullptr) {
+		return nullptr;
+	}
+	uint8_t *data = mem + CHANNEL_DATA_HEADER_SIZE;
+	out_refcount = new (data - sizeof(std::atomic_uint32_t)) std::atomic_uint32_t(1);
+#endif
+	return data;
+}
+
+inline void free_shared_channel_data(uint8_t *data, uint32_t size, std::atomic_uint32_t *refcount) {
+	refcount->~atomic();
+#ifdef VOXEL_BUFFER_USE_MEMORY_POOL
+	VoxelMemoryPool::get_singleton().recycle(data, size);
+#else
+	memfree(data - CHANNEL_DATA_HEADER_SIZE);
+#endif
+}
+
+inline uint64_t *allocate_palette() {
+	return reinterpret_cast<uint64_t *>(
+			allocate_channel_data(VoxelBufferInternal::MAX_PALETTE_SIZE * sizeof(uint64_t)));
+}
+
+inline void free_palette(uint64_t *palette) {
+	free_channel_data(reinterpret_cast<uint8_t *>(palette), VoxelBufferInternal::MAX_PALETTE_SIZE * sizeof(uint64_t));
+}
+
+inline unsigned int get_palette_index_bits(unsigned int palette_size) {
+	if (palette_size <= 2) {
+		return 1;
+	}
+	if (palette_size <= 4) {
+		return 2;
+	}
+	return 4;
+}
+
+inline size_t get_palette_indices_size_in_bytes(uint64_t volume, unsigned int index_bits) {
+	return (volume * index_bits + 7) >> 3;
+}
+
+inline unsigned int get_palette_index(const uint8_t *indices, unsigned int index_bits, size_t i) {
+	const size_t bit_index = i * index_bits;
+	return (indices[bit_index >> 3] >> (bit_index & 7)) & ((1 << index_bits) - 1);
+}
+
+inline void set_palette_index(uint8_t *indices, unsigned int index_bits, size_t i, unsigned int palette_index) {
+	const size_t bit_index = i * index_bits;
+	const unsigned int shift = bit_index & 7;
+	const unsigned int mask = ((1 << index_bits) - 1) << shift;
+	uint8_t &b = indices[bit_index >> 3];
+	b = (b & ~mask) | (palette_index << shift);
+}
+
+inline unsigned int find_palette_index(const uint64_t *palette, unsigned int palette_size, uint64_t value) {
+	unsigned int i = 0;
+	for (; i < palette_size; ++i) {
+		if (palette[i] == value) {
+			break;
+		}
+	}
+	return i;
+}
+
+// Gathers distinct values. Returns false as soon as there are too many of them to fit in a palette.
+template <typename T>
+bool find_palette(const T *values, size_t volume, FixedArray<uint64_t, VoxelBufferInternal::MAX_PALETTE_SIZE> &palette,
+		unsigned int &palette_size) {
+	T prev_value = values[0];
+	palette[0] = prev_value;
+	palette_size = 1;
+	for (size_t i = 1; i < volume; ++i) {
+		const T v = values[i];
+		// Voxels often come in runs along Y
+		if (v == prev_value) {
+			continue;
+		}
+		prev_value = v;
+		if (find_palette_index(palette.data(), palette_size, v) == palette_size) {
+			if (palette_size == palette.size()) {
+				return false;
+			}
+			palette[palette_size] = v;
+			++palette_size;
+		}
+	}
+	return true;
+}
+
+// `indices` must be zero-initialized
+template <typename T>
+void encode_palette_indices(const T *values, size_t volume, const uint64_t *palette, unsigned int palette_size,
+		uint8_t *indices, unsigned int index_bits) {
+	T prev_value = values[0];
+	unsigned int prev_index = find_palette_index(palette, palette_size, prev_value);
+	for (size_t i = 0; i < volume; ++i) {
+		const T v = values[i];
+		if (v != prev_value) {
+			prev_value = v;
+			prev_index = find_palette_index(palette, palette_size, v);
+#ifdef DEBUG_ENABLED
+			ZN_ASSERT(prev_index < palette_size);
+#endif
+		}
+		set_palette_index(indices, index_bits, i, prev_index);
+	}
+}
+
+template <typename T>
+void decode_palette_indices(const VoxelBufferInternal::Channel &channel, T *values, size_t volume) {
+	for (size_t i = 0; i < volume; ++i) {
+		values[i] = VoxelBufferInternal::get_palette_voxel(channel, i);
+	}
+}
+
+// `to_real` converts a raw value into the unit of `min_value` and `inv_step`
+template <typename T, typename F>
+void encode_quantized_values(
+		const T *values, size_t volume, float min_value, float inv_step, uint8_t *codes, F to_real) {
+	for (size_t i = 0; i < volume; ++i) {
+		const int code = Math::round((to_real(values[i]) - min_value) * inv_step);
+		codes[i] = math::clamp(code, 0, 255);
+	}
+}
+
 // uint64_t g_depth_max_values[] = {
 // 	0xff, // 8
 // 	0xffff, // 16
@@ -149,7 +293,7 @@ void VoxelBufferInternal::create(unsigned int sx, unsigned int sy, unsigned int
 		_size = new_size;
 		for (unsigned int i = 0; i < _channels.size(); ++i) {
 			Channel &channel = _channels[i];
-			if (channel.data != nullptr) {
+			if (channel.is_allocated()) {
 				// Channel already contained data
 				delete_channel(i);
 				ZN_ASSERT_RETURN(create_channel(i, channel.defval));
@@ -165,7 +309,7 @@ void VoxelBufferInternal::create(Vector3i size) {
 void VoxelBufferInternal::clear() {
 	for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
 		Channel &channel = _channels[i];
-		if (channel.data != nullptr) {
+		if (channel.is_allocated()) {
 			delete_channel(i);
 		}
 	}
@@ -180,7 +324,7 @@ void VoxelBufferInternal::clear_channel(unsigned int channel_index, uint64_t cle
 }
 
 void VoxelBufferInternal::clear_channel(Channel &channel, uint64_t clear_value) {
-	if (channel.data != nullptr) {
+	if (channel.is_allocated()) {
 		delete_channel(channel);
 	}
 	channel.defval = clear_value;
@@ -225,6 +369,9 @@ uint64_t VoxelBufferInternal::get_voxel(int x, int y, int z, unsigned int channe
 				return 0;
 		}
 
+	} else if (channel.palette_indices != nullptr) {
+		return get_palette_voxel(channel, get_index(x, y, z));
+
 	} else {
 		return channel.defval;
 	}
@@ -238,6 +385,14 @@ void VoxelBufferInternal::set_voxel(uint64_t value, int x, int y, int z, unsigne
 
 	bool do_set = true;
 
+	if (channel.palette_indices != nullptr) {
+		if (set_palette_voxel(channel, get_index(x, y, z), value)) {
+			return;
+		}
+		// The palette is full or the channel is quantized, fallback on dense storage
+		decompress_palette(channel_index);
+	}
+
 	if (channel.data == nullptr) {
 		if (channel.defval != value) {
 			// Allocate channel with same initial values as defval
@@ -245,6 +400,8 @@ void VoxelBufferInternal::set_voxel(uint64_t value, int x, int y, int z, unsigne
 		} else {
 			do_set = false;
 		}
+	} else {
+		ZN_ASSERT_RETURN(unshare_channel_data(channel));
 	}
 
 	if (do_set) {
@@ -292,6 +449,12 @@ void VoxelBufferInternal::fill(uint64_t defval, unsigned int channel_index) {
 
 	Channel &channel = _channels[channel_index];
 
+	if (channel.palette_indices != nullptr || channel.is_data_shared()) {
+		// Every voxel gets the same value, no need to keep the palette or to copy shared data
+		clear_channel(channel, defval);
+		return;
+	}
+
 	if (channel.data == nullptr) {
 		// Channel is already optimized and uniform
 		if (channel.defval == defval) {
@@ -315,21 +478,17 @@ void VoxelBufferInternal::fill(uint64_t defval, unsigned int channel_index) {
 			break;
 
 		case DEPTH_16_BIT:
-			for (size_t i = 0; i < volume; ++i) {
-				reinterpret_cast<uint16_t *>(channel.data)[i] = defval;
-			}
+			simd::fill(
+					Span<uint16_t>(reinterpret_cast<uint16_t *>(channel.data), volume), static_cast<uint16_t>(defval));
 			break;
 
 		case DEPTH_32_BIT:
-			for (size_t i = 0; i < volume; ++i) {
-				reinterpret_cast<uint32_t *>(channel.data)[i] = defval;
-			}
+			simd::fill(
+					Span<uint32_t>(reinterpret_cast<uint32_t *>(channel.data), volume), static_cast<uint32_t>(defval));
 			break;
 
 		case DEPTH_64_BIT:
-			for (size_t i = 0; i < volume; ++i) {
-				reinterpret_cast<uint64_t *>(channel.data)[i] = defval;
-			}
+			simd::fill(Span<uint64_t>(reinterpret_cast<uint64_t *>(channel.data), volume), defval);
 			break;
 
 		default:
@@ -351,12 +510,18 @@ void VoxelBufferInternal::fill_area(uint64_t defval, Vector3i min, Vector3i max,
 
 	Channel &channel = _channels[channel_index];
 
+	if (channel.palette_indices != nullptr) {
+		decompress_palette(channel_index);
+	}
+
 	if (channel.data == nullptr) {
 		if (channel.defval == defval) {
 			return;
 		} else {
 			ZN_ASSERT_RETURN(create_channel(channel_index, channel.defval));
 		}
+	} else {
+		ZN_ASSERT_RETURN(unshare_channel_data(channel));
 	}
 
 	Vector3i pos;
@@ -374,21 +539,18 @@ void VoxelBufferInternal::fill_area(uint64_t defval, Vector3i min, Vector3i max,
 					break;
 
 				case DEPTH_16_BIT:
-					for (int i = 0; i < area_size.y; ++i) {
-						((uint16_t *)channel.data)[dst_ri + i] = defval;
-					}
+					simd::fill(Span<uint16_t>(reinterpret_cast<uint16_t *>(channel.data) + dst_ri, area_size.y),
+							static_cast<uint16_t>(defval));
 					break;
 
 				case DEPTH_32_BIT:
-					for (int i = 0; i < area_size.y; ++i) {
-						((uint32_t *)channel.data)[dst_ri + i] = defval;
-					}
+					simd::fill(Span<uint32_t>(reinterpret_cast<uint32_t *>(channel.data) + dst_ri, area_size.y),
+							static_cast<uint32_t>(defval));
 					break;
 
 				case DEPTH_64_BIT:
-					for (int i = 0; i < area_size.y; ++i) {
-						((uint64_t *)channel.data)[dst_ri + i] = defval;
-					}
+					simd::fill(Span<uint64_t>(reinterpret_cast<uint64_t *>(channel.data) + dst_ri, area_size.y),
+							defval);
 					break;
 
 				default:
@@ -412,7 +574,7 @@ void VoxelBufferInternal::fill_f(real_t value, unsigned int channel) {
 
 template <typename T>
 inline bool is_uniform_b(const uint8_t *data, size_t item_count) {
-	return is_uniform<T>(reinterpret_cast<const T *>(data), item_count);
+	return simd::is_uniform(Span<const T>(reinterpret_cast<const T *>(data), item_count));
 }
 
 bool VoxelBufferInternal::is_uniform(unsigned int channel_index) const {
@@ -421,7 +583,31 @@ bool VoxelBufferInternal::is_uniform(unsigned int channel_index) const {
 	return is_uniform(channel);
 }
 
-bool VoxelBufferInternal::is_uniform(const Channel &channel) {
+bool VoxelBufferInternal::is_uniform(const Channel &channel) const {
+	if (channel.palette_indices != nullptr) {
+		// Palette values are distinct, so we only have to compare indices
+		const unsigned int index_bits = channel.palette_index_bits;
+		const unsigned int first_index = get_palette_index(channel.palette_indices, index_bits, 0);
+		uint8_t pattern = 0;
+		for (unsigned int b = 0; b < 8; b += index_bits) {
+			pattern |= first_index << b;
+		}
+		// Compare whole bytes first, then remaining indices
+		const size_t volume = get_volume();
+		const size_t full_byte_count = (volume * index_bits) >> 3;
+		for (size_t i = 0; i < full_byte_count; ++i) {
+			if (channel.palette_indices[i] != pattern) {
+				return false;
+			}
+		}
+		for (size_t i = (full_byte_count << 3) / index_bits; i < volume; ++i) {
+			if (get_palette_index(channel.palette_indices, index_bits, i) != first_index) {
+				return false;
+			}
+		}
+		return true;
+	}
+
 	if (channel.data == nullptr) {
 		// Channel has been optimized
 		return true;
@@ -446,6 +632,10 @@ bool VoxelBufferInternal::is_uniform(const Channel &channel) {
 }
 
 uint64_t get_first_voxel(const VoxelBufferInternal::Channel &channel) {
+	if (channel.palette_indices != nullptr) {
+		return VoxelBufferInternal::get_palette_voxel(channel, 0);
+	}
+
 	ZN_ASSERT(channel.data != nullptr);
 
 	switch (channel.depth) {
@@ -475,27 +665,298 @@ void VoxelBufferInternal::compress_uniform_channels() {
 }
 
 void VoxelBufferInternal::compress_if_uniform(Channel &channel) {
-	if (channel.data != nullptr && is_uniform(channel)) {
+	if (channel.is_allocated() && is_uniform(channel)) {
 		const uint64_t v = get_first_voxel(channel);
 		clear_channel(channel, v);
 	}
 }
 
+void VoxelBufferInternal::compress_palette_channels() {
+	for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
+		Channel &channel = _channels[i];
+		if (channel.data != nullptr) {
+			compress_with_palette(channel);
+		}
+	}
+}
+
+bool VoxelBufferInternal::compress_with_palette(Channel &channel) {
+	ZN_PROFILE_SCOPE();
+	ZN_ASSERT_RETURN_V(channel.data != nullptr, false);
+
+	const size_t volume = get_volume();
+	FixedArray<uint64_t, MAX_PALETTE_SIZE> palette;
+	unsigned int palette_size = 0;
+	bool found = false;
+
+	switch (channel.depth) {
+		case DEPTH_8_BIT:
+			found = find_palette(channel.data, volume, palette, palette_size);
+			break;
+		case DEPTH_16_BIT:
+			found = find_palette(reinterpret_cast<const uint16_t *>(channel.data), volume, palette, palette_size);
+			break;
+		case DEPTH_32_BIT:
+			found = find_palette(reinterpret_cast<const uint32_t *>(channel.data), volume, palette, palette_size);
+			break;
+		case DEPTH_64_BIT:
+			found = find_palette(reinterpret_cast<const uint64_t *>(channel.data), volume, palette, palette_size);
+			break;
+		default:
+			CRASH_NOW();
+			break;
+	}
+
+	if (!found) {
+		// Too many distinct values
+		return false;
+	}
+
+	if (palette_size == 1) {
+		clear_channel(channel, palette[0]);
+		return true;
+	}
+
+	const unsigned int index_bits = get_palette_index_bits(palette_size);
+	const size_t indices_size_in_bytes = get_palette_indices_size_in_bytes(volume, index_bits);
+
+	if (indices_size_in_bytes + MAX_PALETTE_SIZE * sizeof(uint64_t) >= channel.size_in_bytes) {
+		// Not worth it, this can happen with small buffers or 8-bit channels
+		return false;
+	}
+
+	uint8_t *indices = allocate_channel_data(indices_size_in_bytes);
+	ZN_ASSERT_RETURN_V(indices != nullptr, false);
+	uint64_t *palette_data = allocate_palette();
+	if (palette_data == nullptr) {
+		free_channel_data(indices, indices_size_in_bytes);
+		ZN_PRINT_ERROR("Could not allocate palette");
+		return false;
+	}
+
+	memset(indices, 0, indices_size_in_bytes);
+	for (unsigned int i = 0; i < palette_size; ++i) {
+		palette_data[i] = palette[i];
+	}
+
+	switch (channel.depth) {
+		case DEPTH_8_BIT:
+			encode_palette_indices(channel.data, volume, palette_data, palette_size, indices, index_bits);
+			break;
+		case DEPTH_16_BIT:
+			encode_palette_indices(reinterpret_cast<const uint16_t *>(channel.data), volume, palette_data,
+					palette_size, indices, index_bits);
+			break;
+		case DEPTH_32_BIT:
+			encode_palette_indices(reinterpret_cast<const uint32_t *>(channel.data), volume, palette_data,
+					palette_size, indices, index_bits);
+			break;
+		case DEPTH_64_BIT:
+			encode_palette_indices(reinterpret_cast<const uint64_t *>(channel.data), volume, palette_data,
+					palette_size, indices, index_bits);
+			break;
+		default:
+			CRASH_NOW();
+			break;
+	}
+
+	release_channel_data(channel);
+
+	channel.palette = palette_data;
+	channel.palette_indices = indices;
+	channel.palette_indices_size_in_bytes = indices_size_in_bytes;
+	channel.palette_size = palette_size;
+	channel.palette_index_bits = index_bits;
+	return true;
+}
+
+void VoxelBufferInternal::decompress_palette(unsigned int channel_index) {
+	ZN_PROFILE_SCOPE();
+	Channel &channel = _channels[channel_index];
+	ZN_ASSERT_RETURN(channel.palette_indices != nullptr);
+
+	// Detach palette storage so dense data can be allocated in its place
+	Channel palette_channel = channel;
+	channel.palette = nullptr;
+	channel.palette_indices = nullptr;
+	channel.palette_indices_size_in_bytes = 0;
+	channel.palette_size = 0;
+	channel.palette_index_bits = 0;
+
+	if (!create_channel_noinit(channel_index, _size)) {
+		// Put it back
+		channel = palette_channel;
+		ZN_PRINT_ERROR("Could not decompress palette");
+		return;
+	}
+
+	const size_t volume = get_volume();
+
+	switch (channel.depth) {
+		case DEPTH_8_BIT:
+			decode_palette_indices(palette_channel, channel.data, volume);
+			break;
+		case DEPTH_16_BIT:
+			decode_palette_indices(palette_channel, reinterpret_cast<uint16_t *>(channel.data), volume);
+			break;
+		case DEPTH_32_BIT:
+			decode_palette_indices(palette_channel, reinterpret_cast<uint32_t *>(channel.data), volume);
+			break;
+		case DEPTH_64_BIT:
+			decode_palette_indices(palette_channel, reinterpret_cast<uint64_t *>(channel.data), volume);
+			break;
+		default:
+			CRASH_NOW();
+			break;
+	}
+
+	delete_channel(palette_channel);
+}
+
+bool VoxelBufferInternal::set_palette_voxel(Channel &channel, size_t i, uint64_t value) {
+	if (channel.palette == nullptr) {
+		// Quantized channels are not edited in place, the new value would not always be representable
+		return false;
+	}
+
+	unsigned int palette_index = find_palette_index(channel.palette, channel.palette_size, value);
+
+	if (palette_index == channel.palette_size) {
+		if (channel.palette_size == MAX_PALETTE_SIZE) {
+			return false;
+		}
+
+		if (channel.palette_size == (1u << channel.palette_index_bits)) {
+			// Indices are too small to reference a new value, widen them
+			const unsigned int new_index_bits = channel.palette_index_bits * 2;
+			const size_t volume = get_volume();
+			const size_t new_size_in_bytes = get_palette_indices_size_in_bytes(volume, new_index_bits);
+
+			uint8_t *new_indices = allocate_channel_data(new_size_in_bytes);
+			ZN_ASSERT_RETURN_V(new_indices != nullptr, false);
+			memset(new_indices, 0, new_size_in_bytes);
+
+			for (size_t j = 0; j < volume; ++j) {
+				set_palette_index(new_indices, new_index_bits, j,
+						get_palette_index(channel.palette_indices, channel.palette_index_bits, j));
+			}
+
+			free_channel_data(channel.palette_indices, channel.palette_indices_size_in_bytes);
+			channel.palette_indices = new_indices;
+			channel.palette_indices_size_in_bytes = new_size_in_bytes;
+			channel.palette_index_bits = new_index_bits;
+		}
+
+		channel.palette[palette_index] = value;
+		++channel.palette_size;
+	}
+
+	set_palette_index(channel.palette_indices, channel.palette_index_bits, i, palette_index);
+	return true;
+}
+
+bool VoxelBufferInternal::compress_sdf_channel(float max_error) {
+	ZN_PROFILE_SCOPE();
+	Channel &channel = _channels[CHANNEL_SDF];
+	if (channel.data == nullptr || channel.depth == DEPTH_8_BIT) {
+		// Already compressed, or would not get smaller
+		return false;
+	}
+
+	float min_value;
+	float max_value;
+	get_range_f(min_value, max_value, CHANNEL_SDF);
+
+	if (min_value == max_value) {
+		clear_channel(channel, get_first_voxel(channel));
+		return true;
+	}
+
+	const float step = (max_value - min_value) / 255.f;
+	// Values are rounded to the nearest step
+	if (0.5f * step > max_error * get_sdf_quantization_scale(channel.depth)) {
+		return false;
+	}
+
+	const size_t volume = get_volume();
+	uint8_t *codes = allocate_channel_data(volume);
+	ZN_ASSERT_RETURN_V(codes != nullptr, false);
+	const float inv_step = 1.f / step;
+
+	switch (channel.depth) {
+		case DEPTH_16_BIT:
+			encode_quantized_values(reinterpret_cast<const int16_t *>(channel.data), volume, min_value, inv_step, codes,
+					[](int16_t v) { return s16_to_snorm(v); });
+			break;
+		case DEPTH_32_BIT:
+			encode_quantized_values(reinterpret_cast<const float *>(channel.data), volume, min_value, inv_step, codes,
+					[](float v) { return v; });
+			break;
+		case DEPTH_64_BIT:
+			encode_quantized_values(reinterpret_cast<const double *>(channel.data), volume, min_value, inv_step, codes,
+					[](double v) { return float(v); });
+			break;
+		default:
+			CRASH_NOW();
+			break;
+	}
+
+	release_channel_data(channel);
+
+	channel.palette_indices = codes;
+	channel.palette_indices_size_in_bytes = volume;
+	channel.palette_size = 0;
+	channel.palette_index_bits = 8;
+	channel.quantized_min = min_value;
+	channel.quantized_step = step;
+	return true;
+}
+
+uint64_t VoxelBufferInternal::get_quantized_voxel(const Channel &channel, unsigned int code) {
+	const uint64_t v = real_to_raw_voxel(channel.quantized_min + code * channel.quantized_step, channel.depth);
+	// Return the same as dense storage, where negative 16-bit values are not sign-extended
+	return channel.depth == DEPTH_16_BIT ? static_cast<uint16_t>(v) : v;
+}
+
 void VoxelBufferInternal::decompress_channel(unsigned int channel_index) {
 	ZN_ASSERT_RETURN(channel_index < MAX_CHANNELS);
 	Channel &channel = _channels[channel_index];
-	if (channel.data == nullptr) {
+	if (channel.palette_indices != nullptr) {
+		decompress_palette(channel_index);
+	} else if (channel.data == nullptr) {
 		ZN_ASSERT_RETURN(create_channel(channel_index, channel.defval));
+	} else {
+		ZN_ASSERT_RETURN(unshare_channel_data(channel));
 	}
 }
 
 VoxelBufferInternal::Compression VoxelBufferInternal::get_channel_compression(unsigned int channel_index) const {
 	ZN_ASSERT_RETURN_V(channel_index < MAX_CHANNELS, VoxelBufferInternal::COMPRESSION_NONE);
 	const Channel &channel = _channels[channel_index];
-	if (channel.data == nullptr) {
-		return COMPRESSION_UNIFORM;
+	if (channel.data != nullptr) {
+		return COMPRESSION_NONE;
 	}
-	return COMPRESSION_NONE;
+	if (channel.palette_indices != nullptr) {
+		return channel.palette != nullptr ? COMPRESSION_PALETTE : COMPRESSION_QUANTIZED;
+	}
+	return COMPRESSION_UNIFORM;
+}
+
+size_t VoxelBufferInternal::get_memory_usage() const {
+	size_t size = 0;
+	for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
+		const Channel &channel = _channels[i];
+		if (channel.data != nullptr) {
+			size += channel.size_in_bytes;
+		}
+		if (channel.palette_indices != nullptr) {
+			size += channel.palette_indices_size_in_bytes;
+		}
+		if (channel.palette != nullptr) {
+			size += MAX_PALETTE_SIZE * sizeof(uint64_t);
+		}
+	}
+	return size;
 }
 
 void VoxelBufferInternal::copy_format(const VoxelBufferInternal &other) {
@@ -521,13 +982,43 @@ void VoxelBufferInternal::copy_from(const VoxelBufferInternal &other, unsigned i
 	ZN_ASSERT_RETURN(other_channel.depth == channel.depth);
 
 	if (other_channel.data != nullptr) {
-		if (channel.data == nullptr) {
-			ZN_ASSERT_RETURN(create_channel_noinit(channel_index, _size));
+		if (channel.data != other_channel.data) {
+			// Share data, it will be copied when one of the buffers gets modified
+			ZN_ASSERT_RETURN(other_channel.data_refcount != nullptr);
+			++(*other_channel.data_refcount);
+			if (channel.is_allocated()) {
+				delete_channel(channel_index);
+			}
+			channel.data = other_channel.data;
+			channel.data_refcount = other_channel.data_refcount;
+			channel.size_in_bytes = other_channel.size_in_bytes;
 		}
-		ZN_ASSERT(channel.size_in_bytes == other_channel.size_in_bytes);
-		memcpy(channel.data, other_channel.data, channel.size_in_bytes);
 
-	} else if (channel.data != nullptr) {
+	} else if (other_channel.palette_indices != nullptr) {
+		// Keep the copy compressed, it is much smaller
+		if (channel.is_allocated()) {
+			delete_channel(channel_index);
+		}
+		channel.palette_indices = allocate_channel_data(other_channel.palette_indices_size_in_bytes);
+		ZN_ASSERT_RETURN(channel.palette_indices != nullptr);
+		if (other_channel.palette != nullptr) {
+			channel.palette = allocate_palette();
+			if (channel.palette == nullptr) {
+				free_channel_data(channel.palette_indices, other_channel.palette_indices_size_in_bytes);
+				channel.palette_indices = nullptr;
+				ZN_PRINT_ERROR("Could not allocate palette");
+				return;
+			}
+			memcpy(channel.palette, other_channel.palette, other_channel.palette_size * sizeof(uint64_t));
+		}
+		memcpy(channel.palette_indices, other_channel.palette_indices, other_channel.palette_indices_size_in_bytes);
+		channel.palette_indices_size_in_bytes = other_channel.palette_indices_size_in_bytes;
+		channel.palette_size = other_channel.palette_size;
+		channel.palette_index_bits = other_channel.palette_index_bits;
+		channel.quantized_min = other_channel.quantized_min;
+		channel.quantized_step = other_channel.quantized_step;
+
+	} else if (channel.is_allocated()) {
 		delete_channel(channel_index);
 	}
 
@@ -546,23 +1037,47 @@ void VoxelBufferInternal::copy_from(const VoxelBufferInternal &other, Vector3i s
 
 	ZN_ASSERT_RETURN(other_channel.depth == channel.depth);
 
-	if (channel.data == nullptr && other_channel.data == nullptr && channel.defval == other_channel.defval) {
+	if (!channel.is_allocated() && !other_channel.is_allocated() && channel.defval == other_channel.defval) {
 		// No action needed
 		return;
 	}
 
 	if (other_channel.data != nullptr) {
-		if (channel.data == nullptr) {
-			// Note, we do this even if the pasted data happens to be all the same value as our current channel.
-			// We assume that this case is not frequent enough to bother, and compression can happen later
-			ZN_ASSERT_RETURN(create_channel(channel_index, channel.defval));
-		}
+		// Note, we do this even if the pasted data happens to be all the same value as our current channel.
+		// We assume that this case is not frequent enough to bother, and compression can happen later
+		decompress_channel(channel_index);
+		ZN_ASSERT_RETURN(channel.data != nullptr);
 		const unsigned int item_size = get_depth_byte_count(channel.depth);
 		Span<const uint8_t> src(other_channel.data, other_channel.size_in_bytes);
 		Span<uint8_t> dst(channel.data, channel.size_in_bytes);
 		copy_3d_region_zxy(dst, _size, dst_min, src, other._size, src_min, src_max, item_size);
 
-	} else if (channel.defval != other_channel.defval) {
+	} else if (other_channel.palette_indices != nullptr) {
+		decompress_channel(channel_index);
+		ZN_ASSERT_RETURN(channel.data != nullptr);
+		const size_t volume = get_volume();
+		switch (channel.depth) {
+			case DEPTH_8_BIT:
+				other.copy_to(Span<uint8_t>(channel.data, volume), _size, dst_min, src_min, src_max, channel_index);
+				break;
+			case DEPTH_16_BIT:
+				other.copy_to(Span<uint16_t>(reinterpret_cast<uint16_t *>(channel.data), volume), _size, dst_min,
+						src_min, src_max, channel_index);
+				break;
+			case DEPTH_32_BIT:
+				other.copy_to(Span<uint32_t>(reinterpret_cast<uint32_t *>(channel.data), volume), _size, dst_min,
+						src_min, src_max, channel_index);
+				break;
+			case DEPTH_64_BIT:
+				other.copy_to(Span<uint64_t>(reinterpret_cast<uint64_t *>(channel.data), volume), _size, dst_min,
+						src_min, src_max, channel_index);
+				break;
+			default:
+				CRASH_NOW();
+				break;
+		}
+
+	} else if (channel.is_allocated() || channel.defval != other_channel.defval) {
 		// This logic is still required due to how source and destination regions can be specified.
 		// The actual size of the destination area must be determined from the source area, after it has been clipped.
 		Vector3iUtil::sort_min_max(src_min, src_max);
@@ -604,7 +1119,13 @@ void VoxelBufferInternal::move_to(VoxelBufferInternal &dst) {
 	for (unsigned int i = 0; i < _channels.size(); ++i) {
 		Channel &channel = _channels[i];
 		channel.data = nullptr;
+		channel.data_refcount = nullptr;
 		channel.size_in_bytes = 0;
+		channel.palette = nullptr;
+		channel.palette_indices = nullptr;
+		channel.palette_indices_size_in_bytes = 0;
+		channel.palette_size = 0;
+		channel.palette_index_bits = 0;
 	}
 }
 
@@ -618,6 +1139,42 @@ bool VoxelBufferInternal::get_channel_raw(unsigned int channel_index, Span<uint8
 	return false;
 }
 
+bool VoxelBufferInternal::get_channel_quantized(
+		unsigned int channel_index, float &out_min, float &out_step, Span<const uint8_t> &out_codes) const {
+	ZN_ASSERT_RETURN_V(channel_index < MAX_CHANNELS, false);
+	const Channel &channel = _channels[channel_index];
+	if (channel.palette_indices == nullptr || channel.palette != nullptr) {
+		return false;
+	}
+	out_min = channel.quantized_min;
+	out_step = channel.quantized_step;
+	out_codes = Span<const uint8_t>(channel.palette_indices, channel.palette_indices_size_in_bytes);
+	return true;
+}
+
+bool VoxelBufferInternal::set_channel_quantized(
+		unsigned int channel_index, float min, float step, Span<const uint8_t> codes) {
+	ZN_ASSERT_RETURN_V(channel_index < MAX_CHANNELS, false);
+	ZN_ASSERT_RETURN_V(codes.size() == get_volume(), false);
+	Channel &channel = _channels[channel_index];
+	ZN_ASSERT_RETURN_V_MSG(channel.depth != DEPTH_8_BIT, false, "Quantizing 8-bit channels is not supported");
+
+	uint8_t *data = allocate_channel_data(codes.size());
+	ZN_ASSERT_RETURN_V(data != nullptr, false);
+	memcpy(data, codes.data(), codes.size());
+
+	if (channel.is_allocated()) {
+		delete_channel(channel);
+	}
+	channel.palette_indices = data;
+	channel.palette_indices_size_in_bytes = codes.size();
+	channel.palette_size = 0;
+	channel.palette_index_bits = 8;
+	channel.quantized_min = min;
+	channel.quantized_step = step;
+	return true;
+}
+
 bool VoxelBufferInternal::create_channel(int i, uint64_t defval) {
 	if (!create_channel_noinit(i, _size)) {
 		return false;
@@ -639,7 +1196,7 @@ bool VoxelBufferInternal::create_channel_noinit(int i, Vector3i size) {
 	const size_t size_in_bytes = get_size_in_bytes_for_volume(size, channel.depth);
 	ZN_ASSERT_RETURN_V_MSG(size_in_bytes <= Channel::MAX_SIZE_IN_BYTES, false, "Buffer is too big");
 	CRASH_COND(channel.data != nullptr); // The channel must not already be allocated
-	channel.data = allocate_channel_data(size_in_bytes);
+	channel.data = allocate_shared_channel_data(size_in_bytes, channel.data_refcount);
 	ZN_ASSERT_RETURN_V(channel.data != nullptr, false);
 	channel.size_in_bytes = size_in_bytes;
 	return true;
@@ -651,16 +1208,57 @@ void VoxelBufferInternal::delete_channel(int i) {
 }
 
 void VoxelBufferInternal::delete_channel(Channel &channel) {
-	ZN_ASSERT_RETURN(channel.data != nullptr);
+	ZN_ASSERT_RETURN(channel.is_allocated());
 	// Don't use `_size` to obtain `data` byte count, since we could have changed `_size` up-front during a create().
 	// `size_in_bytes` reflects what is currently allocated inside `data`, regardless of anything else.
-	free_channel_data(channel.data, channel.size_in_bytes);
+	if (channel.data != nullptr) {
+		release_channel_data(channel);
+	}
+	if (channel.palette_indices != nullptr) {
+		free_channel_data(channel.palette_indices, channel.palette_indices_size_in_bytes);
+		if (channel.palette != nullptr) {
+			free_palette(channel.palette);
+		}
+		channel.palette = nullptr;
+		channel.palette_indices = nullptr;
+		channel.palette_indices_size_in_bytes = 0;
+		channel.palette_size = 0;
+		channel.palette_index_bits = 0;
+	}
+}
+
+void VoxelBufferInternal::release_channel_data(Channel &channel) {
+	ZN_ASSERT_RETURN(channel.data != nullptr);
+	ZN_ASSERT_RETURN(channel.data_refcount != nullptr);
+	// The last reference frees the data, which may happen in any thread
+	if (--(*channel.data_refcount) == 0) {
+		free_shared_channel_data(channel.data, channel.size_in_bytes, channel.data_refcount);
+	}
 	channel.data = nullptr;
+	channel.data_refcount = nullptr;
 	channel.size_in_bytes = 0;
 }
 
-void VoxelBufferInternal::downscale_to(
-		VoxelBufferInternal &dst, Vector3i src_min, Vector3i src_max, Vector3i dst_min) const {
+bool VoxelBufferInternal::unshare_channel_data(Channel &channel) {
+	if (!channel.is_data_shared()) {
+		return true;
+	}
+	ZN_PROFILE_SCOPE();
+	std::atomic_uint32_t *refcount = nullptr;
+	uint8_t *data = allocate_shared_channel_data(channel.size_in_bytes, refcount);
+	ZN_ASSERT_RETURN_V(data != nullptr, false);
+	// Other references can't modify the shared data, so it is safe to read while they exist
+	memcpy(data, channel.data, channel.size_in_bytes);
+	const uint32_t size_in_bytes = channel.size_in_bytes;
+	release_channel_data(channel);
+	channel.data = data;
+	channel.data_refcount = refcount;
+	channel.size_in_bytes = size_in_bytes;
+	return true;
+}
+
+void VoxelBufferInternal::downscale_to(VoxelBufferInternal &dst, Vector3i src_min, Vector3i src_max, Vector3i dst_min,
+		uint8_t channels_mask) const {
 	// TODO Align input to multiple of two
 
 	src_min = src_min.clamp(Vector3i(), _size - Vector3i(1, 1, 1));
@@ -673,16 +1271,65 @@ void VoxelBufferInternal::downscale_to(
 	dst_max = dst_max.clamp(Vector3i(), dst._size);
 
 	for (int channel_index = 0; channel_index < MAX_CHANNELS; ++channel_index) {
+		if ((channels_mask & (1 << channel_index)) == 0) {
+			continue;
+		}
+
 		const Channel &src_channel = _channels[channel_index];
 		const Channel &dst_channel = dst._channels[channel_index];
 
-		if (src_channel.data == nullptr && dst_channel.data == nullptr && src_channel.defval == dst_channel.defval) {
+		if (!src_channel.is_allocated() && !dst_channel.is_allocated() && src_channel.defval == dst_channel.defval) {
 			// No action needed
 			continue;
 		}
 
 		// Nearest-neighbor downscaling
 
+		if (src_channel.data != nullptr && src_channel.depth == dst_channel.depth) {
+			// Fast path: rows go along Y, so we can take one voxel out of two in each source row
+			const Vector3i dst_area_size = dst_max - dst_min;
+			if (dst_area_size.x <= 0 || dst_area_size.y <= 0 || dst_area_size.z <= 0) {
+				continue;
+			}
+			dst.decompress_channel(channel_index);
+			ZN_ASSERT_CONTINUE(dst_channel.data != nullptr);
+
+			Vector3i pos;
+			pos.y = dst_min.y;
+			for (pos.z = dst_min.z; pos.z < dst_max.z; ++pos.z) {
+				for (pos.x = dst_min.x; pos.x < dst_max.x; ++pos.x) {
+					const Vector3i src_pos = src_min + ((pos - dst_min) << 1);
+#ifdef DEBUG_ENABLED
+					ZN_ASSERT(is_position_valid(src_pos + Vector3i(0, (dst_area_size.y - 1) * 2, 0)));
+#endif
+					const size_t src_i = get_index(src_pos, _size);
+					const size_t dst_i = get_index(pos, dst._size);
+
+					switch (src_channel.depth) {
+						case DEPTH_8_BIT:
+							simd::decimate_2x(dst_channel.data + dst_i, src_channel.data + src_i, dst_area_size.y);
+							break;
+						case DEPTH_16_BIT:
+							simd::decimate_2x(reinterpret_cast<uint16_t *>(dst_channel.data) + dst_i,
+									reinterpret_cast<const uint16_t *>(src_channel.data) + src_i, dst_area_size.y);
+							break;
+						case DEPTH_32_BIT:
+							simd::decimate_2x(reinterpret_cast<uint32_t *>(dst_channel.data) + dst_i,
+									reinterpret_cast<const uint32_t *>(src_channel.data) + src_i, dst_area_size.y);
+							break;
+						case DEPTH_64_BIT:
+							simd::decimate_2x(reinterpret_cast<uint64_t *>(dst_channel.data) + dst_i,
+									reinterpret_cast<const uint64_t *>(src_channel.data) + src_i, dst_area_size.y);
+							break;
+						default:
+							CRASH_NOW();
+							break;
+					}
+				}
+			}
+			continue;
+		}
+
 		Vector3i pos;
 		for (pos.z = dst_min.z; pos.z < dst_max.z; ++pos.z) {
 			for (pos.x = dst_min.x; pos.x < dst_max.x; ++pos.x) {
@@ -693,7 +1340,7 @@ void VoxelBufferInternal::downscale_to(
 					ZN_ASSERT(is_position_valid(src_pos.x, src_pos.y, src_pos.z));
 
 					uint64_t v;
-					if (src_channel.data) {
+					if (src_channel.is_allocated()) {
 						// TODO Optimized version?
 						v = get_voxel(src_pos, channel_index);
 					} else {
@@ -716,6 +1363,24 @@ bool VoxelBufferInternal::equals(const VoxelBufferInternal &p_other) const {
 		const Channel &channel = _channels[channel_index];
 		const Channel &other_channel = p_other._channels[channel_index];
 
+		if (channel.palette_indices != nullptr || other_channel.palette_indices != nullptr) {
+			if (channel.depth != other_channel.depth) {
+				return false;
+			}
+			// Palettes can be ordered differently, so compare decoded values
+			Vector3i pos;
+			for (pos.z = 0; pos.z < _size.z; ++pos.z) {
+				for (pos.x = 0; pos.x < _size.x; ++pos.x) {
+					for (pos.y = 0; pos.y < _size.y; ++pos.y) {
+						if (get_voxel(pos, channel_index) != p_other.get_voxel(pos, channel_index)) {
+							return false;
+						}
+					}
+				}
+			}
+			continue;
+		}
+
 		if ((channel.data == nullptr) != (other_channel.data == nullptr)) {
 			// Note: they could still logically be equal if one channel contains uniform voxel memory
 			return false;
@@ -750,7 +1415,7 @@ void VoxelBufferInternal::set_channel_depth(unsigned int channel_index, Depth ne
 	if (channel.depth == new_depth) {
 		return;
 	}
-	if (channel.data != nullptr) {
+	if (channel.is_allocated()) {
 		// TODO Implement conversion and do it when specified
 		WARN_PRINT("Changing VoxelBuffer depth with present data, this will reset the channel");
 		delete_channel(channel_index);
@@ -781,6 +1446,41 @@ void VoxelBufferInternal::get_range_f(float &out_min, float &out_max, ChannelId
 	float min_value = get_voxel_f(0, 0, 0, channel_index);
 	float max_value = min_value;
 
+	if (channel.palette_indices != nullptr && channel.palette == nullptr) {
+		// Quantization is monotonic, so only the range of codes matters
+		uint8_t min_code = channel.palette_indices[0];
+		uint8_t max_code = min_code;
+		const size_t volume = get_volume();
+		for (size_t i = 1; i < volume; ++i) {
+			const uint8_t code = channel.palette_indices[i];
+			min_code = math::min(code, min_code);
+			max_code = math::max(code, max_code);
+		}
+		out_min = raw_voxel_to_real(get_quantized_voxel(channel, min_code), channel.depth);
+		out_max = raw_voxel_to_real(get_quantized_voxel(channel, max_code), channel.depth);
+		return;
+	}
+
+	if (channel.palette_indices != nullptr) {
+		// Only look at palette values, but some of them might no longer be used
+		FixedArray<bool, MAX_PALETTE_SIZE> used_indices;
+		zylann::fill(used_indices, false);
+		const size_t volume = get_volume();
+		for (size_t i = 0; i < volume; ++i) {
+			used_indices[get_palette_index(channel.palette_indices, channel.palette_index_bits, i)] = true;
+		}
+		for (unsigned int i = 0; i < channel.palette_size; ++i) {
+			if (used_indices[i]) {
+				const float v = raw_voxel_to_real(channel.palette[i], channel.depth);
+				min_value = math::min(v, min_value);
+				max_value = math::max(v, max_value);
+			}
+		}
+		out_min = min_value;
+		out_max = max_value;
+		return;
+	}
+
 	if (channel.data == nullptr) {
 		out_min = min_value;
 		out_max = max_value;
@@ -789,30 +1489,28 @@ void VoxelBufferInternal::get_range_f(float &out_min, float &out_max, ChannelId
 
 	const uint64_t volume = get_volume();
 
+	// Conversions to float are monotonic, so we can get the range of raw values and convert only the result
 	switch (channel.depth) {
-		case DEPTH_8_BIT:
-			for (unsigned int i = 0; i < volume; ++i) {
-				const float v = s8_to_snorm(channel.data[i]);
-				min_value = math::min(v, min_value);
-				max_value = math::max(v, max_value);
-			}
-			break;
-		case DEPTH_16_BIT: {
-			const int16_t *data = reinterpret_cast<const int16_t *>(channel.data);
-			for (unsigned int i = 0; i < volume; ++i) {
-				const float v = s16_to_snorm(data[i]);
-				min_value = math::min(v, min_value);
-				max_value = math::max(v, max_value);
-			}
+		case DEPTH_8_BIT: {
+			int8_t raw_min;
+			int8_t raw_max;
+			simd::get_range(Span<const int8_t>(reinterpret_cast<const int8_t *>(channel.data), volume), raw_min,
+					raw_max);
+			min_value = s8_to_snorm(raw_min);
+			max_value = s8_to_snorm(raw_max);
 		} break;
-		case DEPTH_32_BIT: {
-			const float *data = reinterpret_cast<const float *>(channel.data);
-			for (unsigned int i = 0; i < volume; ++i) {
-				const float v = data[i];
-				min_value = math::min(v, min_value);
-				max_value = math::max(v, max_value);
-			}
+		case DEPTH_16_BIT: {
+			int16_t raw_min;
+			int16_t raw_max;
+			simd::get_range(Span<const int16_t>(reinterpret_cast<const int16_t *>(channel.data), volume), raw_min,
+					raw_max);
+			min_value = s16_to_snorm(raw_min);
+			max_value = s16_to_snorm(raw_max);
 		} break;
+		case DEPTH_32_BIT:
+			simd::get_range(Span<const float>(reinterpret_cast<const float *>(channel.data), volume), min_value,
+					max_value);
+			break;
 		case DEPTH_64_BIT: {
 			const double *data = reinterpret_cast<const double *>(channel.data);
 			for (unsigned int i = 0; i < volume; ++i) {
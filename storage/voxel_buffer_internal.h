@@ -9,6 +9,7 @@
 #include "funcs.h"
 #include "voxel_metadata.h"
 
+#include <atomic>
 #include <limits>
 
 namespace zylann::voxel {
@@ -42,6 +43,9 @@ public:
 	enum Compression {
 		COMPRESSION_NONE = 0,
 		COMPRESSION_UNIFORM,
+		COMPRESSION_PALETTE,
+		// 8-bit codes mapped linearly to the range of values found in the channel. This is lossy.
+		COMPRESSION_QUANTIZED,
 		//COMPRESSION_RLE,
 		COMPRESSION_COUNT
 	};
@@ -89,6 +93,11 @@ public:
 	// Limit was made explicit for serialization reasons, and also because there must be a reasonable one
 	static const uint32_t MAX_SIZE = 65535;
 
+	// Palette compression is used for channels containing only a few distinct values.
+	// Indices are bit-packed using 1, 2 or 4 bits, so they never straddle two bytes.
+	static const unsigned int MAX_PALETTE_SIZE = 16;
+	static const unsigned int MAX_PALETTE_INDEX_BITS = 4;
+
 	struct Channel {
 		// Allocated when the channel is populated.
 		// Flat array, in order [z][x][y] because it allows faster vertical-wise access (the engine is Y-up).
@@ -102,7 +111,33 @@ public:
 		// Storing gigabytes in a single buffer is neither supported nor practical.
 		uint32_t size_in_bytes = 0;
 
+		// Stored in front of `data`, in the same allocation. Copies of a buffer share the same `data` until one of them
+		// modifies it (copy-on-write), so this counts how many channels reference it.
+		std::atomic_uint32_t *data_refcount = nullptr;
+
+		// Allocated when the channel is palette-compressed, in which case `data` is null.
+		// `palette` has room for `MAX_PALETTE_SIZE` values, of which the first `palette_size` are used.
+		// `palette_indices` stores one bit-packed index into `palette` per voxel, in the same order as `data`.
+		uint64_t *palette = nullptr;
+		uint8_t *palette_indices = nullptr;
+		uint32_t palette_indices_size_in_bytes = 0;
+		uint8_t palette_size = 0;
+		uint8_t palette_index_bits = 0;
+
+		// When the channel is quantized, `palette` is null and `palette_indices` stores one 8-bit code per voxel
+		// instead, which decodes to the value `quantized_min + code * quantized_step`.
+		float quantized_min = 0.f;
+		float quantized_step = 0.f;
+
 		static const size_t MAX_SIZE_IN_BYTES = std::numeric_limits<uint32_t>::max();
+
+		inline bool is_allocated() const {
+			return data != nullptr || palette_indices != nullptr;
+		}
+
+		inline bool is_data_shared() const {
+			return data_refcount != nullptr && *data_refcount > 1;
+		}
 	};
 
 	VoxelBufferInternal();
@@ -151,8 +186,18 @@ public:
 	bool is_uniform(unsigned int channel_index) const;
 
 	void compress_uniform_channels();
+	// Converts dense channels holding few distinct values into palette-compressed channels.
+	// Channels found to be uniform are compressed as such.
+	void compress_palette_channels();
+	// Stores the SDF channel with 8 bits per voxel, mapped to the range of values it contains.
+	// Only done if the channel is dense and if the error this introduces stays below `max_error`, in voxels.
+	// Returns true if the channel got compressed.
+	bool compress_sdf_channel(float max_error);
+	// Makes the channel dense, and makes sure its data is not shared with other buffers so it can be modified.
 	void decompress_channel(unsigned int channel_index);
 	Compression get_channel_compression(unsigned int channel_index) const;
+	// Gets how many bytes channels currently use. Data shared with copies of this buffer is counted too.
+	size_t get_memory_usage() const;
 
 	static size_t get_size_in_bytes_for_volume(Vector3i size, Depth depth);
 
@@ -161,6 +206,8 @@ public:
 	// Specialized copy functions.
 	// Note: these functions don't include metadata on purpose.
 	// If you also want to copy metadata, use the specialized functions.
+	// Full copies share dense data with the source instead of copying it. The actual copy only happens when one of
+	// the buffers gets modified, so this is cheap to use for snapshots (saving, meshing...).
 	void copy_from(const VoxelBufferInternal &other);
 	void copy_from(const VoxelBufferInternal &other, unsigned int channel_index);
 	void copy_from(const VoxelBufferInternal &other, Vector3i src_min, Vector3i src_max, Vector3i dst_min,
@@ -186,7 +233,7 @@ public:
 		// or schedule a recompression for later.
 		decompress_channel(channel_index);
 
-		Span<T> dst(static_cast<T *>(channel.data), channel.size_in_bytes / sizeof(T));
+		Span<T> dst(reinterpret_cast<T *>(channel.data), channel.size_in_bytes / sizeof(T));
 		copy_3d_region_zxy<T>(dst, _size, dst_min, src, src_size, src_min, src_max);
 	}
 
@@ -207,11 +254,34 @@ public:
 		ZN_ASSERT_RETURN(channel.depth == get_depth_from_size(sizeof(T)));
 #endif
 
-		if (channel.data == nullptr) {
-			fill_3d_region_zxy<T>(dst, dst_size, dst_min, dst_min + (src_max - src_min), channel.defval);
-		} else {
-			Span<const T> src(static_cast<const T *>(channel.data), channel.size_in_bytes / sizeof(T));
+		if (channel.data != nullptr) {
+			Span<const T> src(reinterpret_cast<const T *>(channel.data), channel.size_in_bytes / sizeof(T));
 			copy_3d_region_zxy<T>(dst, dst_size, dst_min, src, _size, src_min, src_max);
+
+		} else if (channel.palette_indices != nullptr) {
+			// Decode voxels row by row, without decompressing the channel
+			Vector3iUtil::sort_min_max(src_min, src_max);
+			clip_copy_region(src_min, src_max, _size, dst_min, dst_size);
+			const Vector3i area_size = src_max - src_min;
+			if (area_size.x <= 0 || area_size.y <= 0 || area_size.z <= 0) {
+				return;
+			}
+			Vector3i pos;
+			for (pos.z = 0; pos.z < area_size.z; ++pos.z) {
+				for (pos.x = 0; pos.x < area_size.x; ++pos.x) {
+					pos.y = 0;
+					size_t src_i = get_index(src_min + pos, _size);
+					size_t dst_i = Vector3iUtil::get_zxy_index(dst_min + pos, dst_size);
+					for (; pos.y < area_size.y; ++pos.y) {
+						dst[dst_i] = get_palette_voxel(channel, src_i);
+						++src_i;
+						++dst_i;
+					}
+				}
+			}
+
+		} else {
+			fill_3d_region_zxy<T>(dst, dst_size, dst_min, dst_min + (src_max - src_min), channel.defval);
 		}
 	}
 
@@ -242,6 +312,18 @@ public:
 		}
 	}
 
+	static inline uint64_t get_palette_voxel(const Channel &channel, size_t i) {
+		if (channel.palette == nullptr) {
+			return get_quantized_voxel(channel, channel.palette_indices[i]);
+		}
+		const size_t bit_index = i * channel.palette_index_bits;
+		const unsigned int mask = (1 << channel.palette_index_bits) - 1;
+		const unsigned int palette_index = (channel.palette_indices[bit_index >> 3] >> (bit_index & 7)) & mask;
+		return channel.palette[palette_index];
+	}
+
+	static uint64_t get_quantized_voxel(const Channel &channel, unsigned int code);
+
 	static inline size_t get_index(const Vector3i pos, const Vector3i size) {
 		return Vector3iUtil::get_zxy_index(pos, size);
 	}
@@ -399,8 +481,18 @@ public:
 		return Vector3iUtil::get_volume(_size);
 	}
 
+	// Gets direct access to the dense data of a channel. If the channel is compressed, returns false.
+	// Dense data can be shared with copies of this buffer, so before writing into it,
+	// `decompress_channel` must be called, which also makes sure this buffer has its own data.
 	bool get_channel_raw(unsigned int channel_index, Span<uint8_t> &slice) const;
 
+	// Gets access to the codes of a quantized channel, in ZXY order. If the channel is not quantized, returns false.
+	// Codes must not be modified.
+	bool get_channel_quantized(
+			unsigned int channel_index, float &out_min, float &out_step, Span<const uint8_t> &out_codes) const;
+	// Replaces the contents of a channel with quantized values. Codes are expected in ZXY order.
+	bool set_channel_quantized(unsigned int channel_index, float min, float step, Span<const uint8_t> codes);
+
 	template <typename T>
 	bool get_channel_data(unsigned int channel_index, Span<T> &dst) const {
 		Span<uint8_t> dst8;
@@ -409,7 +501,10 @@ public:
 		return true;
 	}
 
-	void downscale_to(VoxelBufferInternal &dst, Vector3i src_min, Vector3i src_max, Vector3i dst_min) const;
+	// Downscales an area by a factor of two into another buffer, using nearest-neighbor.
+	// See `voxel_downscale.h` for other filters.
+	void downscale_to(VoxelBufferInternal &dst, Vector3i src_min, Vector3i src_max, Vector3i dst_min,
+			uint8_t channels_mask = ALL_CHANNELS_MASK) const;
 
 	bool equals(const VoxelBufferInternal &p_other) const;
 
@@ -482,10 +577,15 @@ private:
 	bool create_channel_noinit(int i, Vector3i size);
 	bool create_channel(int i, uint64_t defval);
 	void delete_channel(int i);
+	bool unshare_channel_data(Channel &channel);
 	void compress_if_uniform(Channel &channel);
+	bool compress_with_palette(Channel &channel);
+	void decompress_palette(unsigned int channel_index);
+	bool set_palette_voxel(Channel &channel, size_t i, uint64_t value);
 	static void delete_channel(Channel &channel);
+	static void release_channel_data(Channel &channel);
 	static void clear_channel(Channel &channel, uint64_t clear_value);
-	static bool is_uniform(const Channel &channel);
+	bool is_uniform(const Channel &channel) const;
 
 private:
 	// Each channel can store arbitary data.
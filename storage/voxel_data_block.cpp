@@ -1,6 +1,9 @@
 #include "voxel_data_block.h"
 #include "../util/log.h"
+#include "../util/memory.h"
+#include "../util/profiling.h"
 #include "../util/string_funcs.h"
+#include "../util/thread/thread.h"
 
 namespace zylann::voxel {
 
@@ -13,4 +16,23 @@ void VoxelDataBlock::set_modified(bool modified) {
 	_modified = modified;
 }
 
+void VoxelDataBlock::unshare_voxels() {
+	uint8_t state = VOXELS_SHARED;
+	if (!_voxels_state.compare_exchange_strong(state, VOXELS_UNSHARING, std::memory_order_acquire)) {
+		// Either not shared, or another thread is unsharing them
+		while (state == VOXELS_UNSHARING) {
+			Thread::sleep_usec(1);
+			state = _voxels_state.load(std::memory_order_acquire);
+		}
+		return;
+	}
+	ZN_PROFILE_SCOPE();
+	std::shared_ptr<VoxelBufferInternal> voxels = make_shared_instance<VoxelBufferInternal>();
+	// Shared voxels are never modified, so they can be read without locking
+	_voxels->duplicate_to(*voxels, true);
+	// Publish the copy before telling other threads they can use it
+	std::atomic_store(&_voxels, voxels);
+	_voxels_state.store(VOXELS_OWNED, std::memory_order_release);
+}
+
 } // namespace zylann::voxel
@@ -4,6 +4,7 @@
 #include "../storage/voxel_buffer_internal.h"
 #include "../util/log.h"
 #include "../util/ref_count.h"
+#include <atomic>
 #include <memory>
 
 namespace zylann::voxel {
@@ -22,7 +23,12 @@ public:
 		return memnew(VoxelDataBlock(bpos, buffer, p_lod_index));
 	}
 
+	// Gets voxels for modification. If they are shared with other blocks, the block gets its own copy first.
 	VoxelBufferInternal &get_voxels() {
+		if (_voxels_state.load(std::memory_order_acquire) != VOXELS_OWNED) {
+			unshare_voxels();
+		}
+		// Once owned, voxels are not replaced by other threads
 #ifdef DEBUG_ENABLED
 		CRASH_COND(_voxels == nullptr);
 #endif
@@ -36,18 +42,38 @@ public:
 		return *_voxels;
 	}
 
+	// Gets a reference to voxels, which may be shared with other blocks. Don't modify them without calling
+	// `unshare_voxels` first.
 	std::shared_ptr<VoxelBufferInternal> get_voxels_shared() const {
 #ifdef DEBUG_ENABLED
 		CRASH_COND(_voxels == nullptr);
 #endif
-		return _voxels;
+		// Atomic because other threads can get the buffer while it is being unshared
+		return std::atomic_load(&_voxels);
 	}
 
 	void set_voxels(std::shared_ptr<VoxelBufferInternal> &buffer) {
 		ERR_FAIL_COND(buffer == nullptr);
-		_voxels = buffer;
+		std::atomic_store(&_voxels, buffer);
+		_voxels_state.store(VOXELS_OWNED, std::memory_order_release);
 	}
 
+	// Sets voxels that are also used by other blocks. They will not be modified, a copy is made when needed.
+	void set_shared_voxels(std::shared_ptr<VoxelBufferInternal> &buffer) {
+		ERR_FAIL_COND(buffer == nullptr);
+		std::atomic_store(&_voxels, buffer);
+		_voxels_state.store(VOXELS_SHARED, std::memory_order_release);
+	}
+
+	inline bool has_shared_voxels() const {
+		return _voxels_state.load(std::memory_order_acquire) != VOXELS_OWNED;
+	}
+
+	// If voxels are shared with other blocks, replaces them with a copy only used by this block.
+	// Can be called from several threads at once, for example while the map is only locked for reading. Only one of
+	// them makes the copy, others wait for it to be published.
+	void unshare_voxels();
+
 	void set_modified(bool modified);
 
 	inline bool is_modified() const {
@@ -76,6 +102,16 @@ private:
 
 	std::shared_ptr<VoxelBufferInternal> _voxels;
 
+	enum VoxelsState : uint8_t {
+		VOXELS_OWNED,
+		// Voxels are used by other blocks as well (see `VoxelDataMap::set_uniform_block_sharing_enabled`)
+		VOXELS_SHARED,
+		// A thread is making a copy of shared voxels
+		VOXELS_UNSHARING
+	};
+
+	std::atomic<uint8_t> _voxels_state = VOXELS_OWNED;
+
 	// The block was edited, which requires its LOD counterparts to be recomputed
 	bool _needs_lodding = false;
 
@@ -17,6 +17,8 @@ public:
 		blocks_box.for_each_cell_zxy([&map, this](const Vector3i pos) {
 			VoxelDataBlock *block = map.get_block(pos);
 			if (block != nullptr) {
+				// The grid is used for editing, so blocks must not share their voxels
+				block->unshare_voxels();
 				set_block(pos, block->get_voxels_shared());
 			} else {
 				set_block(pos, nullptr);
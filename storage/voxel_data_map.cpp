@@ -118,9 +118,9 @@ int VoxelDataMap::get_default_voxel(unsigned int channel) {
 }
 
 VoxelDataBlock *VoxelDataMap::get_block(Vector3i bpos) {
-	auto it = _blocks_map.find(bpos);
-	if (it != _blocks_map.end()) {
-		const unsigned int i = it->second;
+	const unsigned int *index = _blocks_map.find(bpos);
+	if (index != nullptr) {
+		const unsigned int i = *index;
 #ifdef DEBUG_ENABLED
 		CRASH_COND(i >= _blocks.size());
 #endif
@@ -132,9 +132,9 @@ VoxelDataBlock *VoxelDataMap::get_block(Vector3i bpos) {
 }
 
 const VoxelDataBlock *VoxelDataMap::get_block(Vector3i bpos) const {
-	auto it = _blocks_map.find(bpos);
-	if (it != _blocks_map.end()) {
-		const unsigned int i = it->second;
+	const unsigned int *index = _blocks_map.find(bpos);
+	if (index != nullptr) {
+		const unsigned int i = *index;
 #ifdef DEBUG_ENABLED
 		CRASH_COND(i >= _blocks.size());
 #endif
@@ -151,18 +151,14 @@ void VoxelDataMap::set_block(Vector3i bpos, VoxelDataBlock *block) {
 	ERR_FAIL_COND(block == nullptr);
 	CRASH_COND(bpos != block->position);
 #ifdef DEBUG_ENABLED
-	CRASH_COND(_blocks_map.find(bpos) != _blocks_map.end());
+	CRASH_COND(_blocks_map.has(bpos));
 #endif
 	unsigned int i = _blocks.size();
 	_blocks.push_back(block);
-	_blocks_map.insert(std::make_pair(bpos, i));
+	_blocks_map.insert(bpos, i);
 }
 
 void VoxelDataMap::remove_block_internal(Vector3i bpos, unsigned int index) {
-	// TODO `erase` can occasionally be very slow (milliseconds) if the map contains lots of items.
-	// This might be caused by internal rehashing/resizing.
-	// We should look for a faster container, or reduce the number of entries.
-
 	// This function assumes the block is already freed
 	_blocks_map.erase(bpos);
 
@@ -174,9 +170,9 @@ void VoxelDataMap::remove_block_internal(Vector3i bpos, unsigned int index) {
 	_blocks.pop_back();
 
 	if (index < _blocks.size()) {
-		auto it = _blocks_map.find(moved_block->position);
-		CRASH_COND(it == _blocks_map.end());
-		it->second = index;
+		unsigned int *moved_block_index = _blocks_map.find(moved_block->position);
+		CRASH_COND(moved_block_index == nullptr);
+		*moved_block_index = index;
 	}
 }
 
@@ -184,11 +180,20 @@ VoxelDataBlock *VoxelDataMap::set_block_buffer(
 		Vector3i bpos, std::shared_ptr<VoxelBufferInternal> &buffer, bool overwrite) {
 	ERR_FAIL_COND_V(buffer == nullptr, nullptr);
 	VoxelDataBlock *block = get_block(bpos);
-	if (block == nullptr) {
-		block = VoxelDataBlock::create(bpos, buffer, _block_size, _lod_index);
-		set_block(bpos, block);
-	} else if (overwrite) {
-		block->set_voxels(buffer);
+	if (block == nullptr || overwrite) {
+		std::shared_ptr<VoxelBufferInternal> shared_buffer;
+		if (_uniform_block_sharing_enabled) {
+			shared_buffer = get_or_create_shared_uniform_buffer(buffer);
+		}
+		if (block == nullptr) {
+			block = VoxelDataBlock::create(bpos, buffer, _block_size, _lod_index);
+			set_block(bpos, block);
+		}
+		if (shared_buffer != nullptr) {
+			block->set_shared_voxels(shared_buffer);
+		} else {
+			block->set_voxels(buffer);
+		}
 	} else {
 		ZN_PROFILE_MESSAGE("Redundant data block");
 		ZN_PRINT_VERBOSE(format(
@@ -197,15 +202,125 @@ VoxelDataBlock *VoxelDataMap::set_block_buffer(
 	return block;
 }
 
+namespace {
+
+bool is_shareable_uniform_buffer(const VoxelBufferInternal &buffer) {
+	for (unsigned int channel_index = 0; channel_index < VoxelBufferInternal::MAX_CHANNELS; ++channel_index) {
+		if (buffer.get_channel_compression(channel_index) != VoxelBufferInternal::COMPRESSION_UNIFORM) {
+			return false;
+		}
+	}
+	return buffer.get_block_metadata().get_type() == VoxelMetadata::TYPE_EMPTY &&
+			buffer.get_voxel_metadata().size() == 0;
+}
+
+bool is_same_uniform_buffer(const VoxelBufferInternal &a, const VoxelBufferInternal &b) {
+	if (a.get_size() != b.get_size()) {
+		return false;
+	}
+	for (unsigned int channel_index = 0; channel_index < VoxelBufferInternal::MAX_CHANNELS; ++channel_index) {
+		if (a.get_channel_depth(channel_index) != b.get_channel_depth(channel_index) ||
+				a.get_voxel(Vector3i(), channel_index) != b.get_voxel(Vector3i(), channel_index)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+} // namespace
+
+std::shared_ptr<VoxelBufferInternal> VoxelDataMap::get_or_create_shared_uniform_buffer(
+		const std::shared_ptr<VoxelBufferInternal> &buffer) {
+	// Locking because the buffer may be coming from a task which could still be referencing it.
+	// Uniform buffers are cheap to check.
+	RWLockRead rlock(buffer->get_lock());
+	if (!is_shareable_uniform_buffer(*buffer)) {
+		return nullptr;
+	}
+
+	for (unsigned int i = 0; i < _shared_uniform_buffers.size();) {
+		std::shared_ptr<VoxelBufferInternal> &shared_buffer = _shared_uniform_buffers[i];
+		if (shared_buffer.use_count() == 1) {
+			// No block uses it anymore
+			_shared_uniform_buffers[i] = _shared_uniform_buffers.back();
+			_shared_uniform_buffers.pop_back();
+			continue;
+		}
+		if (is_same_uniform_buffer(*shared_buffer, *buffer)) {
+			return shared_buffer;
+		}
+		++i;
+	}
+
+	// The given buffer becomes the reference
+	_shared_uniform_buffers.push_back(buffer);
+	return buffer;
+}
+
+void VoxelDataMap::set_uniform_block_sharing_enabled(bool enabled) {
+	_uniform_block_sharing_enabled = enabled;
+	if (!enabled) {
+		// Blocks already sharing voxels keep doing so until they get modified or unloaded
+		_shared_uniform_buffers.clear();
+	}
+}
+
+bool VoxelDataMap::is_uniform_block_sharing_enabled() const {
+	return _uniform_block_sharing_enabled;
+}
+
+unsigned int VoxelDataMap::get_shared_uniform_buffer_count() const {
+	return _shared_uniform_buffers.size();
+}
+
+void VoxelDataMap::get_blocks_in_area(Box3i block_box, Span<const VoxelDataBlock *> out_blocks) const {
+	ZN_ASSERT_RETURN(out_blocks.size() == Vector3iUtil::get_volume(block_box.size));
+
+	// Query positions in batches so the map can prefetch them
+	const unsigned int BATCH_SIZE = 64;
+	FixedArray<Vector3i, BATCH_SIZE> positions;
+	FixedArray<const unsigned int *, BATCH_SIZE> indices;
+	unsigned int batch_count = 0;
+	unsigned int out_index = 0;
+
+	struct L {
+		static void flush(const VoxelDataMap &map, Span<const Vector3i> positions, Span<const unsigned int *> indices,
+				Span<const VoxelDataBlock *> out_blocks) {
+			map._blocks_map.find_many(positions, indices);
+			for (unsigned int i = 0; i < positions.size(); ++i) {
+				const unsigned int *index = indices[i];
+				out_blocks[i] = index != nullptr ? map._blocks[*index] : nullptr;
+			}
+		}
+	};
+
+	block_box.for_each_cell_zxy([this, &positions, &indices, &batch_count, &out_index, out_blocks](Vector3i bpos) {
+		positions[batch_count] = bpos;
+		++batch_count;
+		if (batch_count == BATCH_SIZE) {
+			L::flush(*this, to_span_const(positions), to_span(indices), out_blocks.sub(out_index, batch_count));
+			out_index += batch_count;
+			batch_count = 0;
+		}
+	});
+
+	if (batch_count > 0) {
+		L::flush(*this, to_span_const(positions, batch_count), to_span(indices, batch_count),
+				out_blocks.sub(out_index, batch_count));
+	}
+}
+
 bool VoxelDataMap::has_block(Vector3i pos) const {
-	return _blocks_map.find(pos) != _blocks_map.end();
+	return _blocks_map.has(pos);
 }
 
 bool VoxelDataMap::is_block_surrounded(Vector3i pos) const {
 	// TODO If that check proves to be too expensive with all blocks we deal with, cache it in VoxelBlocks
-	for (unsigned int i = 0; i < Cube::MOORE_NEIGHBORING_3D_COUNT; ++i) {
-		Vector3i bpos = pos + Cube::g_moore_neighboring_3d[i];
-		if (!has_block(bpos)) {
+	FixedArray<const VoxelDataBlock *, Cube::MOORE_NEIGHBORING_3D_COUNT + 1> blocks;
+	get_blocks_in_area(Box3i(pos - Vector3i(1, 1, 1), Vector3i(3, 3, 3)), to_span(blocks));
+	for (unsigned int i = 0; i < blocks.size(); ++i) {
+		// The block itself doesn't need to be present
+		if (blocks[i] == nullptr && i != blocks.size() / 2) {
 			return false;
 		}
 	}
@@ -338,6 +453,7 @@ void VoxelDataMap::clear() {
 	}
 	_blocks.clear();
 	_blocks_map.clear();
+	_shared_uniform_buffers.clear();
 }
 
 int VoxelDataMap::get_block_count() const {
@@ -2,11 +2,10 @@
 #define VOXEL_DATA_MAP_H
 
 #include "../util/fixed_array.h"
+#include "../util/open_hash_map.h"
 #include "../util/profiling.h"
 #include "voxel_data_block.h"
 
-#include <unordered_map>
-
 namespace zylann::voxel {
 
 class VoxelGenerator;
@@ -74,6 +73,8 @@ public:
 			uint64_t mask_value, bool create_new_blocks);
 
 	// Moves the given buffer into a block of the map. The buffer is referenced, no copy is made.
+	// If uniform block sharing is enabled and the buffer is uniform, the block may reference an equivalent buffer
+	// already used by other blocks instead.
 	VoxelDataBlock *set_block_buffer(Vector3i bpos, std::shared_ptr<VoxelBufferInternal> &buffer, bool overwrite);
 
 	struct NoAction {
@@ -82,9 +83,9 @@ public:
 
 	template <typename Action_T>
 	void remove_block(Vector3i bpos, Action_T pre_delete) {
-		auto it = _blocks_map.find(bpos);
-		if (it != _blocks_map.end()) {
-			const unsigned int i = it->second;
+		const unsigned int *index = _blocks_map.find(bpos);
+		if (index != nullptr) {
+			const unsigned int i = *index;
 #ifdef DEBUG_ENABLED
 			CRASH_COND(i >= _blocks.size());
 #endif
@@ -99,6 +100,11 @@ public:
 	VoxelDataBlock *get_block(Vector3i bpos);
 	const VoxelDataBlock *get_block(Vector3i bpos) const;
 
+	// Gets all blocks within an area of block positions, in ZXY order. Missing blocks are returned as null.
+	// The output span must have the same size as the volume of the area.
+	// Lookups are batched, so this is faster than calling `get_block` for every position.
+	void get_blocks_in_area(Box3i block_box, Span<const VoxelDataBlock *> out_blocks) const;
+
 	bool has_block(Vector3i pos) const;
 	bool is_block_surrounded(Vector3i pos) const;
 
@@ -130,6 +136,17 @@ public:
 
 	bool is_area_fully_loaded(const Box3i voxels_box) const;
 
+	// When enabled, blocks with the same uniform voxels (typically air or underground) reference a single buffer
+	// instead of having their own. This saves memory and allocations in large terrains. Blocks get their own copy
+	// when they are modified.
+	// This only deduplicates buffers: every block still has its own VoxelDataBlock in the map, so uniform regions
+	// are not stored sparsely.
+	void set_uniform_block_sharing_enabled(bool enabled);
+	bool is_uniform_block_sharing_enabled() const;
+
+	// Gets how many distinct uniform buffers are currently shared between blocks.
+	unsigned int get_shared_uniform_buffer_count() const;
+
 	template <typename F>
 	inline void write_box(const Box3i &voxel_box, unsigned int channel, F action) {
 		write_box(voxel_box, channel, action, [](const VoxelBufferInternal &, const Vector3i &) {});
@@ -186,6 +203,8 @@ private:
 	VoxelDataBlock *get_or_create_block_at_voxel_pos(Vector3i pos);
 	VoxelDataBlock *create_default_block(Vector3i bpos);
 	void remove_block_internal(Vector3i bpos, unsigned int index);
+	std::shared_ptr<VoxelBufferInternal> get_or_create_shared_uniform_buffer(
+			const std::shared_ptr<VoxelBufferInternal> &buffer);
 
 	void set_block_size_pow2(unsigned int p);
 
@@ -195,9 +214,9 @@ private:
 
 	// Blocks stored with a spatial hash in all 3D directions.
 	// Before I used Godot's HashMap with RELATIONSHIP = 2 because that delivers better performance compared to
-	// defaults, but it sometimes has very long stalls on removal, which std::unordered_map doesn't seem to have
-	// (not as badly). Also overall performance is slightly better.
-	std::unordered_map<Vector3i, unsigned int> _blocks_map;
+	// defaults, but it sometimes has very long stalls on removal. Then std::unordered_map, which doesn't have them as
+	// badly, but allocates a node per block. Now using open addressing, where removal never rehashes.
+	OpenHashMap<Vector3i, unsigned int> _blocks_map;
 	std::vector<VoxelDataBlock *> _blocks;
 
 	// This was a possible optimization in a single-threaded scenario, but it's not in multithread.
@@ -213,6 +232,11 @@ private:
 	unsigned int _block_size_mask;
 
 	unsigned int _lod_index = 0;
+
+	// Distinct uniform buffers referenced by blocks when uniform block sharing is enabled.
+	// There are usually very few of them, so they are searched linearly.
+	std::vector<std::shared_ptr<VoxelBufferInternal>> _shared_uniform_buffers;
+	bool _uniform_block_sharing_enabled = false;
 };
 
 struct VoxelDataLodMap {
@@ -0,0 +1,469 @@
+#include "voxel_downscale.h"
+#include "../util/profiling.h"
+#include "funcs.h"
+
+#include <type_traits>
+#include <vector>
+
+namespace zylann::voxel {
+
+DownscaleFilters get_default_downscale_filters() {
+	DownscaleFilters filters;
+	fill(filters, DOWNSCALE_NEAREST);
+	return filters;
+}
+
+bool is_nearest_downscale(const DownscaleFilters &filters) {
+	for (unsigned int i = 0; i < filters.size(); ++i) {
+		if (filters[i] != DOWNSCALE_NEAREST) {
+			return false;
+		}
+	}
+	return true;
+}
+
+namespace {
+
+static const unsigned int GROUP_SIZE = 8;
+
+// Computes where each voxel of a 2x2x2 group is, relative to the first one, in a ZXY box.
+// The first voxel is the one nearest-neighbor downscaling would pick.
+inline void get_group_offsets(Vector3i src_size, size_t offsets[GROUP_SIZE]) {
+	const size_t dy = 1;
+	const size_t dx = src_size.y;
+	const size_t dz = src_size.y * src_size.x;
+	offsets[0] = 0;
+	offsets[1] = dy;
+	offsets[2] = dx;
+	offsets[3] = dx + dy;
+	offsets[4] = dz;
+	offsets[5] = dz + dy;
+	offsets[6] = dz + dx;
+	offsets[7] = dz + dx + dy;
+}
+
+// Temporary buffers are reused to avoid allocating for every block
+std::vector<uint8_t> &get_tls_buffer(unsigned int i) {
+	static thread_local std::vector<uint8_t> tls_buffers[4];
+	return tls_buffers[i];
+}
+
+template <typename T>
+Span<T> get_tls_buffer(unsigned int i, size_t count) {
+	std::vector<uint8_t> &buffer = get_tls_buffer(i);
+	buffer.resize(count * sizeof(T));
+	return to_span(buffer).reinterpret_cast_to<T>();
+}
+
+template <typename T>
+inline T reduce_min(const T *values) {
+	T m = values[0];
+	for (unsigned int i = 1; i < GROUP_SIZE; ++i) {
+		if (values[i] < m) {
+			m = values[i];
+		}
+	}
+	return m;
+}
+
+template <typename T>
+inline T reduce_average(const T *values) {
+	if constexpr (std::is_floating_point<T>::value) {
+		double sum = 0.0;
+		for (unsigned int i = 0; i < GROUP_SIZE; ++i) {
+			sum += values[i];
+		}
+		return static_cast<T>(sum / GROUP_SIZE);
+
+	} else if constexpr (sizeof(T) < sizeof(int64_t)) {
+		int64_t sum = 0;
+		for (unsigned int i = 0; i < GROUP_SIZE; ++i) {
+			sum += values[i];
+		}
+		// Rounds to nearest. Shifting keeps rounding consistent with negative values.
+		return static_cast<T>((sum + GROUP_SIZE / 2) >> 3);
+
+	} else {
+		// Summing 64-bit values could overflow
+		T sum_high = 0;
+		T sum_low = 0;
+		for (unsigned int i = 0; i < GROUP_SIZE; ++i) {
+			sum_high += values[i] >> 3;
+			sum_low += values[i] & 7;
+		}
+		return sum_high + ((sum_low + GROUP_SIZE / 2) >> 3);
+	}
+}
+
+template <typename T>
+inline T reduce_majority(const T *values) {
+	T best_value = values[0];
+	unsigned int best_count = 0;
+	for (unsigned int i = 0; i < GROUP_SIZE; ++i) {
+		const T v = values[i];
+		bool counted = false;
+		for (unsigned int j = 0; j < i; ++j) {
+			if (values[j] == v) {
+				counted = true;
+				break;
+			}
+		}
+		if (counted) {
+			continue;
+		}
+		unsigned int count = 1;
+		for (unsigned int j = i + 1; j < GROUP_SIZE; ++j) {
+			if (values[j] == v) {
+				++count;
+			}
+		}
+		// Strict comparison, so the first value wins in case of a tie
+		if (count > best_count) {
+			best_count = count;
+			best_value = v;
+		}
+	}
+	return best_value;
+}
+
+// Unsigned integer with the same size as T. Voxel buffers convert compressed values as such when copying them, so
+// it must be used to transfer raw values of floating point channels.
+template <typename T>
+struct RawType {
+	typedef T type;
+};
+template <>
+struct RawType<float> {
+	typedef uint32_t type;
+};
+template <>
+struct RawType<double> {
+	typedef uint64_t type;
+};
+
+// `T reduce(const T *values)`
+template <typename T, typename F>
+void downscale_channel(const VoxelBufferInternal &src, VoxelBufferInternal &dst, Vector3i src_min, Vector3i dst_min,
+		Vector3i area_size, unsigned int channel_index, F reduce) {
+	typedef typename RawType<T>::type RawT;
+
+	const Vector3i src_area_size = area_size * 2;
+	Span<RawT> src_raw = get_tls_buffer<RawT>(0, Vector3iUtil::get_volume(src_area_size));
+	Span<RawT> dst_raw = get_tls_buffer<RawT>(1, Vector3iUtil::get_volume(area_size));
+
+	// Gathering the area first makes it work with any compression or layout, and makes groups easy to address
+	src.copy_to(src_raw, src_area_size, Vector3i(), src_min, src_min + src_area_size, channel_index);
+
+	Span<const T> src_values = src_raw.template reinterpret_cast_to<const T>();
+	Span<T> dst_values = dst_raw.template reinterpret_cast_to<T>();
+
+	size_t offsets[GROUP_SIZE];
+	get_group_offsets(src_area_size, offsets);
+
+	T group[GROUP_SIZE];
+	size_t dst_i = 0;
+	Vector3i pos;
+	for (pos.z = 0; pos.z < area_size.z; ++pos.z) {
+		for (pos.x = 0; pos.x < area_size.x; ++pos.x) {
+			for (pos.y = 0; pos.y < area_size.y; ++pos.y) {
+				const size_t src_i = Vector3iUtil::get_zxy_index(pos * 2, src_area_size);
+				for (unsigned int i = 0; i < GROUP_SIZE; ++i) {
+					group[i] = src_values[src_i + offsets[i]];
+				}
+				dst_values[dst_i] = reduce(group);
+				++dst_i;
+			}
+		}
+	}
+
+	dst.copy_from(to_span_const(dst_raw), area_size, Vector3i(), area_size, dst_min, channel_index);
+}
+
+// `T`: type to interpret values with, depending on depth and on whether values are signed.
+template <typename T>
+void downscale_channel(const VoxelBufferInternal &src, VoxelBufferInternal &dst, Vector3i src_min, Vector3i dst_min,
+		Vector3i area_size, unsigned int channel_index, DownscaleFilter filter) {
+	switch (filter) {
+		case DOWNSCALE_SDF_MIN:
+			downscale_channel<T>(src, dst, src_min, dst_min, area_size, channel_index, reduce_min<T>);
+			break;
+		case DOWNSCALE_AVERAGE:
+			downscale_channel<T>(src, dst, src_min, dst_min, area_size, channel_index, reduce_average<T>);
+			break;
+		case DOWNSCALE_MAJORITY:
+			downscale_channel<T>(src, dst, src_min, dst_min, area_size, channel_index, reduce_majority<T>);
+			break;
+		default:
+			ZN_PRINT_ERROR("Unexpected filter");
+			break;
+	}
+}
+
+void downscale_channel(const VoxelBufferInternal &src, VoxelBufferInternal &dst, Vector3i src_min, Vector3i dst_min,
+		Vector3i area_size, unsigned int channel_index, DownscaleFilter filter) {
+	// SDF values are signed, including when they are quantized
+	const bool is_signed = channel_index == VoxelBufferInternal::CHANNEL_SDF;
+
+	switch (src.get_channel_depth(channel_index)) {
+		case VoxelBufferInternal::DEPTH_8_BIT:
+			if (is_signed) {
+				downscale_channel<int8_t>(src, dst, src_min, dst_min, area_size, channel_index, filter);
+			} else {
+				downscale_channel<uint8_t>(src, dst, src_min, dst_min, area_size, channel_index, filter);
+			}
+			break;
+
+		case VoxelBufferInternal::DEPTH_16_BIT:
+			if (is_signed) {
+				downscale_channel<int16_t>(src, dst, src_min, dst_min, area_size, channel_index, filter);
+			} else {
+				downscale_channel<uint16_t>(src, dst, src_min, dst_min, area_size, channel_index, filter);
+			}
+			break;
+
+		case VoxelBufferInternal::DEPTH_32_BIT:
+			if (is_signed) {
+				downscale_channel<float>(src, dst, src_min, dst_min, area_size, channel_index, filter);
+			} else {
+				downscale_channel<uint32_t>(src, dst, src_min, dst_min, area_size, channel_index, filter);
+			}
+			break;
+
+		case VoxelBufferInternal::DEPTH_64_BIT:
+			if (is_signed) {
+				downscale_channel<double>(src, dst, src_min, dst_min, area_size, channel_index, filter);
+			} else {
+				downscale_channel<uint64_t>(src, dst, src_min, dst_min, area_size, channel_index, filter);
+			}
+			break;
+
+		default:
+			ZN_PRINT_ERROR("Unknown depth");
+			break;
+	}
+}
+
+void reduce_texture_blend(
+		const uint16_t *src_indices, const uint16_t *src_weights, uint16_t &out_indices, uint16_t &out_weights) {
+	// Texture indices are 4-bit
+	const unsigned int TEXTURE_COUNT = 16;
+	const unsigned int SLOT_COUNT = 4;
+
+	FixedArray<uint32_t, TEXTURE_COUNT> totals;
+	fill(totals, uint32_t(0));
+	uint32_t grand_total = 0;
+
+	for (unsigned int i = 0; i < GROUP_SIZE; ++i) {
+		const FixedArray<uint8_t, 4> indices = decode_indices_from_packed_u16(src_indices[i]);
+		const FixedArray<uint8_t, 4> weights = decode_weights_from_packed_u16(src_weights[i]);
+		for (unsigned int j = 0; j < SLOT_COUNT; ++j) {
+			totals[indices[j]] += weights[j];
+		}
+		grand_total += weights[0] + weights[1] + weights[2] + weights[3];
+	}
+
+	// Pick the strongest textures. In case of a tie, the lowest index wins.
+	FixedArray<uint8_t, SLOT_COUNT> selected;
+	FixedArray<bool, TEXTURE_COUNT> is_selected;
+	fill(is_selected, false);
+	uint32_t selected_total = 0;
+	for (unsigned int s = 0; s < SLOT_COUNT; ++s) {
+		unsigned int best = 0;
+		while (is_selected[best]) {
+			++best;
+		}
+		for (unsigned int ti = best + 1; ti < TEXTURE_COUNT; ++ti) {
+			if (!is_selected[ti] && totals[ti] > totals[best]) {
+				best = ti;
+			}
+		}
+		selected[s] = best;
+		is_selected[best] = true;
+		selected_total += totals[best];
+	}
+
+	// Keep textures in the slots they had in the first voxel, so a group of identical voxels doesn't change.
+	// The other textures go into remaining slots. Indices stay unique within the voxel.
+	FixedArray<uint8_t, SLOT_COUNT> indices = decode_indices_from_packed_u16(src_indices[0]);
+	FixedArray<bool, SLOT_COUNT> slot_used;
+	fill(slot_used, false);
+	for (unsigned int j = 0; j < SLOT_COUNT; ++j) {
+		if (is_selected[indices[j]]) {
+			slot_used[j] = true;
+			is_selected[indices[j]] = false;
+		}
+	}
+	unsigned int free_slot = 0;
+	for (unsigned int s = 0; s < SLOT_COUNT; ++s) {
+		if (!is_selected[selected[s]]) {
+			// Already placed
+			continue;
+		}
+		while (slot_used[free_slot]) {
+			++free_slot;
+		}
+		indices[free_slot] = selected[s];
+		slot_used[free_slot] = true;
+	}
+
+	// Weights of dropped textures are given to the ones we kept, and the total matches the average of the group.
+	// Weights are stored with 4 bits, so they are computed in units of 16, distributing rounding errors such that the
+	// total is preserved.
+	const uint32_t WEIGHT_UNIT = 16;
+	const uint32_t target_units = (grand_total + GROUP_SIZE * WEIGHT_UNIT / 2) / (GROUP_SIZE * WEIGHT_UNIT);
+	FixedArray<uint32_t, SLOT_COUNT> units;
+	FixedArray<uint32_t, SLOT_COUNT> remainders;
+	fill(units, uint32_t(0));
+	fill(remainders, uint32_t(0));
+	if (selected_total > 0) {
+		uint32_t assigned_units = 0;
+		for (unsigned int j = 0; j < SLOT_COUNT; ++j) {
+			const uint32_t n = totals[indices[j]] * target_units;
+			units[j] = n / selected_total;
+			remainders[j] = n % selected_total;
+			assigned_units += units[j];
+		}
+		while (assigned_units < target_units) {
+			unsigned int best = 0;
+			for (unsigned int j = 1; j < SLOT_COUNT; ++j) {
+				if (remainders[j] > remainders[best]) {
+					best = j;
+				}
+			}
+			++units[best];
+			remainders[best] = 0;
+			++assigned_units;
+		}
+	}
+	FixedArray<uint8_t, SLOT_COUNT> weights;
+	for (unsigned int j = 0; j < SLOT_COUNT; ++j) {
+		weights[j] = math::min(units[j], uint32_t(15)) * WEIGHT_UNIT;
+	}
+
+	out_indices = encode_indices_to_packed_u16(indices[0], indices[1], indices[2], indices[3]);
+	out_weights = encode_weights_to_packed_u16(weights[0], weights[1], weights[2], weights[3]);
+}
+
+void downscale_texture_channels(const VoxelBufferInternal &src, VoxelBufferInternal &dst, Vector3i src_min,
+		Vector3i dst_min, Vector3i area_size) {
+	const unsigned int indices_channel = VoxelBufferInternal::CHANNEL_INDICES;
+	const unsigned int weights_channel = VoxelBufferInternal::CHANNEL_WEIGHTS;
+
+	const Vector3i src_area_size = area_size * 2;
+	const size_t src_volume = Vector3iUtil::get_volume(src_area_size);
+	const size_t dst_volume = Vector3iUtil::get_volume(area_size);
+	Span<uint16_t> src_indices = get_tls_buffer<uint16_t>(0, src_volume);
+	Span<uint16_t> src_weights = get_tls_buffer<uint16_t>(1, src_volume);
+	Span<uint16_t> dst_indices = get_tls_buffer<uint16_t>(2, dst_volume);
+	Span<uint16_t> dst_weights = get_tls_buffer<uint16_t>(3, dst_volume);
+
+	src.copy_to(src_indices, src_area_size, Vector3i(), src_min, src_min + src_area_size, indices_channel);
+	src.copy_to(src_weights, src_area_size, Vector3i(), src_min, src_min + src_area_size, weights_channel);
+
+	size_t offsets[GROUP_SIZE];
+	get_group_offsets(src_area_size, offsets);
+
+	uint16_t group_indices[GROUP_SIZE];
+	uint16_t group_weights[GROUP_SIZE];
+	size_t dst_i = 0;
+	Vector3i pos;
+	for (pos.z = 0; pos.z < area_size.z; ++pos.z) {
+		for (pos.x = 0; pos.x < area_size.x; ++pos.x) {
+			for (pos.y = 0; pos.y < area_size.y; ++pos.y) {
+				const size_t src_i = Vector3iUtil::get_zxy_index(pos * 2, src_area_size);
+				for (unsigned int i = 0; i < GROUP_SIZE; ++i) {
+					group_indices[i] = src_indices[src_i + offsets[i]];
+					group_weights[i] = src_weights[src_i + offsets[i]];
+				}
+				reduce_texture_blend(group_indices, group_weights, dst_indices[dst_i], dst_weights[dst_i]);
+				++dst_i;
+			}
+		}
+	}
+
+	dst.copy_from(to_span_const(dst_indices), area_size, Vector3i(), area_size, dst_min, indices_channel);
+	dst.copy_from(to_span_const(dst_weights), area_size, Vector3i(), area_size, dst_min, weights_channel);
+}
+
+inline bool is_channel_uniform(const VoxelBufferInternal &vb, unsigned int channel_index) {
+	return vb.get_channel_compression(channel_index) == VoxelBufferInternal::COMPRESSION_UNIFORM;
+}
+
+} // namespace
+
+void downscale_voxels(const VoxelBufferInternal &src, VoxelBufferInternal &dst, Vector3i src_min, Vector3i src_max,
+		Vector3i dst_min, const DownscaleFilters &filters) {
+	ZN_PROFILE_SCOPE();
+
+	const unsigned int indices_channel = VoxelBufferInternal::CHANNEL_INDICES;
+	const unsigned int weights_channel = VoxelBufferInternal::CHANNEL_WEIGHTS;
+
+	// Channels using nearest-neighbor are all done at once by the buffer
+	uint8_t nearest_channels_mask = 0;
+	for (unsigned int channel_index = 0; channel_index < VoxelBufferInternal::MAX_CHANNELS; ++channel_index) {
+		DownscaleFilter filter = filters[channel_index];
+		if (channel_index == weights_channel && filters[indices_channel] == DOWNSCALE_TEXTURE_BLEND) {
+			filter = DOWNSCALE_TEXTURE_BLEND;
+		}
+		if (filter == DOWNSCALE_NEAREST ||
+				src.get_channel_depth(channel_index) != dst.get_channel_depth(channel_index)) {
+			nearest_channels_mask |= (1 << channel_index);
+		} else if (filter == DOWNSCALE_TEXTURE_BLEND) {
+			if (src.get_channel_depth(channel_index) != VoxelBufferInternal::DEPTH_16_BIT ||
+					(channel_index != indices_channel && channel_index != weights_channel)) {
+				nearest_channels_mask |= (1 << channel_index);
+			}
+		}
+	}
+	// Texture channels are processed as a pair, so both have to use the filter
+	const bool texture_blend = filters[indices_channel] == DOWNSCALE_TEXTURE_BLEND;
+	if (texture_blend &&
+			((nearest_channels_mask >> indices_channel) & 1) != ((nearest_channels_mask >> weights_channel) & 1)) {
+		nearest_channels_mask |= (1 << indices_channel) | (1 << weights_channel);
+	}
+	if (nearest_channels_mask != 0) {
+		src.downscale_to(dst, src_min, src_max, dst_min, nearest_channels_mask);
+	}
+	if (nearest_channels_mask == VoxelBufferInternal::ALL_CHANNELS_MASK) {
+		return;
+	}
+
+	// Same clipping as `downscale_to`
+	src_min = src_min.clamp(Vector3i(), src.get_size() - Vector3i(1, 1, 1));
+	src_max = src_max.clamp(Vector3i(), src.get_size());
+	Vector3i dst_max = dst_min + ((src_max - src_min) >> 1);
+	dst_min = dst_min.clamp(Vector3i(), dst.get_size() - Vector3i(1, 1, 1));
+	dst_max = dst_max.clamp(Vector3i(), dst.get_size());
+
+	const Vector3i area_size = dst_max - dst_min;
+	if (area_size.x <= 0 || area_size.y <= 0 || area_size.z <= 0) {
+		return;
+	}
+
+	for (unsigned int channel_index = 0; channel_index < VoxelBufferInternal::MAX_CHANNELS; ++channel_index) {
+		if ((nearest_channels_mask & (1 << channel_index)) != 0 ||
+				(texture_blend && channel_index == weights_channel)) {
+			continue;
+		}
+
+		if (texture_blend && channel_index == indices_channel) {
+			if (is_channel_uniform(src, indices_channel) && is_channel_uniform(src, weights_channel)) {
+				dst.fill_area(src.get_voxel(Vector3i(), indices_channel), dst_min, dst_max, indices_channel);
+				dst.fill_area(src.get_voxel(Vector3i(), weights_channel), dst_min, dst_max, weights_channel);
+			} else {
+				downscale_texture_channels(src, dst, src_min, dst_min, area_size);
+			}
+			continue;
+		}
+
+		// All filters give back the same value when the input is uniform
+		if (is_channel_uniform(src, channel_index)) {
+			dst.fill_area(src.get_voxel(Vector3i(), channel_index), dst_min, dst_max, channel_index);
+			continue;
+		}
+
+		downscale_channel(src, dst, src_min, dst_min, area_size, channel_index, filters[channel_index]);
+	}
+}
+
+} // namespace zylann::voxel
@@ -0,0 +1,40 @@
+#ifndef VOXEL_DOWNSCALE_H
+#define VOXEL_DOWNSCALE_H
+
+#include "../util/fixed_array.h"
+#include "voxel_buffer_internal.h"
+
+namespace zylann::voxel {
+
+// How groups of 2x2x2 voxels are combined into one when building lower levels of detail from edited voxels.
+enum DownscaleFilter {
+	// Takes one voxel out of eight. Cheapest, but thin features can disappear or flicker between LODs.
+	DOWNSCALE_NEAREST = 0,
+	// Takes the smallest value. On a signed distance field, this keeps thin walls and small details solid.
+	DOWNSCALE_SDF_MIN,
+	// Takes the average. Values are considered signed on the SDF channel, unsigned on others.
+	// Not suitable for channels packing several values, such as colors or texture data.
+	DOWNSCALE_AVERAGE,
+	// Takes the most frequent value, or the first one found in case of a tie. Suitable for voxel types.
+	DOWNSCALE_MAJORITY,
+	// Only applies to the INDICES channel, and also processes the WEIGHTS channel (its own filter is then ignored).
+	// Weights of each texture are summed over the group, and the four strongest textures are kept.
+	DOWNSCALE_TEXTURE_BLEND,
+	DOWNSCALE_FILTER_COUNT
+};
+
+typedef FixedArray<DownscaleFilter, VoxelBufferInternal::MAX_CHANNELS> DownscaleFilters;
+
+DownscaleFilters get_default_downscale_filters();
+bool is_nearest_downscale(const DownscaleFilters &filters);
+
+// Downscales an area by a factor of two into another buffer, using a filter for each channel.
+// Parameters are the same as `VoxelBufferInternal::downscale_to`.
+// Both buffers can use any layout. Channels must have the same depth in both buffers, otherwise nearest-neighbor is
+// used.
+void downscale_voxels(const VoxelBufferInternal &src, VoxelBufferInternal &dst, Vector3i src_min, Vector3i src_max,
+		Vector3i dst_min, const DownscaleFilters &filters);
+
+} // namespace zylann::voxel
+
+#endif // VOXEL_DOWNSCALE_H
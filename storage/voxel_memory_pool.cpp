@@ -8,6 +8,11 @@ namespace zylann::voxel {
 
 namespace {
 VoxelMemoryPool *g_memory_pool = nullptr;
+
+inline size_t get_block_count_for_bytes(size_t bytes, size_t block_size) {
+	return (bytes + block_size - 1) / block_size;
+}
+
 } // namespace
 
 void VoxelMemoryPool::create_singleton() {
@@ -27,7 +32,10 @@ VoxelMemoryPool &VoxelMemoryPool::get_singleton() {
 	return *g_memory_pool;
 }
 
-VoxelMemoryPool::VoxelMemoryPool() {}
+VoxelMemoryPool::VoxelMemoryPool() {
+	_numa_node_count = math::clamp(Thread::get_numa_node_count(), 1u, MAX_NUMA_NODES);
+	ZN_PRINT_VERBOSE(format("VoxelMemoryPool: {} NUMA nodes", _numa_node_count));
+}
 
 VoxelMemoryPool::~VoxelMemoryPool() {
 #ifdef TOOLS_ENABLED
@@ -38,6 +46,131 @@ VoxelMemoryPool::~VoxelMemoryPool() {
 	clear();
 }
 
+VoxelMemoryPool::ThreadCache::~ThreadCache() {
+	if (owner != nullptr && owner == g_memory_pool) {
+		owner->flush_thread_cache(*this);
+	} else {
+		// The pool is gone (or was replaced), nothing to give blocks back to
+		free_blocks();
+	}
+}
+
+void VoxelMemoryPool::ThreadCache::free_blocks() {
+	for (unsigned int pot = 0; pot < magazines.size(); ++pot) {
+		Magazine &magazine = magazines[pot];
+		for (unsigned int i = 0; i < magazine.count; ++i) {
+			ZN_FREE(magazine.blocks[i] - BLOCK_HEADER_SIZE);
+		}
+		magazine.count = 0;
+	}
+	owner = nullptr;
+}
+
+VoxelMemoryPool::ThreadCache &VoxelMemoryPool::get_thread_cache() {
+	thread_local ThreadCache tls_cache;
+	return tls_cache;
+}
+
+VoxelMemoryPool::ThreadCache &VoxelMemoryPool::get_bound_thread_cache() {
+	ThreadCache &cache = get_thread_cache();
+	if (cache.owner != this) {
+		if (cache.owner == g_memory_pool) {
+			// This thread is using a different pool than the singleton (can happen in tests)
+			g_memory_pool->flush_thread_cache(cache);
+		} else {
+			// Blocks cached for a pool that no longer exists
+			cache.free_blocks();
+		}
+		cache.owner = this;
+		cache.trim_epoch = _trim_epoch.load(std::memory_order_relaxed);
+	}
+	const uint32_t trim_epoch = _trim_epoch.load(std::memory_order_relaxed);
+	if (cache.trim_epoch != trim_epoch) {
+		// Blocks cached by this thread were out of reach of the last trim. Give them back so the next one can
+		// release them.
+		for (unsigned int pot = 0; pot < cache.magazines.size(); ++pot) {
+			flush_magazine(pot, cache.magazines[pot], 0);
+		}
+		cache.trim_epoch = trim_epoch;
+	}
+	return cache;
+}
+
+void VoxelMemoryPool::flush_thread_cache(ThreadCache &cache) {
+	for (unsigned int pot = 0; pot < cache.magazines.size(); ++pot) {
+		flush_magazine(pot, cache.magazines[pot], 0);
+	}
+	cache.owner = nullptr;
+}
+
+unsigned int VoxelMemoryPool::refill_magazine(unsigned int pot, ThreadCache::Magazine &magazine, unsigned int count) {
+	Pool &pool = _pot_pools[pot];
+	// Only take blocks of the current node. If there are none, new ones get allocated on this node instead of
+	// reusing remote ones.
+	FreeList &free_list = pool.free_lists[get_current_numa_node()];
+	MutexLock lock(pool.mutex);
+	const unsigned int moved_count = math::min(count, static_cast<unsigned int>(free_list.blocks.size()));
+	const size_t src_begin = free_list.blocks.size() - moved_count;
+	for (unsigned int i = 0; i < moved_count; ++i) {
+		magazine.blocks[magazine.count] = free_list.blocks[src_begin + i];
+		++magazine.count;
+	}
+	free_list.blocks.resize(src_begin);
+	if (src_begin < free_list.min_free_blocks_since_trim) {
+		free_list.min_free_blocks_since_trim = src_begin;
+	}
+	return moved_count;
+}
+
+void VoxelMemoryPool::flush_magazine(unsigned int pot, ThreadCache::Magazine &magazine, unsigned int keep_count) {
+	if (magazine.count <= keep_count) {
+		return;
+	}
+	Pool &pool = _pot_pools[pot];
+	MutexLock lock(pool.mutex);
+	for (unsigned int i = keep_count; i < magazine.count; ++i) {
+		uint8_t *block = magazine.blocks[i];
+		pool.free_lists[get_block_numa_node(block)].blocks.push_back(block);
+	}
+	magazine.count = keep_count;
+}
+
+size_t VoxelMemoryPool::release_oldest_free_blocks(unsigned int pot, unsigned int node, size_t count) {
+	Pool &pool = _pot_pools[pot];
+	FreeList &free_list = pool.free_lists[node];
+	count = math::min(count, free_list.blocks.size());
+	if (count == 0) {
+		return 0;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		free_pooled_block(free_list.blocks[i]);
+	}
+	free_list.blocks.erase(free_list.blocks.begin(), free_list.blocks.begin() + count);
+	free_list.min_free_blocks_since_trim -= math::min(free_list.min_free_blocks_since_trim, count);
+	pool.total_blocks -= count;
+	pool.trimmed_blocks += count;
+	_total_memory -= count * get_size_from_pool_index(pot);
+	return count;
+}
+
+void VoxelMemoryPool::free_pooled_block(uint8_t *block) const {
+	ZN_FREE(block - BLOCK_HEADER_SIZE);
+}
+
+size_t VoxelMemoryPool::get_free_block_count(const Pool &pool) const {
+	// The pool's mutex must be locked
+	size_t count = 0;
+	for (unsigned int node = 0; node < _numa_node_count; ++node) {
+		count += pool.free_lists[node].blocks.size();
+	}
+	return count;
+}
+
+bool VoxelMemoryPool::is_over_budget(const Pool &pool, unsigned int pot) const {
+	const size_t budget = pool.memory_budget;
+	return budget != 0 && size_t(pool.total_blocks) * get_size_from_pool_index(pot) > budget;
+}
+
 uint8_t *VoxelMemoryPool::allocate(size_t size) {
 	ZN_PROFILE_SCOPE();
 	ZN_ASSERT(size != 0);
@@ -46,22 +179,31 @@ uint8_t *VoxelMemoryPool::allocate(size_t size) {
 	// while `size_t` can be larger than that.
 	if (size > get_highest_supported_size()) {
 		// Sorry, memory is not pooled past this size
-		block = (uint8_t *)ZN_ALLOC(size * sizeof(uint8_t));
-#ifdef DEBUG_ENABLED
+		block = (uint8_t *)ZN_ALLOC(BLOCK_HEADER_SIZE + size * sizeof(uint8_t));
 		if (block != nullptr) {
+			block += BLOCK_HEADER_SIZE;
+			_total_memory += size;
+#ifdef DEBUG_ENABLED
 			_debug_nonpooled_used_blocks.add(block);
-		}
 #endif
+		}
 	} else {
 		const unsigned int pot = get_pool_index_from_size(size);
 		Pool &pool = _pot_pools[pot];
-		pool.mutex.lock();
-		if (pool.blocks.size() > 0) {
-			block = pool.blocks.back();
-			pool.blocks.pop_back();
-			pool.mutex.unlock();
+		const unsigned int magazine_capacity = get_magazine_capacity(pot);
+		ThreadCache::Magazine &magazine = get_bound_thread_cache().magazines[pot];
+
+		if (magazine.count == 0) {
+			// Take a batch at once so the next allocations don't have to lock.
+			// Only fill half of the magazine, so recycling blocks right after doesn't have to flush immediately.
+			refill_magazine(pot, magazine, math::max(magazine_capacity / 2, 1u));
+		}
+
+		if (magazine.count > 0) {
+			--magazine.count;
+			block = magazine.blocks[magazine.count];
+			++pool.hits;
 		} else {
-			pool.mutex.unlock();
 			ZN_PROFILE_SCOPE_NAMED("new alloc");
 			// All allocations done in this pool have the same size,
 			// which must be greater or equal to `size`
@@ -69,13 +211,29 @@ uint8_t *VoxelMemoryPool::allocate(size_t size) {
 #ifdef DEBUG_ENABLED
 			ZN_ASSERT(capacity >= size);
 #endif
-			block = (uint8_t *)ZN_ALLOC(capacity * sizeof(uint8_t));
+			block = (uint8_t *)ZN_ALLOC(BLOCK_HEADER_SIZE + capacity * sizeof(uint8_t));
+			if (block != nullptr) {
+				// Also touches the first page, which makes the system place it on the current node
+				block[0] = get_current_numa_node();
+				block += BLOCK_HEADER_SIZE;
+				++pool.total_blocks;
+				const size_t total_memory = _total_memory += capacity;
+				// Not exact if other threads allocate at the same time, but good enough for statistics
+				if (total_memory > _peak_total_memory) {
+					_peak_total_memory = total_memory;
+				}
+			}
+			++pool.misses;
 		}
-#ifdef DEBUG_ENABLED
 		if (block != nullptr) {
+			const unsigned int used_blocks = ++pool.used_blocks;
+			if (used_blocks > pool.peak_used_blocks) {
+				pool.peak_used_blocks = used_blocks;
+			}
+#ifdef DEBUG_ENABLED
 			pool.debug_used_blocks.add(block);
-		}
 #endif
+		}
 	}
 	if (block == nullptr) {
 		ZN_PRINT_ERROR("Out of memory");
@@ -96,7 +254,8 @@ void VoxelMemoryPool::recycle(uint8_t *block, size_t size) {
 		// Make sure this allocation was done by this pool in this scenario
 		_debug_nonpooled_used_blocks.remove(block);
 #endif
-		ZN_FREE(block);
+		ZN_FREE(block - BLOCK_HEADER_SIZE);
+		_total_memory -= size;
 	} else {
 		const unsigned int pot = get_pool_index_from_size(size);
 		Pool &pool = _pot_pools[pot];
@@ -104,35 +263,202 @@ void VoxelMemoryPool::recycle(uint8_t *block, size_t size) {
 		// Make sure this allocation was done by this pool in this scenario
 		pool.debug_used_blocks.remove(block);
 #endif
-		MutexLock lock(pool.mutex);
-		pool.blocks.push_back(block);
+		--pool.used_blocks;
+		const unsigned int magazine_capacity = get_magazine_capacity(pot);
+
+		const unsigned int block_node = get_block_numa_node(block);
+
+		if (is_over_budget(pool, pot)) {
+			// Don't keep it around
+			free_pooled_block(block);
+			--pool.total_blocks;
+			++pool.trimmed_blocks;
+			_total_memory -= get_size_from_pool_index(pot);
+
+		} else if (magazine_capacity == 0) {
+			// Blocks of this size are not cached per thread
+			MutexLock lock(pool.mutex);
+			pool.free_lists[block_node].blocks.push_back(block);
+
+		} else if (block_node != get_current_numa_node()) {
+			// Give it back to the node it was allocated on, rather than reusing it from here
+			++pool.remote_recycles;
+			MutexLock lock(pool.mutex);
+			pool.free_lists[block_node].blocks.push_back(block);
+
+		} else {
+			ThreadCache::Magazine &magazine = get_bound_thread_cache().magazines[pot];
+			if (magazine.count == magazine_capacity) {
+				// Give half of the blocks back, so other threads can use them
+				flush_magazine(pot, magazine, magazine_capacity / 2);
+			}
+			magazine.blocks[magazine.count] = block;
+			++magazine.count;
+		}
 	}
 	--_used_blocks;
 	_used_memory -= size;
 }
 
 void VoxelMemoryPool::clear_unused_blocks() {
+	// Only the calling thread's cache can be reached here. Blocks cached by other threads are returned to pools
+	// when those threads recycle enough of them or exit.
+	ThreadCache &cache = get_thread_cache();
+	if (cache.owner == this) {
+		flush_thread_cache(cache);
+	}
+
+	for (unsigned int pot = 0; pot < _pot_pools.size(); ++pot) {
+		Pool &pool = _pot_pools[pot];
+		MutexLock lock(pool.mutex);
+		for (unsigned int node = 0; node < _numa_node_count; ++node) {
+			FreeList &free_list = pool.free_lists[node];
+			for (unsigned int i = 0; i < free_list.blocks.size(); ++i) {
+				free_pooled_block(free_list.blocks[i]);
+			}
+			_total_memory -= get_size_from_pool_index(pot) * free_list.blocks.size();
+			pool.total_blocks -= free_list.blocks.size();
+			free_list.blocks.clear();
+			free_list.min_free_blocks_since_trim = 0;
+		}
+	}
+}
+
+void VoxelMemoryPool::set_memory_budget(size_t bytes) {
+	_memory_budget = bytes;
+}
+
+size_t VoxelMemoryPool::get_memory_budget() const {
+	return _memory_budget;
+}
+
+void VoxelMemoryPool::set_pool_memory_budget(unsigned int pool_index, size_t bytes) {
+	ZN_ASSERT_RETURN(pool_index < _pot_pools.size());
+	_pot_pools[pool_index].memory_budget = bytes;
+}
+
+void VoxelMemoryPool::set_pools_memory_budget(size_t bytes) {
+	for (unsigned int pot = 0; pot < _pot_pools.size(); ++pot) {
+		_pot_pools[pot].memory_budget = bytes;
+	}
+}
+
+void VoxelMemoryPool::trim() {
+	ZN_PROFILE_SCOPE();
+
+	bool budget_exceeded = false;
+
+	// Per-pool budgets. They are also checked when blocks get recycled, but budgets can change at runtime.
+	for (unsigned int pot = 0; pot < _pot_pools.size(); ++pot) {
+		Pool &pool = _pot_pools[pot];
+		if (!is_over_budget(pool, pot)) {
+			continue;
+		}
+		budget_exceeded = true;
+		MutexLock lock(pool.mutex);
+		const size_t block_size = get_size_from_pool_index(pot);
+		const size_t pool_memory = size_t(pool.total_blocks) * block_size;
+		const size_t budget = pool.memory_budget;
+		if (pool_memory > budget) {
+			size_t count = get_block_count_for_bytes(pool_memory - budget, block_size);
+			for (unsigned int node = 0; node < _numa_node_count && count > 0; ++node) {
+				count -= release_oldest_free_blocks(pot, node, count);
+			}
+		}
+	}
+
+	// Global budget
+	const size_t budget = _memory_budget;
+	if (budget != 0 && _total_memory > budget) {
+		budget_exceeded = true;
+		// Go a bit below the budget, so we don't have to trim again right after
+		const size_t target = budget - budget / 4;
+
+		// The first pass only releases blocks that were not used since the last trim. If that's not enough, the
+		// second pass releases any free block. Large blocks are released first, they free more memory for the same
+		// amount of work.
+		for (unsigned int pass = 0; pass < 2; ++pass) {
+			for (int pot = _pot_pools.size() - 1; pot >= 0 && _total_memory > target; --pot) {
+				Pool &pool = _pot_pools[pot];
+				MutexLock lock(pool.mutex);
+				for (unsigned int node = 0; node < _numa_node_count; ++node) {
+					const FreeList &free_list = pool.free_lists[node];
+					const size_t available =
+							pass == 0 ? free_list.min_free_blocks_since_trim : free_list.blocks.size();
+					const size_t total_memory = _total_memory;
+					if (total_memory <= target) {
+						break;
+					}
+					const size_t block_size = get_size_from_pool_index(pot);
+					const size_t needed = get_block_count_for_bytes(total_memory - target, block_size);
+					release_oldest_free_blocks(pot, node, math::min(available, needed));
+				}
+			}
+		}
+	}
+
+	if (budget_exceeded) {
+		// Threads will give back the blocks they cache the next time they use the pool
+		++_trim_epoch;
+	}
+
+	// Start a new period of observation
 	for (unsigned int pot = 0; pot < _pot_pools.size(); ++pot) {
 		Pool &pool = _pot_pools[pot];
 		MutexLock lock(pool.mutex);
-		for (unsigned int i = 0; i < pool.blocks.size(); ++i) {
-			void *block = pool.blocks[i];
-			ZN_FREE(block);
+		for (unsigned int node = 0; node < _numa_node_count; ++node) {
+			FreeList &free_list = pool.free_lists[node];
+			free_list.min_free_blocks_since_trim = free_list.blocks.size();
 		}
-		_total_memory -= get_size_from_pool_index(pot) * pool.blocks.size();
-		pool.blocks.clear();
 	}
 }
 
+VoxelMemoryPool::Stats VoxelMemoryPool::get_stats() {
+	Stats stats;
+	stats.used_memory = _used_memory;
+	stats.total_memory = _total_memory;
+	stats.peak_total_memory = _peak_total_memory;
+	stats.memory_budget = _memory_budget;
+	stats.numa_node_count = _numa_node_count;
+	for (unsigned int pot = 0; pot < _pot_pools.size(); ++pot) {
+		Pool &pool = _pot_pools[pot];
+		PoolStats &ps = stats.pools[pot];
+		ps.block_size = get_size_from_pool_index(pot);
+		ps.total_blocks = pool.total_blocks;
+		ps.used_blocks = pool.used_blocks;
+		ps.peak_used_blocks = pool.peak_used_blocks;
+		ps.hits = pool.hits;
+		ps.misses = pool.misses;
+		ps.trimmed_blocks = pool.trimmed_blocks;
+		ps.remote_recycles = pool.remote_recycles;
+		ps.memory_budget = pool.memory_budget;
+		{
+			MutexLock lock(pool.mutex);
+			ps.free_blocks = get_free_block_count(pool);
+		}
+	}
+	return stats;
+}
+
 void VoxelMemoryPool::clear() {
+	ThreadCache &cache = get_thread_cache();
+	if (cache.owner == this) {
+		flush_thread_cache(cache);
+	}
+
 	for (unsigned int pot = 0; pot < _pot_pools.size(); ++pot) {
 		Pool &pool = _pot_pools[pot];
 		MutexLock lock(pool.mutex);
-		for (unsigned int i = 0; i < pool.blocks.size(); ++i) {
-			void *block = pool.blocks[i];
-			ZN_FREE(block);
+		for (unsigned int node = 0; node < _numa_node_count; ++node) {
+			FreeList &free_list = pool.free_lists[node];
+			for (unsigned int i = 0; i < free_list.blocks.size(); ++i) {
+				free_pooled_block(free_list.blocks[i]);
+			}
+			free_list.blocks.clear();
+			free_list.min_free_blocks_since_trim = 0;
 		}
-		pool.blocks.clear();
+		pool.total_blocks = 0;
+		pool.used_blocks = 0;
 	}
 	_used_memory = 0;
 	_total_memory = 0;
@@ -144,7 +470,7 @@ void VoxelMemoryPool::debug_print() {
 	for (unsigned int pot = 0; pot < _pot_pools.size(); ++pot) {
 		Pool &pool = _pot_pools[pot];
 		MutexLock lock(pool.mutex);
-		println(format("Pool {}: {} blocks (capacity {})", pot, pool.blocks.size(), pool.blocks.capacity()));
+		println(format("Pool {}: {} free blocks", pot, get_free_block_count(pool)));
 	}
 }
 
@@ -4,6 +4,7 @@
 #include "../util/fixed_array.h"
 #include "../util/math/funcs.h"
 #include "../util/thread/mutex.h"
+#include "../util/thread/thread.h"
 
 #include <atomic>
 #include <limits>
@@ -17,7 +18,34 @@ namespace zylann::voxel {
 // The majority of VoxelBuffers use powers of two so most of the time
 // we won't waste memory. Sometimes non-power-of-two buffers are created,
 // but they are often temporary and less numerous.
+//
+// Each thread keeps a small cache of free blocks for every size class ("magazine"), so most allocations and
+// recycles don't touch shared state at all. Shared pools are only locked to exchange batches of blocks when a
+// magazine becomes empty or full. When a trim finds a budget exceeded, threads give their magazines back on their next
+// allocation or recycle, so the next trim can release them.
+//
+// On systems with several NUMA nodes, free blocks are kept separately for each node, so threads reuse memory that was
+// allocated on their own node.
+//
+// Blocks are preceded by a small header storing their node. Part of it can be used by owners of the block to store
+// their own data, like a reference count, without making the block fall in a larger size class.
 class VoxelMemoryPool {
+public:
+	// We handle allocations with up to 2^20 = 1,048,576 bytes.
+	// This is chosen based on practical needs.
+	static const unsigned int POOL_COUNT = 21;
+	// Maximum number of free blocks a thread can cache for one size class
+	static const unsigned int MAGAZINE_CAPACITY = 32;
+	// Maximum amount of memory a thread can cache for one size class. Large blocks are cached less (or not at all),
+	// so idle threads don't retain too much memory.
+	static const size_t MAGAZINE_MAX_BYTES = 256 * 1024;
+	// Nodes beyond this share the free lists of the last one
+	static const unsigned int MAX_NUMA_NODES = 8;
+	// Size of the header in front of every block. Keeps the alignment of blocks returned by the system allocator.
+	static const size_t BLOCK_HEADER_SIZE = 16;
+	// Bytes at the end of the header that the owner of a block can use
+	static const size_t BLOCK_USER_HEADER_SIZE = 8;
+
 private:
 #ifdef DEBUG_ENABLED
 	struct DebugUsedBlocks {
@@ -42,16 +70,79 @@ private:
 	};
 #endif
 
-	struct Pool {
-		Mutex mutex;
+	struct FreeList {
 		// Would a linked list be better?
+		// Blocks are taken from the back, so the front has the blocks that were not used for the longest time.
 		std::vector<uint8_t *> blocks;
+		// Lowest size `blocks` had since the last trim. Blocks below that index were not used in the meantime.
+		size_t min_free_blocks_since_trim = 0;
+	};
+
+	struct Pool {
+		Mutex mutex;
+		// Free blocks, by NUMA node they were allocated on. Only the first `_numa_node_count` lists are used.
+		FixedArray<FreeList, MAX_NUMA_NODES> free_lists;
+
+		// If not zero, free blocks are released when the memory owned by this pool exceeds this amount of bytes
+		std::atomic_size_t memory_budget = 0;
+
+		// Counters are atomic because most of the time the mutex is not locked when blocks are allocated.
+		// Blocks owned by the pool, either used or free (including those cached by threads)
+		std::atomic_uint32_t total_blocks = 0;
+		std::atomic_uint32_t used_blocks = 0;
+		std::atomic_uint32_t peak_used_blocks = 0;
+		// Allocations served with blocks previously recycled
+		std::atomic_uint64_t hits = 0;
+		// Allocations that required to allocate new memory
+		std::atomic_uint64_t misses = 0;
+		std::atomic_uint64_t trimmed_blocks = 0;
+		// Blocks recycled by a thread running on a different NUMA node than the one they were allocated on
+		std::atomic_uint64_t remote_recycles = 0;
 #ifdef DEBUG_ENABLED
 		DebugUsedBlocks debug_used_blocks;
 #endif
 	};
 
+	struct ThreadCache {
+		struct Magazine {
+			FixedArray<uint8_t *, MAGAZINE_CAPACITY> blocks;
+			unsigned int count = 0;
+		};
+		FixedArray<Magazine, POOL_COUNT> magazines;
+		// Pool the cached blocks belong to
+		VoxelMemoryPool *owner = nullptr;
+		// Value of the owner's trim epoch when magazines were last flushed
+		uint32_t trim_epoch = 0;
+
+		// Returns cached blocks to their pool when the thread exits
+		~ThreadCache();
+		void free_blocks();
+	};
+
 public:
+	struct PoolStats {
+		size_t block_size;
+		unsigned int total_blocks;
+		unsigned int used_blocks;
+		unsigned int peak_used_blocks;
+		// Free blocks in the shared pool. Blocks cached by threads are not counted.
+		unsigned int free_blocks;
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t trimmed_blocks;
+		uint64_t remote_recycles;
+		size_t memory_budget;
+	};
+
+	struct Stats {
+		size_t used_memory;
+		size_t total_memory;
+		size_t peak_total_memory;
+		size_t memory_budget;
+		unsigned int numa_node_count;
+		FixedArray<PoolStats, POOL_COUNT> pools;
+	};
+
 	static void create_singleton();
 	static void destroy_singleton();
 	static VoxelMemoryPool &get_singleton();
@@ -62,8 +153,32 @@ public:
 	uint8_t *allocate(size_t size);
 	void recycle(uint8_t *block, size_t size);
 
+	// Gets the `BLOCK_USER_HEADER_SIZE` bytes right before a block returned by `allocate`, which its owner can use
+	// until the block is recycled. They are aligned to 8 bytes, and their content is undefined after allocation.
+	static inline uint8_t *get_block_user_header(uint8_t *block) {
+		return block - BLOCK_USER_HEADER_SIZE;
+	}
+
 	void clear_unused_blocks();
 
+	// Sets how many bytes the pool can own in total before starting to release free blocks. 0 means no limit.
+	// This is a high-water mark checked by `trim`. Used blocks cannot be released, so it may still be exceeded.
+	void set_memory_budget(size_t bytes);
+	size_t get_memory_budget() const;
+
+	// Sets how many bytes blocks of a given size class can use before free ones get released. 0 means no limit.
+	// Blocks recycled while the budget is exceeded are released immediately.
+	void set_pool_memory_budget(unsigned int pool_index, size_t bytes);
+	// Convenience to set the same budget for every size class
+	void set_pools_memory_budget(size_t bytes);
+
+	// Releases free blocks if budgets are exceeded, starting with those that were not used since the last call.
+	// Meant to be called periodically. Blocks cached by threads can't be released by this call, but if a budget was
+	// exceeded, threads give them back to the shared pool the next time they allocate or recycle.
+	void trim();
+
+	Stats get_stats();
+
 	void debug_print();
 	unsigned int debug_get_used_blocks() const;
 	size_t debug_get_used_memory() const;
@@ -72,6 +187,34 @@ public:
 private:
 	void clear();
 
+	static ThreadCache &get_thread_cache();
+	ThreadCache &get_bound_thread_cache();
+	void flush_thread_cache(ThreadCache &cache);
+
+	// Moves up to `count` blocks from the shared pool into the magazine. Returns how many were moved.
+	unsigned int refill_magazine(unsigned int pot, ThreadCache::Magazine &magazine, unsigned int count);
+	// Moves blocks from the magazine into the shared pool, until it contains `keep_count` blocks.
+	void flush_magazine(unsigned int pot, ThreadCache::Magazine &magazine, unsigned int keep_count);
+	// Frees the `count` oldest free blocks of a node in a pool. Its mutex must be locked. Returns how many were freed.
+	size_t release_oldest_free_blocks(unsigned int pot, unsigned int node, size_t count);
+	bool is_over_budget(const Pool &pool, unsigned int pot) const;
+	size_t get_free_block_count(const Pool &pool) const;
+
+	inline unsigned int get_current_numa_node() const {
+		return _numa_node_count == 1 ? 0 : math::min(Thread::get_current_numa_node(), _numa_node_count - 1);
+	}
+
+	inline unsigned int get_block_numa_node(const uint8_t *block) const {
+		return _numa_node_count == 1 ? 0 : *(block - BLOCK_HEADER_SIZE);
+	}
+
+	void free_pooled_block(uint8_t *block) const;
+
+	static inline unsigned int get_magazine_capacity(unsigned int pot) {
+		const size_t max_blocks = MAGAZINE_MAX_BYTES >> pot;
+		return max_blocks < MAGAZINE_CAPACITY ? max_blocks : MAGAZINE_CAPACITY;
+	}
+
 	inline size_t get_highest_supported_size() const {
 		return size_t(1) << (_pot_pools.size() - 1);
 	}
@@ -88,18 +231,23 @@ private:
 		return size_t(1) << i;
 	}
 
-	// We handle allocations with up to 2^20 = 1,048,576 bytes.
-	// This is chosen based on practical needs.
 	// Each slot in this array corresponds to allocations
 	// that contain 2^index bytes in them.
-	FixedArray<Pool, 21> _pot_pools;
+	FixedArray<Pool, POOL_COUNT> _pot_pools;
 #ifdef DEBUG_ENABLED
 	DebugUsedBlocks _debug_nonpooled_used_blocks;
 #endif
 
 	std::atomic_uint32_t _used_blocks = 0;
-	size_t _used_memory = 0;
-	size_t _total_memory = 0;
+	std::atomic_size_t _used_memory = 0;
+	std::atomic_size_t _total_memory = 0;
+	std::atomic_size_t _peak_total_memory = 0;
+	std::atomic_size_t _memory_budget = 0;
+	// Incremented when a trim finds a budget exceeded, which tells threads to flush their magazines
+	std::atomic_uint32_t _trim_epoch = 0;
+
+	// Only set on construction
+	unsigned int _numa_node_count = 1;
 };
 
 } // namespace zylann::voxel
@@ -4,10 +4,88 @@
 #include "../util/serialization.h"
 #include "../util/string_funcs.h"
 
+#include <zstd.h>
+
+#include <algorithm>
 #include <limits>
 
 namespace zylann::voxel::CompressedData {
 
+namespace {
+
+// Zstd contexts hold sizeable tables, so they are reused by each thread
+struct ZstdContexts {
+	ZSTD_CCtx *cctx = nullptr;
+	ZSTD_DCtx *dctx = nullptr;
+
+	~ZstdContexts() {
+		if (cctx != nullptr) {
+			ZSTD_freeCCtx(cctx);
+		}
+		if (dctx != nullptr) {
+			ZSTD_freeDCtx(dctx);
+		}
+	}
+
+	ZSTD_CCtx *get_cctx() {
+		if (cctx == nullptr) {
+			cctx = ZSTD_createCCtx();
+		}
+		return cctx;
+	}
+
+	ZSTD_DCtx *get_dctx() {
+		if (dctx == nullptr) {
+			dctx = ZSTD_createDCtx();
+		}
+		return dctx;
+	}
+};
+
+thread_local ZstdContexts tls_zstd_contexts;
+
+uint32_t hash_fnv1a(Span<const uint8_t> data) {
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < data.size(); ++i) {
+		h = (h ^ data[i]) * 16777619u;
+	}
+	return h;
+}
+
+} // namespace
+
+std::shared_ptr<ZstdDictionary> ZstdDictionary::create(Span<const uint8_t> data, int compression_level) {
+	ZN_ASSERT_RETURN_V(data.size() > 0, nullptr);
+	ZN_ASSERT_RETURN_V(compression_level >= 1 && compression_level <= MAX_ZSTD_LEVEL, nullptr);
+
+	// Constructor is private
+	std::shared_ptr<ZstdDictionary> dict(new ZstdDictionary());
+	dict->_data.assign(data.data(), data.data() + data.size());
+	dict->_compression_level = compression_level;
+	dict->_id = hash_fnv1a(data);
+	if (dict->_id == 0) {
+		// 0 means no dictionary
+		dict->_id = 1;
+	}
+
+	// Zstd makes its own copy of the data
+	dict->_cdict = ZSTD_createCDict(data.data(), data.size(), compression_level);
+	ZN_ASSERT_RETURN_V_MSG(dict->_cdict != nullptr, nullptr, "Could not load Zstd compression dictionary");
+	dict->_ddict = ZSTD_createDDict(data.data(), data.size());
+	ZN_ASSERT_RETURN_V_MSG(dict->_ddict != nullptr, nullptr, "Could not load Zstd decompression dictionary");
+
+	return dict;
+}
+
+ZstdDictionary::~ZstdDictionary() {
+	if (_cdict != nullptr) {
+		ZSTD_freeCDict(_cdict);
+	}
+	if (_ddict != nullptr) {
+		ZSTD_freeDDict(_ddict);
+	}
+}
+
 bool decompress_lz4(MemoryReader &f, Span<const uint8_t> src, std::vector<uint8_t> &dst) {
 	const uint32_t decompressed_size = f.get_32();
 	const uint32_t header_size = sizeof(uint8_t) + sizeof(uint32_t);
@@ -26,7 +104,43 @@ bool decompress_lz4(MemoryReader &f, Span<const uint8_t> src, std::vector<uint8_
 	return true;
 }
 
-bool decompress(Span<const uint8_t> src, std::vector<uint8_t> &dst) {
+bool decompress_zstd(MemoryReader &f, Span<const uint8_t> src, std::vector<uint8_t> &dst,
+		const ZstdDictionary *zstd_dictionary) {
+	const uint32_t header_size = sizeof(uint8_t) + 2 * sizeof(uint32_t);
+	ZN_ASSERT_RETURN_V(src.size() >= header_size, false);
+
+	const uint32_t decompressed_size = f.get_32();
+	const uint32_t dictionary_id = f.get_32();
+
+	ZSTD_DCtx *dctx = tls_zstd_contexts.get_dctx();
+	ZN_ASSERT_RETURN_V(dctx != nullptr, false);
+
+	dst.resize(decompressed_size);
+
+	size_t actually_decompressed_size;
+	if (dictionary_id == 0) {
+		actually_decompressed_size = ZSTD_decompressDCtx(
+				dctx, dst.data(), dst.size(), src.data() + header_size, src.size() - header_size);
+	} else {
+		ZN_ASSERT_RETURN_V_MSG(zstd_dictionary != nullptr, false,
+				format("Data was compressed with Zstd dictionary {}, which is not available", dictionary_id));
+		ZN_ASSERT_RETURN_V_MSG(zstd_dictionary->get_id() == dictionary_id, false,
+				format("Data was compressed with Zstd dictionary {}, but the available one is {}", dictionary_id,
+						zstd_dictionary->get_id()));
+		actually_decompressed_size = ZSTD_decompress_usingDDict(dctx, dst.data(), dst.size(),
+				src.data() + header_size, src.size() - header_size, zstd_dictionary->get_ddict());
+	}
+
+	ZN_ASSERT_RETURN_V_MSG(!ZSTD_isError(actually_decompressed_size), false,
+			format("Zstd decompression error: {}", ZSTD_getErrorName(actually_decompressed_size)));
+
+	ZN_ASSERT_RETURN_V_MSG(actually_decompressed_size == decompressed_size, false,
+			format("Expected {} bytes, obtained {}", decompressed_size, actually_decompressed_size));
+
+	return true;
+}
+
+bool decompress(Span<const uint8_t> src, std::vector<uint8_t> &dst, const ZstdDictionary *zstd_dictionary) {
 	ZN_PROFILE_SCOPE();
 
 	MemoryReader f(src, ENDIANESS_LITTLE_ENDIAN);
@@ -52,6 +166,10 @@ bool decompress(Span<const uint8_t> src, std::vector<uint8_t> &dst) {
 			ZN_ASSERT_RETURN_V(decompress_lz4(f, src, dst), false);
 			break;
 
+		case COMPRESSION_ZSTD:
+			ZN_ASSERT_RETURN_V(decompress_zstd(f, src, dst, zstd_dictionary), false);
+			break;
+
 		default:
 			ZN_PRINT_ERROR("Invalid compression header");
 			return false;
@@ -79,9 +197,47 @@ bool compress_lz4(MemoryWriter &f, Span<const uint8_t> src, std::vector<uint8_t>
 	return true;
 }
 
+bool compress_zstd(MemoryWriter &f, Span<const uint8_t> src, std::vector<uint8_t> &dst, int level,
+		const ZstdDictionary *zstd_dictionary) {
+	ZN_ASSERT_RETURN_V(src.size() <= std::numeric_limits<uint32_t>::max(), false);
+
+	ZSTD_CCtx *cctx = tls_zstd_contexts.get_cctx();
+	ZN_ASSERT_RETURN_V(cctx != nullptr, false);
+
+	f.store_32(src.size());
+	f.store_32(zstd_dictionary != nullptr ? zstd_dictionary->get_id() : 0);
+
+	const uint32_t header_size = sizeof(uint8_t) + 2 * sizeof(uint32_t);
+	dst.resize(header_size + ZSTD_compressBound(src.size()));
+
+	size_t compressed_size;
+	if (zstd_dictionary == nullptr) {
+		compressed_size = ZSTD_compressCCtx(
+				cctx, dst.data() + header_size, dst.size() - header_size, src.data(), src.size(), level);
+	} else {
+		compressed_size = ZSTD_compress_usingCDict(cctx, dst.data() + header_size, dst.size() - header_size,
+				src.data(), src.size(), zstd_dictionary->get_cdict());
+	}
+
+	ZN_ASSERT_RETURN_V_MSG(!ZSTD_isError(compressed_size), false,
+			format("Zstd compression error: {}", ZSTD_getErrorName(compressed_size)));
+
+	dst.resize(header_size + compressed_size);
+
+	return true;
+}
+
 bool compress(Span<const uint8_t> src, std::vector<uint8_t> &dst, Compression comp) {
+	Settings settings;
+	settings.compression = comp;
+	return compress(src, dst, settings);
+}
+
+bool compress(Span<const uint8_t> src, std::vector<uint8_t> &dst, const Settings &settings) {
 	ZN_PROFILE_SCOPE();
 
+	const Compression comp = settings.compression;
+
 	switch (comp) {
 		case COMPRESSION_NONE: {
 			dst.resize(src.size() + 1);
@@ -106,6 +262,14 @@ bool compress(Span<const uint8_t> src, std::vector<uint8_t> &dst, Compression co
 			compress_lz4(f, src, dst);
 		} break;
 
+		case COMPRESSION_ZSTD: {
+			dst.clear();
+			MemoryWriter f(dst, ENDIANESS_LITTLE_ENDIAN);
+			f.store_8(comp);
+			ZN_ASSERT_RETURN_V(
+					compress_zstd(f, src, dst, settings.zstd_level, settings.zstd_dictionary.get()), false);
+		} break;
+
 		default:
 			ZN_PRINT_ERROR("Invalid compression header");
 			return false;
@@ -114,4 +278,144 @@ bool compress(Span<const uint8_t> src, std::vector<uint8_t> &dst, Compression co
 	return true;
 }
 
+// Simplified version of the COVER algorithm used by Zstd's dictionary builder (which Godot doesn't ship):
+// "Effective Construction of Relative Lempel-Ziv Dictionaries", Liao, Petri, Moffat, Wirth.
+// Samples are split into epochs, and from each epoch we pick the segment containing the most d-mers (short byte
+// sequences) that appear in many different samples. D-mers of picked segments are no longer counted, so the next
+// segments bring something new.
+bool train_zstd_dictionary(
+		const std::vector<std::vector<uint8_t>> &samples, unsigned int max_size, std::vector<uint8_t> &out_dictionary) {
+	ZN_PROFILE_SCOPE();
+
+	// D-mer length and segment length
+	const unsigned int d = 8;
+	const unsigned int k = 64;
+	// D-mers are counted in a hash table rather than exactly, collisions are acceptable
+	const unsigned int table_size_po2 = 20;
+	const uint32_t invalid_dmer = std::numeric_limits<uint32_t>::max();
+
+	ZN_ASSERT_RETURN_V(max_size >= k, false);
+
+	size_t total_size = 0;
+	for (const std::vector<uint8_t> &sample : samples) {
+		total_size += sample.size();
+	}
+	ZN_ASSERT_RETURN_V_MSG(total_size >= 2 * k, false, "Not enough sample data to train a dictionary");
+
+	// Concatenate samples, and hash the d-mer starting at each position.
+	// D-mers overlapping two samples are invalid.
+	std::vector<uint8_t> data;
+	std::vector<uint32_t> dmers;
+	data.reserve(total_size);
+	dmers.resize(total_size, invalid_dmer);
+
+	std::vector<uint32_t> frequencies;
+	std::vector<uint32_t> last_sample;
+	frequencies.resize(1 << table_size_po2, 0);
+	last_sample.resize(1 << table_size_po2, 0);
+
+	for (size_t sample_index = 0; sample_index < samples.size(); ++sample_index) {
+		const std::vector<uint8_t> &sample = samples[sample_index];
+		const size_t begin = data.size();
+		data.insert(data.end(), sample.begin(), sample.end());
+
+		for (size_t i = 0; i + d <= sample.size(); ++i) {
+			uint64_t v;
+			memcpy(&v, sample.data() + i, sizeof(v));
+			const uint32_t h = (v * 0xCF1BBCDCB7A56463ull) >> (64 - table_size_po2);
+			dmers[begin + i] = h;
+			// Count each d-mer once per sample: we want what samples have in common
+			if (last_sample[h] != sample_index + 1) {
+				last_sample[h] = sample_index + 1;
+				++frequencies[h];
+			}
+		}
+	}
+
+	// Tracks which d-mers are in the current window, so each only counts once
+	std::vector<uint16_t> active;
+	active.resize(1 << table_size_po2, 0);
+
+	const unsigned int epoch_count = std::max(1u, unsigned(std::min<size_t>(max_size / k, data.size() / k)));
+	const size_t epoch_size = data.size() / epoch_count;
+
+	std::vector<size_t> segments;
+	size_t dictionary_size = 0;
+	bool found = true;
+
+	while (found && dictionary_size + k <= max_size) {
+		found = false;
+
+		for (unsigned int epoch_index = 0; epoch_index < epoch_count && dictionary_size + k <= max_size;
+				++epoch_index) {
+			const size_t epoch_begin = epoch_index * epoch_size;
+			const size_t epoch_end = std::min(epoch_begin + epoch_size, data.size());
+			if (epoch_end - epoch_begin < k) {
+				continue;
+			}
+
+			// Slide a window of `k` bytes, which contains `k - d + 1` d-mers
+			uint64_t score = 0;
+			uint64_t best_score = 0;
+			size_t best_begin = 0;
+
+			for (size_t i = epoch_begin; i + d <= epoch_end; ++i) {
+				const uint32_t h_in = dmers[i];
+				if (h_in != invalid_dmer) {
+					if (active[h_in]++ == 0) {
+						score += frequencies[h_in];
+					}
+				}
+				if (i >= epoch_begin + k - d + 1) {
+					const uint32_t h_out = dmers[i - (k - d + 1)];
+					if (h_out != invalid_dmer) {
+						if (--active[h_out] == 0) {
+							score -= frequencies[h_out];
+						}
+					}
+				}
+				if (i + 1 >= epoch_begin + k - d + 1 && score > best_score) {
+					best_score = score;
+					best_begin = i + 1 - (k - d + 1);
+				}
+			}
+
+			// Reset window
+			for (size_t i = epoch_begin; i + d <= epoch_end; ++i) {
+				const uint32_t h = dmers[i];
+				if (h != invalid_dmer) {
+					active[h] = 0;
+				}
+			}
+
+			// D-mers found in a single sample don't help
+			if (best_score <= k - d + 1) {
+				continue;
+			}
+
+			for (size_t i = best_begin; i < best_begin + k - d + 1; ++i) {
+				const uint32_t h = dmers[i];
+				if (h != invalid_dmer) {
+					frequencies[h] = 0;
+				}
+			}
+
+			segments.push_back(best_begin);
+			dictionary_size += k;
+			found = true;
+		}
+	}
+
+	ZN_ASSERT_RETURN_V_MSG(segments.size() > 0, false, "Samples don't have enough in common to train a dictionary");
+
+	// Zstd refers to the end of the dictionary with shorter offsets, so the best segments go last
+	out_dictionary.clear();
+	out_dictionary.reserve(dictionary_size);
+	for (auto it = segments.rbegin(); it != segments.rend(); ++it) {
+		out_dictionary.insert(out_dictionary.end(), data.begin() + *it, data.begin() + *it + k);
+	}
+
+	return true;
+}
+
 } // namespace zylann::voxel::CompressedData
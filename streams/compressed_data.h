@@ -1,8 +1,14 @@
 #ifndef VOXEL_COMPRESSED_DATA_H
 #define VOXEL_COMPRESSED_DATA_H
 
+#include "../util/non_copyable.h"
 #include "../util/span.h"
 #include <cstdint>
+#include <memory>
+#include <vector>
+
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
 
 namespace zylann::voxel::CompressedData {
 
@@ -22,11 +28,74 @@ enum Compression {
 	// All following bytes are compressed data using LZ4 defaults.
 	// This is the fastest compression format.
 	COMPRESSION_LZ4 = 2,
-	COMPRESSION_COUNT = 3
+	// The next uint32_t will be the size of decompressed data (little endian).
+	// The next uint32_t is the ID of the dictionary used to compress, or 0 if none was used.
+	// All following bytes are a Zstandard frame.
+	// Slower than LZ4, but compresses better, especially small buffers with a dictionary.
+	COMPRESSION_ZSTD = 3,
+	COMPRESSION_COUNT = 4
+};
+
+static const int DEFAULT_ZSTD_LEVEL = 3;
+static const int MAX_ZSTD_LEVEL = 19;
+
+// Data compressed buffers can refer to, so small buffers which look alike compress better than they would alone.
+// The same dictionary must be used to decompress. It can be used by multiple threads at once.
+class ZstdDictionary : public NonCopyable {
+public:
+	// Returns null if the dictionary could not be loaded
+	static std::shared_ptr<ZstdDictionary> create(Span<const uint8_t> data, int compression_level);
+
+	~ZstdDictionary();
+
+	// Identifies the content of the dictionary, so buffers can't be decompressed with another one. Never 0.
+	uint32_t get_id() const {
+		return _id;
+	}
+
+	int get_compression_level() const {
+		return _compression_level;
+	}
+
+	Span<const uint8_t> get_data() const {
+		return to_span_const(_data);
+	}
+
+	const ZSTD_CDict_s *get_cdict() const {
+		return _cdict;
+	}
+
+	const ZSTD_DDict_s *get_ddict() const {
+		return _ddict;
+	}
+
+private:
+	ZstdDictionary() {}
+
+	std::vector<uint8_t> _data;
+	uint32_t _id = 0;
+	int _compression_level = DEFAULT_ZSTD_LEVEL;
+	ZSTD_CDict_s *_cdict = nullptr;
+	ZSTD_DDict_s *_ddict = nullptr;
+};
+
+struct Settings {
+	Compression compression = COMPRESSION_LZ4;
+	// Only used with Zstd. If there is a dictionary, its own level is used instead.
+	int zstd_level = DEFAULT_ZSTD_LEVEL;
+	std::shared_ptr<ZstdDictionary> zstd_dictionary;
 };
 
 bool compress(Span<const uint8_t> src, std::vector<uint8_t> &dst, Compression comp);
-bool decompress(Span<const uint8_t> src, std::vector<uint8_t> &dst);
+bool compress(Span<const uint8_t> src, std::vector<uint8_t> &dst, const Settings &settings);
+// A dictionary is only needed for data which was compressed with one
+bool decompress(Span<const uint8_t> src, std::vector<uint8_t> &dst, const ZstdDictionary *zstd_dictionary = nullptr);
+
+// Builds a dictionary from samples of the data it will be used with, of at most `max_size` bytes.
+// It uses zstd's raw content format: it is made of the most common segments found among samples, with the most common
+// ones at the end, where they are the cheapest to refer to.
+bool train_zstd_dictionary(
+		const std::vector<std::vector<uint8_t>> &samples, unsigned int max_size, std::vector<uint8_t> &out_dictionary);
 
 } // namespace zylann::voxel::CompressedData
 
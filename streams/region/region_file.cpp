@@ -2,16 +2,23 @@
 #include "../../streams/voxel_block_serializer.h"
 #include "../../util/godot/funcs.h"
 #include "../../util/log.h"
+#include "../../util/math/box3i.h"
+#include "../../util/math/funcs.h"
 #include "../../util/profiling.h"
+#include "../../util/serialization.h"
 #include "../../util/string_funcs.h"
 #include "../file_utils.h"
+#include <core/io/dir_access.h>
 #include <core/io/file_access.h>
 #include <algorithm>
 
 namespace zylann::voxel {
 
 namespace {
-const uint8_t FORMAT_VERSION = 3;
+const uint8_t FORMAT_VERSION = 4;
+
+// Version 3 is like 4, but blocks are contiguous. There can't be free sectors between them.
+const uint8_t FORMAT_VERSION_LEGACY_3 = 3;
 
 // Version 2 is like 3, but does not include any format information
 const uint8_t FORMAT_VERSION_LEGACY_2 = 2;
@@ -106,6 +113,46 @@ static bool save_header(
 	return true;
 }
 
+// Reads the format following the version, from `FileAccess` or `MemoryReader`
+template <typename Reader_T>
+static bool load_format(Reader_T &f, RegionFormat &out_format) {
+	out_format.block_size_po2 = f.get_8();
+
+	out_format.region_size.x = f.get_8();
+	out_format.region_size.y = f.get_8();
+	out_format.region_size.z = f.get_8();
+
+	for (unsigned int i = 0; i < out_format.channel_depths.size(); ++i) {
+		const uint8_t d = f.get_8();
+		ERR_FAIL_COND_V(d >= VoxelBufferInternal::DEPTH_COUNT, false);
+		out_format.channel_depths[i] = static_cast<VoxelBufferInternal::Depth>(d);
+	}
+
+	out_format.sector_size = f.get_16();
+
+	const uint8_t palette_size = f.get_8();
+	if (palette_size == 0xff) {
+		out_format.has_palette = true;
+		for (unsigned int i = 0; i < out_format.palette.size(); ++i) {
+			Color8 c;
+			c.r = f.get_8();
+			c.g = f.get_8();
+			c.b = f.get_8();
+			c.a = f.get_8();
+			out_format.palette[i] = c;
+		}
+
+	} else if (palette_size == 0x00) {
+		out_format.has_palette = false;
+
+	} else {
+		ERR_PRINT(String("Unexpected palette value: {0}").format(varray(palette_size)));
+		return false;
+	}
+
+	return true;
+}
+
 static bool load_header(
 		FileAccess &f, uint8_t &out_version, RegionFormat &out_format, std::vector<RegionBlockInfo> &out_block_infos) {
 	ERR_FAIL_COND_V(f.get_position() != 0, false);
@@ -118,40 +165,8 @@ static bool load_header(
 
 	const uint8_t version = f.get_8();
 
-	if (version == FORMAT_VERSION) {
-		out_format.block_size_po2 = f.get_8();
-
-		out_format.region_size.x = f.get_8();
-		out_format.region_size.y = f.get_8();
-		out_format.region_size.z = f.get_8();
-
-		for (unsigned int i = 0; i < out_format.channel_depths.size(); ++i) {
-			const uint8_t d = f.get_8();
-			ERR_FAIL_COND_V(d >= VoxelBufferInternal::DEPTH_COUNT, false);
-			out_format.channel_depths[i] = static_cast<VoxelBufferInternal::Depth>(d);
-		}
-
-		out_format.sector_size = f.get_16();
-
-		const uint8_t palette_size = f.get_8();
-		if (palette_size == 0xff) {
-			out_format.has_palette = true;
-			for (unsigned int i = 0; i < out_format.palette.size(); ++i) {
-				Color8 c;
-				c.r = f.get_8();
-				c.g = f.get_8();
-				c.b = f.get_8();
-				c.a = f.get_8();
-				out_format.palette[i] = c;
-			}
-
-		} else if (palette_size == 0x00) {
-			out_format.has_palette = false;
-
-		} else {
-			ERR_PRINT(String("Unexpected palette value: {0}").format(varray(palette_size)));
-			return false;
-		}
+	if (version == FORMAT_VERSION || version == FORMAT_VERSION_LEGACY_3) {
+		ERR_FAIL_COND_V(!load_format(f, out_format), false);
 	}
 
 	out_version = version;
@@ -222,39 +237,8 @@ Error RegionFile::open(const String &fpath, bool create_if_not_found) {
 
 	_file_access = f;
 
-	// Precalculate location of sectors and which block they contain.
-	// This will be useful to know when sectors get moved on insertion and removal
-
-	struct BlockInfoAndIndex {
-		RegionBlockInfo b;
-		unsigned int i;
-	};
-
-	// Filter only present blocks and keep the index around because it represents the 3D position of the block
-	std::vector<BlockInfoAndIndex> blocks_sorted_by_offset;
-	for (unsigned int i = 0; i < _header.blocks.size(); ++i) {
-		const RegionBlockInfo b = _header.blocks[i];
-		if (b.data != 0) {
-			BlockInfoAndIndex p;
-			p.b = b;
-			p.i = i;
-			blocks_sorted_by_offset.push_back(p);
-		}
-	}
-
-	std::sort(blocks_sorted_by_offset.begin(), blocks_sorted_by_offset.end(),
-			[](const BlockInfoAndIndex &a, const BlockInfoAndIndex &b) {
-				return a.b.get_sector_index() < b.b.get_sector_index();
-			});
-
-	CRASH_COND(_sectors.size() != 0);
-	for (unsigned int i = 0; i < blocks_sorted_by_offset.size(); ++i) {
-		const BlockInfoAndIndex b = blocks_sorted_by_offset[i];
-		Vector3i bpos = get_block_position_from_index(b.i);
-		for (unsigned int j = 0; j < b.b.get_sector_count(); ++j) {
-			_sectors.push_back(bpos);
-		}
-	}
+	// Find which sectors are free, so they can be reused when blocks are saved
+	update_free_sectors();
 
 #ifdef DEBUG_ENABLED
 	debug_check();
@@ -277,10 +261,20 @@ Error RegionFile::close() {
 		}
 		_file_access.unref();
 	}
-	_sectors.clear();
+	_free_sectors.clear();
+	_sector_count = 0;
 	return err;
 }
 
+Error RegionFile::flush() {
+	ERR_FAIL_COND_V(_file_access == nullptr, ERR_FILE_CANT_WRITE);
+	if (_header_modified) {
+		ERR_FAIL_COND_V(!save_header(**_file_access), ERR_FILE_CANT_WRITE);
+	}
+	_file_access->flush();
+	return OK;
+}
+
 bool RegionFile::is_open() const {
 	return _file_access != nullptr;
 }
@@ -358,41 +352,37 @@ Error RegionFile::save_block(Vector3i position, VoxelBufferInternal &block) {
 	ERR_FAIL_COND_V(lut_index >= _header.blocks.size(), ERR_INVALID_PARAMETER);
 	RegionBlockInfo &block_info = _header.blocks[lut_index];
 
-	if (block_info.data == 0) {
-		// The block isn't in the file yet, append at the end
+	const unsigned int sector_size = _header.format.sector_size;
 
-		const unsigned int end_offset = _blocks_begin_offset + _sectors.size() * _header.format.sector_size;
-		f.seek(end_offset);
-		const unsigned int block_offset = f.get_position();
-		// Check position matches the sectors rule
-		CRASH_COND((block_offset - _blocks_begin_offset) % _header.format.sector_size != 0);
+	if (block_info.data == 0) {
+		// The block isn't in the file yet, write it in free sectors or append it at the end
 
 		BlockSerializer::SerializeResult res = BlockSerializer::serialize_and_compress(block);
 		ERR_FAIL_COND_V(!res.success, ERR_INVALID_PARAMETER);
-		f.store_32(res.data.size());
 		const unsigned int written_size = sizeof(uint32_t) + res.data.size();
+		const uint32_t sector_count = get_sector_count_from_bytes(written_size);
+		const uint32_t sector_index = allocate_sectors(sector_count);
+
+		const size_t block_offset = _blocks_begin_offset + sector_index * sector_size;
+		f.seek(block_offset);
+
+		f.store_32(res.data.size());
 		f.store_buffer(res.data.data(), res.data.size());
 
-		const unsigned int end_pos = f.get_position();
+		const size_t end_pos = f.get_position();
 		CRASH_COND_MSG(written_size != (end_pos - block_offset),
 				String("written_size: {0}, block_offset: {1}, end_pos: {2}")
 						.format(varray(written_size, block_offset, end_pos)));
 		pad_to_sector_size(f);
 
-		block_info.set_sector_index((block_offset - _blocks_begin_offset) / _header.format.sector_size);
-		block_info.set_sector_count(get_sector_count_from_bytes(written_size));
-
-		for (unsigned int i = 0; i < block_info.get_sector_count(); ++i) {
-			_sectors.push_back(position);
-		}
+		block_info.set_sector_index(sector_index);
+		block_info.set_sector_count(sector_count);
 
 		_header_modified = true;
 
 	} else {
 		// The block is already in the file
 
-		CRASH_COND(_sectors.size() == 0);
-
 		const int old_sector_index = block_info.get_sector_index();
 		const int old_sector_count = block_info.get_sector_count();
 		CRASH_COND(old_sector_count < 1);
@@ -409,12 +399,12 @@ Error RegionFile::save_block(Vector3i position, VoxelBufferInternal &block) {
 			// We can write the block at the same spot
 
 			if (new_sector_count < old_sector_count) {
-				// The block now uses less sectors, we can compact others.
-				remove_sectors_from_block(position, old_sector_count - new_sector_count);
+				// The block now uses less sectors, the last ones become free
+				free_sectors(old_sector_index + new_sector_count, old_sector_count - new_sector_count);
 				_header_modified = true;
 			}
 
-			const size_t block_offset = _blocks_begin_offset + old_sector_index * _header.format.sector_size;
+			const size_t block_offset = _blocks_begin_offset + old_sector_index * sector_size;
 			f.seek(block_offset);
 
 			f.store_32(data.size());
@@ -424,15 +414,13 @@ Error RegionFile::save_block(Vector3i position, VoxelBufferInternal &block) {
 			CRASH_COND(written_size != (end_pos - block_offset));
 
 		} else {
-			// The block now uses more sectors, we have to move others.
-			// Note: we could shift blocks forward, but we can also remove the block entirely and rewrite it at the end.
-			// Need to investigate if it's worth implementing forward shift instead.
-			// TODO Prefer doing an end swap kind of thing?
-
-			// This also shifts the rest of the file so the freed sectors may get re-occupied.
-			remove_sectors_from_block(position, old_sector_count);
+			// The block now uses more sectors, it has to move to free sectors large enough, or to the end of the file.
+			// Its current sectors are freed first, so it can stay at the same spot if the sectors following it are
+			// free too. Other blocks never move.
+			free_sectors(old_sector_index, old_sector_count);
+			const uint32_t sector_index = allocate_sectors(new_sector_count);
 
-			const size_t block_offset = _blocks_begin_offset + _sectors.size() * _header.format.sector_size;
+			const size_t block_offset = _blocks_begin_offset + sector_index * sector_size;
 			f.seek(block_offset);
 
 			f.store_32(data.size());
@@ -443,10 +431,7 @@ Error RegionFile::save_block(Vector3i position, VoxelBufferInternal &block) {
 
 			pad_to_sector_size(f);
 
-			block_info.set_sector_index(_sectors.size());
-			for (int i = 0; i < new_sector_count; ++i) {
-				_sectors.push_back(Vector3u16(position));
-			}
+			block_info.set_sector_index(sector_index);
 
 			_header_modified = true;
 		}
@@ -471,78 +456,206 @@ void RegionFile::pad_to_sector_size(FileAccess &f) {
 	}
 }
 
-void RegionFile::remove_sectors_from_block(Vector3i block_pos, unsigned int p_sector_count) {
-	ZN_PROFILE_SCOPE();
+void RegionFile::update_free_sectors() {
+	std::vector<SectorRange> used_sectors;
+	for (unsigned int i = 0; i < _header.blocks.size(); ++i) {
+		const RegionBlockInfo b = _header.blocks[i];
+		if (b.data != 0) {
+			used_sectors.push_back(SectorRange{ b.get_sector_index(), b.get_sector_count() });
+		}
+	}
 
-	// Removes sectors from a block, starting from the last ones.
-	// So if a block has 5 sectors and we remove 2, the first 3 will be preserved.
-	// Then all following sectors are moved earlier in the file to fill the gap.
+	std::sort(used_sectors.begin(), used_sectors.end(),
+			[](const SectorRange &a, const SectorRange &b) { return a.index < b.index; });
+
+	// Gaps between blocks are free
+	_free_sectors.clear();
+	uint32_t end_index = 0;
+	for (unsigned int i = 0; i < used_sectors.size(); ++i) {
+		const SectorRange r = used_sectors[i];
+		if (r.index > end_index) {
+			_free_sectors.push_back(SectorRange{ end_index, r.index - end_index });
+		} else if (r.index < end_index) {
+			ZN_PRINT_ERROR(format("Region file {}: blocks overlap at sector {}", _file_path, r.index));
+		}
+		end_index = math::max(end_index, r.index + r.count);
+	}
+	_sector_count = end_index;
+}
 
-	CRASH_COND(_file_access == nullptr);
-	CRASH_COND(p_sector_count <= 0);
+uint32_t RegionFile::allocate_sectors(uint32_t sector_count) {
+	CRASH_COND(sector_count == 0);
+
+	// First fit, so blocks tend to fill the beginning of the file
+	for (unsigned int i = 0; i < _free_sectors.size(); ++i) {
+		SectorRange &r = _free_sectors[i];
+		if (r.count >= sector_count) {
+			const uint32_t sector_index = r.index;
+			r.index += sector_count;
+			r.count -= sector_count;
+			if (r.count == 0) {
+				_free_sectors.erase(_free_sectors.begin() + i);
+			}
+			return sector_index;
+		}
+	}
 
-	FileAccess &f = **_file_access;
-	const unsigned int sector_size = _header.format.sector_size;
-	const unsigned int old_end_offset = _blocks_begin_offset + _sectors.size() * sector_size;
+	const uint32_t sector_index = _sector_count;
+	_sector_count += sector_count;
+	return sector_index;
+}
 
-	const unsigned int block_index = get_block_index_in_header(block_pos);
-	CRASH_COND(block_index >= _header.blocks.size());
-	RegionBlockInfo &block_info = _header.blocks[block_index];
+void RegionFile::free_sectors(uint32_t sector_index, uint32_t sector_count) {
+	CRASH_COND(sector_count == 0);
+	CRASH_COND(sector_index + sector_count > _sector_count);
 
-	unsigned int src_offset =
-			_blocks_begin_offset + (block_info.get_sector_index() + block_info.get_sector_count()) * sector_size;
+	unsigned int i = std::lower_bound(_free_sectors.begin(), _free_sectors.end(), sector_index,
+							 [](const SectorRange &r, uint32_t index) { return r.index < index; }) -
+			_free_sectors.begin();
 
-	unsigned int dst_offset = src_offset - p_sector_count * sector_size;
+#ifdef DEBUG_ENABLED
+	CRASH_COND(i < _free_sectors.size() && sector_index + sector_count > _free_sectors[i].index);
+	CRASH_COND(i > 0 && _free_sectors[i - 1].index + _free_sectors[i - 1].count > sector_index);
+#endif
 
-	CRASH_COND(_sectors.size() < p_sector_count);
-	CRASH_COND(src_offset - sector_size < dst_offset);
-	CRASH_COND(block_info.get_sector_index() + p_sector_count > _sectors.size());
-	CRASH_COND(p_sector_count > block_info.get_sector_count());
-	CRASH_COND(dst_offset < _blocks_begin_offset);
+	_free_sectors.insert(_free_sectors.begin() + i, SectorRange{ sector_index, sector_count });
 
-	std::vector<uint8_t> temp;
-	temp.resize(sector_size);
+	// Merge with neighbors
+	if (i + 1 < _free_sectors.size()) {
+		SectorRange &next = _free_sectors[i + 1];
+		if (sector_index + sector_count == next.index) {
+			_free_sectors[i].count += next.count;
+			_free_sectors.erase(_free_sectors.begin() + i + 1);
+		}
+	}
+	if (i > 0) {
+		SectorRange &prev = _free_sectors[i - 1];
+		if (prev.index + prev.count == sector_index) {
+			prev.count += _free_sectors[i].count;
+			_free_sectors.erase(_free_sectors.begin() + i);
+			--i;
+		}
+	}
 
-	// TODO There might be a faster way to shrink a file
-	// Erase sectors from file
-	while (src_offset < old_end_offset) {
-		f.seek(src_offset);
-		const size_t read_bytes = f.get_buffer(temp.data(), sector_size);
-		CRASH_COND(read_bytes != sector_size); // Corrupted file
+	// Free sectors at the end are not kept, blocks get appended there anyways
+	const SectorRange &last = _free_sectors.back();
+	if (last.index + last.count == _sector_count) {
+		_sector_count = last.index;
+		_free_sectors.pop_back();
+	}
+}
 
-		f.seek(dst_offset);
-		f.store_buffer(temp.data(), sector_size);
+Error RegionFile::compact() {
+	ZN_PROFILE_SCOPE();
+	ERR_FAIL_COND_V(_file_access == nullptr, ERR_FILE_CANT_WRITE);
 
-		src_offset += sector_size;
-		dst_offset += sector_size;
+	if (_header.version != FORMAT_VERSION) {
+		ERR_FAIL_COND_V(migrate_to_latest(**_file_access) == false, ERR_UNAVAILABLE);
 	}
 
-	// TODO We need to truncate the end of the file since we effectively shortened it,
-	// but FileAccess doesn't have any function to do that... so can't rely on EOF either
+	const unsigned int sector_size = _header.format.sector_size;
+	if (_free_sectors.size() == 0 &&
+			_file_access->get_length() <= _blocks_begin_offset + uint64_t(_sector_count) * sector_size) {
+		// Already compact
+		return OK;
+	}
 
-	// Erase sectors from cache
-	_sectors.erase(_sectors.begin() + (block_info.get_sector_index() + block_info.get_sector_count() - p_sector_count),
-			_sectors.begin() + (block_info.get_sector_index() + block_info.get_sector_count()));
+	ZN_PRINT_VERBOSE(format("Compacting region file {}, {} free sectors out of {}", _file_path,
+			get_free_sector_count(), _sector_count));
 
-	const unsigned int old_sector_index = block_info.get_sector_index();
+	struct BlockInfoAndIndex {
+		RegionBlockInfo b;
+		unsigned int i;
+	};
 
-	// Reduce sectors of current block in header.
-	if (block_info.get_sector_count() > p_sector_count) {
-		block_info.set_sector_count(block_info.get_sector_count() - p_sector_count);
-	} else {
-		// Block removed
-		block_info.data = 0;
+	// Blocks stay in the same order, so blocks written close to each other remain close
+	std::vector<BlockInfoAndIndex> blocks_sorted_by_offset;
+	for (unsigned int i = 0; i < _header.blocks.size(); ++i) {
+		const RegionBlockInfo b = _header.blocks[i];
+		if (b.data != 0) {
+			blocks_sorted_by_offset.push_back(BlockInfoAndIndex{ b, i });
+		}
 	}
+	std::sort(blocks_sorted_by_offset.begin(), blocks_sorted_by_offset.end(),
+			[](const BlockInfoAndIndex &a, const BlockInfoAndIndex &b) {
+				return a.b.get_sector_index() < b.b.get_sector_index();
+			});
+
+	// Write a new file next to the current one, so the current one remains intact if something goes wrong
+	const String temp_file_path = _file_path + ".tmp";
+	Error err;
+	Ref<FileAccess> temp_f = FileAccess::open(temp_file_path, FileAccess::WRITE, &err);
+	if (temp_f.is_null()) {
+		ERR_PRINT(String("Failed to create file {0}, error {1}").format(varray(temp_file_path, err)));
+		return err;
+	}
+
+	std::vector<RegionBlockInfo> new_block_infos = _header.blocks;
+	// Block locations are not known yet, the header will be written again at the end
+	ERR_FAIL_COND_V(!zylann::voxel::save_header(**temp_f, FORMAT_VERSION, _header.format, new_block_infos),
+			ERR_FILE_CANT_WRITE);
+
+	FileAccess &f = **_file_access;
+	std::vector<uint8_t> block_data;
+	uint32_t sector_index = 0;
 
-	// Shift sector index of following blocks
-	if (old_sector_index < _sectors.size()) {
-		for (unsigned int i = 0; i < _header.blocks.size(); ++i) {
-			RegionBlockInfo &b = _header.blocks[i];
-			if (b.data != 0 && b.get_sector_index() > old_sector_index) {
-				b.set_sector_index(b.get_sector_index() - p_sector_count);
+	for (unsigned int i = 0; i < blocks_sorted_by_offset.size(); ++i) {
+		const BlockInfoAndIndex &b = blocks_sorted_by_offset[i];
+		const size_t block_size_in_bytes = b.b.get_sector_count() * sector_size;
+		block_data.resize(block_size_in_bytes);
+
+		f.seek(_blocks_begin_offset + b.b.get_sector_index() * sector_size);
+		const size_t read_size = f.get_buffer(block_data.data(), block_size_in_bytes);
+		if (read_size != block_size_in_bytes) {
+			ERR_PRINT(String("Failed to compact region file {0}: could not read block {1}")
+							  .format(varray(_file_path, get_block_position_from_index(b.i))));
+			temp_f.unref();
+			Ref<DirAccess> da = DirAccess::create_for_path(temp_file_path);
+			if (da.is_valid()) {
+				da->remove(temp_file_path);
 			}
+			return ERR_FILE_CORRUPT;
 		}
+		temp_f->store_buffer(block_data.data(), block_size_in_bytes);
+
+		new_block_infos[b.i].set_sector_index(sector_index);
+		sector_index += b.b.get_sector_count();
+	}
+
+	ERR_FAIL_COND_V(!zylann::voxel::save_header(**temp_f, FORMAT_VERSION, _header.format, new_block_infos),
+			ERR_FILE_CANT_WRITE);
+	temp_f.unref();
+
+	// Replace the current file
+	_file_access.unref();
+	Ref<DirAccess> da = DirAccess::create_for_path(_file_path);
+	ERR_FAIL_COND_V(da.is_null(), ERR_CANT_CREATE);
+	const Error rename_err = da->rename(temp_file_path, _file_path);
+	if (rename_err == OK) {
+		_header.blocks = std::move(new_block_infos);
+		_header_modified = false;
+	} else {
+		ERR_PRINT(String("Failed to replace {0} with compacted file, error {1}")
+						  .format(varray(_file_path, rename_err)));
 	}
+
+	_file_access = FileAccess::open(_file_path, FileAccess::READ_WRITE, &err);
+	ERR_FAIL_COND_V_MSG(_file_access.is_null(), err, String("Failed to reopen {0}").format(varray(_file_path)));
+	update_free_sectors();
+
+	return rename_err;
+}
+
+unsigned int RegionFile::get_sector_count() const {
+	return _sector_count;
+}
+
+unsigned int RegionFile::get_free_sector_count() const {
+	unsigned int count = 0;
+	for (unsigned int i = 0; i < _free_sectors.size(); ++i) {
+		count += _free_sectors[i].count;
+	}
+	return count;
 }
 
 bool RegionFile::save_header(FileAccess &f) {
@@ -574,12 +687,24 @@ bool RegionFile::migrate_from_v2_to_v3(FileAccess &f, RegionFormat &format) {
 	f.seek(MAGIC_AND_VERSION_SIZE);
 	insert_bytes(f, extra_bytes_needed);
 
-	f.seek(0);
+	// Not using the `save_header` method, because it would attempt to migrate again causing stack-overflow
+	ERR_FAIL_COND_V(!zylann::voxel::save_header(f, FORMAT_VERSION_LEGACY_3, format, _header.blocks), false);
+	_blocks_begin_offset = f.get_position();
+	_header.version = FORMAT_VERSION_LEGACY_3;
+
+	return true;
+}
+
+bool RegionFile::migrate_from_v3_to_v4(FileAccess &f) {
+	ZN_PRINT_VERBOSE(zylann::format("Migrating region file {} from v3 to v4", _file_path));
 
-	// Set version because otherwise `save_header` will attempt to migrate again causing stack-overflow
+	// The layout is the same, but readers of version 3 would not expect free sectors, so only the version changes.
+	// It is written now, because free sectors could appear before the header gets saved.
+	f.seek(MAGIC_AND_VERSION_SIZE - 1);
+	f.store_8(FORMAT_VERSION);
 	_header.version = FORMAT_VERSION;
 
-	return save_header(f);
+	return true;
 }
 
 bool RegionFile::migrate_to_latest(FileAccess &f) {
@@ -596,6 +721,11 @@ bool RegionFile::migrate_to_latest(FileAccess &f) {
 
 	if (version == FORMAT_VERSION_LEGACY_2) {
 		ERR_FAIL_COND_V(!migrate_from_v2_to_v3(f, _header.format), false);
+		version = FORMAT_VERSION_LEGACY_3;
+	}
+
+	if (version == FORMAT_VERSION_LEGACY_3) {
+		ERR_FAIL_COND_V(!migrate_from_v3_to_v4(f), false);
 		version = FORMAT_VERSION;
 	}
 
@@ -675,4 +805,106 @@ void RegionFile::debug_check() {
 	}
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Error RegionFileMapping::open(const String &fpath) {
+	close();
+
+	const Error map_err = _file.open(fpath);
+	if (map_err != OK) {
+		return map_err;
+	}
+
+	const Span<const uint8_t> data = _file.get_data();
+	MemoryReader reader(data, ENDIANESS_LITTLE_ENDIAN);
+
+	if (data.size() < MAGIC_AND_VERSION_SIZE + FIXED_HEADER_DATA_SIZE ||
+			memcmp(data.data(), FORMAT_REGION_MAGIC, 4) != 0) {
+		close();
+		return ERR_FILE_UNRECOGNIZED;
+	}
+	reader.pos = 4;
+
+	const uint8_t version = reader.get_8();
+	if (version != FORMAT_VERSION && version != FORMAT_VERSION_LEGACY_3) {
+		// Older versions need to be migrated, which can only be done by `RegionFile`
+		close();
+		return ERR_FILE_UNRECOGNIZED;
+	}
+
+	// The palette flag is the last byte of fixed data
+	const bool has_palette = data[MAGIC_AND_VERSION_SIZE + FIXED_HEADER_DATA_SIZE - 1] == 0xff;
+	if (has_palette && data.size() < MAGIC_AND_VERSION_SIZE + FIXED_HEADER_DATA_SIZE + PALETTE_SIZE_IN_BYTES) {
+		close();
+		return ERR_FILE_CORRUPT;
+	}
+
+	if (!load_format(reader, _format)) {
+		close();
+		return ERR_PARSE_ERROR;
+	}
+
+	const size_t block_count = Vector3iUtil::get_volume(_format.region_size);
+	_blocks_begin_offset = reader.get_position() + block_count * sizeof(RegionBlockInfo);
+	if (_blocks_begin_offset > data.size()) {
+		close();
+		return ERR_FILE_CORRUPT;
+	}
+
+	// The table is referenced directly from the mapping. Its offset is a multiple of 4 and mappings start at a page
+	// boundary, so it is aligned.
+	// TODO Deal with endianess
+	_blocks = Span<const RegionBlockInfo>(
+			reinterpret_cast<const RegionBlockInfo *>(data.data() + reader.get_position()), block_count);
+	ZN_ASSERT((reinterpret_cast<uintptr_t>(_blocks.data()) % alignof(RegionBlockInfo)) == 0);
+
+	return OK;
+}
+
+void RegionFileMapping::close() {
+	_file.close();
+	_blocks = Span<const RegionBlockInfo>();
+	_blocks_begin_offset = 0;
+}
+
+bool RegionFileMapping::is_open() const {
+	return _file.is_open();
+}
+
+const RegionFormat &RegionFileMapping::get_format() const {
+	return _format;
+}
+
+Error RegionFileMapping::load_block(Vector3i position, VoxelBufferInternal &out_block) const {
+	ZN_PROFILE_SCOPE();
+	ERR_FAIL_COND_V(!is_open(), ERR_FILE_CANT_READ);
+
+	ERR_FAIL_COND_V(!Box3i(Vector3i(), _format.region_size).contains(position), ERR_INVALID_PARAMETER);
+	const RegionBlockInfo block_info = _blocks[Vector3iUtil::get_zxy_index(position, _format.region_size)];
+
+	if (block_info.data == 0) {
+		return ERR_DOES_NOT_EXIST;
+	}
+
+	for (unsigned int channel_index = 0; channel_index < _format.channel_depths.size(); ++channel_index) {
+		out_block.set_channel_depth(channel_index, _format.channel_depths[channel_index]);
+	}
+
+	const Span<const uint8_t> data = _file.get_data();
+	const size_t block_begin = _blocks_begin_offset + size_t(block_info.get_sector_index()) * _format.sector_size;
+	ERR_FAIL_COND_V(block_begin + sizeof(uint32_t) > data.size(), ERR_FILE_CORRUPT);
+
+	MemoryReader reader(data, ENDIANESS_LITTLE_ENDIAN);
+	reader.pos = block_begin;
+	const uint32_t block_data_size = reader.get_32();
+	ERR_FAIL_COND_V(reader.pos + block_data_size > data.size(), ERR_FILE_CORRUPT);
+
+	// Decompressing straight from the mapping, no need to copy compressed data first
+	ERR_FAIL_COND_V_MSG(
+			!BlockSerializer::decompress_and_deserialize(data.sub(reader.pos, block_data_size), out_block),
+			ERR_PARSE_ERROR, String("Failed to read block {0}").format(varray(position)));
+
+	return OK;
+}
+
 } // namespace zylann::voxel
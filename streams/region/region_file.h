@@ -5,6 +5,7 @@
 #include "../../util/fixed_array.h"
 #include "../../util/math/color8.h"
 #include "../../util/math/vector3i.h"
+#include "../../util/memory_mapped_file.h"
 
 #include <core/io/file_access.h>
 #include <vector>
@@ -72,6 +73,10 @@ static_assert(sizeof(RegionBlockInfo) == 4, "Data in this struct must have a con
 // of data in memory.
 // It isn't thread-safe.
 //
+// Blocks don't have to be contiguous. When a block changes size, it may move to a range of sectors left free by other
+// blocks, or to the end of the file, leaving its previous sectors free for later saves. Free sectors are not stored
+// separately, they are the ones no block of the header covers. `compact()` can be used to get rid of them.
+//
 class RegionFile {
 public:
 	RegionFile();
@@ -79,6 +84,8 @@ public:
 
 	Error open(const String &fpath, bool create_if_not_found);
 	Error close();
+	// Writes the header if it changed, and flushes buffered writes, so the file can be read by other handles
+	Error flush();
 	bool is_open() const;
 
 	bool set_format(const RegionFormat &format);
@@ -87,6 +94,15 @@ public:
 	Error load_block(Vector3i position, VoxelBufferInternal &out_block);
 	Error save_block(Vector3i position, VoxelBufferInternal &block);
 
+	// Rewrites the file so blocks are contiguous and free sectors are removed, which also makes the file smaller.
+	// Blocks are written to a temporary file first, which then replaces the original.
+	// This can take a while on large files, so it is better done while the region is not needed, or in a thread.
+	Error compact();
+
+	// Number of sectors from the beginning of block data to the end of the last block, including free ones
+	unsigned int get_sector_count() const;
+	unsigned int get_free_sector_count() const;
+
 	unsigned int get_header_block_count() const;
 	bool has_block(Vector3i position) const;
 	bool has_block(unsigned int index) const;
@@ -104,10 +120,14 @@ private:
 	uint32_t get_sector_count_from_bytes(uint32_t size_in_bytes) const;
 
 	void pad_to_sector_size(FileAccess &f);
-	void remove_sectors_from_block(Vector3i block_pos, unsigned int p_sector_count);
+	void update_free_sectors();
+	// Finds a place for a block of the given size and returns its first sector
+	uint32_t allocate_sectors(uint32_t sector_count);
+	void free_sectors(uint32_t sector_index, uint32_t sector_count);
 
 	bool migrate_to_latest(FileAccess &f);
 	bool migrate_from_v2_to_v3(FileAccess &f, RegionFormat &format);
+	bool migrate_from_v3_to_v4(FileAccess &f);
 
 	struct Header {
 		uint8_t version = -1;
@@ -123,23 +143,42 @@ private:
 
 	Header _header;
 
-	struct Vector3u16 {
-		uint16_t x;
-		uint16_t y;
-		uint16_t z;
-
-		Vector3u16(Vector3i p) : x(p.x), y(p.y), z(p.z) {}
+	struct SectorRange {
+		uint32_t index;
+		uint32_t count;
 	};
 
-	// TODO Is it ever read?
-	// List of sectors in the order they appear in the file,
-	// and which position their block is. The same block can span multiple sectors.
-	// This is essentially a reverse table of `Header::blocks`.
-	std::vector<Vector3u16> _sectors;
+	// Ranges of sectors not used by any block, sorted by index. Adjacent ranges are merged.
+	// This is essentially the complement of `Header::blocks`, and is computed from it when the file is opened.
+	std::vector<SectorRange> _free_sectors;
+	// Sectors up to the end of the last block. The file can be longer, since it can't be truncated.
+	uint32_t _sector_count = 0;
 	uint32_t _blocks_begin_offset;
 	String _file_path;
 };
 
+// Read-only access to a region file mapped in memory. Blocks are decompressed straight from the mapped pages, and
+// since no file cursor is involved, multiple threads can load blocks at the same time.
+// It doesn't support versions older than 3, which have to be migrated by `RegionFile` first.
+// Changes made to the file afterwards are not reliably visible. If it is modified, it has to be opened again.
+class RegionFileMapping {
+public:
+	Error open(const String &fpath);
+	void close();
+	bool is_open() const;
+
+	const RegionFormat &get_format() const;
+
+	Error load_block(Vector3i position, VoxelBufferInternal &out_block) const;
+
+private:
+	MemoryMappedFile _file;
+	RegionFormat _format;
+	// Points into the mapping
+	Span<const RegionBlockInfo> _blocks;
+	size_t _blocks_begin_offset = 0;
+};
+
 } // namespace zylann::voxel
 
 #endif // REGION_FILE_H
@@ -3,6 +3,7 @@
 #include "../../util/godot/funcs.h"
 #include "../../util/log.h"
 #include "../../util/math/box3i.h"
+#include "../../util/memory.h"
 #include "../../util/profiling.h"
 #include "../../util/string_funcs.h"
 
@@ -110,11 +111,18 @@ void VoxelStreamRegionFiles::save_voxel_blocks(Span<VoxelStream::VoxelQueryData>
 	comparator.self = this;
 	get_sorted_indices(p_blocks, comparator, sorted_block_indices);
 
+	// Saved regions can only be mapped again once their header is written, so the batch is saved as a whole
+	MutexLock lock(_mutex);
+
 	for (unsigned int i = 0; i < sorted_block_indices.size(); ++i) {
 		const unsigned int bi = sorted_block_indices[i];
 		VoxelStream::VoxelQueryData &q = p_blocks[bi];
 		_save_block(q.voxel_buffer, q.origin_in_voxels, q.lod);
 	}
+
+	if (_memory_mapped_reads_enabled) {
+		flush_regions();
+	}
 }
 
 int VoxelStreamRegionFiles::get_used_channels_mask() const {
@@ -122,58 +130,83 @@ int VoxelStreamRegionFiles::get_used_channels_mask() const {
 	return VoxelBufferInternal::ALL_CHANNELS_MASK;
 }
 
+VoxelStreamRegionFiles::EmergeResult VoxelStreamRegionFiles::get_emerge_result_from_load_error(Error err) {
+	switch (err) {
+		case OK:
+			return EMERGE_OK;
+
+		case ERR_DOES_NOT_EXIST:
+			return EMERGE_OK_FALLBACK;
+
+		default:
+			return EMERGE_FAILED;
+	}
+}
+
 VoxelStreamRegionFiles::EmergeResult VoxelStreamRegionFiles::_load_block(
 		VoxelBufferInternal &out_buffer, Vector3i origin_in_voxels, int lod) {
 	ZN_PROFILE_SCOPE();
 
-	MutexLock lock(_mutex);
-
-	if (_directory_path.is_empty()) {
-		return EMERGE_OK_FALLBACK;
-	}
+	Vector3i block_rpos;
+	std::shared_ptr<MappedRegion> mapped_region;
+	{
+		MutexLock lock(_mutex);
 
-	if (!_meta_loaded) {
-		const FileResult load_res = load_meta();
-		if (load_res != FILE_OK) {
-			// No block was ever saved
+		if (_directory_path.is_empty()) {
 			return EMERGE_OK_FALLBACK;
 		}
-	}
 
-	const Vector3i block_size = Vector3iUtil::create(1 << _meta.block_size_po2);
-	const Vector3i region_size = Vector3iUtil::create(1 << _meta.region_size_po2);
+		if (!_meta_loaded) {
+			const FileResult load_res = load_meta();
+			if (load_res != FILE_OK) {
+				// No block was ever saved
+				return EMERGE_OK_FALLBACK;
+			}
+		}
 
-	CRASH_COND(!_meta_loaded);
-	ERR_FAIL_COND_V(lod >= _meta.lod_count, EMERGE_FAILED);
-	ERR_FAIL_COND_V(block_size != out_buffer.get_size(), EMERGE_FAILED);
+		const Vector3i block_size = Vector3iUtil::create(1 << _meta.block_size_po2);
+		const Vector3i region_size = Vector3iUtil::create(1 << _meta.region_size_po2);
 
-	// Configure depths, as they might not be specified in old block data.
-	// Regions are expected to contain such depths, and use those in the buffer to know how much data to read.
-	for (unsigned int channel_index = 0; channel_index < _meta.channel_depths.size(); ++channel_index) {
-		out_buffer.set_channel_depth(channel_index, _meta.channel_depths[channel_index]);
-	}
+		CRASH_COND(!_meta_loaded);
+		ERR_FAIL_COND_V(lod >= _meta.lod_count, EMERGE_FAILED);
+		ERR_FAIL_COND_V(block_size != out_buffer.get_size(), EMERGE_FAILED);
 
-	const Vector3i block_pos = get_block_position_from_voxels(origin_in_voxels) >> lod;
-	const Vector3i region_pos = get_region_position_from_blocks(block_pos);
-
-	CachedRegion *cache = open_region(region_pos, lod, false);
-	if (cache == nullptr || !cache->file_exists) {
-		return EMERGE_OK_FALLBACK;
-	}
+		// Configure depths, as they might not be specified in old block data.
+		// Regions are expected to contain such depths, and use those in the buffer to know how much data to read.
+		for (unsigned int channel_index = 0; channel_index < _meta.channel_depths.size(); ++channel_index) {
+			out_buffer.set_channel_depth(channel_index, _meta.channel_depths[channel_index]);
+		}
 
-	const Vector3i block_rpos = math::wrap(block_pos, region_size);
+		const Vector3i block_pos = get_block_position_from_voxels(origin_in_voxels) >> lod;
+		const Vector3i region_pos = get_region_position_from_blocks(block_pos);
+		block_rpos = math::wrap(block_pos, region_size);
 
-	const Error err = cache->region.load_block(block_rpos, out_buffer);
-	switch (err) {
-		case OK:
-			return EMERGE_OK;
+		if (_memory_mapped_reads_enabled) {
+			mapped_region = get_or_map_region(region_pos, lod);
+			if (mapped_region->open_error == ERR_FILE_NOT_FOUND) {
+				return EMERGE_OK_FALLBACK;
+			}
+		}
 
-		case ERR_DOES_NOT_EXIST:
-			return EMERGE_OK_FALLBACK;
+		if (mapped_region == nullptr || mapped_region->open_error != OK) {
+			CachedRegion *cache = open_region(region_pos, lod, false);
+			if (cache == nullptr || !cache->file_exists) {
+				return EMERGE_OK_FALLBACK;
+			}
+			return get_emerge_result_from_load_error(cache->region.load_block(block_rpos, out_buffer));
+		}
+	}
 
-		default:
-			return EMERGE_FAILED;
+	// Only this region must not change while the block is read, other threads can keep using the stream
+	{
+		RWLockRead rlock(mapped_region->lock);
+		if (!mapped_region->stale) {
+			return get_emerge_result_from_load_error(mapped_region->mapping.load_block(block_rpos, out_buffer));
+		}
 	}
+
+	// The region was saved since we got it, its file has to be mapped again
+	return _load_block(out_buffer, origin_in_voxels, lod);
 }
 
 void VoxelStreamRegionFiles::_save_block(VoxelBufferInternal &voxel_buffer, Vector3i origin_in_voxels, int lod) {
@@ -216,6 +249,8 @@ void VoxelStreamRegionFiles::_save_block(VoxelBufferInternal &voxel_buffer, Vect
 	Vector3i region_pos = get_region_position_from_blocks(block_pos);
 	Vector3i block_rpos = math::wrap(block_pos, region_size);
 
+	unmap_region(region_pos, lod);
+
 	CachedRegion *cache = open_region(region_pos, lod, true);
 	ERR_FAIL_COND_MSG(cache == nullptr, "Could not save region file data");
 	ERR_FAIL_COND(cache->region.save_block(block_rpos, voxel_buffer) != OK);
@@ -407,6 +442,7 @@ Vector3i VoxelStreamRegionFiles::get_region_position_from_blocks(const Vector3i
 }
 
 void VoxelStreamRegionFiles::close_all_regions() {
+	unmap_all_regions();
 	for (unsigned int i = 0; i < _region_cache.size(); ++i) {
 		CachedRegion *cache = _region_cache[i];
 		close_region(cache);
@@ -519,6 +555,103 @@ void VoxelStreamRegionFiles::close_region(CachedRegion *region) {
 	region->region.close();
 }
 
+std::shared_ptr<VoxelStreamRegionFiles::MappedRegion> VoxelStreamRegionFiles::get_or_map_region(
+		const Vector3i region_pos, unsigned int lod) {
+	ZN_PROFILE_SCOPE();
+	const uint64_t now = Time::get_singleton()->get_ticks_usec();
+
+	for (unsigned int i = 0; i < _mapped_regions.size(); ++i) {
+		const std::shared_ptr<MappedRegion> &r = _mapped_regions[i];
+		if (r->position == region_pos && r->lod == int(lod)) {
+			r->last_used = now;
+			return r;
+		}
+	}
+
+	if (_mapped_regions.size() >= _max_mapped_regions) {
+		// Loads still using the least recently used mapping keep it alive until they are done
+		unsigned int oldest_index = 0;
+		for (unsigned int i = 1; i < _mapped_regions.size(); ++i) {
+			if (_mapped_regions[i]->last_used < _mapped_regions[oldest_index]->last_used) {
+				oldest_index = i;
+			}
+		}
+		_mapped_regions[oldest_index] = _mapped_regions.back();
+		_mapped_regions.pop_back();
+	}
+
+	std::shared_ptr<MappedRegion> r = make_shared_instance<MappedRegion>();
+	r->position = region_pos;
+	r->lod = lod;
+	r->last_used = now;
+
+	const String fpath = get_region_file_path(region_pos, lod);
+	// The file may have been modified and not closed yet
+	CachedRegion *cache = get_region_from_cache(region_pos, lod);
+	if (cache != nullptr) {
+		cache->region.flush();
+	}
+	r->open_error = r->mapping.open(fpath);
+
+	if (r->open_error == OK) {
+		const RegionFormat &format = r->mapping.get_format();
+		if (format.block_size_po2 != _meta.block_size_po2 //
+				|| format.channel_depths != _meta.channel_depths //
+				|| format.region_size != Vector3iUtil::create(1 << _meta.region_size_po2) //
+				|| format.sector_size != _meta.sector_size) {
+			ERR_PRINT("Region file has unexpected format");
+			r->mapping.close();
+			r->open_error = ERR_FILE_CORRUPT;
+		}
+
+	} else if (r->open_error != ERR_FILE_NOT_FOUND) {
+		// Old versions and platforms without mapping support are read with `RegionFile` instead
+		ZN_PRINT_VERBOSE(zylann::format("Could not map region file {}, error {}", fpath, r->open_error));
+	}
+
+	_mapped_regions.push_back(r);
+	return r;
+}
+
+void VoxelStreamRegionFiles::unmap_region(const Vector3i region_pos, unsigned int lod) {
+	for (unsigned int i = 0; i < _mapped_regions.size(); ++i) {
+		std::shared_ptr<MappedRegion> r = _mapped_regions[i];
+		if (r->position == region_pos && r->lod == int(lod)) {
+			{
+				// Wait for loads reading the file, and prevent new ones
+				RWLockWrite wlock(r->lock);
+				r->stale = true;
+				r->mapping.close();
+			}
+			_mapped_regions[i] = _mapped_regions.back();
+			_mapped_regions.pop_back();
+			return;
+		}
+	}
+}
+
+void VoxelStreamRegionFiles::unmap_all_regions() {
+	for (unsigned int i = 0; i < _mapped_regions.size(); ++i) {
+		MappedRegion &r = *_mapped_regions[i];
+		RWLockWrite wlock(r.lock);
+		r.stale = true;
+		r.mapping.close();
+	}
+	_mapped_regions.clear();
+}
+
+void VoxelStreamRegionFiles::flush_regions() {
+	ZN_PROFILE_SCOPE();
+	for (unsigned int i = 0; i < _region_cache.size(); ++i) {
+		CachedRegion *cache = _region_cache[i];
+		const Error err = cache->region.flush();
+		if (err != OK) {
+			ERR_PRINT(String("Failed to flush region lod{0}/{1}, error {2}")
+							  .format(varray(cache->lod, cache->position, err)));
+		}
+	}
+}
+
 void VoxelStreamRegionFiles::close_oldest_region() {
 	// Close region assumed to be the least recently used
 
@@ -600,55 +733,13 @@ void VoxelStreamRegionFiles::_convert_files(Meta new_meta) {
 		ZN_PRINT_VERBOSE(format("Data backed up as {}", old_dir));
 	}
 
-	struct PositionAndLod {
-		Vector3i position;
-		int lod;
-	};
-
 	ERR_FAIL_COND(old_stream->load_meta() != FILE_OK);
 
 	std::vector<PositionAndLod> old_region_list;
 	Meta old_meta = old_stream->_meta;
 
 	// Get list of all regions from the old stream
-	{
-		for (int lod = 0; lod < old_meta.lod_count; ++lod) {
-			const String lod_folder =
-					old_stream->_directory_path.plus_file("regions").plus_file("lod") + String::num_int64(lod);
-			const String ext = String(".") + RegionFormat::FILE_EXTENSION;
-
-			Ref<DirAccess> da = DirAccess::open(lod_folder);
-			if (da.is_null()) {
-				continue;
-			}
-
-			da->list_dir_begin();
-
-			while (true) {
-				String fname = da->get_next();
-				if (fname == "") {
-					break;
-				}
-				if (da->current_is_dir()) {
-					continue;
-				}
-				if (fname.ends_with(ext)) {
-					Vector<String> parts = fname.split(".");
-					// r.x.y.z.ext
-					ERR_FAIL_COND_MSG(
-							parts.size() < 4, String("Found invalid region file: '{0}'").format(varray(fname)));
-					PositionAndLod p;
-					p.position.x = parts[1].to_int();
-					p.position.y = parts[2].to_int();
-					p.position.z = parts[3].to_int();
-					p.lod = lod;
-					old_region_list.push_back(p);
-				}
-			}
-
-			da->list_dir_end();
-		}
-	}
+	ERR_FAIL_COND(!old_stream->get_region_list(old_region_list));
 
 	_meta = new_meta;
 	ERR_FAIL_COND(save_meta() != FILE_OK);
@@ -861,6 +952,100 @@ void VoxelStreamRegionFiles::set_lod_count(int p_lod_count) {
 	emit_changed();
 }
 
+bool VoxelStreamRegionFiles::get_region_list(std::vector<PositionAndLod> &out_regions) const {
+	for (int lod = 0; lod < _meta.lod_count; ++lod) {
+		const String lod_folder = _directory_path.plus_file("regions").plus_file("lod") + String::num_int64(lod);
+		const String ext = String(".") + RegionFormat::FILE_EXTENSION;
+
+		Ref<DirAccess> da = DirAccess::open(lod_folder);
+		if (da.is_null()) {
+			continue;
+		}
+
+		da->list_dir_begin();
+
+		while (true) {
+			String fname = da->get_next();
+			if (fname == "") {
+				break;
+			}
+			if (da->current_is_dir()) {
+				continue;
+			}
+			if (fname.ends_with(ext)) {
+				Vector<String> parts = fname.split(".");
+				// r.x.y.z.ext
+				ERR_FAIL_COND_V_MSG(
+						parts.size() < 4, false, String("Found invalid region file: '{0}'").format(varray(fname)));
+				PositionAndLod p;
+				p.position.x = parts[1].to_int();
+				p.position.y = parts[2].to_int();
+				p.position.z = parts[3].to_int();
+				p.lod = lod;
+				out_regions.push_back(p);
+			}
+		}
+
+		da->list_dir_end();
+	}
+	return true;
+}
+
+void VoxelStreamRegionFiles::compact_files() {
+	ZN_PROFILE_SCOPE();
+	ZN_PRINT_VERBOSE("Compacting region files");
+
+	std::vector<PositionAndLod> region_list;
+	{
+		MutexLock lock(_mutex);
+		if (!_meta_loaded && load_meta() != FILE_OK) {
+			// Nothing was saved yet
+			return;
+		}
+		ERR_FAIL_COND(!get_region_list(region_list));
+	}
+
+	for (unsigned int i = 0; i < region_list.size(); ++i) {
+		const PositionAndLod region_info = region_list[i];
+		// Locking for each region, so blocks can still be loaded and saved in between when this runs in a thread
+		MutexLock lock(_mutex);
+		// Compaction replaces the file
+		unmap_region(region_info.position, region_info.lod);
+		CachedRegion *cache = open_region(region_info.position, region_info.lod, false);
+		if (cache == nullptr) {
+			continue;
+		}
+		const Error err = cache->region.compact();
+		if (err != OK) {
+			ERR_PRINT(String("Failed to compact region lod{0}/{1}, error {2}")
+							  .format(varray(region_info.lod, region_info.position, err)));
+		}
+	}
+}
+
+void VoxelStreamRegionFiles::set_memory_mapped_reads_enabled(bool enabled) {
+	MutexLock lock(_mutex);
+	if (enabled == _memory_mapped_reads_enabled) {
+		return;
+	}
+	if (enabled) {
+		// Regions may have been modified without writing their header yet
+		flush_regions();
+	} else {
+		unmap_all_regions();
+	}
+	_memory_mapped_reads_enabled = enabled;
+}
+
+bool VoxelStreamRegionFiles::is_memory_mapped_reads_enabled() const {
+	MutexLock lock(_mutex);
+	return _memory_mapped_reads_enabled;
+}
+
+bool VoxelStreamRegionFiles::supports_concurrent_access() const {
+	return is_memory_mapped_reads_enabled();
+}
+
 void VoxelStreamRegionFiles::convert_files(Dictionary d) {
 	Meta meta;
 	meta.version = _meta.version;
@@ -908,9 +1093,17 @@ void VoxelStreamRegionFiles::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("set_region_size_po2"), &VoxelStreamRegionFiles::set_region_size_po2);
 	ClassDB::bind_method(D_METHOD("set_sector_size"), &VoxelStreamRegionFiles::set_sector_size);
 
+	ClassDB::bind_method(D_METHOD("set_memory_mapped_reads_enabled", "enabled"),
+			&VoxelStreamRegionFiles::set_memory_mapped_reads_enabled);
+	ClassDB::bind_method(
+			D_METHOD("is_memory_mapped_reads_enabled"), &VoxelStreamRegionFiles::is_memory_mapped_reads_enabled);
+
 	ClassDB::bind_method(D_METHOD("convert_files", "new_settings"), &VoxelStreamRegionFiles::convert_files);
+	ClassDB::bind_method(D_METHOD("compact_files"), &VoxelStreamRegionFiles::compact_files);
 
 	ADD_PROPERTY(PropertyInfo(Variant::STRING, "directory", PROPERTY_HINT_DIR), "set_directory", "get_directory");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "memory_mapped_reads_enabled"), "set_memory_mapped_reads_enabled",
+			"is_memory_mapped_reads_enabled");
 
 	ADD_GROUP("Dimensions", "");
 	ADD_PROPERTY(PropertyInfo(Variant::INT, "lod_count"), "set_lod_count", "get_lod_count");
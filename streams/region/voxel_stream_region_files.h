@@ -3,10 +3,13 @@
 
 #include "../../util/fixed_array.h"
 #include "../../util/thread/mutex.h"
+#include "../../util/thread/rw_lock.h"
 #include "../file_utils.h"
 #include "../voxel_stream.h"
 #include "region_file.h"
 
+#include <memory>
+
 class FileAccess;
 
 namespace zylann::voxel {
@@ -19,6 +22,8 @@ namespace zylann::voxel {
 // Inspired by https://www.seedofandromeda.com/blogs/1-creating-a-region-file-system-for-a-voxel-game
 //
 // Region files are not thread-safe. Because of this, internal mutexing may often constrain the use by one thread only.
+// When memory-mapped reads are enabled, loading blocks only locks the stream to find the mapping of their region, so
+// multiple threads can decompress blocks at the same time.
 //
 class VoxelStreamRegionFiles : public VoxelStream {
 	GDCLASS(VoxelStreamRegionFiles, VoxelStream)
@@ -34,6 +39,9 @@ public:
 
 	int get_used_channels_mask() const override;
 
+	// True when memory-mapped reads are enabled. Saves are still done one at a time.
+	bool supports_concurrent_access() const override;
+
 	String get_directory() const;
 	void set_directory(String dirpath);
 
@@ -51,7 +59,14 @@ public:
 	void set_sector_size(int p_sector_size);
 	void set_lod_count(int p_lod_count);
 
+	// Loads blocks from region files mapped in memory, which allows multiple threads to load at the same time.
+	// Saving blocks still works, but they must be written to files immediately, which is more expensive.
+	void set_memory_mapped_reads_enabled(bool enabled);
+	bool is_memory_mapped_reads_enabled() const;
+
 	void convert_files(Dictionary d);
+	// Removes free space left in region files when blocks changed size. Can be called from a thread.
+	void compact_files();
 
 protected:
 	static void _bind_methods();
@@ -66,6 +81,7 @@ private:
 		EMERGE_FAILED
 	};
 
+	static EmergeResult get_emerge_result_from_load_error(Error err);
 	EmergeResult _load_block(VoxelBufferInternal &out_buffer, Vector3i origin_in_voxels, int lod);
 	void _save_block(VoxelBufferInternal &voxel_buffer, Vector3i origin_in_voxels, int lod);
 
@@ -80,6 +96,14 @@ private:
 	CachedRegion *get_region_from_cache(const Vector3i pos, int lod) const;
 	void close_oldest_region();
 
+	struct MappedRegion;
+
+	std::shared_ptr<MappedRegion> get_or_map_region(const Vector3i region_pos, unsigned int lod);
+	// Must be called before the file of the region is modified
+	void unmap_region(const Vector3i region_pos, unsigned int lod);
+	void unmap_all_regions();
+	void flush_regions();
+
 	struct Meta {
 		uint8_t version = -1;
 		uint8_t lod_count = 0;
@@ -89,8 +113,15 @@ private:
 		uint32_t sector_size = 0; // Blocks are stored at offsets multiple of that size
 	};
 
+	struct PositionAndLod {
+		Vector3i position;
+		int lod;
+	};
+
 	static bool check_meta(const Meta &meta);
 	void _convert_files(Meta new_meta);
+	// Lists region files found in the directory
+	bool get_region_list(std::vector<PositionAndLod> &out_regions) const;
 
 	// Orders block requests so those querying the same regions get grouped together
 	struct BlockQueryComparator {
@@ -125,6 +156,19 @@ private:
 		//uint64_t last_accessed;
 	};
 
+	struct MappedRegion {
+		Vector3i position;
+		int lod = 0;
+		// `ERR_FILE_NOT_FOUND` if the region has no file yet. For other errors, the region is read with `RegionFile`.
+		Error open_error = OK;
+		RegionFileMapping mapping;
+		// Held for reading while blocks are loaded from the mapping, and for writing when the file is about to change
+		RWLock lock;
+		// Set when the file is about to change. Loads that got the region before have to get the new one.
+		bool stale = false;
+		uint64_t last_used = 0;
+	};
+
 	String _directory_path;
 	Meta _meta;
 	bool _meta_loaded = false;
@@ -133,6 +177,11 @@ private:
 	// TODO Add memory caches to increase capacity.
 	unsigned int _max_open_regions = MIN(8, FOPEN_MAX);
 
+	bool _memory_mapped_reads_enabled = false;
+	// Mappings don't keep file handles open, so more of them can be kept than open regions
+	std::vector<std::shared_ptr<MappedRegion>> _mapped_regions;
+	unsigned int _max_mapped_regions = 64;
+
 	Mutex _mutex;
 };
 
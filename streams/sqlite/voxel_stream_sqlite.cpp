@@ -2,10 +2,12 @@
 #include "../../thirdparty/sqlite/sqlite3.h"
 #include "../../util/godot/funcs.h"
 #include "../../util/log.h"
+#include "../../util/math/funcs.h"
 #include "../../util/profiling.h"
 #include "../../util/string_funcs.h"
 #include "../compressed_data.h"
 
+#include <algorithm>
 #include <limits>
 #include <string>
 
@@ -27,13 +29,28 @@ struct BlockLocation {
 		return true;
 	}
 
+	// Interleaves the bits of coordinates (Morton code, or Z-order), so blocks close to each other in space are also
+	// close in the database. The LOD index is in the highest bits.
+	// Coordinates are offset so negative ones come before positive ones.
 	uint64_t encode() const {
-		// 0l xx yy zz
-		return ((static_cast<uint64_t>(lod) & 0xffff) << 48) | ((static_cast<uint64_t>(x) & 0xffff) << 32) |
-				((static_cast<uint64_t>(y) & 0xffff) << 16) | (static_cast<uint64_t>(z) & 0xffff);
+		// 0l zyxzyx...zyx
+		return (static_cast<uint64_t>(lod) << 48) | spread_bits(static_cast<uint16_t>(x) ^ 0x8000) |
+				(spread_bits(static_cast<uint16_t>(y) ^ 0x8000) << 1) |
+				(spread_bits(static_cast<uint16_t>(z) ^ 0x8000) << 2);
 	}
 
 	static BlockLocation decode(uint64_t id) {
+		BlockLocation b;
+		b.x = static_cast<uint16_t>(compact_bits(id) ^ 0x8000);
+		b.y = static_cast<uint16_t>(compact_bits(id >> 1) ^ 0x8000);
+		b.z = static_cast<uint16_t>(compact_bits(id >> 2) ^ 0x8000);
+		b.lod = ((id >> 48) & 0xff);
+		return b;
+	}
+
+	// Encoding used in databases of version 0. It doesn't preserve locality.
+	static BlockLocation decode_v0(uint64_t id) {
+		// 0l xx yy zz
 		BlockLocation b;
 		b.z = (id & 0xffff);
 		b.y = ((id >> 16) & 0xffff);
@@ -41,6 +58,26 @@ struct BlockLocation {
 		b.lod = ((id >> 48) & 0xff);
 		return b;
 	}
+
+private:
+	// Inserts two zero bits after each of the 16 bits of `v`
+	static uint64_t spread_bits(uint64_t v) {
+		v = (v | (v << 16)) & 0xff0000ff;
+		v = (v | (v << 8)) & 0xf00f00f00f;
+		v = (v | (v << 4)) & 0xc30c30c30c3;
+		v = (v | (v << 2)) & 0x249249249249;
+		return v;
+	}
+
+	// Inverse of `spread_bits`
+	static uint64_t compact_bits(uint64_t v) {
+		v &= 0x249249249249;
+		v = (v | (v >> 2)) & 0xc30c30c30c3;
+		v = (v | (v >> 4)) & 0xf00f00f00f;
+		v = (v | (v >> 8)) & 0xff0000ff;
+		v = (v | (v >> 16)) & 0xffff;
+		return v;
+	}
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -48,7 +85,8 @@ struct BlockLocation {
 // One connection to the database, with our prepared statements
 class VoxelStreamSQLiteInternal {
 public:
-	static const int VERSION = 0;
+	// Version 0 used an encoding of block locations which did not preserve locality
+	static const int VERSION = 1;
 
 	struct Meta {
 		int version = -1;
@@ -67,16 +105,44 @@ public:
 		INSTANCES
 	};
 
+	// When loading several blocks, requested locations further apart than this in the database are loaded with
+	// separate range scans, instead of going through all blocks in between. Larger gaps read too many blocks that
+	// were not requested, smaller ones run too many statements.
+	static const uint64_t MAX_LOAD_RANGE_GAP = 8;
+
+	// Maximum amount of blocks written by a single statement when saving in batches.
+	// Each row takes 3 variables, and SQLite limits them to 999 per statement in older versions.
+	static const unsigned int MAX_ROWS_PER_STATEMENT = 64;
+
+	struct BlockToSave {
+		BlockLocation location;
+		// When false, voxel data in the database is left untouched
+		bool has_voxels = false;
+		// Empty data is saved as null
+		std::vector<uint8_t> voxel_data;
+		std::vector<uint8_t> instance_data;
+	};
+
 	VoxelStreamSQLiteInternal();
 	~VoxelStreamSQLiteInternal();
 
-	bool open(const char *fpath);
+	// Read-only connections can't create the database, and need it to be setup already.
+	// They allow to read while another connection writes, if the database is in WAL mode.
+	bool open(const char *fpath, const VoxelStreamSQLite::ConnectionSettings &settings, bool read_only);
 	void close();
 
 	bool is_open() const {
 		return _db != nullptr;
 	}
 
+	bool is_read_only() const {
+		return _read_only;
+	}
+
+	const VoxelStreamSQLite::ConnectionSettings &get_settings() const {
+		return _settings;
+	}
+
 	// Returns the file path from SQLite
 	const char *get_file_path() const;
 
@@ -88,9 +154,18 @@ public:
 
 	bool begin_transaction();
 	bool end_transaction();
+	// Cancels all changes made since `begin_transaction`
+	bool rollback_transaction();
 
 	bool save_block(BlockLocation loc, const std::vector<uint8_t> &block_data, BlockType type);
-	VoxelStream::ResultCode load_block(BlockLocation loc, std::vector<uint8_t> &out_block_data, BlockType type);
+	// Saves voxels and instances of several blocks with multi-row statements, which is faster than one by one.
+	bool save_blocks(Span<const BlockToSave> blocks);
+	// Loads blocks with range scans, which touch fewer pages of the database than one query per block, when the
+	// blocks are close to each other. `locations` must be encoded and sorted.
+	// The function is called with the index of each location which has data. The data can only be used during the
+	// call.
+	bool load_blocks(Span<const uint64_t> locations, BlockType type, void *callback_data,
+			void (*process_block_func)(void *callback_data, unsigned int index, Span<const uint8_t> data));
 
 	bool load_all_blocks(void *callback_data,
 			void (*process_block_func)(void *callback_data, BlockLocation location, Span<const uint8_t> voxel_data,
@@ -99,6 +174,18 @@ public:
 	Meta load_meta();
 	void save_meta(Meta meta);
 
+	// Gets the Zstd dictionary used to compress voxel blocks. It is empty if there is none.
+	bool load_zstd_dictionary(std::vector<uint8_t> &out_data);
+	bool save_zstd_dictionary(Span<const uint8_t> data);
+
+	// Loads the voxel data of up to `count` blocks picked randomly
+	bool load_random_voxel_blocks(unsigned int count, std::vector<std::vector<uint8_t>> &out_blocks);
+
+	// Loads the voxel data of up to `count` blocks, ordered by encoded location, starting after `after_location`.
+	// This allows to go through all blocks in batches, without keeping a query running while they get modified.
+	bool load_voxel_blocks_after(int64_t after_location, unsigned int count, std::vector<uint64_t> &out_locations,
+			std::vector<std::vector<uint8_t>> &out_blocks);
+
 private:
 	struct TransactionScope {
 		VoxelStreamSQLiteInternal &db;
@@ -126,46 +213,97 @@ private:
 		}
 	}
 
+	bool exec(const char *sql) {
+		char *error_message = nullptr;
+		const int rc = sqlite3_exec(_db, sql, nullptr, nullptr, &error_message);
+		if (rc != SQLITE_OK) {
+			ERR_PRINT(String("Executing \"{0}\" failed: {1}").format(varray(sql, error_message)));
+			sqlite3_free(error_message);
+			return false;
+		}
+		return true;
+	}
+
+	sqlite3_stmt *get_save_blocks_statement(unsigned int row_count, bool with_voxels);
+
+	// Re-encodes block locations of a database of version 0
+	bool migrate_from_v0();
+
 	std::string _opened_path;
+	VoxelStreamSQLite::ConnectionSettings _settings;
+	bool _read_only = false;
 	sqlite3 *_db = nullptr;
 	sqlite3_stmt *_begin_statement = nullptr;
 	sqlite3_stmt *_end_statement = nullptr;
+	sqlite3_stmt *_rollback_statement = nullptr;
 	sqlite3_stmt *_update_voxel_block_statement = nullptr;
-	sqlite3_stmt *_get_voxel_block_statement = nullptr;
+	sqlite3_stmt *_load_voxel_blocks_in_range_statement = nullptr;
 	sqlite3_stmt *_update_instance_block_statement = nullptr;
-	sqlite3_stmt *_get_instance_block_statement = nullptr;
+	sqlite3_stmt *_load_instance_blocks_in_range_statement = nullptr;
 	sqlite3_stmt *_load_meta_statement = nullptr;
 	sqlite3_stmt *_save_meta_statement = nullptr;
 	sqlite3_stmt *_load_channels_statement = nullptr;
 	sqlite3_stmt *_save_channel_statement = nullptr;
 	sqlite3_stmt *_load_all_blocks_statement = nullptr;
+	sqlite3_stmt *_load_zstd_dictionary_statement = nullptr;
+	sqlite3_stmt *_save_zstd_dictionary_statement = nullptr;
+	// Prepared when first needed, indexed by row count
+	FixedArray<sqlite3_stmt *, MAX_ROWS_PER_STATEMENT + 1> _save_blocks_statements;
+	FixedArray<sqlite3_stmt *, MAX_ROWS_PER_STATEMENT + 1> _save_instance_blocks_statements;
 };
 
-VoxelStreamSQLiteInternal::VoxelStreamSQLiteInternal() {}
+VoxelStreamSQLiteInternal::VoxelStreamSQLiteInternal() {
+	fill(_save_blocks_statements, (sqlite3_stmt *)nullptr);
+	fill(_save_instance_blocks_statements, (sqlite3_stmt *)nullptr);
+}
 
 VoxelStreamSQLiteInternal::~VoxelStreamSQLiteInternal() {
 	close();
 }
 
-bool VoxelStreamSQLiteInternal::open(const char *fpath) {
+bool VoxelStreamSQLiteInternal::open(
+		const char *fpath, const VoxelStreamSQLite::ConnectionSettings &settings, bool read_only) {
 	ZN_PROFILE_SCOPE();
 	close();
 
-	int rc = sqlite3_open_v2(fpath, &_db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr);
+	const int flags = read_only ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+	int rc = sqlite3_open_v2(fpath, &_db, flags, nullptr);
 	if (rc != 0) {
 		ERR_PRINT(String("Could not open database: {0}").format(varray(sqlite3_errmsg(_db))));
 		close();
 		return false;
 	}
 
+	// Several threads can use the database at once, each with their own connection. Wait for locks held by other
+	// connections instead of failing right away.
+	sqlite3_busy_timeout(_db, 5000);
+
 	sqlite3 *db = _db;
 	char *error_message = nullptr;
 
+	// The journal mode is stored in the database, so only writers set it.
+	// In WAL mode, readers don't block the writer and the writer doesn't block readers. Changes are appended to a
+	// `-wal` file next to the database, and moved into it from time to time.
+	if (!read_only) {
+		exec(settings.wal_enabled ? "PRAGMA journal_mode=WAL" : "PRAGMA journal_mode=DELETE");
+	}
+	// With WAL, NORMAL only syncs at checkpoints. The last transactions can be lost on power failure, but the
+	// database can't get corrupted.
+	exec(format("PRAGMA synchronous={}", int(settings.synchronous)).c_str());
+	// A negative value is in kibibytes instead of pages
+	exec(format("PRAGMA cache_size=-{}", settings.cache_size_kb).c_str());
+
+	_settings = settings;
+	_read_only = read_only;
+
 	// Create tables if they dont exist
-	const char *tables[3] = { "CREATE TABLE IF NOT EXISTS meta (version INTEGER, block_size_po2 INTEGER)",
+	// Read-only connections are opened once a writer did it
+	const char *tables[4] = { "CREATE TABLE IF NOT EXISTS meta (version INTEGER, block_size_po2 INTEGER)",
 		"CREATE TABLE IF NOT EXISTS blocks (loc INTEGER PRIMARY KEY, vb BLOB, instances BLOB)",
-		"CREATE TABLE IF NOT EXISTS channels (idx INTEGER PRIMARY KEY, depth INTEGER)" };
-	for (size_t i = 0; i < 3; ++i) {
+		"CREATE TABLE IF NOT EXISTS channels (idx INTEGER PRIMARY KEY, depth INTEGER)",
+		// Has at most one row. Older databases don't have it, which is equivalent to having no dictionary.
+		"CREATE TABLE IF NOT EXISTS zstd_dictionary (idx INTEGER PRIMARY KEY, data BLOB)" };
+	for (size_t i = 0; i < 4 && !read_only; ++i) {
 		rc = sqlite3_exec(db, tables[i], nullptr, nullptr, &error_message);
 		if (rc != SQLITE_OK) {
 			ERR_PRINT(String("Failed to create table: {0}").format(varray(error_message)));
@@ -175,13 +313,15 @@ bool VoxelStreamSQLiteInternal::open(const char *fpath) {
 		}
 	}
 
-	// Prepare statements
+	// Prepare statements.
+	// Read-only connections also get those writing, they are just not used.
 	if (!prepare(db, &_update_voxel_block_statement,
 				"INSERT INTO blocks VALUES (:loc, :vb, null) "
 				"ON CONFLICT(loc) DO UPDATE SET vb=excluded.vb")) {
 		return false;
 	}
-	if (!prepare(db, &_get_voxel_block_statement, "SELECT vb FROM blocks WHERE loc=:loc")) {
+	if (!prepare(db, &_load_voxel_blocks_in_range_statement,
+				"SELECT loc, vb FROM blocks WHERE loc BETWEEN :min_loc AND :max_loc")) {
 		return false;
 	}
 	if (!prepare(db, &_update_instance_block_statement,
@@ -189,7 +329,8 @@ bool VoxelStreamSQLiteInternal::open(const char *fpath) {
 				"ON CONFLICT(loc) DO UPDATE SET instances=excluded.instances")) {
 		return false;
 	}
-	if (!prepare(db, &_get_instance_block_statement, "SELECT instances FROM blocks WHERE loc=:loc")) {
+	if (!prepare(db, &_load_instance_blocks_in_range_statement,
+				"SELECT loc, instances FROM blocks WHERE loc BETWEEN :min_loc AND :max_loc")) {
 		return false;
 	}
 	if (!prepare(db, &_begin_statement, "BEGIN")) {
@@ -198,6 +339,9 @@ bool VoxelStreamSQLiteInternal::open(const char *fpath) {
 	if (!prepare(db, &_end_statement, "END")) {
 		return false;
 	}
+	if (!prepare(db, &_rollback_statement, "ROLLBACK")) {
+		return false;
+	}
 	if (!prepare(db, &_load_meta_statement, "SELECT * FROM meta")) {
 		return false;
 	}
@@ -215,20 +359,42 @@ bool VoxelStreamSQLiteInternal::open(const char *fpath) {
 	if (!prepare(db, &_load_all_blocks_statement, "SELECT * FROM blocks")) {
 		return false;
 	}
+	if (!prepare(db, &_load_zstd_dictionary_statement, "SELECT data FROM zstd_dictionary WHERE idx=0")) {
+		return false;
+	}
+	if (!prepare(db, &_save_zstd_dictionary_statement,
+				"INSERT INTO zstd_dictionary VALUES (0, :data) "
+				"ON CONFLICT(idx) DO UPDATE SET data=excluded.data")) {
+		return false;
+	}
 
 	// Is the database setup?
-	Meta meta = load_meta();
-	if (meta.version == -1) {
-		// Setup database
-		meta.version = VERSION;
-		// Defaults
-		meta.block_size_po2 = constants::DEFAULT_BLOCK_SIZE_PO2;
-		for (unsigned int i = 0; i < meta.channels.size(); ++i) {
-			Meta::Channel &channel = meta.channels[i];
-			channel.used = true;
-			channel.depth = VoxelBufferInternal::DEPTH_16_BIT;
+	if (!read_only) {
+		Meta meta = load_meta();
+		if (meta.version == -1) {
+			// Setup database
+			meta.version = VERSION;
+			// Defaults
+			meta.block_size_po2 = constants::DEFAULT_BLOCK_SIZE_PO2;
+			for (unsigned int i = 0; i < meta.channels.size(); ++i) {
+				Meta::Channel &channel = meta.channels[i];
+				channel.used = true;
+				channel.depth = VoxelBufferInternal::DEPTH_16_BIT;
+			}
+			save_meta(meta);
+
+		} else if (meta.version == 0) {
+			if (!migrate_from_v0()) {
+				close();
+				return false;
+			}
+
+		} else if (meta.version > VERSION) {
+			ZN_PRINT_ERROR(format(
+					"Database version {} is not supported, it was made by a newer version", meta.version));
+			close();
+			return false;
 		}
-		save_meta(meta);
 	}
 
 	_opened_path = fpath;
@@ -241,15 +407,22 @@ void VoxelStreamSQLiteInternal::close() {
 	}
 	finalize(_begin_statement);
 	finalize(_end_statement);
+	finalize(_rollback_statement);
 	finalize(_update_voxel_block_statement);
-	finalize(_get_voxel_block_statement);
+	finalize(_load_voxel_blocks_in_range_statement);
 	finalize(_update_instance_block_statement);
-	finalize(_get_instance_block_statement);
+	finalize(_load_instance_blocks_in_range_statement);
 	finalize(_load_meta_statement);
 	finalize(_save_meta_statement);
 	finalize(_load_channels_statement);
 	finalize(_save_channel_statement);
 	finalize(_load_all_blocks_statement);
+	finalize(_load_zstd_dictionary_statement);
+	finalize(_save_zstd_dictionary_statement);
+	for (unsigned int i = 0; i < _save_blocks_statements.size(); ++i) {
+		finalize(_save_blocks_statements[i]);
+		finalize(_save_instance_blocks_statements[i]);
+	}
 	sqlite3_close(_db);
 	_db = nullptr;
 	_opened_path.clear();
@@ -290,6 +463,20 @@ bool VoxelStreamSQLiteInternal::end_transaction() {
 	return true;
 }
 
+bool VoxelStreamSQLiteInternal::rollback_transaction() {
+	int rc = sqlite3_reset(_rollback_statement);
+	if (rc != SQLITE_OK) {
+		ERR_PRINT(sqlite3_errmsg(_db));
+		return false;
+	}
+	rc = sqlite3_step(_rollback_statement);
+	if (rc != SQLITE_DONE) {
+		ERR_PRINT(sqlite3_errmsg(_db));
+		return false;
+	}
+	return true;
+}
+
 bool VoxelStreamSQLiteInternal::save_block(BlockLocation loc, const std::vector<uint8_t> &block_data, BlockType type) {
 	ZN_PROFILE_SCOPE();
 
@@ -341,62 +528,219 @@ bool VoxelStreamSQLiteInternal::save_block(BlockLocation loc, const std::vector<
 	return true;
 }
 
-VoxelStream::ResultCode VoxelStreamSQLiteInternal::load_block(
-		BlockLocation loc, std::vector<uint8_t> &out_block_data, BlockType type) {
+sqlite3_stmt *VoxelStreamSQLiteInternal::get_save_blocks_statement(unsigned int row_count, bool with_voxels) {
+	ZN_ASSERT_RETURN_V(row_count > 0 && row_count <= MAX_ROWS_PER_STATEMENT, nullptr);
+
+	sqlite3_stmt *&statement =
+			with_voxels ? _save_blocks_statements[row_count] : _save_instance_blocks_statements[row_count];
+
+	if (statement == nullptr) {
+		std::string sql = "INSERT INTO blocks VALUES ";
+		for (unsigned int i = 0; i < row_count; ++i) {
+			if (i > 0) {
+				sql += ",";
+			}
+			sql += with_voxels ? "(?,?,?)" : "(?,null,?)";
+		}
+		sql += with_voxels ? " ON CONFLICT(loc) DO UPDATE SET vb=excluded.vb, instances=excluded.instances"
+						   : " ON CONFLICT(loc) DO UPDATE SET instances=excluded.instances";
+		if (!prepare(_db, &statement, sql.c_str())) {
+			return nullptr;
+		}
+	}
+
+	return statement;
+}
+
+bool VoxelStreamSQLiteInternal::migrate_from_v0() {
+	ZN_PROFILE_SCOPE();
+	ZN_PRINT_VERBOSE(format("Migrating SQLite database {} from version 0", get_file_path()));
+
+	struct L {
+		static void convert_location(sqlite3_context *context, int argc, sqlite3_value **argv) {
+			const uint64_t eloc = sqlite3_value_int64(argv[0]);
+			sqlite3_result_int64(context, BlockLocation::decode_v0(eloc).encode());
+		}
+	};
+
+	if (sqlite3_create_function(_db, "voxel_location_from_v0", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr,
+				L::convert_location, nullptr, nullptr) != SQLITE_OK) {
+		ERR_PRINT(sqlite3_errmsg(_db));
+		return false;
+	}
+
+	// Locations are primary keys. Changing them in place could collide with locations not converted yet, so blocks
+	// are copied into a new table. Inserting them in order also leaves the table well packed.
+	if (!exec("BEGIN;"
+			  "CREATE TABLE blocks_v1 (loc INTEGER PRIMARY KEY, vb BLOB, instances BLOB);"
+			  "INSERT INTO blocks_v1 SELECT voxel_location_from_v0(loc), vb, instances FROM blocks ORDER BY 1;"
+			  "DROP TABLE blocks;"
+			  "ALTER TABLE blocks_v1 RENAME TO blocks;"
+			  "UPDATE meta SET version=1;"
+			  "COMMIT;")) {
+		sqlite3_exec(_db, "ROLLBACK", nullptr, nullptr, nullptr);
+		return false;
+	}
+
+	return true;
+}
+
+bool VoxelStreamSQLiteInternal::save_blocks(Span<const BlockToSave> blocks) {
+	ZN_PROFILE_SCOPE();
+
 	sqlite3 *db = _db;
 
-	sqlite3_stmt *get_block_statement;
+	// Blocks with and without voxels need different statements. Saving voxels is the most common case.
+	for (int with_voxels = 1; with_voxels >= 0; --with_voxels) {
+		size_t block_index = 0;
+
+		while (block_index < blocks.size()) {
+			// Gather a batch
+			FixedArray<const BlockToSave *, MAX_ROWS_PER_STATEMENT> batch;
+			unsigned int row_count = 0;
+			for (; block_index < blocks.size() && row_count < batch.size(); ++block_index) {
+				const BlockToSave &block = blocks[block_index];
+				if (block.has_voxels == bool(with_voxels)) {
+					batch[row_count] = &block;
+					++row_count;
+				}
+			}
+			if (row_count == 0) {
+				break;
+			}
+
+			sqlite3_stmt *statement = get_save_blocks_statement(row_count, with_voxels);
+			if (statement == nullptr) {
+				return false;
+			}
+
+			int rc = sqlite3_reset(statement);
+			if (rc != SQLITE_OK) {
+				ERR_PRINT(sqlite3_errmsg(db));
+				return false;
+			}
+
+			int param_index = 1;
+			for (unsigned int i = 0; i < row_count && rc == SQLITE_OK; ++i) {
+				const BlockToSave &block = *batch[i];
+
+				rc = sqlite3_bind_int64(statement, param_index++, block.location.encode());
+
+				if (with_voxels && rc == SQLITE_OK) {
+					if (block.voxel_data.size() == 0) {
+						rc = sqlite3_bind_null(statement, param_index++);
+					} else {
+						// Data is kept alive until the statement is reset, SQLite doesn't need to copy it
+						rc = sqlite3_bind_blob(statement, param_index++, block.voxel_data.data(),
+								block.voxel_data.size(), SQLITE_STATIC);
+					}
+				}
+
+				if (rc == SQLITE_OK) {
+					if (block.instance_data.size() == 0) {
+						rc = sqlite3_bind_null(statement, param_index++);
+					} else {
+						rc = sqlite3_bind_blob(statement, param_index++, block.instance_data.data(),
+								block.instance_data.size(), SQLITE_STATIC);
+					}
+				}
+			}
+			if (rc != SQLITE_OK) {
+				ERR_PRINT(sqlite3_errmsg(db));
+				return false;
+			}
+
+			rc = sqlite3_step(statement);
+			// Don't keep references to the data
+			sqlite3_clear_bindings(statement);
+			if (rc != SQLITE_DONE) {
+				ERR_PRINT(sqlite3_errmsg(db));
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool VoxelStreamSQLiteInternal::load_blocks(Span<const uint64_t> locations, BlockType type, void *callback_data,
+		void (*process_block_func)(void *callback_data, unsigned int index, Span<const uint8_t> data)) {
+	ZN_PROFILE_SCOPE();
+	CRASH_COND(process_block_func == nullptr);
+
+	sqlite3 *db = _db;
+
+	sqlite3_stmt *statement;
 	switch (type) {
 		case VOXELS:
-			get_block_statement = _get_voxel_block_statement;
+			statement = _load_voxel_blocks_in_range_statement;
 			break;
 		case INSTANCES:
-			get_block_statement = _get_instance_block_statement;
+			statement = _load_instance_blocks_in_range_statement;
 			break;
 		default:
 			CRASH_NOW();
 	}
 
-	int rc;
+	// All ranges see the same state of the database
+	TransactionScope transaction(*this);
 
-	rc = sqlite3_reset(get_block_statement);
-	if (rc != SQLITE_OK) {
-		ERR_PRINT(sqlite3_errmsg(db));
-		return VoxelStream::RESULT_ERROR;
-	}
+	size_t range_begin = 0;
 
-	const uint64_t eloc = loc.encode();
+	while (range_begin < locations.size()) {
+		// Extend the range while locations are close to each other
+		size_t range_end = range_begin + 1;
+		while (range_end < locations.size() && locations[range_end] - locations[range_end - 1] <= MAX_LOAD_RANGE_GAP) {
+			++range_end;
+		}
 
-	rc = sqlite3_bind_int64(get_block_statement, 1, eloc);
-	if (rc != SQLITE_OK) {
-		ERR_PRINT(sqlite3_errmsg(db));
-		return VoxelStream::RESULT_ERROR;
-	}
+		int rc = sqlite3_reset(statement);
+		if (rc == SQLITE_OK) {
+			rc = sqlite3_bind_int64(statement, 1, locations[range_begin]);
+		}
+		if (rc == SQLITE_OK) {
+			rc = sqlite3_bind_int64(statement, 2, locations[range_end - 1]);
+		}
+		if (rc != SQLITE_OK) {
+			ERR_PRINT(sqlite3_errmsg(db));
+			return false;
+		}
 
-	VoxelStream::ResultCode result = VoxelStream::RESULT_BLOCK_NOT_FOUND;
+		// Rows come ordered by location, so we can go through them and requested locations at the same time.
+		// Blocks in between which were not requested are skipped.
+		size_t location_index = range_begin;
 
-	while (true) {
-		rc = sqlite3_step(get_block_statement);
-		if (rc == SQLITE_ROW) {
-			const void *blob = sqlite3_column_blob(get_block_statement, 0);
-			//const uint8_t *b = reinterpret_cast<const uint8_t *>(blob);
-			const size_t blob_size = sqlite3_column_bytes(get_block_statement, 0);
-			if (blob_size != 0) {
-				result = VoxelStream::RESULT_BLOCK_FOUND;
-				out_block_data.resize(blob_size);
-				memcpy(out_block_data.data(), blob, blob_size);
+		while (true) {
+			rc = sqlite3_step(statement);
+
+			if (rc == SQLITE_ROW) {
+				const uint64_t eloc = sqlite3_column_int64(statement, 0);
+				while (location_index < range_end && locations[location_index] < eloc) {
+					++location_index;
+				}
+				// The same block could be requested more than once
+				for (; location_index < range_end && locations[location_index] == eloc; ++location_index) {
+					const void *blob = sqlite3_column_blob(statement, 1);
+					const size_t blob_size = sqlite3_column_bytes(statement, 1);
+					if (blob_size != 0) {
+						process_block_func(callback_data, location_index,
+								Span<const uint8_t>(reinterpret_cast<const uint8_t *>(blob), blob_size));
+					}
+				}
+
+			} else if (rc == SQLITE_DONE) {
+				break;
+
+			} else {
+				ERR_PRINT(sqlite3_errmsg(db));
+				return false;
 			}
-			// The query is still ongoing, we'll need to step one more time to complete it
-			continue;
 		}
-		if (rc != SQLITE_DONE) {
-			ERR_PRINT(sqlite3_errmsg(db));
-			return VoxelStream::RESULT_ERROR;
-		}
-		break;
+
+		range_begin = range_end;
 	}
 
-	return result;
+	return true;
 }
 
 bool VoxelStreamSQLiteInternal::load_all_blocks(void *callback_data,
@@ -576,11 +920,162 @@ void VoxelStreamSQLiteInternal::save_meta(Meta meta) {
 	}
 }
 
+bool VoxelStreamSQLiteInternal::load_zstd_dictionary(std::vector<uint8_t> &out_data) {
+	sqlite3 *db = _db;
+	sqlite3_stmt *load_zstd_dictionary_statement = _load_zstd_dictionary_statement;
+
+	int rc = sqlite3_reset(load_zstd_dictionary_statement);
+	if (rc != SQLITE_OK) {
+		ERR_PRINT(sqlite3_errmsg(db));
+		return false;
+	}
+
+	out_data.clear();
+
+	while (true) {
+		rc = sqlite3_step(load_zstd_dictionary_statement);
+		if (rc == SQLITE_ROW) {
+			const void *blob = sqlite3_column_blob(load_zstd_dictionary_statement, 0);
+			const size_t blob_size = sqlite3_column_bytes(load_zstd_dictionary_statement, 0);
+			out_data.resize(blob_size);
+			memcpy(out_data.data(), blob, blob_size);
+			// The query is still ongoing, we'll need to step one more time to complete it
+			continue;
+		}
+		if (rc != SQLITE_DONE) {
+			ERR_PRINT(sqlite3_errmsg(db));
+			return false;
+		}
+		break;
+	}
+
+	return true;
+}
+
+bool VoxelStreamSQLiteInternal::save_zstd_dictionary(Span<const uint8_t> data) {
+	sqlite3 *db = _db;
+	sqlite3_stmt *save_zstd_dictionary_statement = _save_zstd_dictionary_statement;
+
+	int rc = sqlite3_reset(save_zstd_dictionary_statement);
+	if (rc != SQLITE_OK) {
+		ERR_PRINT(sqlite3_errmsg(db));
+		return false;
+	}
+
+	rc = sqlite3_bind_blob(save_zstd_dictionary_statement, 1, data.data(), data.size(), SQLITE_TRANSIENT);
+	if (rc != SQLITE_OK) {
+		ERR_PRINT(sqlite3_errmsg(db));
+		return false;
+	}
+
+	rc = sqlite3_step(save_zstd_dictionary_statement);
+	if (rc != SQLITE_DONE) {
+		ERR_PRINT(sqlite3_errmsg(db));
+		return false;
+	}
+
+	return true;
+}
+
+bool VoxelStreamSQLiteInternal::load_random_voxel_blocks(
+		unsigned int count, std::vector<std::vector<uint8_t>> &out_blocks) {
+	ZN_PROFILE_SCOPE();
+
+	sqlite3 *db = _db;
+	// Not prepared in advance, this is only used by tools
+	sqlite3_stmt *statement = nullptr;
+	if (!prepare(db, &statement, "SELECT vb FROM blocks WHERE vb IS NOT NULL ORDER BY RANDOM() LIMIT :count")) {
+		return false;
+	}
+
+	int rc = sqlite3_bind_int(statement, 1, count);
+
+	while (rc == SQLITE_OK || rc == SQLITE_ROW) {
+		rc = sqlite3_step(statement);
+		if (rc == SQLITE_ROW) {
+			const uint8_t *blob = reinterpret_cast<const uint8_t *>(sqlite3_column_blob(statement, 0));
+			const size_t blob_size = sqlite3_column_bytes(statement, 0);
+			out_blocks.push_back(std::vector<uint8_t>(blob, blob + blob_size));
+		}
+	}
+
+	finalize(statement);
+
+	if (rc != SQLITE_DONE) {
+		ERR_PRINT(sqlite3_errmsg(db));
+		return false;
+	}
+	return true;
+}
+
+bool VoxelStreamSQLiteInternal::load_voxel_blocks_after(int64_t after_location, unsigned int count,
+		std::vector<uint64_t> &out_locations, std::vector<std::vector<uint8_t>> &out_blocks) {
+	ZN_PROFILE_SCOPE();
+
+	sqlite3 *db = _db;
+	// Not prepared in advance, this is only used by tools
+	sqlite3_stmt *statement = nullptr;
+	if (!prepare(db, &statement,
+				"SELECT loc, vb FROM blocks WHERE loc > :loc AND vb IS NOT NULL ORDER BY loc LIMIT :count")) {
+		return false;
+	}
+
+	int rc = sqlite3_bind_int64(statement, 1, after_location);
+	if (rc == SQLITE_OK) {
+		rc = sqlite3_bind_int(statement, 2, count);
+	}
+
+	while (rc == SQLITE_OK || rc == SQLITE_ROW) {
+		rc = sqlite3_step(statement);
+		if (rc == SQLITE_ROW) {
+			out_locations.push_back(sqlite3_column_int64(statement, 0));
+			const uint8_t *blob = reinterpret_cast<const uint8_t *>(sqlite3_column_blob(statement, 1));
+			const size_t blob_size = sqlite3_column_bytes(statement, 1);
+			out_blocks.push_back(std::vector<uint8_t>(blob, blob + blob_size));
+		}
+	}
+
+	finalize(statement);
+
+	if (rc != SQLITE_DONE) {
+		ERR_PRINT(sqlite3_errmsg(db));
+		return false;
+	}
+	return true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 thread_local std::vector<uint8_t> VoxelStreamSQLite::_temp_block_data;
 thread_local std::vector<uint8_t> VoxelStreamSQLite::_temp_compressed_block_data;
 
+namespace {
+thread_local std::vector<VoxelStreamSQLiteInternal::BlockToSave> tls_blocks_to_save;
+
+struct BlockToLoad {
+	uint64_t location;
+	unsigned int query_index;
+
+	inline bool operator<(const BlockToLoad &other) const {
+		return location < other.location;
+	}
+};
+
+thread_local std::vector<BlockToLoad> tls_blocks_to_load;
+thread_local std::vector<uint64_t> tls_locations_to_load;
+
+// Sorts blocks by location, so they can be loaded with range scans
+Span<const uint64_t> sort_blocks_to_load(std::vector<BlockToLoad> &blocks, std::vector<uint64_t> &locations) {
+	std::sort(blocks.begin(), blocks.end());
+	locations.clear();
+	for (const BlockToLoad &block : blocks) {
+		locations.push_back(block.location);
+	}
+	return to_span_const(locations);
+}
+
+} // namespace
+
 VoxelStreamSQLite::VoxelStreamSQLite() {}
 
 VoxelStreamSQLite::~VoxelStreamSQLite() {
@@ -590,10 +1085,7 @@ VoxelStreamSQLite::~VoxelStreamSQLite() {
 		flush_cache();
 		ZN_PRINT_VERBOSE("~VoxelStreamSQLite flushy done");
 	}
-	for (auto it = _connection_pool.begin(); it != _connection_pool.end(); ++it) {
-		delete *it;
-	}
-	_connection_pool.clear();
+	clear_connection_pools();
 	ZN_PRINT_VERBOSE("~VoxelStreamSQLite done");
 }
 
@@ -606,19 +1098,23 @@ void VoxelStreamSQLite::set_database_path(String path) {
 		// Save cached data before changing the path.
 		// Not using get_connection() because it locks.
 		VoxelStreamSQLiteInternal con;
-		CharString cpath = path.utf8();
+		CharString cpath = _connection_path.utf8();
 		// Note, the path could be invalid,
 		// Since Godot helpfully sets the property for every character typed in the inspector.
 		// So there can be lots of errors in the editor if you type it.
-		if (con.open(cpath)) {
+		if (con.open(cpath, _connection_settings, false)) {
 			flush_cache(&con);
 		}
 	}
-	for (auto it = _connection_pool.begin(); it != _connection_pool.end(); ++it) {
-		delete *it;
-	}
-	_connection_pool.clear();
+	clear_connection_pools();
 	_connection_path = path;
+	_database_ready = false;
+	{
+		// The new database may have another dictionary
+		MutexLock compression_lock(_compression_mutex);
+		_compression_settings.zstd_dictionary.reset();
+		_zstd_dictionary_loaded = false;
+	}
 	// Don't actually open anything here. We'll do it only when necessary
 }
 
@@ -642,7 +1138,8 @@ void VoxelStreamSQLite::load_voxel_blocks(Span<VoxelStream::VoxelQueryData> p_bl
 	const int bs_po2 = constants::DEFAULT_BLOCK_SIZE_PO2;
 
 	// Check the cache first
-	std::vector<unsigned int> blocks_to_load;
+	std::vector<BlockToLoad> &blocks_to_load = tls_blocks_to_load;
+	blocks_to_load.clear();
 	for (unsigned int i = 0; i < p_blocks.size(); ++i) {
 		VoxelStream::VoxelQueryData &q = p_blocks[i];
 		const Vector3i pos = q.origin_in_voxels >> (bs_po2 + q.lod);
@@ -650,8 +1147,18 @@ void VoxelStreamSQLite::load_voxel_blocks(Span<VoxelStream::VoxelQueryData> p_bl
 		if (_cache.load_voxel_block(pos, q.lod, q.voxel_buffer)) {
 			q.result = RESULT_BLOCK_FOUND;
 
+		} else if (!BlockLocation::validate(pos, q.lod)) {
+			// Can't have been saved
+			q.result = RESULT_BLOCK_NOT_FOUND;
+
 		} else {
-			blocks_to_load.push_back(i);
+			BlockLocation loc;
+			loc.x = pos.x;
+			loc.y = pos.y;
+			loc.z = pos.z;
+			loc.lod = q.lod;
+			blocks_to_load.push_back(BlockToLoad{ loc.encode(), i });
+			q.result = RESULT_BLOCK_NOT_FOUND;
 		}
 	}
 
@@ -660,37 +1167,42 @@ void VoxelStreamSQLite::load_voxel_blocks(Span<VoxelStream::VoxelQueryData> p_bl
 		return;
 	}
 
-	VoxelStreamSQLiteInternal *con = get_connection();
+	const Span<const uint64_t> locations = sort_blocks_to_load(blocks_to_load, tls_locations_to_load);
+
+	VoxelStreamSQLiteInternal *con = get_connection(true);
 	ERR_FAIL_COND(con == nullptr);
 
-	// TODO We should handle busy return codes
-	ERR_FAIL_COND(con->begin_transaction() == false);
+	// Got after the connection, which loads the dictionary
+	const std::shared_ptr<CompressedData::ZstdDictionary> zstd_dictionary =
+			get_compression_settings().zstd_dictionary;
 
-	for (unsigned int i = 0; i < blocks_to_load.size(); ++i) {
-		const unsigned int ri = blocks_to_load[i];
-		VoxelStream::VoxelQueryData &q = p_blocks[ri];
+	struct Context {
+		Span<VoxelStream::VoxelQueryData> queries;
+		const std::vector<BlockToLoad> &blocks_to_load;
+		const CompressedData::ZstdDictionary *zstd_dictionary;
+	};
 
-		const unsigned int po2 = bs_po2 + q.lod;
+	struct L {
+		static void process_block_func(void *callback_data, unsigned int index, Span<const uint8_t> data) {
+			Context *ctx = reinterpret_cast<Context *>(callback_data);
+			VoxelStream::VoxelQueryData &q = ctx->queries[ctx->blocks_to_load[index].query_index];
+			BlockSerializer::decompress_and_deserialize(data, q.voxel_buffer, ctx->zstd_dictionary);
+			q.result = RESULT_BLOCK_FOUND;
+		}
+	};
 
-		BlockLocation loc;
-		loc.x = q.origin_in_voxels.x >> po2;
-		loc.y = q.origin_in_voxels.y >> po2;
-		loc.z = q.origin_in_voxels.z >> po2;
-		loc.lod = q.lod;
+	Context ctx_outer{ p_blocks, blocks_to_load, zstd_dictionary.get() };
+	const bool request_result =
+			con->load_blocks(locations, VoxelStreamSQLiteInternal::VOXELS, &ctx_outer, L::process_block_func);
 
-		const ResultCode res = con->load_block(loc, _temp_block_data, VoxelStreamSQLiteInternal::VOXELS);
+	recycle_connection(con);
 
-		if (res == RESULT_BLOCK_FOUND) {
-			// TODO Not sure if we should actually expect non-null. There can be legit not found blocks.
-			BlockSerializer::decompress_and_deserialize(to_span_const(_temp_block_data), q.voxel_buffer);
+	if (!request_result) {
+		for (const BlockToLoad &block : blocks_to_load) {
+			p_blocks[block.query_index].result = RESULT_ERROR;
 		}
-
-		q.result = res;
+		ERR_FAIL();
 	}
-
-	ERR_FAIL_COND(con->end_transaction() == false);
-
-	recycle_connection(con);
 }
 
 void VoxelStreamSQLite::save_voxel_blocks(Span<VoxelStream::VoxelQueryData> p_blocks) {
@@ -727,15 +1239,25 @@ void VoxelStreamSQLite::load_instance_blocks(Span<VoxelStream::InstancesQueryDat
 	//const int bs_po2 = constants::DEFAULT_BLOCK_SIZE_PO2;
 
 	// Check the cache first
-	std::vector<unsigned int> blocks_to_load;
-	for (size_t i = 0; i < out_blocks.size(); ++i) {
+	std::vector<BlockToLoad> &blocks_to_load = tls_blocks_to_load;
+	blocks_to_load.clear();
+	for (unsigned int i = 0; i < out_blocks.size(); ++i) {
 		VoxelStream::InstancesQueryData &q = out_blocks[i];
 
 		if (_cache.load_instance_block(q.position, q.lod, q.data)) {
 			q.result = RESULT_BLOCK_FOUND;
 
+		} else if (!BlockLocation::validate(q.position, q.lod)) {
+			q.result = RESULT_BLOCK_NOT_FOUND;
+
 		} else {
-			blocks_to_load.push_back(i);
+			BlockLocation loc;
+			loc.x = q.position.x;
+			loc.y = q.position.y;
+			loc.z = q.position.z;
+			loc.lod = q.lod;
+			blocks_to_load.push_back(BlockToLoad{ loc.encode(), i });
+			q.result = RESULT_BLOCK_NOT_FOUND;
 		}
 	}
 
@@ -744,45 +1266,49 @@ void VoxelStreamSQLite::load_instance_blocks(Span<VoxelStream::InstancesQueryDat
 		return;
 	}
 
-	VoxelStreamSQLiteInternal *con = get_connection();
-	ERR_FAIL_COND(con == nullptr);
-
-	// TODO We should handle busy return codes
-	// TODO recycle on error
-	ERR_FAIL_COND(con->begin_transaction() == false);
+	const Span<const uint64_t> locations = sort_blocks_to_load(blocks_to_load, tls_locations_to_load);
 
-	for (unsigned int i = 0; i < blocks_to_load.size(); ++i) {
-		const unsigned int ri = blocks_to_load[i];
-		VoxelStream::InstancesQueryData &q = out_blocks[ri];
+	VoxelStreamSQLiteInternal *con = get_connection(true);
+	ERR_FAIL_COND(con == nullptr);
 
-		BlockLocation loc;
-		loc.x = q.position.x;
-		loc.y = q.position.y;
-		loc.z = q.position.z;
-		loc.lod = q.lod;
+	struct Context {
+		Span<VoxelStream::InstancesQueryData> queries;
+		const std::vector<BlockToLoad> &blocks_to_load;
+		std::vector<uint8_t> &temp_block_data;
+	};
 
-		const ResultCode res = con->load_block(loc, _temp_compressed_block_data, VoxelStreamSQLiteInternal::INSTANCES);
+	struct L {
+		static void process_block_func(void *callback_data, unsigned int index, Span<const uint8_t> data) {
+			Context *ctx = reinterpret_cast<Context *>(callback_data);
+			VoxelStream::InstancesQueryData &q = ctx->queries[ctx->blocks_to_load[index].query_index];
 
-		if (res == RESULT_BLOCK_FOUND) {
-			if (!CompressedData::decompress(to_span_const(_temp_compressed_block_data), _temp_block_data)) {
+			if (!CompressedData::decompress(data, ctx->temp_block_data)) {
 				ERR_PRINT("Failed to decompress instance block");
 				q.result = RESULT_ERROR;
-				continue;
+				return;
 			}
 			q.data = make_unique_instance<InstanceBlockData>();
-			if (!deserialize_instance_block_data(*q.data, to_span_const(_temp_block_data))) {
+			if (!deserialize_instance_block_data(*q.data, to_span_const(ctx->temp_block_data))) {
 				ERR_PRINT("Failed to deserialize instance block");
 				q.result = RESULT_ERROR;
-				continue;
+				return;
 			}
+			q.result = RESULT_BLOCK_FOUND;
 		}
+	};
 
-		q.result = res;
-	}
-
-	ERR_FAIL_COND(con->end_transaction() == false);
+	Context ctx_outer{ out_blocks, blocks_to_load, _temp_block_data };
+	const bool request_result =
+			con->load_blocks(locations, VoxelStreamSQLiteInternal::INSTANCES, &ctx_outer, L::process_block_func);
 
 	recycle_connection(con);
+
+	if (!request_result) {
+		for (const BlockToLoad &block : blocks_to_load) {
+			out_blocks[block.query_index].result = RESULT_ERROR;
+		}
+		ERR_FAIL();
+	}
 }
 
 void VoxelStreamSQLite::save_instance_blocks(Span<VoxelStream::InstancesQueryData> p_blocks) {
@@ -804,12 +1330,13 @@ void VoxelStreamSQLite::save_instance_blocks(Span<VoxelStream::InstancesQueryDat
 void VoxelStreamSQLite::load_all_blocks(FullLoadingResult &result) {
 	ZN_PROFILE_SCOPE();
 
-	VoxelStreamSQLiteInternal *con = get_connection();
+	VoxelStreamSQLiteInternal *con = get_connection(true);
 	ERR_FAIL_COND(con == nullptr);
 
 	struct Context {
 		VoxelStreamSQLite &stream;
 		FullLoadingResult &result;
+		const CompressedData::ZstdDictionary *zstd_dictionary;
 	};
 
 	// Using local function instead of a lambda for quite stupid reason admittedly:
@@ -832,7 +1359,7 @@ void VoxelStreamSQLite::load_all_blocks(FullLoadingResult &result) {
 
 			if (voxel_data.size() > 0) {
 				std::shared_ptr<VoxelBufferInternal> voxels = make_shared_instance<VoxelBufferInternal>();
-				ERR_FAIL_COND(!BlockSerializer::decompress_and_deserialize(voxel_data, *voxels));
+				ERR_FAIL_COND(!BlockSerializer::decompress_and_deserialize(voxel_data, *voxels, ctx->zstd_dictionary));
 				result_block.voxels = voxels;
 			}
 
@@ -855,8 +1382,11 @@ void VoxelStreamSQLite::load_all_blocks(FullLoadingResult &result) {
 
 	// Had to suffix `_outer`,
 	// because otherwise GCC thinks it shadows a variable inside the local function/captureless lambda
-	Context ctx_outer{ *this, result };
+	const std::shared_ptr<CompressedData::ZstdDictionary> zstd_dictionary =
+			get_compression_settings().zstd_dictionary;
+	Context ctx_outer{ *this, result, zstd_dictionary.get() };
 	const bool request_result = con->load_all_blocks(&ctx_outer, L::process_block_func);
+	recycle_connection(con);
 	ERR_FAIL_COND(request_result == false);
 }
 
@@ -866,6 +1396,8 @@ int VoxelStreamSQLite::get_used_channels_mask() const {
 }
 
 void VoxelStreamSQLite::flush_cache() {
+	// Two connections writing at the same time could each wait for the other to release its lock
+	MutexLock lock(_flush_mutex);
 	VoxelStreamSQLiteInternal *con = get_connection();
 	ERR_FAIL_COND(con == nullptr);
 	flush_cache(con);
@@ -881,61 +1413,96 @@ void VoxelStreamSQLite::flush_cache(VoxelStreamSQLiteInternal *con) {
 	ERR_FAIL_COND(con->begin_transaction() == false);
 
 	std::vector<uint8_t> &temp_data = _temp_block_data;
-	std::vector<uint8_t> &temp_compressed_data = _temp_compressed_block_data;
-
-	// TODO Needs better error rollback handling
-	_cache.flush([con, &temp_data, &temp_compressed_data](VoxelStreamCache::Block &block) {
+	std::vector<VoxelStreamSQLiteInternal::BlockToSave> &blocks_to_save = tls_blocks_to_save;
+	const CompressedData::Settings compression_settings = get_compression_settings();
+	// Elements are reused, so their buffers don't get reallocated every time
+	unsigned int block_count = 0;
+	// Once saving failed, the remaining blocks are not sent since the transaction will be rolled back
+	bool success = true;
+
+	_cache.flush([con, &temp_data, &blocks_to_save, &block_count, &compression_settings, &success](
+						 VoxelStreamCache::Block &block) {
+		if (!success) {
+			return;
+		}
 		ERR_FAIL_COND(!BlockLocation::validate(block.position, block.lod));
 
-		BlockLocation loc;
+		if (block_count == blocks_to_save.size()) {
+			blocks_to_save.resize(block_count + 1);
+		}
+		VoxelStreamSQLiteInternal::BlockToSave &block_to_save = blocks_to_save[block_count];
+
+		BlockLocation &loc = block_to_save.location;
 		loc.x = block.position.x;
 		loc.y = block.position.y;
 		loc.z = block.position.z;
 		loc.lod = block.lod;
 
 		// Save voxels
-		if (block.has_voxels) {
-			if (block.voxels_deleted) {
-				const std::vector<uint8_t> empty;
-				con->save_block(loc, empty, VoxelStreamSQLiteInternal::VOXELS);
-			} else {
-				BlockSerializer::SerializeResult res = BlockSerializer::serialize_and_compress(block.voxels);
-				ERR_FAIL_COND(!res.success);
-				con->save_block(loc, res.data, VoxelStreamSQLiteInternal::VOXELS);
-			}
+		block_to_save.has_voxels = block.has_voxels;
+		block_to_save.voxel_data.clear();
+		if (block.has_voxels && !block.voxels_deleted) {
+			BlockSerializer::SerializeResult res =
+					BlockSerializer::serialize_and_compress(block.voxels, compression_settings);
+			ERR_FAIL_COND(!res.success);
+			block_to_save.voxel_data = res.data;
 		}
 
 		// Save instances
-		temp_compressed_data.clear();
+		block_to_save.instance_data.clear();
 		if (block.instances != nullptr) {
 			temp_data.clear();
 
 			ERR_FAIL_COND(!serialize_instance_block_data(*block.instances, temp_data));
 
 			ERR_FAIL_COND(!CompressedData::compress(
-					to_span_const(temp_data), temp_compressed_data, CompressedData::COMPRESSION_NONE));
+					to_span_const(temp_data), block_to_save.instance_data, CompressedData::COMPRESSION_NONE));
 		}
-		con->save_block(loc, temp_compressed_data, VoxelStreamSQLiteInternal::INSTANCES);
 
-		// TODO Optimization: add a version of the query that can update both at once
+		++block_count;
+
+		if (block_count == VoxelStreamSQLiteInternal::MAX_ROWS_PER_STATEMENT) {
+			success = con->save_blocks(
+					Span<const VoxelStreamSQLiteInternal::BlockToSave>(blocks_to_save.data(), block_count));
+			block_count = 0;
+		}
 	});
 
-	ERR_FAIL_COND(con->end_transaction() == false);
+	if (success && block_count > 0) {
+		success = con->save_blocks(
+				Span<const VoxelStreamSQLiteInternal::BlockToSave>(blocks_to_save.data(), block_count));
+	}
+	if (success) {
+		success = con->end_transaction();
+	}
+
+	if (!success) {
+		con->rollback_transaction();
+		ZN_PRINT_ERROR(format("VoxelStreamSQLite: could not save blocks to {}, changes were rolled back",
+				con->get_opened_file_path()));
+	}
 }
 
-VoxelStreamSQLiteInternal *VoxelStreamSQLite::get_connection() {
+VoxelStreamSQLiteInternal *VoxelStreamSQLite::get_connection(bool read_only) {
+	std::vector<VoxelStreamSQLiteInternal *> &pool = read_only ? _read_connection_pool : _connection_pool;
+
 	_connection_mutex.lock();
 	if (_connection_path.is_empty()) {
 		_connection_mutex.unlock();
 		return nullptr;
 	}
-	if (_connection_pool.size() != 0) {
-		VoxelStreamSQLiteInternal *s = _connection_pool.back();
-		_connection_pool.pop_back();
+	if (pool.size() != 0) {
+		VoxelStreamSQLiteInternal *s = pool.back();
+		pool.pop_back();
 		_connection_mutex.unlock();
 		return s;
 	}
 	String fpath = _connection_path;
+	const ConnectionSettings settings = _connection_settings;
+	if (!_database_ready) {
+		// The database may not even exist yet. The connection will be recycled as a writer.
+		read_only = false;
+	}
 	_connection_mutex.unlock();
 
 	if (fpath.is_empty()) {
@@ -943,32 +1510,316 @@ VoxelStreamSQLiteInternal *VoxelStreamSQLite::get_connection() {
 	}
 	VoxelStreamSQLiteInternal *con = new VoxelStreamSQLiteInternal();
 	CharString fpath_utf8 = fpath.utf8();
-	if (!con->open(fpath_utf8)) {
+	if (!con->open(fpath_utf8, settings, read_only)) {
 		delete con;
-		con = nullptr;
+		return nullptr;
+	}
+
+	if (!read_only) {
+		MutexLock lock(_connection_mutex);
+		if (_connection_path == fpath) {
+			_database_ready = true;
+		}
 	}
+
+	MutexLock compression_lock(_compression_mutex);
+	if (!_zstd_dictionary_loaded) {
+		std::vector<uint8_t> dictionary_data;
+		if (con->load_zstd_dictionary(dictionary_data) && dictionary_data.size() > 0) {
+			_compression_settings.zstd_dictionary = CompressedData::ZstdDictionary::create(
+					to_span_const(dictionary_data), _compression_settings.zstd_level);
+		}
+		_zstd_dictionary_loaded = true;
+	}
+
 	return con;
 }
 
 void VoxelStreamSQLite::recycle_connection(VoxelStreamSQLiteInternal *con) {
 	String con_path = con->get_opened_file_path();
 	_connection_mutex.lock();
-	// If path differs, delete this connection
-	if (_connection_path != con_path) {
+	// If path or settings differ, delete this connection
+	if (_connection_path != con_path || !(_connection_settings == con->get_settings())) {
 		_connection_mutex.unlock();
 		delete con;
 	} else {
-		_connection_pool.push_back(con);
+		if (con->is_read_only()) {
+			_read_connection_pool.push_back(con);
+		} else {
+			_connection_pool.push_back(con);
+		}
 		_connection_mutex.unlock();
 	}
 }
 
+// This function does not lock any mutex for internal use.
+void VoxelStreamSQLite::clear_connection_pools() {
+	for (auto it = _connection_pool.begin(); it != _connection_pool.end(); ++it) {
+		delete *it;
+	}
+	_connection_pool.clear();
+	for (auto it = _read_connection_pool.begin(); it != _read_connection_pool.end(); ++it) {
+		delete *it;
+	}
+	_read_connection_pool.clear();
+}
+
+void VoxelStreamSQLite::set_wal_enabled(bool enabled) {
+	MutexLock lock(_connection_mutex);
+	if (enabled == _connection_settings.wal_enabled) {
+		return;
+	}
+	_connection_settings.wal_enabled = enabled;
+	// Connections in use are deleted when they get recycled
+	clear_connection_pools();
+}
+
+bool VoxelStreamSQLite::is_wal_enabled() const {
+	MutexLock lock(_connection_mutex);
+	return _connection_settings.wal_enabled;
+}
+
+void VoxelStreamSQLite::set_synchronous(Synchronous mode) {
+	ERR_FAIL_INDEX(mode, SYNCHRONOUS_FULL + 1);
+	MutexLock lock(_connection_mutex);
+	if (mode == _connection_settings.synchronous) {
+		return;
+	}
+	_connection_settings.synchronous = mode;
+	clear_connection_pools();
+}
+
+VoxelStreamSQLite::Synchronous VoxelStreamSQLite::get_synchronous() const {
+	MutexLock lock(_connection_mutex);
+	return _connection_settings.synchronous;
+}
+
+void VoxelStreamSQLite::set_cache_size_kb(int size) {
+	size = math::max(size, 0);
+	MutexLock lock(_connection_mutex);
+	if (size == _connection_settings.cache_size_kb) {
+		return;
+	}
+	_connection_settings.cache_size_kb = size;
+	clear_connection_pools();
+}
+
+int VoxelStreamSQLite::get_cache_size_kb() const {
+	MutexLock lock(_connection_mutex);
+	return _connection_settings.cache_size_kb;
+}
+
+CompressedData::Settings VoxelStreamSQLite::get_compression_settings() const {
+	MutexLock lock(_compression_mutex);
+	return _compression_settings;
+}
+
+void VoxelStreamSQLite::set_compression(Compression compression) {
+	ERR_FAIL_COND(compression != COMPRESSION_LZ4 && compression != COMPRESSION_ZSTD);
+	MutexLock lock(_compression_mutex);
+	_compression_settings.compression = static_cast<CompressedData::Compression>(compression);
+}
+
+VoxelStreamSQLite::Compression VoxelStreamSQLite::get_compression() const {
+	MutexLock lock(_compression_mutex);
+	return static_cast<Compression>(_compression_settings.compression);
+}
+
+void VoxelStreamSQLite::set_zstd_compression_level(int level) {
+	level = math::clamp(level, 1, CompressedData::MAX_ZSTD_LEVEL);
+	MutexLock lock(_compression_mutex);
+	if (level == _compression_settings.zstd_level) {
+		return;
+	}
+	_compression_settings.zstd_level = level;
+	const std::shared_ptr<CompressedData::ZstdDictionary> dictionary = _compression_settings.zstd_dictionary;
+	if (dictionary != nullptr) {
+		// The level is part of the dictionary
+		_compression_settings.zstd_dictionary = CompressedData::ZstdDictionary::create(dictionary->get_data(), level);
+	}
+}
+
+int VoxelStreamSQLite::get_zstd_compression_level() const {
+	MutexLock lock(_compression_mutex);
+	return _compression_settings.zstd_level;
+}
+
+Dictionary VoxelStreamSQLite::train_compression_dictionary(int max_size, int sample_count) {
+	ZN_PROFILE_SCOPE();
+	ERR_FAIL_COND_V(max_size < 256, Dictionary());
+	ERR_FAIL_COND_V(sample_count < 1, Dictionary());
+	ERR_FAIL_COND_V_MSG(get_compression() != COMPRESSION_ZSTD, Dictionary(),
+			"Dictionaries are only used with Zstd compression");
+
+	// Blocks are compressed with the dictionary when the cache is flushed, it must not change in the middle
+	MutexLock flush_lock(_flush_mutex);
+
+	VoxelStreamSQLiteInternal *con = get_connection();
+	ERR_FAIL_COND_V(con == nullptr, Dictionary());
+
+	// Pending blocks get compressed with the previous dictionary, and then recompressed like the others
+	flush_cache(con);
+
+	const CompressedData::Settings previous_settings = get_compression_settings();
+	const CompressedData::ZstdDictionary *previous_dictionary = previous_settings.zstd_dictionary.get();
+
+	// Train on decompressed data, since that's what the dictionary will be used with
+	std::vector<std::vector<uint8_t>> samples;
+	if (!con->load_random_voxel_blocks(sample_count, samples)) {
+		recycle_connection(con);
+		ERR_FAIL_V_MSG(Dictionary(), "Could not load samples");
+	}
+	for (std::vector<uint8_t> &sample : samples) {
+		std::vector<uint8_t> &data = _temp_block_data;
+		if (CompressedData::decompress(to_span_const(sample), data, previous_dictionary)) {
+			sample = data;
+		} else {
+			sample.clear();
+		}
+	}
+
+	std::vector<uint8_t> dictionary_data;
+	if (!CompressedData::train_zstd_dictionary(samples, max_size, dictionary_data)) {
+		recycle_connection(con);
+		ERR_FAIL_V_MSG(Dictionary(), "Could not train dictionary");
+	}
+
+	CompressedData::Settings settings = previous_settings;
+	settings.zstd_dictionary =
+			CompressedData::ZstdDictionary::create(to_span_const(dictionary_data), previous_settings.zstd_level);
+	if (settings.zstd_dictionary == nullptr) {
+		recycle_connection(con);
+		ERR_FAIL_V_MSG(Dictionary(), "Could not create dictionary");
+	}
+
+	// Recompress all blocks, so they don't depend on the previous dictionary
+	uint64_t block_count = 0;
+	uint64_t previous_size = 0;
+	uint64_t new_size = 0;
+	{
+		ZN_PROFILE_SCOPE_NAMED("Recompress blocks");
+		const unsigned int batch_size = 1024;
+		std::vector<uint64_t> locations;
+		std::vector<std::vector<uint8_t>> blocks;
+		int64_t last_location = -1;
+
+		if (!con->begin_transaction()) {
+			recycle_connection(con);
+			ERR_FAIL_V(Dictionary());
+		}
+
+		// If anything fails, changes are rolled back so the database keeps using the previous dictionary
+		bool success = true;
+
+		do {
+			locations.clear();
+			blocks.clear();
+			if (!con->load_voxel_blocks_after(last_location, batch_size, locations, blocks)) {
+				success = false;
+				break;
+			}
+
+			for (size_t i = 0; i < blocks.size(); ++i) {
+				const std::vector<uint8_t> &block = blocks[i];
+				last_location = locations[i];
+
+				std::vector<uint8_t> &data = _temp_block_data;
+				std::vector<uint8_t> &compressed_data = _temp_compressed_block_data;
+				if (!CompressedData::decompress(to_span_const(block), data, previous_dictionary)) {
+					ZN_PRINT_ERROR(format("Could not decompress block {}, it won't be recompressed", last_location));
+					continue;
+				}
+				if (!CompressedData::compress(to_span_const(data), compressed_data, settings)) {
+					// It would no longer be readable once the dictionary changes
+					ZN_PRINT_ERROR(format("Could not compress block {}", last_location));
+					success = false;
+					break;
+				}
+				if (!con->save_block(BlockLocation::decode(last_location), compressed_data,
+							VoxelStreamSQLiteInternal::VOXELS)) {
+					success = false;
+					break;
+				}
+
+				++block_count;
+				previous_size += block.size();
+				new_size += compressed_data.size();
+			}
+		} while (success && blocks.size() == batch_size);
+
+		if (success) {
+			success = con->save_zstd_dictionary(to_span_const(dictionary_data));
+		}
+		if (success) {
+			success = con->end_transaction();
+		}
+
+		if (!success) {
+			con->rollback_transaction();
+			recycle_connection(con);
+			ERR_FAIL_V_MSG(Dictionary(), "Could not recompress blocks, the previous dictionary is still used");
+		}
+	}
+
+	{
+		MutexLock lock(_compression_mutex);
+		_compression_settings.zstd_dictionary = settings.zstd_dictionary;
+	}
+
+	recycle_connection(con);
+
+	ZN_PRINT_VERBOSE(format("VoxelStreamSQLite: recompressed {} blocks from {} to {} bytes", block_count,
+			previous_size, new_size));
+
+	Dictionary d;
+	d["dictionary_size"] = int64_t(dictionary_data.size());
+	d["sample_count"] = int64_t(samples.size());
+	d["block_count"] = int64_t(block_count);
+	d["previous_size"] = int64_t(previous_size);
+	d["new_size"] = int64_t(new_size);
+	return d;
+}
+
 void VoxelStreamSQLite::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("set_database_path", "path"), &VoxelStreamSQLite::set_database_path);
 	ClassDB::bind_method(D_METHOD("get_database_path"), &VoxelStreamSQLite::get_database_path);
 
+	ClassDB::bind_method(D_METHOD("set_compression", "compression"), &VoxelStreamSQLite::set_compression);
+	ClassDB::bind_method(D_METHOD("get_compression"), &VoxelStreamSQLite::get_compression);
+
+	ClassDB::bind_method(
+			D_METHOD("set_zstd_compression_level", "level"), &VoxelStreamSQLite::set_zstd_compression_level);
+	ClassDB::bind_method(D_METHOD("get_zstd_compression_level"), &VoxelStreamSQLite::get_zstd_compression_level);
+
+	ClassDB::bind_method(D_METHOD("set_wal_enabled", "enabled"), &VoxelStreamSQLite::set_wal_enabled);
+	ClassDB::bind_method(D_METHOD("is_wal_enabled"), &VoxelStreamSQLite::is_wal_enabled);
+
+	ClassDB::bind_method(D_METHOD("set_synchronous", "mode"), &VoxelStreamSQLite::set_synchronous);
+	ClassDB::bind_method(D_METHOD("get_synchronous"), &VoxelStreamSQLite::get_synchronous);
+
+	ClassDB::bind_method(D_METHOD("set_cache_size_kb", "size"), &VoxelStreamSQLite::set_cache_size_kb);
+	ClassDB::bind_method(D_METHOD("get_cache_size_kb"), &VoxelStreamSQLite::get_cache_size_kb);
+
+	ClassDB::bind_method(D_METHOD("train_compression_dictionary", "max_size", "sample_count"),
+			&VoxelStreamSQLite::train_compression_dictionary, DEFVAL(65536), DEFVAL(1000));
+
 	ADD_PROPERTY(PropertyInfo(Variant::STRING, "database_path", PROPERTY_HINT_FILE), "set_database_path",
 			"get_database_path");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "compression", PROPERTY_HINT_ENUM, "LZ4:2,Zstd:3"), "set_compression",
+			"get_compression");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "zstd_compression_level", PROPERTY_HINT_RANGE, "1,19"),
+			"set_zstd_compression_level", "get_zstd_compression_level");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "wal_enabled"), "set_wal_enabled", "is_wal_enabled");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "synchronous", PROPERTY_HINT_ENUM, "Off,Normal,Full"), "set_synchronous",
+			"get_synchronous");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "cache_size_kb"), "set_cache_size_kb", "get_cache_size_kb");
+
+	BIND_ENUM_CONSTANT(COMPRESSION_LZ4);
+	BIND_ENUM_CONSTANT(COMPRESSION_ZSTD);
+
+	BIND_ENUM_CONSTANT(SYNCHRONOUS_OFF);
+	BIND_ENUM_CONSTANT(SYNCHRONOUS_NORMAL);
+	BIND_ENUM_CONSTANT(SYNCHRONOUS_FULL);
 }
 
 } // namespace zylann::voxel
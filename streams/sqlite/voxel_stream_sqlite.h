@@ -2,6 +2,7 @@
 #define VOXEL_STREAM_SQLITE_H
 
 #include "../../util/thread/mutex.h"
+#include "../compressed_data.h"
 #include "../voxel_block_serializer.h"
 #include "../voxel_stream.h"
 #include "../voxel_stream_cache.h"
@@ -17,6 +18,31 @@ class VoxelStreamSQLite : public VoxelStream {
 public:
 	static const unsigned int CACHE_SIZE = 64;
 
+	// How voxel blocks are compressed. Blocks saved with a different mode remain readable.
+	enum Compression {
+		COMPRESSION_LZ4 = CompressedData::COMPRESSION_LZ4,
+		COMPRESSION_ZSTD = CompressedData::COMPRESSION_ZSTD
+	};
+
+	// Same as SQLite's `synchronous` pragma
+	enum Synchronous { //
+		SYNCHRONOUS_OFF = 0,
+		SYNCHRONOUS_NORMAL = 1,
+		SYNCHRONOUS_FULL = 2
+	};
+
+	// Applied to connections when they open
+	struct ConnectionSettings {
+		bool wal_enabled = true;
+		Synchronous synchronous = SYNCHRONOUS_NORMAL;
+		int cache_size_kb = 2000;
+
+		bool operator==(const ConnectionSettings &other) const {
+			return wal_enabled == other.wal_enabled && synchronous == other.synchronous &&
+					cache_size_kb == other.cache_size_kb;
+		}
+	};
+
 	VoxelStreamSQLite();
 	~VoxelStreamSQLite();
 
@@ -38,10 +64,34 @@ public:
 	}
 	void load_all_blocks(FullLoadingResult &result) override;
 
+	// Each thread gets its own connection
+	bool supports_concurrent_access() const override {
+		return true;
+	}
+
 	int get_used_channels_mask() const override;
 
 	void flush_cache();
 
+	void set_compression(Compression compression);
+	Compression get_compression() const;
+
+	void set_zstd_compression_level(int level);
+	int get_zstd_compression_level() const;
+
+	void set_wal_enabled(bool enabled);
+	bool is_wal_enabled() const;
+
+	void set_synchronous(Synchronous mode);
+	Synchronous get_synchronous() const;
+
+	void set_cache_size_kb(int size);
+	int get_cache_size_kb() const;
+
+	// Trains a Zstd dictionary from a sample of the voxel blocks in the database, then recompresses all of them with
+	// it. The dictionary is saved in the database. This is meant to be run as a tool, while no terrain uses the stream.
+	Dictionary train_compression_dictionary(int max_size, int sample_count);
+
 private:
 	// An SQlite3 database is safe to use with multiple threads in serialized mode,
 	// but after having a look at the implementation while stepping with a debugger, here are what actually happens:
@@ -57,17 +107,31 @@ private:
 	// Because of this, in our use case, it might be simpler to just leave SQLite in thread-safe mode,
 	// and synchronize ourselves.
 
-	VoxelStreamSQLiteInternal *get_connection();
+	// Read-only connections can be used by several threads while another one writes
+	VoxelStreamSQLiteInternal *get_connection(bool read_only = false);
 	void recycle_connection(VoxelStreamSQLiteInternal *con);
+	void clear_connection_pools();
 	void flush_cache(VoxelStreamSQLiteInternal *con);
+	CompressedData::Settings get_compression_settings() const;
 
 	static void _bind_methods();
 
 	String _connection_path;
+	ConnectionSettings _connection_settings;
+	// Read-only connections can only be opened once the database was setup by another
+	bool _database_ready = false;
 	std::vector<VoxelStreamSQLiteInternal *> _connection_pool;
+	std::vector<VoxelStreamSQLiteInternal *> _read_connection_pool;
 	Mutex _connection_mutex;
+	Mutex _flush_mutex;
 	VoxelStreamCache _cache;
 
+	// Loads may run in multiple threads while these are changed, so they are copied under a lock
+	CompressedData::Settings _compression_settings;
+	// Loaded from the database when the first connection is opened
+	bool _zstd_dictionary_loaded = false;
+	Mutex _compression_mutex;
+
 	// TODO I should consider specialized memory allocators
 	static thread_local std::vector<uint8_t> _temp_block_data;
 	static thread_local std::vector<uint8_t> _temp_compressed_block_data;
@@ -75,4 +139,7 @@ private:
 
 } // namespace zylann::voxel
 
+VARIANT_ENUM_CAST(zylann::voxel::VoxelStreamSQLite::Compression)
+VARIANT_ENUM_CAST(zylann::voxel::VoxelStreamSQLite::Synchronous)
+
 #endif // VOXEL_STREAM_SQLITE_H
@@ -242,7 +242,9 @@ size_t get_size_in_bytes(const VoxelBufferInternal &buffer, size_t &metadata_siz
 		size += 1;
 
 		switch (compression) {
-			case VoxelBufferInternal::COMPRESSION_NONE: {
+			case VoxelBufferInternal::COMPRESSION_NONE:
+			// Palette compression is only used in memory, such channels are saved without compression
+			case VoxelBufferInternal::COMPRESSION_PALETTE: {
 				size += VoxelBufferInternal::get_size_in_bytes_for_volume(size_in_voxels, depth);
 			} break;
 
@@ -250,6 +252,11 @@ size_t get_size_in_bytes(const VoxelBufferInternal &buffer, size_t &metadata_siz
 				size += VoxelBufferInternal::get_depth_bit_count(depth) >> 3;
 			} break;
 
+			case VoxelBufferInternal::COMPRESSION_QUANTIZED: {
+				// Min, step, and one byte per voxel
+				size += 2 * sizeof(float) + Vector3iUtil::get_volume(size_in_voxels);
+			} break;
+
 			default:
 				ERR_PRINT("Unhandled compression mode");
 				CRASH_NOW();
@@ -266,6 +273,15 @@ size_t get_size_in_bytes(const VoxelBufferInternal &buffer, size_t &metadata_siz
 	return size + metadata_size_with_header + BLOCK_TRAILING_MAGIC_SIZE;
 }
 
+template <typename T>
+static void store_palette_channel(
+		MemoryWriter &f, const VoxelBufferInternal &voxel_buffer, unsigned int channel_index, std::vector<T> &tmp) {
+	const Vector3i size = voxel_buffer.get_size();
+	tmp.resize(Vector3iUtil::get_volume(size));
+	voxel_buffer.copy_to(to_span(tmp), size, Vector3i(), Vector3i(), size, channel_index);
+	f.store_buffer(to_span(tmp).template reinterpret_cast_to<uint8_t>());
+}
+
 SerializeResult serialize(const VoxelBufferInternal &voxel_buffer) {
 	//
 	ZN_PROFILE_SCOPE();
@@ -301,6 +317,33 @@ SerializeResult serialize(const VoxelBufferInternal &voxel_buffer) {
 	for (unsigned int channel_index = 0; channel_index < VoxelBufferInternal::MAX_CHANNELS; ++channel_index) {
 		const VoxelBufferInternal::Compression compression = voxel_buffer.get_channel_compression(channel_index);
 		const VoxelBufferInternal::Depth depth = voxel_buffer.get_channel_depth(channel_index);
+
+		if (compression == VoxelBufferInternal::COMPRESSION_PALETTE) {
+			// Palette compression is only used in memory, such channels are saved without compression
+			f.store_8(static_cast<uint8_t>(VoxelBufferInternal::COMPRESSION_NONE) | (static_cast<uint8_t>(depth) << 4));
+			switch (depth) {
+				case VoxelBufferInternal::DEPTH_8_BIT: {
+					static thread_local std::vector<uint8_t> tls_tmp;
+					store_palette_channel(f, voxel_buffer, channel_index, tls_tmp);
+				} break;
+				case VoxelBufferInternal::DEPTH_16_BIT: {
+					static thread_local std::vector<uint16_t> tls_tmp;
+					store_palette_channel(f, voxel_buffer, channel_index, tls_tmp);
+				} break;
+				case VoxelBufferInternal::DEPTH_32_BIT: {
+					static thread_local std::vector<uint32_t> tls_tmp;
+					store_palette_channel(f, voxel_buffer, channel_index, tls_tmp);
+				} break;
+				case VoxelBufferInternal::DEPTH_64_BIT: {
+					static thread_local std::vector<uint64_t> tls_tmp;
+					store_palette_channel(f, voxel_buffer, channel_index, tls_tmp);
+				} break;
+				default:
+					CRASH_NOW();
+			}
+			continue;
+		}
+
 		// Low nibble: compression (up to 16 values allowed)
 		// High nibble: depth (up to 16 values allowed)
 		const uint8_t fmt = static_cast<uint8_t>(compression) | (static_cast<uint8_t>(depth) << 4);
@@ -333,6 +376,17 @@ SerializeResult serialize(const VoxelBufferInternal &voxel_buffer) {
 				}
 			} break;
 
+			case VoxelBufferInternal::COMPRESSION_QUANTIZED: {
+				float min_value;
+				float step;
+				Span<const uint8_t> codes;
+				ERR_FAIL_COND_V(!voxel_buffer.get_channel_quantized(channel_index, min_value, step, codes),
+						SerializeResult(dst_data, false));
+				f.store_float(min_value);
+				f.store_float(step);
+				f.store_buffer(codes);
+			} break;
+
 			default:
 				CRASH_COND("Unhandled compression mode");
 		}
@@ -573,6 +627,10 @@ bool deserialize(Span<const uint8_t> p_data, VoxelBufferInternal &out_voxel_buff
 			return deserialize(to_span(migrated_data), out_voxel_buffer);
 		} break;
 
+		case 4:
+			// Version 5 only added a compression mode, version 4 blocks can be read as they are
+			break;
+
 		default:
 			ERR_FAIL_COND_V(format_version != BLOCK_FORMAT_VERSION, false);
 	}
@@ -632,6 +690,20 @@ bool deserialize(Span<const uint8_t> p_data, VoxelBufferInternal &out_voxel_buff
 				out_voxel_buffer.clear_channel(channel_index, v);
 			} break;
 
+			case VoxelBufferInternal::COMPRESSION_QUANTIZED: {
+				const float min_value = f.get_float();
+				const float step = f.get_float();
+				static thread_local std::vector<uint8_t> tls_codes;
+				tls_codes.resize(Vector3iUtil::get_volume(out_voxel_buffer.get_size()));
+				const size_t read_len = f.get_buffer(to_span(tls_codes));
+				if (read_len != tls_codes.size()) {
+					ERR_PRINT("Unexpected end of file");
+					return false;
+				}
+				const Span<const uint8_t> codes = to_span_const(tls_codes);
+				ERR_FAIL_COND_V(!out_voxel_buffer.set_channel_quantized(channel_index, min_value, step, codes), false);
+			} break;
+
 			default:
 				ERR_PRINT("Unhandled compression mode");
 				return false;
@@ -653,6 +725,13 @@ bool deserialize(Span<const uint8_t> p_data, VoxelBufferInternal &out_voxel_buff
 }
 
 SerializeResult serialize_and_compress(const VoxelBufferInternal &voxel_buffer) {
+	CompressedData::Settings compression_settings;
+	compression_settings.compression = CompressedData::COMPRESSION_LZ4;
+	return serialize_and_compress(voxel_buffer, compression_settings);
+}
+
+SerializeResult serialize_and_compress(
+		const VoxelBufferInternal &voxel_buffer, const CompressedData::Settings &compression_settings) {
 	ZN_PROFILE_SCOPE();
 
 	std::vector<uint8_t> &compressed_data = tls_compressed_data;
@@ -662,18 +741,19 @@ SerializeResult serialize_and_compress(const VoxelBufferInternal &voxel_buffer)
 	const std::vector<uint8_t> &data = res.data;
 
 	res.success = CompressedData::compress(
-			Span<const uint8_t>(data.data(), 0, data.size()), compressed_data, CompressedData::COMPRESSION_LZ4);
+			Span<const uint8_t>(data.data(), 0, data.size()), compressed_data, compression_settings);
 	ERR_FAIL_COND_V(!res.success, SerializeResult(compressed_data, false));
 
 	return SerializeResult(compressed_data, true);
 }
 
-bool decompress_and_deserialize(Span<const uint8_t> p_data, VoxelBufferInternal &out_voxel_buffer) {
+bool decompress_and_deserialize(Span<const uint8_t> p_data, VoxelBufferInternal &out_voxel_buffer,
+		const CompressedData::ZstdDictionary *zstd_dictionary) {
 	ZN_PROFILE_SCOPE();
 
 	std::vector<uint8_t> &data = tls_data;
 
-	const bool res = CompressedData::decompress(p_data, data);
+	const bool res = CompressedData::decompress(p_data, data, zstd_dictionary);
 	ERR_FAIL_COND_V(!res, false);
 
 	return deserialize(to_span_const(data), out_voxel_buffer);
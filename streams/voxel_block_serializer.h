@@ -2,6 +2,7 @@
 #define VOXEL_BLOCK_SERIALIZER_H
 
 #include "../util/span.h"
+#include "compressed_data.h"
 
 #include <cstdint>
 #include <vector>
@@ -16,7 +17,7 @@ class VoxelBufferInternal;
 namespace BlockSerializer {
 
 // Latest version, used when serializing
-static const uint8_t BLOCK_FORMAT_VERSION = 4;
+static const uint8_t BLOCK_FORMAT_VERSION = 5;
 
 struct SerializeResult {
 	// The lifetime of the pointed object is only valid in the calling thread,
@@ -30,8 +31,13 @@ struct SerializeResult {
 SerializeResult serialize(const VoxelBufferInternal &voxel_buffer);
 bool deserialize(Span<const uint8_t> p_data, VoxelBufferInternal &out_voxel_buffer);
 
+// Uses LZ4 compression
 SerializeResult serialize_and_compress(const VoxelBufferInternal &voxel_buffer);
-bool decompress_and_deserialize(Span<const uint8_t> p_data, VoxelBufferInternal &out_voxel_buffer);
+SerializeResult serialize_and_compress(
+		const VoxelBufferInternal &voxel_buffer, const CompressedData::Settings &compression_settings);
+// A dictionary is only needed for data which was compressed with one
+bool decompress_and_deserialize(Span<const uint8_t> p_data, VoxelBufferInternal &out_voxel_buffer,
+		const CompressedData::ZstdDictionary *zstd_dictionary = nullptr);
 bool decompress_and_deserialize(FileAccess &f, unsigned int size_to_read, VoxelBufferInternal &out_voxel_buffer);
 
 // Temporary thread-local buffers for internal use
@@ -50,6 +50,19 @@ void VoxelStream::load_all_blocks(FullLoadingResult &result) {
 	ERR_PRINT(String("{0} does not support `load_all_blocks`").format(varray(get_class_name())));
 }
 
+VoxelStream::AccessLock::AccessLock(VoxelStream &stream) {
+	if (!stream.supports_concurrent_access()) {
+		_mutex = &stream._serial_access_mutex;
+		_mutex->lock();
+	}
+}
+
+VoxelStream::AccessLock::~AccessLock() {
+	if (_mutex != nullptr) {
+		_mutex->unlock();
+	}
+}
+
 int VoxelStream::get_used_channels_mask() const {
 	return 0;
 }
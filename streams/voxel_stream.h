@@ -2,6 +2,7 @@
 #define VOXEL_STREAM_H
 
 #include "../util/memory.h"
+#include "../util/thread/mutex.h"
 #include "../util/thread/rw_lock.h"
 #include "instance_data.h"
 
@@ -16,8 +17,9 @@ class VoxelBuffer;
 }
 
 // Provides access to a source of paged voxel data, which may load and save.
-// This is intented for files, so it may run in a single background thread and gets requests in batches.
-// Must be implemented in a thread-safe way.
+// This is intented for files, so it runs in background threads and gets requests in batches.
+// Must be implemented in a thread-safe way. Unless the stream supports concurrent access, calls made by tasks are
+// serialized, so only one thread uses it at a time.
 //
 // Functions currently don't enforce querying blocks of the same size, however it is required for every stream to
 // support querying blocks the size of the declared block size, at positions matching their origins.
@@ -95,6 +97,22 @@ public:
 
 	virtual void load_all_blocks(FullLoadingResult &result);
 
+	// Tells if the stream can serve calls from several threads at once efficiently. When it doesn't, tasks use
+	// `AccessLock` so they don't wait on each other inside the stream while other streams could be used.
+	virtual bool supports_concurrent_access() const {
+		return false;
+	}
+
+	// Held by tasks while they use the stream. Does nothing if the stream supports concurrent access.
+	class AccessLock {
+	public:
+		AccessLock(VoxelStream &stream);
+		~AccessLock();
+
+	private:
+		Mutex *_mutex = nullptr;
+	};
+
 	// Tells which channels can be found in this stream.
 	// The simplest implementation is to return them all.
 	// One reason to specify which channels are available is to help the editor detect configuration issues,
@@ -130,6 +148,8 @@ private:
 
 	Parameters _parameters;
 	RWLock _parameters_lock;
+
+	Mutex _serial_access_mutex;
 };
 
 } // namespace zylann::voxel
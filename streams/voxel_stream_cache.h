@@ -4,6 +4,8 @@
 #include "../storage/voxel_buffer_internal.h"
 #include "../util/memory.h"
 #include "instance_data.h"
+
+#include <atomic>
 #include <unordered_map>
 
 namespace zylann::voxel {
@@ -26,6 +28,8 @@ public:
 		UniquePtr<InstanceBlockData> instances;
 	};
 
+	VoxelStreamCache() : _count(0) {}
+
 	// Copies cached block into provided buffer
 	bool load_voxel_block(Vector3i position, uint8_t lod_index, VoxelBufferInternal &out_voxels);
 
@@ -62,7 +66,8 @@ private:
 	};
 
 	FixedArray<Lod, constants::MAX_LOD> _cache;
-	unsigned int _count = 0;
+	// Blocks of different LODs can be saved from different threads at the same time
+	std::atomic_uint32_t _count;
 };
 
 } // namespace zylann::voxel
@@ -6,6 +6,7 @@
 #include "../../server/voxel_server_updater.h"
 #include "../../storage/voxel_buffer_gd.h"
 #include "../../util/container_funcs.h"
+#include "../../util/godot/funcs.h"
 #include "../../util/macros.h"
 #include "../../util/math/conv.h"
 #include "../../util/profiling.h"
@@ -17,6 +18,7 @@
 #include <core/config/engine.h>
 #include <core/core_string_names.h>
 #include <scene/3d/mesh_instance_3d.h>
+#include <scene/resources/concave_polygon_shape_3d.h>
 
 namespace zylann::voxel {
 
@@ -56,7 +58,8 @@ VoxelTerrain::VoxelTerrain() {
 		task->volume_id = self->_volume_id;
 		task->self = self;
 		task->data = ob;
-		VoxelServer::get_singleton().push_main_thread_time_spread_task(task);
+		VoxelServer::get_singleton().push_main_thread_time_spread_task(
+				task, VoxelServer::MAIN_THREAD_TASK_MESH, ob.priority);
 	};
 	callbacks.data_output_callback = [](void *cb_data, VoxelServer::BlockDataOutput &ob) {
 		VoxelTerrain *self = reinterpret_cast<VoxelTerrain *>(cb_data);
@@ -567,7 +570,7 @@ struct ScheduleSaveAction {
 			//print_line(String("Scheduling save for block {0}").format(varray(block->position.to_vec3())));
 			VoxelTerrain::BlockToSave b;
 			if (with_copy) {
-				RWLockRead lock(block.get_voxels().get_lock());
+				RWLockRead lock(block.get_voxels_const().get_lock());
 				b.voxels = make_shared_instance<VoxelBufferInternal>();
 				block.get_voxels_const().duplicate_to(*b.voxels, true);
 			} else {
@@ -1382,13 +1385,17 @@ void VoxelTerrain::process_meshing() {
 			//mesh_request.data_blocks_count = data_box.size.volume();
 
 			// This iteration order is specifically chosen to match VoxelServer and threaded access
-			data_box.for_each_cell_zxy([this, &mesh_request](Vector3i data_block_pos) {
-				VoxelDataBlock *data_block = _data_map.get_block(data_block_pos);
+			FixedArray<const VoxelDataBlock *, constants::MAX_BLOCK_COUNT_PER_REQUEST> data_blocks;
+			const unsigned int data_block_count = Vector3iUtil::get_volume(data_box.size);
+			ERR_CONTINUE(data_block_count > data_blocks.size());
+			_data_map.get_blocks_in_area(data_box, to_span(data_blocks, data_block_count));
+			for (unsigned int i = 0; i < data_block_count; ++i) {
+				const VoxelDataBlock *data_block = data_blocks[i];
 				if (data_block != nullptr) {
 					mesh_request.data_blocks[mesh_request.data_blocks_count] = data_block->get_voxels_shared();
 				}
 				++mesh_request.data_blocks_count;
-			});
+			}
 
 #ifdef DEBUG_ENABLED
 			{
@@ -1441,8 +1448,6 @@ void VoxelTerrain::apply_mesh_update(const VoxelServer::BlockMeshOutput &ob) {
 	Ref<ArrayMesh> mesh;
 
 	const bool gen_collisions = _generate_collisions && block->collision_viewers.get() > 0;
-	const bool use_render_mesh_as_collider = gen_collisions && ob.surfaces.collision_surface.positions.size() == 0;
-	std::vector<Array> render_surfaces;
 
 	int gd_surface_index = 0;
 	for (unsigned int surface_index = 0; surface_index < ob.surfaces.surfaces.size(); ++surface_index) {
@@ -1457,10 +1462,6 @@ void VoxelTerrain::apply_mesh_update(const VoxelServer::BlockMeshOutput &ob) {
 			continue;
 		}
 
-		if (use_render_mesh_as_collider) {
-			render_surfaces.push_back(arrays);
-		}
-
 		if (mesh.is_null()) {
 			mesh.instantiate();
 		}
@@ -1475,7 +1476,6 @@ void VoxelTerrain::apply_mesh_update(const VoxelServer::BlockMeshOutput &ob) {
 
 	if (mesh.is_valid() && is_mesh_empty(**mesh)) {
 		mesh = Ref<Mesh>();
-		render_surfaces.clear();
 	}
 
 	if (_instancer != nullptr) {
@@ -1498,17 +1498,14 @@ void VoxelTerrain::apply_mesh_update(const VoxelServer::BlockMeshOutput &ob) {
 	}
 
 	if (gen_collisions) {
-		const bool debug_collisions = get_tree()->is_debugging_collisions_hint();
-		const VoxelMesher::Output::CollisionSurface &collision_surface = ob.surfaces.collision_surface;
-
-		if (use_render_mesh_as_collider) {
-			block->set_collision_mesh(to_span(render_surfaces), debug_collisions, this, _collision_margin);
-
+		Ref<Shape3D> shape;
+		if (ob.has_collision_faces) {
+			shape = create_concave_polygon_shape(ob.collision_faces);
 		} else {
-			block->set_collision_mesh(to_span(collision_surface.positions), to_span(collision_surface.indices),
-					debug_collisions, this, _collision_margin);
+			// Collisions were turned on after the meshing request was sent
+			shape = VoxelMesher::build_collision_shape(ob.surfaces);
 		}
-
+		block->set_collision_shape(shape, get_tree()->is_debugging_collisions_hint(), this, _collision_margin);
 		block->set_collision_layer(_collision_layer);
 		block->set_collision_mask(_collision_mask);
 	}
@@ -1553,6 +1550,14 @@ bool VoxelTerrain::is_stream_running_in_editor() const {
 	return _run_stream_in_editor;
 }
 
+void VoxelTerrain::set_uniform_block_sharing_enabled(bool enabled) {
+	_data_map.set_uniform_block_sharing_enabled(enabled);
+}
+
+bool VoxelTerrain::is_uniform_block_sharing_enabled() const {
+	return _data_map.is_uniform_block_sharing_enabled();
+}
+
 void VoxelTerrain::set_bounds(Box3i box) {
 	_bounds_in_voxels =
 			box.clipped(Box3i::from_center_extents(Vector3i(), Vector3iUtil::create(constants::MAX_VOLUME_EXTENT)));
@@ -1691,6 +1696,11 @@ void VoxelTerrain::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("set_run_stream_in_editor", "enable"), &VoxelTerrain::set_run_stream_in_editor);
 	ClassDB::bind_method(D_METHOD("is_stream_running_in_editor"), &VoxelTerrain::is_stream_running_in_editor);
 
+	ClassDB::bind_method(D_METHOD("set_uniform_block_sharing_enabled", "enabled"),
+			&VoxelTerrain::set_uniform_block_sharing_enabled);
+	ClassDB::bind_method(
+			D_METHOD("is_uniform_block_sharing_enabled"), &VoxelTerrain::is_uniform_block_sharing_enabled);
+
 	ClassDB::bind_method(
 			D_METHOD("set_automatic_loading_enabled", "enable"), &VoxelTerrain::set_automatic_loading_enabled);
 	ClassDB::bind_method(D_METHOD("is_automatic_loading_enabled"), &VoxelTerrain::is_automatic_loading_enabled);
@@ -1746,6 +1756,8 @@ void VoxelTerrain::_bind_methods() {
 	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "run_stream_in_editor"), "set_run_stream_in_editor",
 			"is_stream_running_in_editor");
 	ADD_PROPERTY(PropertyInfo(Variant::INT, "mesh_block_size"), "set_mesh_block_size", "get_mesh_block_size");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "uniform_block_sharing_enabled"), "set_uniform_block_sharing_enabled",
+			"is_uniform_block_sharing_enabled");
 
 	// TODO Add back access to block, but with an API securing multithreaded access
 	ADD_SIGNAL(MethodInfo(VoxelStringNames::get_singleton().block_loaded, PropertyInfo(Variant::VECTOR3, "position")));
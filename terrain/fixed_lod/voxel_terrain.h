@@ -10,6 +10,7 @@
 #include "voxel_mesh_block_vt.h"
 
 #include <scene/3d/node_3d.h>
+#include <unordered_map>
 
 namespace zylann::voxel {
 
@@ -99,6 +100,9 @@ public:
 	void set_run_stream_in_editor(bool enable);
 	bool is_stream_running_in_editor() const;
 
+	void set_uniform_block_sharing_enabled(bool enabled);
+	bool is_uniform_block_sharing_enabled() const;
+
 	void set_bounds(Box3i box);
 	Box3i get_bounds() const;
 
@@ -21,6 +21,7 @@
 #include <core/config/engine.h>
 #include <core/core_string_names.h>
 #include <scene/3d/mesh_instance_3d.h>
+#include <scene/resources/concave_polygon_shape_3d.h>
 #include <scene/resources/packed_scene.h>
 
 namespace zylann::voxel {
@@ -105,7 +106,7 @@ struct ScheduleSaveAction {
 
 			b.voxels = make_shared_instance<VoxelBufferInternal>();
 			{
-				RWLockRead lock(block.get_voxels().get_lock());
+				RWLockRead lock(block.get_voxels_const().get_lock());
 				block.get_voxels_const().duplicate_to(*b.voxels, true);
 			}
 
@@ -170,7 +171,8 @@ VoxelLodTerrain::VoxelLodTerrain() {
 		task->volume_id = self->get_volume_id();
 		task->self = self;
 		task->data = ob;
-		VoxelServer::get_singleton().push_main_thread_time_spread_task(task);
+		VoxelServer::get_singleton().push_main_thread_time_spread_task(
+				task, VoxelServer::MAIN_THREAD_TASK_MESH, ob.priority);
 	};
 	callbacks.data_output_callback = [](void *cb_data, VoxelServer::BlockDataOutput &ob) {
 		VoxelLodTerrain *self = reinterpret_cast<VoxelLodTerrain *>(cb_data);
@@ -459,6 +461,31 @@ bool VoxelLodTerrain::is_full_load_mode_enabled() const {
 	return _update_data->settings.full_load_mode;
 }
 
+void VoxelLodTerrain::set_downscale_filter(int channel, DownscaleFilter filter) {
+	ERR_FAIL_INDEX(channel, VoxelBufferInternal::MAX_CHANNELS);
+	ERR_FAIL_INDEX(filter, DOWNSCALE_FILTER_COUNT);
+	// Settings are read by the update task
+	_update_data->wait_for_end_of_task();
+	_update_data->settings.downscale_filters[channel] = static_cast<zylann::voxel::DownscaleFilter>(filter);
+}
+
+VoxelLodTerrain::DownscaleFilter VoxelLodTerrain::get_downscale_filter(int channel) const {
+	ERR_FAIL_INDEX_V(channel, VoxelBufferInternal::MAX_CHANNELS, DOWNSCALE_FILTER_NEAREST);
+	return static_cast<DownscaleFilter>(_update_data->settings.downscale_filters[channel]);
+}
+
+void VoxelLodTerrain::set_uniform_block_sharing_enabled(bool enabled) {
+	for (unsigned int lod_index = 0; lod_index < _data->lods.size(); ++lod_index) {
+		VoxelDataLodMap::Lod &data_lod = _data->lods[lod_index];
+		RWLockWrite wlock(data_lod.map_lock);
+		data_lod.map.set_uniform_block_sharing_enabled(enabled);
+	}
+}
+
+bool VoxelLodTerrain::is_uniform_block_sharing_enabled() const {
+	return _data->lods[0].map.is_uniform_block_sharing_enabled();
+}
+
 void VoxelLodTerrain::set_threaded_update_enabled(bool enabled) {
 	if (enabled != _threaded_update_enabled) {
 		if (_threaded_update_enabled) {
@@ -532,6 +559,19 @@ inline std::shared_ptr<VoxelBufferInternal> try_get_voxel_buffer_with_lock(
 	return block->get_voxels_shared();
 }
 
+// Same as `try_get_voxel_buffer_with_lock`, but the returned buffer is not shared with other blocks, so it can be
+// modified.
+inline std::shared_ptr<VoxelBufferInternal> try_get_voxel_buffer_for_write_with_lock(
+		VoxelDataLodMap::Lod &data_lod, Vector3i block_pos) {
+	RWLockRead rlock(data_lod.map_lock);
+	VoxelDataBlock *block = data_lod.map.get_block(block_pos);
+	if (block == nullptr) {
+		return nullptr;
+	}
+	block->unshare_voxels();
+	return block->get_voxels_shared();
+}
+
 inline VoxelSingleValue get_voxel_with_lock(VoxelBufferInternal &vb, Vector3i pos, unsigned int channel) {
 	VoxelSingleValue v;
 	if (channel == VoxelBufferInternal::CHANNEL_SDF) {
@@ -591,23 +631,24 @@ bool VoxelLodTerrain::try_set_voxel_without_update(Vector3i pos, unsigned int ch
 	const Vector3i block_pos_lod0 = pos >> get_data_block_size_pow2();
 	VoxelDataLodMap::Lod &data_lod0 = _data->lods[0];
 	const Vector3i block_pos = data_lod0.map.voxel_to_block(pos);
-	std::shared_ptr<VoxelBufferInternal> voxels = try_get_voxel_buffer_with_lock(data_lod0, block_pos);
+	std::shared_ptr<VoxelBufferInternal> voxels = try_get_voxel_buffer_for_write_with_lock(data_lod0, block_pos);
 	if (voxels == nullptr) {
-		if (!_update_data->settings.full_load_mode) {
+		if (!_update_data->settings.full_load_mode || _generator.is_null()) {
 			return false;
 		}
-		if (_generator.is_valid()) {
-			voxels = make_shared_instance<VoxelBufferInternal>();
-			voxels->create(Vector3iUtil::create(get_data_block_size()));
-			VoxelGenerator::VoxelQueryData q{ *voxels, pos, 0 };
-			_generator->generate_block(q);
-			RWLockWrite wlock(data_lod0.map_lock);
-			if (data_lod0.map.has_block(block_pos_lod0)) {
-				// A block was loaded by another thread, cancel our edit.
-				return false;
-			}
-			data_lod0.map.set_block_buffer(block_pos_lod0, voxels, true);
+		voxels = make_shared_instance<VoxelBufferInternal>();
+		voxels->create(Vector3iUtil::create(get_data_block_size()));
+		VoxelGenerator::VoxelQueryData q{ *voxels, pos, 0 };
+		_generator->generate_block(q);
+		// Edit before adding the block, so the map doesn't share the buffer with other blocks
+		voxels->set_voxel(value, data_lod0.map.to_local(pos), channel);
+		RWLockWrite wlock(data_lod0.map_lock);
+		if (data_lod0.map.has_block(block_pos_lod0)) {
+			// A block was loaded by another thread, cancel our edit.
+			return false;
 		}
+		data_lod0.map.set_block_buffer(block_pos_lod0, voxels, true);
+		return true;
 	}
 	// If it turns out to be a problem, use CoW?
 	RWLockWrite lock(voxels->get_lock());
@@ -884,16 +925,16 @@ int VoxelLodTerrain::get_lod_count() const {
 }
 
 void VoxelLodTerrain::set_generate_collisions(bool enabled) {
-	_generate_collisions = enabled;
+	_update_data->settings.generate_collisions = enabled;
 }
 
 void VoxelLodTerrain::set_collision_lod_count(int lod_count) {
 	ERR_FAIL_COND(lod_count < 0);
-	_collision_lod_count = static_cast<unsigned int>(math::min(lod_count, get_lod_count()));
+	_update_data->settings.collision_lod_count = static_cast<unsigned int>(math::min(lod_count, get_lod_count()));
 }
 
 int VoxelLodTerrain::get_collision_lod_count() const {
-	return _collision_lod_count;
+	return _update_data->settings.collision_lod_count;
 }
 
 void VoxelLodTerrain::set_collision_layer(int layer) {
@@ -1124,7 +1165,7 @@ void VoxelLodTerrain::_process(float delta) {
 	process_fading_blocks(delta);
 
 	// TODO This could go into time spread tasks too
-	process_deferred_collision_updates(VoxelServer::get_singleton().get_main_thread_time_budget_usec());
+	process_deferred_collision_updates();
 
 #ifdef TOOLS_ENABLED
 	if (is_showing_gizmos() && is_visible_in_tree()) {
@@ -1423,10 +1464,7 @@ void VoxelLodTerrain::apply_mesh_update(const VoxelServer::BlockMeshOutput &ob)
 		mesh_map.set_block(ob.position, block);
 	}
 
-	bool has_collision = _generate_collisions;
-	if (has_collision && _collision_lod_count != 0) {
-		has_collision = ob.lod < _collision_lod_count;
-	}
+	const bool has_collision = _update_data->settings.is_collision_lod(ob.lod);
 
 	// TODO Is this boolean needed anymore now that we create blocks only if a surface is present?
 	if (block->got_first_mesh_update == false) {
@@ -1436,7 +1474,7 @@ void VoxelLodTerrain::apply_mesh_update(const VoxelServer::BlockMeshOutput &ob)
 		if (_instancer != nullptr && ob.surfaces.surfaces.size() > 0) {
 			// TODO The mesh could come from an edited region!
 			// We would have to know if specific voxels got edited, or different from the generator
-			_instancer->on_mesh_block_enter(ob.position, ob.lod, ob.surfaces.surfaces[0].arrays);
+			push_instancer_update_task(*block, ob.surfaces.surfaces[0].arrays, ob.priority);
 		}
 
 		// Lazy initialization
@@ -1483,37 +1521,24 @@ void VoxelLodTerrain::apply_mesh_update(const VoxelServer::BlockMeshOutput &ob)
 		}
 	}
 
-	const uint32_t now = get_ticks_msec();
 	if (has_collision) {
-		if (_collision_update_delay == 0 ||
-				static_cast<int>(now - block->last_collider_update_time) > _collision_update_delay) {
-			static thread_local std::vector<Array> tls_collidable_surfaces;
-			std::vector<Array> &collidable_surfaces = tls_collidable_surfaces;
-			collidable_surfaces.clear();
-			for (unsigned int i = 0; i < mesh_data.surfaces.size(); ++i) {
-				collidable_surfaces.push_back(mesh_data.surfaces[i].arrays);
-			}
-			block->set_collision_mesh(
-					to_span(collidable_surfaces), get_tree()->is_debugging_collisions_hint(), this, _collision_margin);
-
-			block->set_collision_layer(_collision_layer);
-			block->set_collision_mask(_collision_mask);
-			block->last_collider_update_time = now;
-			block->has_deferred_collider_update = false;
-			block->deferred_collider_data.clear();
+		// Colliders are applied in separate tasks, which have their own share of the main thread time budget.
+		if (ob.has_collision_faces) {
+			block->deferred_collider_faces = ob.collision_faces;
 		} else {
-			if (!block->has_deferred_collider_update) {
+			// Collisions were turned on after the meshing request was sent
+			block->deferred_collider_faces = VoxelMesher::build_collision_faces(mesh_data);
+		}
+
+		// If an update is already pending, it will use the new data
+		if (!block->has_deferred_collider_update) {
+			block->has_deferred_collider_update = true;
+			const uint32_t now = get_ticks_msec();
+			if (_collision_update_delay == 0 ||
+					static_cast<int>(now - block->last_collider_update_time) > _collision_update_delay) {
+				push_collider_update_task(ob.position, ob.lod, ob.priority);
+			} else {
 				_deferred_collision_updates_per_lod[ob.lod].push_back(ob.position);
-				block->has_deferred_collider_update = true;
-			}
-			// TODO Optimization: could avoid the small allocation.
-			// It's usually a small vectors with a handful of elements.
-			// The caller providing `mesh_data` doesnt use `mesh_data` later so we could have moved the vector,
-			// but at the moment it's passed with `const` so that isn't possible. Indeed we are only going to read the
-			// data, but `const` also means the structure holding it is read-only as well.
-			block->deferred_collider_data.resize(mesh_data.surfaces.size());
-			for (size_t i = 0; i < mesh_data.surfaces.size(); ++i) {
-				block->deferred_collider_data[i] = mesh_data.surfaces[i].arrays;
 			}
 		}
 	}
@@ -1521,7 +1546,108 @@ void VoxelLodTerrain::apply_mesh_update(const VoxelServer::BlockMeshOutput &ob)
 	block->set_parent_transform(get_global_transform());
 }
 
-void VoxelLodTerrain::process_deferred_collision_updates(uint32_t timeout_msec) {
+void VoxelLodTerrain::push_collider_update_task(Vector3i block_position, uint8_t lod_index, int priority) {
+	struct ApplyColliderUpdateTask : public ITimeSpreadTask {
+		void run(TimeSpreadTaskContext &ctx) override {
+			if (!VoxelServer::get_singleton().is_volume_valid(volume_id)) {
+				// The node can have been destroyed while this task was still pending
+				return;
+			}
+			self->apply_collider_update(block_position, lod_index);
+		}
+		uint32_t volume_id = 0;
+		VoxelLodTerrain *self = nullptr;
+		Vector3i block_position;
+		uint8_t lod_index = 0;
+	};
+
+	ApplyColliderUpdateTask *task = memnew(ApplyColliderUpdateTask);
+	task->volume_id = _volume_id;
+	task->self = this;
+	task->block_position = block_position;
+	task->lod_index = lod_index;
+	VoxelServer::get_singleton().push_main_thread_time_spread_task(
+			task, VoxelServer::MAIN_THREAD_TASK_COLLIDER, priority);
+}
+
+void VoxelLodTerrain::apply_collider_update(Vector3i block_position, uint8_t lod_index) {
+	ZN_PROFILE_SCOPE();
+
+	if (lod_index >= _update_data->settings.lod_count) {
+		return;
+	}
+	VoxelMeshBlockVLT *block = _mesh_maps_per_lod[lod_index].get_block(block_position);
+	if (block == nullptr || block->has_deferred_collider_update == false) {
+		// Block was unloaded or no longer needs a collision update
+		return;
+	}
+	if (!is_inside_tree()) {
+		// Try again later
+		_deferred_collision_updates_per_lod[lod_index].push_back(block_position);
+		return;
+	}
+
+	block->set_collision_shape(create_concave_polygon_shape(block->deferred_collider_faces),
+			get_tree()->is_debugging_collisions_hint(), this, _collision_margin);
+	block->set_collision_layer(_collision_layer);
+	block->set_collision_mask(_collision_mask);
+	block->last_collider_update_time = get_ticks_msec();
+	block->has_deferred_collider_update = false;
+	block->deferred_collider_faces.clear();
+}
+
+void VoxelLodTerrain::push_instancer_update_task(VoxelMeshBlockVLT &block, Array surface_arrays, int priority) {
+	struct ApplyInstancerUpdateTask : public ITimeSpreadTask {
+		void run(TimeSpreadTaskContext &ctx) override {
+			if (!VoxelServer::get_singleton().is_volume_valid(volume_id)) {
+				// The node can have been destroyed while this task was still pending
+				return;
+			}
+			self->apply_instancer_update(block_position, lod_index, update_id, surface_arrays);
+		}
+		uint32_t volume_id = 0;
+		VoxelLodTerrain *self = nullptr;
+		Vector3i block_position;
+		uint8_t lod_index = 0;
+		uint32_t update_id = 0;
+		Array surface_arrays;
+	};
+
+	// Zero means no update is pending
+	++_next_instancer_update_id;
+	if (_next_instancer_update_id == 0) {
+		++_next_instancer_update_id;
+	}
+	block.pending_instancer_update_id = _next_instancer_update_id;
+
+	ApplyInstancerUpdateTask *task = memnew(ApplyInstancerUpdateTask);
+	task->volume_id = _volume_id;
+	task->self = this;
+	task->block_position = block.position;
+	task->lod_index = block.lod_index;
+	task->update_id = _next_instancer_update_id;
+	task->surface_arrays = surface_arrays;
+	VoxelServer::get_singleton().push_main_thread_time_spread_task(
+			task, VoxelServer::MAIN_THREAD_TASK_INSTANCER, priority);
+}
+
+void VoxelLodTerrain::apply_instancer_update(
+		Vector3i block_position, uint8_t lod_index, uint32_t update_id, Array surface_arrays) {
+	if (lod_index >= _update_data->settings.lod_count) {
+		return;
+	}
+	VoxelMeshBlockVLT *block = _mesh_maps_per_lod[lod_index].get_block(block_position);
+	if (block == nullptr || block->pending_instancer_update_id != update_id) {
+		// Block was unloaded, and maybe loaded again since
+		return;
+	}
+	block->pending_instancer_update_id = 0;
+	if (_instancer != nullptr) {
+		_instancer->on_mesh_block_enter(block_position, lod_index, surface_arrays);
+	}
+}
+
+void VoxelLodTerrain::process_deferred_collision_updates() {
 	ZN_PROFILE_SCOPE();
 
 	const unsigned int lod_count = _update_data->settings.lod_count;
@@ -1544,22 +1670,11 @@ void VoxelLodTerrain::process_deferred_collision_updates(uint32_t timeout_msec)
 			const uint32_t now = get_ticks_msec();
 
 			if (static_cast<int>(now - block->last_collider_update_time) > _collision_update_delay) {
-				block->set_collision_mesh(to_span_const(block->deferred_collider_data),
-						get_tree()->is_debugging_collisions_hint(), this, _collision_margin);
-				block->set_collision_layer(_collision_layer);
-				block->set_collision_mask(_collision_mask);
-				block->last_collider_update_time = now;
-				block->has_deferred_collider_update = false;
-				block->deferred_collider_data.clear();
-
+				// These have waited long enough already, so they go first among collider updates
+				push_collider_update_task(block_pos, lod_index, 0);
 				unordered_remove(deferred_collision_updates, i);
 				--i;
 			}
-
-			// We always process at least one, then we to check the timeout
-			if (get_ticks_msec() >= timeout_msec) {
-				return;
-			}
 		}
 	}
 }
@@ -1660,11 +1775,13 @@ void VoxelLodTerrain::save_all_modified_blocks(bool with_copy) {
 	// This could be part of the update task if async, but here we want it to be immediate.
 	_update_data->wait_for_end_of_task();
 
-	VoxelLodTerrainUpdateTask::flush_pending_lod_edits(
-			_update_data->state, *_data, _generator, _update_data->settings.full_load_mode, get_mesh_block_size());
-
 	std::vector<VoxelLodTerrainUpdateData::BlockToSave> blocks_to_save;
 
+	// Also gets blocks which were unloaded while downscales were running
+	VoxelLodTerrainUpdateTask::flush_pending_lod_edits(_update_data->state, *_data, _generator,
+			_update_data->settings.full_load_mode, get_mesh_block_size(), _update_data->settings.downscale_filters,
+			nullptr, blocks_to_save);
+
 	if (_stream.is_valid()) {
 		for (unsigned int i = 0; i < _data->lod_count; ++i) {
 			VoxelDataLodMap::Lod &data_lod = _data->lods[i];
@@ -2262,6 +2379,15 @@ void VoxelLodTerrain::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("set_full_load_mode_enabled"), &VoxelLodTerrain::set_full_load_mode_enabled);
 	ClassDB::bind_method(D_METHOD("is_full_load_mode_enabled"), &VoxelLodTerrain::is_full_load_mode_enabled);
 
+	ClassDB::bind_method(D_METHOD("set_uniform_block_sharing_enabled", "enabled"),
+			&VoxelLodTerrain::set_uniform_block_sharing_enabled);
+	ClassDB::bind_method(
+			D_METHOD("is_uniform_block_sharing_enabled"), &VoxelLodTerrain::is_uniform_block_sharing_enabled);
+
+	ClassDB::bind_method(
+			D_METHOD("set_downscale_filter", "channel", "filter"), &VoxelLodTerrain::set_downscale_filter);
+	ClassDB::bind_method(D_METHOD("get_downscale_filter", "channel"), &VoxelLodTerrain::get_downscale_filter);
+
 	ClassDB::bind_method(D_METHOD("get_statistics"), &VoxelLodTerrain::_b_get_statistics);
 	ClassDB::bind_method(
 			D_METHOD("voxel_to_data_block_position", "lod_index"), &VoxelLodTerrain::voxel_to_data_block_position);
@@ -2304,6 +2430,13 @@ void VoxelLodTerrain::_bind_methods() {
 	BIND_ENUM_CONSTANT(PROCESS_CALLBACK_PHYSICS);
 	BIND_ENUM_CONSTANT(PROCESS_CALLBACK_DISABLED);
 
+	BIND_ENUM_CONSTANT(DOWNSCALE_FILTER_NEAREST);
+	BIND_ENUM_CONSTANT(DOWNSCALE_FILTER_SDF_MIN);
+	BIND_ENUM_CONSTANT(DOWNSCALE_FILTER_AVERAGE);
+	BIND_ENUM_CONSTANT(DOWNSCALE_FILTER_MAJORITY);
+	BIND_ENUM_CONSTANT(DOWNSCALE_FILTER_TEXTURE_BLEND);
+	BIND_ENUM_CONSTANT(DOWNSCALE_FILTER_COUNT);
+
 	ADD_GROUP("Bounds", "");
 
 	ADD_PROPERTY(PropertyInfo(Variant::INT, "view_distance"), "set_view_distance", "get_view_distance");
@@ -2344,6 +2477,8 @@ void VoxelLodTerrain::_bind_methods() {
 			"is_full_load_mode_enabled");
 	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "threaded_update_enabled"), "set_threaded_update_enabled",
 			"is_threaded_update_enabled");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "uniform_block_sharing_enabled"), "set_uniform_block_sharing_enabled",
+			"is_uniform_block_sharing_enabled");
 }
 
 } // namespace zylann::voxel
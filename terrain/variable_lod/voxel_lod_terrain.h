@@ -56,7 +56,7 @@ public:
 
 	void set_generate_collisions(bool enabled);
 	bool get_generate_collisions() const {
-		return _generate_collisions;
+		return _update_data->settings.generate_collisions;
 	}
 
 	// Sets up to which amount of LODs collision will generate. -1 means all of them.
@@ -89,9 +89,25 @@ public:
 	void set_full_load_mode_enabled(bool enabled);
 	bool is_full_load_mode_enabled() const;
 
+	void set_uniform_block_sharing_enabled(bool enabled);
+	bool is_uniform_block_sharing_enabled() const;
+
 	void set_threaded_update_enabled(bool enabled);
 	bool is_threaded_update_enabled() const;
 
+	enum DownscaleFilter {
+		DOWNSCALE_FILTER_NEAREST = zylann::voxel::DOWNSCALE_NEAREST,
+		DOWNSCALE_FILTER_SDF_MIN = zylann::voxel::DOWNSCALE_SDF_MIN,
+		DOWNSCALE_FILTER_AVERAGE = zylann::voxel::DOWNSCALE_AVERAGE,
+		DOWNSCALE_FILTER_MAJORITY = zylann::voxel::DOWNSCALE_MAJORITY,
+		DOWNSCALE_FILTER_TEXTURE_BLEND = zylann::voxel::DOWNSCALE_TEXTURE_BLEND,
+		DOWNSCALE_FILTER_COUNT = zylann::voxel::DOWNSCALE_FILTER_COUNT
+	};
+
+	// Sets how voxels of a channel are combined when edits get propagated to lower LODs
+	void set_downscale_filter(int channel, DownscaleFilter filter);
+	DownscaleFilter get_downscale_filter(int channel) const;
+
 	bool is_area_editable(Box3i p_box) const;
 	VoxelSingleValue get_voxel(Vector3i pos, unsigned int channel, VoxelSingleValue defval);
 	bool try_set_voxel_without_update(Vector3i pos, unsigned int channel, uint64_t value);
@@ -273,7 +289,12 @@ private:
 	// TODO Put in common with VoxelLodTerrainUpdateTask
 	// void send_block_save_requests(Span<BlockToSave> blocks_to_save);
 
-	void process_deferred_collision_updates(uint32_t timeout_msec);
+	// Collider and instancer updates are spread over frames with main thread tasks
+	void push_collider_update_task(Vector3i block_position, uint8_t lod_index, int priority);
+	void apply_collider_update(Vector3i block_position, uint8_t lod_index);
+	void push_instancer_update_task(VoxelMeshBlockVLT &block, Array surface_arrays, int priority);
+	void apply_instancer_update(Vector3i block_position, uint8_t lod_index, uint32_t update_id, Array surface_arrays);
+	void process_deferred_collision_updates();
 	void process_fading_blocks(float delta);
 
 	void _b_save_modified_blocks();
@@ -300,8 +321,6 @@ private:
 
 	FixedArray<VoxelMeshMap<VoxelMeshBlockVLT>, constants::MAX_LOD> _mesh_maps_per_lod;
 
-	bool _generate_collisions = true;
-	unsigned int _collision_lod_count = 0;
 	unsigned int _collision_layer = 1;
 	unsigned int _collision_mask = 1;
 	float _collision_margin = constants::DEFAULT_COLLISION_MARGIN;
@@ -315,6 +334,8 @@ private:
 	FixedArray<std::map<Vector3i, VoxelMeshBlockVLT *>, constants::MAX_LOD> _fading_blocks_per_lod;
 
 	VoxelInstancer *_instancer = nullptr;
+	// Identifies instancer updates, so those of blocks unloaded in the meantime can be told apart
+	uint32_t _next_instancer_update_id = 0;
 
 	Ref<VoxelMesher> _mesher;
 	Ref<VoxelGenerator> _generator;
@@ -343,5 +364,6 @@ private:
 } // namespace zylann::voxel
 
 VARIANT_ENUM_CAST(zylann::voxel::VoxelLodTerrain::ProcessCallback)
+VARIANT_ENUM_CAST(zylann::voxel::VoxelLodTerrain::DownscaleFilter)
 
 #endif // VOXEL_LOD_TERRAIN_HPP
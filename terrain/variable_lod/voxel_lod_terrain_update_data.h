@@ -4,12 +4,14 @@
 #include "../../constants/voxel_constants.h"
 #include "../../generators/voxel_generator.h"
 #include "../../storage/voxel_data_map.h"
+#include "../../storage/voxel_downscale.h"
 #include "../../streams/voxel_stream.h"
 #include "../../util/fixed_array.h"
 #include "../voxel_mesh_map.h"
 #include "lod_octree.h"
 
 #include <map>
+#include <unordered_map>
 #include <unordered_set>
 
 namespace zylann {
@@ -54,6 +56,15 @@ struct VoxelLodTerrainUpdateData {
 		bool full_load_mode = false;
 		bool run_stream_in_editor = true;
 		unsigned int mesh_block_size_po2 = 4;
+		bool generate_collisions = true;
+		// Collisions are only generated for LODs below this index. 0 means all of them.
+		unsigned int collision_lod_count = 0;
+		// How voxels are combined when edits are propagated to lower LODs
+		DownscaleFilters downscale_filters = get_default_downscale_filters();
+
+		inline bool is_collision_lod(unsigned int lod_index) const {
+			return generate_collisions && (collision_lod_count == 0 || lod_index < collision_lod_count);
+		}
 	};
 
 	enum MeshState {
@@ -127,6 +138,15 @@ struct VoxelLodTerrainUpdateData {
 		Box3i box;
 	};
 
+	struct RunningLodDownscale {
+		std::shared_ptr<AsyncDependencyTracker> tracker;
+		// Data blocks written by the downscale. Their meshes get updated once it completes.
+		std::vector<BlockLocation> blocks;
+		// Some of these blocks which got unloaded before the downscale completed. They are saved once it completes,
+		// otherwise the saved voxels could miss part of the downscale.
+		std::vector<BlockToSave> blocks_to_save;
+	};
+
 	struct Stats {
 		uint32_t blocked_lods = 0;
 		uint32_t time_detect_required_blocks = 0;
@@ -159,6 +179,9 @@ struct VoxelLodTerrainUpdateData {
 		BinaryMutex pending_async_edits_mutex;
 		std::vector<RunningAsyncEdit> running_async_edits;
 
+		// Edits being propagated to lower LODs in the thread pool
+		std::vector<RunningLodDownscale> running_lod_downscales;
+
 		Stats stats;
 	};
 
@@ -1,6 +1,8 @@
 #include "voxel_lod_terrain_update_task.h"
 #include "../../server/generate_block_task.h"
 #include "../../server/load_block_data_task.h"
+#include "../../server/lod_downscale_task.h"
+#include "../../server/mesh_block_batch_task.h"
 #include "../../server/mesh_block_task.h"
 #include "../../server/save_block_data_task.h"
 #include "../../server/voxel_server.h"
@@ -9,11 +11,59 @@
 #include "../../util/profiling.h"
 #include "../../util/profiling_clock.h"
 #include "../../util/string_funcs.h"
+#include "../../util/thread/thread.h"
 
 namespace zylann::voxel {
 
+static void schedule_mesh_update_for_data_block(VoxelLodTerrainUpdateData::State &state, Vector3i data_block_pos,
+		unsigned int lod_index, int data_to_mesh_factor) {
+	VoxelLodTerrainUpdateData::Lod &lod = state.lods[lod_index];
+	const Vector3i mesh_block_pos = math::floordiv(data_block_pos, data_to_mesh_factor);
+	auto mesh_block_it = lod.mesh_map_state.map.find(mesh_block_pos);
+	if (mesh_block_it != lod.mesh_map_state.map.end()) {
+		// If a mesh exists here, it will need an update.
+		// If there is no mesh, it will probably get created later when we come closer to it
+		VoxelLodTerrainUpdateTask::schedule_mesh_update(
+				mesh_block_it->second, mesh_block_pos, lod.blocks_pending_update);
+	}
+}
+
+static void process_completed_lod_downscales(VoxelLodTerrainUpdateData::State &state, int data_to_mesh_factor,
+		bool wait, std::vector<VoxelLodTerrainUpdateData::BlockToSave> &blocks_to_save) {
+	ZN_PROFILE_SCOPE();
+
+	if (wait) {
+		for (unsigned int i = 0; i < state.running_lod_downscales.size(); ++i) {
+			const AsyncDependencyTracker &tracker = *state.running_lod_downscales[i].tracker;
+			while (!tracker.is_complete() && !tracker.is_aborted()) {
+				Thread::sleep_usec(500);
+			}
+		}
+	}
+
+	unordered_remove_if(state.running_lod_downscales,
+			[&state, data_to_mesh_factor, &blocks_to_save](VoxelLodTerrainUpdateData::RunningLodDownscale &downscale) {
+				const bool complete = downscale.tracker->is_complete();
+				if (!complete && !downscale.tracker->is_aborted()) {
+					return false;
+				}
+				if (complete) {
+					for (const VoxelLodTerrainUpdateData::BlockLocation &loc : downscale.blocks) {
+						schedule_mesh_update_for_data_block(state, loc.position, loc.lod, data_to_mesh_factor);
+					}
+				}
+				// Saved even if the downscale was aborted, they still contain edits
+				for (VoxelLodTerrainUpdateData::BlockToSave &b : downscale.blocks_to_save) {
+					blocks_to_save.push_back(std::move(b));
+				}
+				return true;
+			});
+}
+
 void VoxelLodTerrainUpdateTask::flush_pending_lod_edits(VoxelLodTerrainUpdateData::State &state, VoxelDataLodMap &data,
-		Ref<VoxelGenerator> generator, bool full_load_mode, const int mesh_block_size) {
+		Ref<VoxelGenerator> generator, bool full_load_mode, const int mesh_block_size,
+		const DownscaleFilters &downscale_filters, BufferedTaskScheduler *task_scheduler,
+		std::vector<VoxelLodTerrainUpdateData::BlockToSave> &blocks_to_save) {
 	ZN_PROFILE_SCOPE();
 	// Propagates edits performed so far to other LODs.
 	// These LODs must be currently in memory, otherwise terrain data will miss it.
@@ -26,10 +76,12 @@ void VoxelLodTerrainUpdateTask::flush_pending_lod_edits(VoxelLodTerrainUpdateDat
 	const int data_to_mesh_factor = mesh_block_size / data_block_size;
 	const unsigned int lod_count = data.lod_count;
 
+	// Meshes of lower LODs are updated only once their voxels are up to date
+	process_completed_lod_downscales(state, data_to_mesh_factor, task_scheduler == nullptr, blocks_to_save);
+
 	static thread_local FixedArray<std::vector<Vector3i>, constants::MAX_LOD> tls_blocks_to_process_per_lod;
 
 	// Make sure LOD0 gets updates even if _lod_count is 1
-	VoxelLodTerrainUpdateData::Lod &lod0 = state.lods[0];
 	{
 		// Consume scheduled positions from LOD0
 		std::vector<Vector3i> &dst_lod0 = tls_blocks_to_process_per_lod[0];
@@ -55,20 +107,20 @@ void VoxelLodTerrainUpdateTask::flush_pending_lod_edits(VoxelLodTerrainUpdateDat
 			VoxelDataBlock *data_block = data_lod0.map.get_block(data_block_pos);
 			ERR_CONTINUE(data_block == nullptr);
 			data_block->set_needs_lodding(false);
-
-			const Vector3i mesh_block_pos = math::floordiv(data_block_pos, data_to_mesh_factor);
-			auto mesh_block_it = lod0.mesh_map_state.map.find(mesh_block_pos);
-			if (mesh_block_it != lod0.mesh_map_state.map.end()) {
-				// If a mesh exists here, it will need an update.
-				// If there is no mesh, it will probably get created later when we come closer to it
-				schedule_mesh_update(mesh_block_it->second, mesh_block_pos, lod0.blocks_pending_update);
-			}
+			schedule_mesh_update_for_data_block(state, data_block_pos, 0, data_to_mesh_factor);
 		}
 	}
 
 	const int half_bs = data_block_size >> 1;
 
-	// Process downscales upwards in pairs of consecutive LODs.
+	// Downscales are grouped by sub-tree, identified by their ancestor block in the last LOD.
+	// Each group is processed by one task, in increasing LOD order. Groups don't share any block.
+	static thread_local std::unordered_map<Vector3i, std::vector<LodDownscaleTask::Item>> tls_items_per_subtree;
+	static thread_local std::vector<VoxelLodTerrainUpdateData::BlockLocation> tls_downscaled_blocks;
+	tls_items_per_subtree.clear();
+	tls_downscaled_blocks.clear();
+
+	// Gather downscales upwards in pairs of consecutive LODs.
 	// This ensures we don't process multiple times the same blocks.
 	// Only LOD0 is editable at the moment, so we'll downscale from there
 	for (uint8_t dst_lod_index = 1; dst_lod_index < lod_count; ++dst_lod_index) {
@@ -76,8 +128,6 @@ void VoxelLodTerrainUpdateTask::flush_pending_lod_edits(VoxelLodTerrainUpdateDat
 		std::vector<Vector3i> &src_lod_blocks_to_process = tls_blocks_to_process_per_lod[src_lod_index];
 		std::vector<Vector3i> &dst_lod_blocks_to_process = tls_blocks_to_process_per_lod[dst_lod_index];
 
-		VoxelLodTerrainUpdateData::Lod &dst_lod = state.lods[dst_lod_index];
-
 		VoxelDataLodMap::Lod &src_data_lod = data.lods[src_lod_index];
 		RWLockRead rlock(src_data_lod.map_lock);
 
@@ -124,48 +174,87 @@ void VoxelLodTerrainUpdateTask::flush_pending_lod_edits(VoxelLodTerrainUpdateDat
 			CRASH_COND(src_block == nullptr);
 			//CRASH_COND(dst_block == nullptr);
 
-			{
-				const Vector3i mesh_block_pos = math::floordiv(dst_bpos, data_to_mesh_factor);
-				auto mesh_block_it = dst_lod.mesh_map_state.map.find(mesh_block_pos);
-				if (mesh_block_it != dst_lod.mesh_map_state.map.end()) {
-					schedule_mesh_update(mesh_block_it->second, mesh_block_pos, dst_lod.blocks_pending_update);
-				}
-				// If there is no mesh, it will probably get created later when we come closer to it
-			}
-
+			// Marked now rather than when the downscale completes, so the block can't be unloaded without saving
 			dst_block->set_modified(true);
+			// Downscaling writes into the voxels of the destination block from another thread. If they are shared
+			// with other blocks, it must get its own copy first.
+			dst_block->unshare_voxels();
 
 			if (dst_lod_index != lod_count - 1 && !dst_block->get_needs_lodding()) {
 				dst_block->set_needs_lodding(true);
 				dst_lod_blocks_to_process.push_back(dst_bpos);
 			}
 
+			// May contain duplicates, which is fine because a mesh update is only scheduled once
+			tls_downscaled_blocks.push_back(VoxelLodTerrainUpdateData::BlockLocation{ dst_bpos, dst_lod_index });
+
 			const Vector3i rel = src_bpos - (dst_bpos << 1);
 
 			// Update lower LOD
 			// This must always be done after an edit before it gets saved, otherwise LODs won't match and it will look
 			// ugly.
 			// TODO Optimization: try to narrow to edited region instead of taking whole block
-			{
-				ZN_PROFILE_SCOPE_NAMED("Downscale");
-				RWLockWrite lock(src_block->get_voxels().get_lock());
-				src_block->get_voxels().downscale_to(
-						dst_block->get_voxels(), Vector3i(), src_block->get_voxels_const().get_size(), rel * half_bs);
-			}
+			const Vector3i subtree_pos = dst_bpos >> (lod_count - 1 - dst_lod_index);
+			tls_items_per_subtree[subtree_pos].push_back(LodDownscaleTask::Item{
+					src_block->get_voxels_shared(), dst_block->get_voxels_shared(), rel * half_bs });
 		}
 
 		src_lod_blocks_to_process.clear();
 		// No need to clear the last list because we never add blocks to it
 	}
 
+	if (tls_items_per_subtree.size() == 0) {
+		return;
+	}
+
+	if (task_scheduler == nullptr) {
+		ZN_PROFILE_SCOPE_NAMED("Downscale");
+		for (auto it = tls_items_per_subtree.begin(); it != tls_items_per_subtree.end(); ++it) {
+			LodDownscaleTask::run_items(to_span_const(it->second), downscale_filters);
+		}
+		for (const VoxelLodTerrainUpdateData::BlockLocation &loc : tls_downscaled_blocks) {
+			schedule_mesh_update_for_data_block(state, loc.position, loc.lod, data_to_mesh_factor);
+		}
+
+	} else {
+		std::shared_ptr<AsyncDependencyTracker> tracker =
+				make_shared_instance<AsyncDependencyTracker>(tls_items_per_subtree.size());
+		// The thread pool notifies the tracker, so the tasks don't need to know about it
+		std::vector<IThreadedTask *> tasks;
+		for (auto it = tls_items_per_subtree.begin(); it != tls_items_per_subtree.end(); ++it) {
+			tasks.push_back(memnew(LodDownscaleTask(std::move(it->second), downscale_filters)));
+		}
+		task_scheduler->push_main_tasks(std::move(tasks), tracker);
+		state.running_lod_downscales.push_back(
+				VoxelLodTerrainUpdateData::RunningLodDownscale{ tracker, tls_downscaled_blocks, {} });
+	}
+
 	//	uint64_t time_spent = profiling_clock.restart();
 	//	if (time_spent > 10) {
 	//		print_line(String("Took {0} us to update lods").format(varray(time_spent)));
 	//	}
 }
 
+// Finds a downscale which hasn't completed yet and writes into the given block
+static VoxelLodTerrainUpdateData::RunningLodDownscale *find_running_lod_downscale(
+		std::vector<VoxelLodTerrainUpdateData::RunningLodDownscale> &running_lod_downscales, Vector3i block_pos,
+		unsigned int lod_index) {
+	for (VoxelLodTerrainUpdateData::RunningLodDownscale &downscale : running_lod_downscales) {
+		if (downscale.tracker->is_complete() || downscale.tracker->is_aborted()) {
+			continue;
+		}
+		for (const VoxelLodTerrainUpdateData::BlockLocation &loc : downscale.blocks) {
+			if (loc.position == block_pos && loc.lod == lod_index) {
+				return &downscale;
+			}
+		}
+	}
+	return nullptr;
+}
+
 struct BeforeUnloadDataAction {
 	std::vector<VoxelLodTerrainUpdateData::BlockToSave> &blocks_to_save;
+	std::vector<VoxelLodTerrainUpdateData::RunningLodDownscale> &running_lod_downscales;
 	bool save;
 
 	void operator()(VoxelDataBlock &block) {
@@ -178,16 +267,26 @@ struct BeforeUnloadDataAction {
 			b.voxels = block.get_voxels_shared();
 			b.position = block.position;
 			b.lod = block.lod_index;
-			blocks_to_save.push_back(b);
+			// A downscale task may still be writing into the voxels, in which case the save waits for it.
+			// Not waiting here, the update task might be running on the only thread that can run the downscale.
+			VoxelLodTerrainUpdateData::RunningLodDownscale *downscale =
+					find_running_lod_downscale(running_lod_downscales, block.position, block.lod_index);
+			if (downscale != nullptr) {
+				downscale->blocks_to_save.push_back(b);
+			} else {
+				blocks_to_save.push_back(b);
+			}
 		}
 	}
 };
 
-static void unload_data_block_no_lock(VoxelLodTerrainUpdateData::Lod &lod, VoxelDataLodMap::Lod &data_lod,
-		Vector3i block_pos, std::vector<VoxelLodTerrainUpdateData::BlockToSave> &blocks_to_save, bool can_save) {
+static void unload_data_block_no_lock(VoxelLodTerrainUpdateData::State &state, VoxelLodTerrainUpdateData::Lod &lod,
+		VoxelDataLodMap::Lod &data_lod, Vector3i block_pos,
+		std::vector<VoxelLodTerrainUpdateData::BlockToSave> &blocks_to_save, bool can_save) {
 	ZN_PROFILE_SCOPE();
 
-	data_lod.map.remove_block(block_pos, BeforeUnloadDataAction{ blocks_to_save, can_save });
+	data_lod.map.remove_block(
+			block_pos, BeforeUnloadDataAction{ blocks_to_save, state.running_lod_downscales, can_save });
 
 	//print_line(String("Unloading data block {0} lod {1}").format(varray(block_pos.to_vec3(), lod_index)));
 	MutexLock lock(lod.loading_blocks_mutex);
@@ -252,10 +351,10 @@ static void process_unload_data_blocks_sliding_box(VoxelLodTerrainUpdateData::St
 			ZN_PROFILE_SCOPE_NAMED("Unload data");
 			VoxelDataLodMap::Lod &data_lod = data.lods[lod_index];
 			RWLockWrite wlock(data_lod.map_lock);
-			prev_box.difference(new_box, [&lod, &data_lod, &blocks_to_save, can_save](Box3i out_of_range_box) {
-				out_of_range_box.for_each_cell([&lod, &data_lod, &blocks_to_save, can_save](Vector3i pos) {
+			prev_box.difference(new_box, [&state, &lod, &data_lod, &blocks_to_save, can_save](Box3i out_of_range_box) {
+				out_of_range_box.for_each_cell([&state, &lod, &data_lod, &blocks_to_save, can_save](Vector3i pos) {
 					//print_line(String("Immerge {0}").format(varray(pos.to_vec3())));
-					unload_data_block_no_lock(lod, data_lod, pos, blocks_to_save, can_save);
+					unload_data_block_no_lock(state, lod, data_lod, pos, blocks_to_save, can_save);
 				});
 			});
 		}
@@ -1159,9 +1258,12 @@ static void request_block_mesh(uint32_t volume_id, const VoxelServer::BlockMeshI
 	task->blocks_count = input.data_blocks_count;
 	task->position = input.render_block_position;
 	task->lod = input.lod;
+	task->collision_hint = input.collision_hint;
 	task->meshing_dependency = meshing_dependency;
 	task->data_block_size = data_block_size;
 	task->data = data;
+	task->index_slot = VoxelServer::get_singleton().get_block_task_index().add(
+			BlockTaskIndex::Key{ volume_id, input.render_block_position, input.lod, BlockTaskIndex::TASK_MESH });
 
 	init_sparse_octree_priority_dependency(task->priority_dependency, input.render_block_position, input.lod,
 			mesh_block_size, shared_viewers_data, volume_transform, lod_distance);
@@ -1169,6 +1271,64 @@ static void request_block_mesh(uint32_t volume_id, const VoxelServer::BlockMeshI
 	task_scheduler.push_main_task(task);
 }
 
+// Mesh blocks close to each other can be meshed by the same task, so the voxels they share are only gathered once
+static void request_block_mesh_batch(uint32_t volume_id, Vector3i region_origin, Span<const Vector3i> block_positions,
+		uint8_t lod_index, bool collision_hint, const VoxelDataLodMap::Lod &data_lod,
+		std::shared_ptr<MeshingDependency> meshing_dependency,
+		std::shared_ptr<PriorityDependency::ViewersData> &shared_viewers_data, unsigned int data_block_size,
+		unsigned int mesh_block_size, const Transform3D &volume_transform, float lod_distance,
+		BufferedTaskScheduler &task_scheduler, const std::shared_ptr<VoxelDataLodMap> &data) {
+	//
+	ERR_FAIL_COND(meshing_dependency == nullptr);
+	ERR_FAIL_COND(meshing_dependency->mesher.is_null());
+	ERR_FAIL_COND(data_block_size > 255);
+
+	const int region_size = constants::MESH_BATCH_REGION_SIZE;
+	const int mesh_to_data_factor = mesh_block_size / data_block_size;
+
+	MeshBlockBatchTask *task = memnew(MeshBlockBatchTask);
+	task->volume_id = volume_id;
+	task->region_origin = region_origin;
+	task->lod = lod_index;
+	task->region_size = region_size;
+	task->data_block_size = data_block_size;
+	task->mesh_block_size = mesh_block_size;
+	task->collision_hint = collision_hint;
+	task->meshing_dependency = meshing_dependency;
+	task->data = data;
+
+	const Box3i data_box =
+			Box3i(mesh_to_data_factor * region_origin, Vector3iUtil::create(mesh_to_data_factor * region_size))
+					.padded(1);
+	{
+		// Same iteration order as single requests, see `send_mesh_requests`
+		std::vector<const VoxelDataBlock *> nblocks;
+		nblocks.resize(Vector3iUtil::get_volume(data_box.size));
+		RWLockRead rlock(data_lod.map_lock);
+		data_lod.map.get_blocks_in_area(data_box, to_span(nblocks));
+		task->blocks.resize(nblocks.size());
+		for (unsigned int i = 0; i < nblocks.size(); ++i) {
+			const VoxelDataBlock *nblock = nblocks[i];
+			if (nblock != nullptr) {
+				task->blocks[i] = nblock->get_voxels_shared();
+			}
+		}
+	}
+
+	BlockTaskIndex &task_index = VoxelServer::get_singleton().get_block_task_index();
+	task->items.resize(block_positions.size());
+	for (unsigned int i = 0; i < block_positions.size(); ++i) {
+		MeshBlockBatchTask::Item &item = task->items[i];
+		item.position = block_positions[i];
+		item.index_slot =
+				task_index.add(BlockTaskIndex::Key{ volume_id, item.position, lod_index, BlockTaskIndex::TASK_MESH });
+		init_sparse_octree_priority_dependency(item.priority_dependency, item.position, lod_index, mesh_block_size,
+				shared_viewers_data, volume_transform, lod_distance);
+	}
+
+	task_scheduler.push_main_task(task);
+}
+
 static void send_mesh_requests(uint32_t volume_id, VoxelLodTerrainUpdateData::State &state,
 		const VoxelLodTerrainUpdateData::Settings &settings, const std::shared_ptr<VoxelDataLodMap> &data_ptr,
 		std::shared_ptr<MeshingDependency> meshing_dependency,
@@ -1182,14 +1342,26 @@ static void send_mesh_requests(uint32_t volume_id, VoxelLodTerrainUpdateData::St
 
 	const int data_block_size = data.lods[0].map.get_block_size();
 	const int mesh_block_size = 1 << settings.mesh_block_size_po2;
-	const int render_to_data_factor = mesh_block_size / mesh_block_size;
+	const int render_to_data_factor = mesh_block_size / data_block_size;
+
+	// Batching is only worth it when it reads fewer data blocks than sending each request separately
+	const int region_size = constants::MESH_BATCH_REGION_SIZE;
+	const unsigned int single_request_data_block_count =
+			Vector3iUtil::get_volume(Vector3iUtil::create(render_to_data_factor + 2));
+	const unsigned int batch_data_block_count =
+			Vector3iUtil::get_volume(Vector3iUtil::create(render_to_data_factor * region_size + 2));
+
+	static thread_local std::unordered_map<Vector3i, std::vector<Vector3i>> tls_blocks_per_region;
 
 	for (unsigned int lod_index = 0; lod_index < settings.lod_count; ++lod_index) {
 		ZN_PROFILE_SCOPE();
 		VoxelLodTerrainUpdateData::Lod &lod = state.lods[lod_index];
+		const VoxelDataLodMap::Lod &data_lod = data.lods[lod_index];
+		const bool collision_hint = settings.is_collision_lod(lod_index);
+
+		tls_blocks_per_region.clear();
 
 		for (unsigned int bi = 0; bi < lod.blocks_pending_update.size(); ++bi) {
-			ZN_PROFILE_SCOPE();
 			const Vector3i mesh_block_pos = lod.blocks_pending_update[bi];
 
 			auto mesh_block_it = lod.mesh_map_state.map.find(mesh_block_pos);
@@ -1199,35 +1371,59 @@ static void send_mesh_requests(uint32_t volume_id, VoxelLodTerrainUpdateData::St
 			// All blocks we get here must be in the scheduled state
 			ERR_CONTINUE(mesh_block.state != VoxelLodTerrainUpdateData::MESH_UPDATE_NOT_SENT);
 
-			// Get block and its neighbors
-			VoxelServer::BlockMeshInput mesh_request;
-			mesh_request.render_block_position = mesh_block_pos;
-			mesh_request.lod = lod_index;
+			tls_blocks_per_region[math::floordiv(mesh_block_pos, region_size)].push_back(mesh_block_pos);
+			mesh_block.state = VoxelLodTerrainUpdateData::MESH_UPDATE_SENT;
+		}
 
-			const Box3i data_box =
-					Box3i(render_to_data_factor * mesh_block_pos, Vector3iUtil::create(render_to_data_factor))
-							.padded(1);
+		for (auto region_it = tls_blocks_per_region.begin(); region_it != tls_blocks_per_region.end(); ++region_it) {
+			const std::vector<Vector3i> &block_positions = region_it->second;
 
-			const VoxelDataLodMap::Lod &data_lod = data.lods[lod_index];
-			RWLockRead rlock(data_lod.map_lock);
+			if (block_positions.size() * single_request_data_block_count > batch_data_block_count) {
+				ZN_PROFILE_SCOPE_NAMED("Batch");
+				request_block_mesh_batch(volume_id, region_it->first * region_size, to_span(block_positions),
+						lod_index, collision_hint, data_lod, meshing_dependency, shared_viewers_data,
+						data_block_size, mesh_block_size, volume_transform, settings.lod_distance, task_scheduler,
+						data_ptr);
+				continue;
+			}
 
-			// Iteration order matters for thread access.
-			// The array also implicitely encodes block position due to the convention being used,
-			// so there is no need to also include positions in the request
-			data_box.for_each_cell_zxy([&mesh_request, &data_lod](Vector3i data_block_pos) {
-				const VoxelDataBlock *nblock = data_lod.map.get_block(data_block_pos);
-				// The block can actually be null on some occasions. Not sure yet if it's that bad
-				//CRASH_COND(nblock == nullptr);
-				if (nblock != nullptr) {
-					mesh_request.data_blocks[mesh_request.data_blocks_count] = nblock->get_voxels_shared();
-				}
-				++mesh_request.data_blocks_count;
-			});
+			for (unsigned int bi = 0; bi < block_positions.size(); ++bi) {
+				ZN_PROFILE_SCOPE();
+				const Vector3i mesh_block_pos = block_positions[bi];
 
-			request_block_mesh(volume_id, mesh_request, meshing_dependency, shared_viewers_data, data_block_size,
-					mesh_block_size, volume_transform, settings.lod_distance, task_scheduler, data_ptr);
+				// Get block and its neighbors
+				VoxelServer::BlockMeshInput mesh_request;
+				mesh_request.render_block_position = mesh_block_pos;
+				mesh_request.lod = lod_index;
+				mesh_request.collision_hint = collision_hint;
 
-			mesh_block.state = VoxelLodTerrainUpdateData::MESH_UPDATE_SENT;
+				const Box3i data_box =
+						Box3i(render_to_data_factor * mesh_block_pos, Vector3iUtil::create(render_to_data_factor))
+								.padded(1);
+
+				RWLockRead rlock(data_lod.map_lock);
+
+				// Iteration order matters for thread access.
+				// The array also implicitely encodes block position due to the convention being used,
+				// so there is no need to also include positions in the request
+				FixedArray<const VoxelDataBlock *, constants::MAX_BLOCK_COUNT_PER_REQUEST> nblocks;
+				const unsigned int nblock_count = Vector3iUtil::get_volume(data_box.size);
+				ERR_CONTINUE(nblock_count > nblocks.size());
+				data_lod.map.get_blocks_in_area(data_box, to_span(nblocks, nblock_count));
+				for (unsigned int i = 0; i < nblock_count; ++i) {
+					const VoxelDataBlock *nblock = nblocks[i];
+					// The block can actually be null on some occasions. Not sure yet if it's that bad
+					//CRASH_COND(nblock == nullptr);
+					if (nblock != nullptr) {
+						mesh_request.data_blocks[mesh_request.data_blocks_count] = nblock->get_voxels_shared();
+					}
+					++mesh_request.data_blocks_count;
+				}
+
+				request_block_mesh(volume_id, mesh_request, meshing_dependency, shared_viewers_data,
+						data_block_size, mesh_block_size, volume_transform, settings.lod_distance, task_scheduler,
+						data_ptr);
+			}
 		}
 
 		lod.blocks_pending_update.clear();
@@ -1397,15 +1593,18 @@ void VoxelLodTerrainUpdateTask::run(ThreadedTaskContext ctx) {
 	CRASH_COND_MSG(update_data.task_is_complete, "Expected only one update task to run on a given volume");
 	MutexLock mutex_lock(update_data.completion_mutex);
 
-	// Update pending LOD data modifications due to edits.
-	// These are deferred from edits so we can batch them.
-	// It has to happen first because blocks can be unloaded afterwards.
-	flush_pending_lod_edits(state, data, generator, settings.full_load_mode, 1 << settings.mesh_block_size_po2);
+	BufferedTaskScheduler &task_scheduler = BufferedTaskScheduler::get_for_current_thread();
 
 	static thread_local std::vector<VoxelLodTerrainUpdateData::BlockToSave> data_blocks_to_save;
 	static thread_local std::vector<VoxelLodTerrainUpdateData::BlockLocation> data_blocks_to_load;
 	data_blocks_to_load.clear();
 
+	// Update pending LOD data modifications due to edits.
+	// These are deferred from edits so we can batch them.
+	// It has to happen first because blocks can be unloaded afterwards.
+	flush_pending_lod_edits(state, data, generator, settings.full_load_mode, 1 << settings.mesh_block_size_po2,
+			settings.downscale_filters, &task_scheduler, data_blocks_to_save);
+
 	profiling_clock.restart();
 	{
 		// Unload data blocks falling out of block region extent
@@ -1430,8 +1629,6 @@ void VoxelLodTerrainUpdateTask::run(ThreadedTaskContext ctx) {
 	}
 	state.stats.time_detect_required_blocks = profiling_clock.restart();
 
-	BufferedTaskScheduler &task_scheduler = BufferedTaskScheduler::get_for_current_thread();
-
 	process_async_edits(state, settings, data, _volume_id, _streaming_dependency, _shared_viewers_data,
 			_volume_transform, task_scheduler);
 
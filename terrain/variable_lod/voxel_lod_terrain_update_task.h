@@ -42,8 +42,15 @@ public:
 
 	// Functions also used outside of this task
 
+	// Propagates edits to lower LODs. Downscaling is done by tasks pushed into `task_scheduler`, and meshes are
+	// updated when they complete. If `task_scheduler` is null, downscaling is done on the calling thread, after
+	// waiting for the ones still running.
+	// Blocks which were unloaded while a downscale was writing into them are added to `blocks_to_save` once it
+	// completes.
 	static void flush_pending_lod_edits(VoxelLodTerrainUpdateData::State &state, VoxelDataLodMap &data,
-			Ref<VoxelGenerator> generator, bool full_load_mode, const int mesh_block_size);
+			Ref<VoxelGenerator> generator, bool full_load_mode, const int mesh_block_size,
+			const DownscaleFilters &downscale_filters, BufferedTaskScheduler *task_scheduler,
+			std::vector<VoxelLodTerrainUpdateData::BlockToSave> &blocks_to_save);
 
 	static uint8_t get_transition_mask(
 			const VoxelLodTerrainUpdateData::State &state, Vector3i block_pos, int lod_index, unsigned int lod_count);
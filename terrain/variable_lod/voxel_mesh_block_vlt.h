@@ -28,10 +28,12 @@ public:
 	bool active = false;
 
 	bool got_first_mesh_update = false;
+	// Non-zero while the instancer has not been notified of this block yet
+	uint32_t pending_instancer_update_id = 0;
 
 	uint32_t last_collider_update_time = 0;
 	bool has_deferred_collider_update = false;
-	std::vector<Array> deferred_collider_data;
+	PackedVector3Array deferred_collider_faces;
 
 	VoxelMeshBlockVLT(const Vector3i bpos, unsigned int size, unsigned int p_lod_index);
 	~VoxelMeshBlockVLT();
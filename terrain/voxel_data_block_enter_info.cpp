@@ -10,6 +10,8 @@ int VoxelDataBlockEnterInfo::_b_get_network_peer_id() const {
 
 Ref<gd::VoxelBuffer> VoxelDataBlockEnterInfo::_b_get_voxels() const {
 	ERR_FAIL_COND_V(voxel_block == nullptr, Ref<gd::VoxelBuffer>());
+	// Scripts may modify the buffer
+	voxel_block->unshare_voxels();
 	std::shared_ptr<VoxelBufferInternal> vbi = voxel_block->get_voxels_shared();
 	Ref<gd::VoxelBuffer> vb = gd::VoxelBuffer::create_shared(vbi);
 	return vb;
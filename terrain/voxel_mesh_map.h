@@ -3,8 +3,8 @@
 
 #include "../server/voxel_server.h"
 #include "../util/macros.h"
+#include "../util/open_hash_map.h"
 
-#include <unordered_map>
 #include <vector>
 
 namespace zylann::voxel {
@@ -28,9 +28,9 @@ public:
 		if (_last_accessed_block && _last_accessed_block->position == bpos) {
 			_last_accessed_block = nullptr;
 		}
-		auto it = _blocks_map.find(bpos);
-		if (it != _blocks_map.end()) {
-			const unsigned int i = it->second;
+		const unsigned int *index = _blocks_map.find(bpos);
+		if (index != nullptr) {
+			const unsigned int i = *index;
 #ifdef DEBUG_ENABLED
 			CRASH_COND(i >= _blocks.size());
 #endif
@@ -38,7 +38,7 @@ public:
 			ERR_FAIL_COND(block == nullptr);
 			pre_delete(*block);
 			queue_free_mesh_block(block);
-			remove_block_internal(it, i);
+			remove_block_internal(bpos, i);
 		}
 	}
 
@@ -46,9 +46,9 @@ public:
 		if (_last_accessed_block && _last_accessed_block->position == bpos) {
 			return _last_accessed_block;
 		}
-		auto it = _blocks_map.find(bpos);
-		if (it != _blocks_map.end()) {
-			const unsigned int i = it->second;
+		const unsigned int *index = _blocks_map.find(bpos);
+		if (index != nullptr) {
+			const unsigned int i = *index;
 #ifdef DEBUG_ENABLED
 			CRASH_COND(i >= _blocks.size());
 #endif
@@ -64,9 +64,9 @@ public:
 		if (_last_accessed_block != nullptr && _last_accessed_block->position == bpos) {
 			return _last_accessed_block;
 		}
-		auto it = _blocks_map.find(bpos);
-		if (it != _blocks_map.end()) {
-			const unsigned int i = it->second;
+		const unsigned int *index = _blocks_map.find(bpos);
+		if (index != nullptr) {
+			const unsigned int i = *index;
 #ifdef DEBUG_ENABLED
 			CRASH_COND(i >= _blocks.size());
 #endif
@@ -90,12 +90,12 @@ public:
 #endif
 		unsigned int i = _blocks.size();
 		_blocks.push_back(block);
-		_blocks_map.insert({ bpos, i });
+		_blocks_map.insert(bpos, i);
 	}
 
 	bool has_block(Vector3i pos) const {
 		//(_last_accessed_block != nullptr && _last_accessed_block->pos == pos) ||
-		return _blocks_map.find(pos) != _blocks_map.end();
+		return _blocks_map.has(pos);
 	}
 
 	void clear() {
@@ -143,13 +143,9 @@ public:
 	}
 
 private:
-	void remove_block_internal(std::unordered_map<Vector3i, unsigned int>::iterator rm_it, unsigned int index) {
-		// TODO `erase` can occasionally be very slow (milliseconds) if the map contains lots of items.
-		// This might be caused by internal rehashing/resizing.
-		// We should look for a faster container, or reduce the number of entries.
-
+	void remove_block_internal(Vector3i bpos, unsigned int index) {
 		// This function assumes the block is already freed
-		_blocks_map.erase(rm_it);
+		_blocks_map.erase(bpos);
 
 		MeshBlock_T *moved_block = _blocks.back();
 #ifdef DEBUG_ENABLED
@@ -159,9 +155,9 @@ private:
 		_blocks.pop_back();
 
 		if (index < _blocks.size()) {
-			auto moved_block_index_it = _blocks_map.find(moved_block->position);
-			CRASH_COND(moved_block_index_it == _blocks_map.end());
-			moved_block_index_it->second = index;
+			unsigned int *moved_block_index = _blocks_map.find(moved_block->position);
+			CRASH_COND(moved_block_index == nullptr);
+			*moved_block_index = index;
 		}
 	}
 
@@ -182,7 +178,7 @@ private:
 
 private:
 	// Blocks stored with a spatial hash in all 3D directions.
-	std::unordered_map<Vector3i, unsigned int> _blocks_map;
+	OpenHashMap<Vector3i, unsigned int> _blocks_map;
 	// Blocks are stored in a vector to allow faster iteration over all of them
 	std::vector<MeshBlock_T *> _blocks;
 
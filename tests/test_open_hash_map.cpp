@@ -0,0 +1,204 @@
+#include "test_open_hash_map.h"
+#include "../util/math/box3i.h"
+#include "../util/open_hash_map.h"
+#include "../util/profiling_clock.h"
+#include "testing.h"
+
+#include <core/math/random_pcg.h>
+#include <core/string/print_string.h>
+#include <unordered_map>
+
+namespace zylann::voxel::tests {
+
+void test_open_hash_map() {
+	// Apply the same random operations to an OpenHashMap and an std::unordered_map, and check they always match.
+	// Keys are taken in a small area so there are lots of collisions, insertions of existing keys and removals.
+	OpenHashMap<Vector3i, int> map;
+	std::unordered_map<Vector3i, int> expected_map;
+
+	struct L {
+		static bool validate(const OpenHashMap<Vector3i, int> &map, const std::unordered_map<Vector3i, int> &expected) {
+			ZYLANN_TEST_ASSERT_V(map.size() == expected.size(), false);
+			for (auto it = expected.begin(); it != expected.end(); ++it) {
+				const int *value = map.find(it->first);
+				ZYLANN_TEST_ASSERT_V(value != nullptr, false);
+				ZYLANN_TEST_ASSERT_V(*value == it->second, false);
+			}
+			unsigned int count = 0;
+			bool all_found = true;
+			map.for_each([&expected, &count, &all_found](const Vector3i &key, const int &value) {
+				auto it = expected.find(key);
+				if (it == expected.end() || it->second != value) {
+					all_found = false;
+				}
+				++count;
+			});
+			ZYLANN_TEST_ASSERT_V(all_found, false);
+			ZYLANN_TEST_ASSERT_V(count == expected.size(), false);
+			return true;
+		}
+	};
+
+	RandomPCG rng;
+	rng.seed(131183);
+
+	for (int i = 0; i < 20000; ++i) {
+		const Vector3i key(int(rng.rand() % 16) - 8, int(rng.rand() % 16) - 8, int(rng.rand() % 16) - 8);
+		const int value = rng.rand() % 1000;
+		const unsigned int op = rng.rand() % 4;
+		if (op == 0) {
+			const bool inserted = map.insert(key, value);
+			const bool expected_inserted = expected_map.insert({ key, value }).second;
+			ZYLANN_TEST_ASSERT(inserted == expected_inserted);
+		} else if (op == 1) {
+			map.insert_or_assign(key, value);
+			expected_map[key] = value;
+		} else if (op == 2) {
+			const bool erased = map.erase(key);
+			const bool expected_erased = expected_map.erase(key) != 0;
+			ZYLANN_TEST_ASSERT(erased == expected_erased);
+		} else {
+			ZYLANN_TEST_ASSERT(map.has(key) == (expected_map.find(key) != expected_map.end()));
+		}
+		if ((i % 1000) == 0) {
+			ZYLANN_TEST_ASSERT(L::validate(map, expected_map));
+		}
+	}
+	ZYLANN_TEST_ASSERT(L::validate(map, expected_map));
+
+	// Batched lookups give the same results as individual ones
+	{
+		std::vector<Vector3i> keys;
+		Box3i(Vector3i(-9, -9, -9), Vector3i(18, 18, 18)).for_each_cell_zxy([&keys](Vector3i pos) { //
+			keys.push_back(pos);
+		});
+		std::vector<int *> values;
+		values.resize(keys.size());
+		map.find_many(to_span_const(keys), to_span(values));
+		for (unsigned int i = 0; i < keys.size(); ++i) {
+			ZYLANN_TEST_ASSERT(values[i] == map.find(keys[i]));
+		}
+	}
+
+	// Reserving and shrinking keeps contents
+	map.reserve(10000);
+	ZYLANN_TEST_ASSERT(map.get_capacity() >= 10000);
+	ZYLANN_TEST_ASSERT(L::validate(map, expected_map));
+	map.rehash(0);
+	ZYLANN_TEST_ASSERT(map.get_capacity() < 10000);
+	ZYLANN_TEST_ASSERT(L::validate(map, expected_map));
+
+	map.clear();
+	expected_map.clear();
+	ZYLANN_TEST_ASSERT(L::validate(map, expected_map));
+	ZYLANN_TEST_ASSERT(!map.has(Vector3i()));
+}
+
+namespace {
+
+// Replays what a terrain does with its block maps while a viewer moves around: blocks entering the view distance get
+// inserted, blocks leaving it get removed, and meshing looks up the neighbors of blocks in the area.
+template <typename Map_T>
+struct BlockMapTrace {
+	static inline void insert(std::unordered_map<Vector3i, unsigned int> &map, Vector3i pos, unsigned int v) {
+		map.insert({ pos, v });
+	}
+	static inline void insert(OpenHashMap<Vector3i, unsigned int> &map, Vector3i pos, unsigned int v) {
+		map.insert(pos, v);
+	}
+
+	static inline uint64_t gather(const std::unordered_map<Vector3i, unsigned int> &map, Span<const Vector3i> keys) {
+		uint64_t sum = 0;
+		for (unsigned int i = 0; i < keys.size(); ++i) {
+			auto it = map.find(keys[i]);
+			if (it != map.end()) {
+				sum += it->second;
+			}
+		}
+		return sum;
+	}
+	static inline uint64_t gather(const OpenHashMap<Vector3i, unsigned int> &map, Span<const Vector3i> keys) {
+		FixedArray<const unsigned int *, 27> values;
+		map.find_many(keys, to_span(values));
+		uint64_t sum = 0;
+		for (unsigned int i = 0; i < keys.size(); ++i) {
+			if (values[i] != nullptr) {
+				sum += *values[i];
+			}
+		}
+		return sum;
+	}
+
+	static void run(Map_T &map, unsigned int steps, int radius, uint64_t &checksum, uint64_t &ops) {
+		Box3i prev_box;
+		for (unsigned int step = 0; step < steps; ++step) {
+			// Viewer moves along a diagonal-ish path
+			const Vector3i center(step, step / 3, step / 2);
+			const Box3i box = Box3i::from_center_extents(center, Vector3iUtil::create(radius));
+
+			prev_box.difference(box, [&map, &ops](Box3i out_box) {
+				out_box.for_each_cell([&map, &ops](Vector3i pos) {
+					map.erase(pos);
+					++ops;
+				});
+			});
+			box.for_each_cell([&map, &ops, &prev_box](Vector3i pos) {
+				if (!prev_box.contains(pos)) {
+					insert(map, pos, pos.x ^ pos.y ^ pos.z);
+					++ops;
+				}
+			});
+
+			// Neighbor gathering around blocks close to the viewer, like mesh requests do
+			const Box3i meshing_box = Box3i::from_center_extents(center, Vector3iUtil::create(radius / 2));
+			meshing_box.for_each_cell([&map, &checksum, &ops](Vector3i pos) {
+				FixedArray<Vector3i, 27> neighbors;
+				unsigned int i = 0;
+				Box3i(pos - Vector3i(1, 1, 1), Vector3i(3, 3, 3)).for_each_cell_zxy([&neighbors, &i](Vector3i npos) {
+					neighbors[i] = npos;
+					++i;
+				});
+				checksum += gather(map, to_span_const(neighbors));
+				ops += neighbors.size();
+			});
+
+			prev_box = box;
+		}
+	}
+};
+
+} // namespace
+
+void test_open_hash_map_benchmark() {
+	static const unsigned int STEPS = 200;
+	static const int RADIUS = 12;
+
+	uint64_t std_checksum = 0;
+	uint64_t std_ops = 0;
+	uint64_t std_time = 0;
+	{
+		std::unordered_map<Vector3i, unsigned int> map;
+		ProfilingClock profiling_clock;
+		BlockMapTrace<std::unordered_map<Vector3i, unsigned int>>::run(map, STEPS, RADIUS, std_checksum, std_ops);
+		std_time = profiling_clock.restart();
+	}
+
+	uint64_t open_checksum = 0;
+	uint64_t open_ops = 0;
+	uint64_t open_time = 0;
+	{
+		OpenHashMap<Vector3i, unsigned int> map;
+		ProfilingClock profiling_clock;
+		BlockMapTrace<OpenHashMap<Vector3i, unsigned int>>::run(map, STEPS, RADIUS, open_checksum, open_ops);
+		open_time = profiling_clock.restart();
+	}
+
+	// Both must have done the same work
+	ZYLANN_TEST_ASSERT(std_checksum == open_checksum);
+	ZYLANN_TEST_ASSERT(std_ops == open_ops);
+
+	print_line(String("Block map trace with {0} operations: std::unordered_map: {1} us, OpenHashMap: {2} us")
+					   .format(varray(open_ops, std_time, open_time)));
+}
+
+} // namespace zylann::voxel::tests
@@ -0,0 +1,11 @@
+#ifndef TEST_OPEN_HASH_MAP_H
+#define TEST_OPEN_HASH_MAP_H
+
+namespace zylann::voxel::tests {
+
+void test_open_hash_map();
+void test_open_hash_map_benchmark();
+
+} // namespace zylann::voxel::tests
+
+#endif // TEST_OPEN_HASH_MAP_H
@@ -0,0 +1,234 @@
+#include "test_region_file.h"
+#include "../streams/region/region_file.h"
+#include "../util/profiling_clock.h"
+#include "testing.h"
+
+#include <core/io/file_access.h>
+#include <core/math/random_pcg.h>
+#include <core/string/print_string.h>
+#include <unordered_map>
+
+namespace zylann::voxel::tests {
+
+namespace {
+
+const int BLOCK_SIZE_PO2 = 4;
+
+// Makes blocks with a controllable amount of noise, so their compressed size can grow or shrink
+void generate_block(VoxelBufferInternal &buffer, RandomPCG &rng, unsigned int noisy_voxel_ratio_percent) {
+	buffer.create(Vector3iUtil::create(1 << BLOCK_SIZE_PO2));
+	buffer.set_channel_depth(0, VoxelBufferInternal::DEPTH_16_BIT);
+	buffer.clear_channel(0, 0);
+	Vector3i pos;
+	for (pos.z = 0; pos.z < buffer.get_size().z; ++pos.z) {
+		for (pos.x = 0; pos.x < buffer.get_size().x; ++pos.x) {
+			for (pos.y = 0; pos.y < buffer.get_size().y; ++pos.y) {
+				if (rng.rand() % 100 < noisy_voxel_ratio_percent) {
+					buffer.set_voxel(1 + rng.rand() % 65535, pos, 0);
+				}
+			}
+		}
+	}
+}
+
+bool open_region_file(RegionFile &region_file, const String &fpath, bool create) {
+	// Same depths as generated blocks
+	VoxelBufferInternal block;
+	block.set_channel_depth(0, VoxelBufferInternal::DEPTH_16_BIT);
+
+	RegionFormat format = region_file.get_format();
+	format.block_size_po2 = BLOCK_SIZE_PO2;
+	for (unsigned int channel_index = 0; channel_index < VoxelBufferInternal::MAX_CHANNELS; ++channel_index) {
+		format.channel_depths[channel_index] = block.get_channel_depth(channel_index);
+	}
+	ZYLANN_TEST_ASSERT_V(region_file.set_format(format), false);
+	return region_file.open(fpath, create) == OK;
+}
+
+void check_blocks(RegionFile &region_file, const std::unordered_map<Vector3i, VoxelBufferInternal> &blocks) {
+	for (auto it = blocks.begin(); it != blocks.end(); ++it) {
+		VoxelBufferInternal loaded_block;
+		ZYLANN_TEST_ASSERT(region_file.load_block(it->first, loaded_block) == OK);
+		ZYLANN_TEST_ASSERT(it->second.equals(loaded_block));
+	}
+}
+
+} // namespace
+
+void test_region_file_free_sectors() {
+	zylann::testing::TestDirectory test_dir;
+	ZYLANN_TEST_ASSERT(test_dir.is_valid());
+	const String fpath = test_dir.get_path().plus_file("test_region_file_free_sectors.vxr");
+
+	RandomPCG rng;
+	std::unordered_map<Vector3i, VoxelBufferInternal> blocks;
+	RegionFile region_file;
+	ZYLANN_TEST_ASSERT(open_region_file(region_file, fpath, true));
+
+	// Blocks of increasing size are written one after the other
+	const unsigned int block_count = 8;
+	for (unsigned int i = 0; i < block_count; ++i) {
+		const Vector3i pos(i, 0, 0);
+		generate_block(blocks[pos], rng, 10 + i * 10);
+		ZYLANN_TEST_ASSERT(region_file.save_block(pos, blocks[pos]) == OK);
+	}
+	ZYLANN_TEST_ASSERT(region_file.get_free_sector_count() == 0);
+	const unsigned int initial_sector_count = region_file.get_sector_count();
+
+	// Growing a block in the middle moves it to the end, leaving free sectors
+	generate_block(blocks[Vector3i(2, 0, 0)], rng, 100);
+	ZYLANN_TEST_ASSERT(region_file.save_block(Vector3i(2, 0, 0), blocks[Vector3i(2, 0, 0)]) == OK);
+	const unsigned int free_sector_count = region_file.get_free_sector_count();
+	ZYLANN_TEST_ASSERT(free_sector_count > 0);
+	ZYLANN_TEST_ASSERT(region_file.get_sector_count() > initial_sector_count);
+	check_blocks(region_file, blocks);
+
+	// A new small block reuses free sectors instead of growing the file
+	const unsigned int sector_count_before_reuse = region_file.get_sector_count();
+	generate_block(blocks[Vector3i(0, 1, 0)], rng, 0);
+	ZYLANN_TEST_ASSERT(region_file.save_block(Vector3i(0, 1, 0), blocks[Vector3i(0, 1, 0)]) == OK);
+	ZYLANN_TEST_ASSERT(region_file.get_sector_count() == sector_count_before_reuse);
+	ZYLANN_TEST_ASSERT(region_file.get_free_sector_count() < free_sector_count);
+
+	// Shrinking the last block gives its sectors back to the end of the file
+	generate_block(blocks[Vector3i(2, 0, 0)], rng, 0);
+	ZYLANN_TEST_ASSERT(region_file.save_block(Vector3i(2, 0, 0), blocks[Vector3i(2, 0, 0)]) == OK);
+	ZYLANN_TEST_ASSERT(region_file.get_sector_count() < sector_count_before_reuse);
+	check_blocks(region_file, blocks);
+
+	// Many random saves
+	for (unsigned int i = 0; i < 500; ++i) {
+		const Vector3i pos(rng.rand() % block_count, rng.rand() % 2, 0);
+		generate_block(blocks[pos], rng, rng.rand() % 100);
+		ZYLANN_TEST_ASSERT(region_file.save_block(pos, blocks[pos]) == OK);
+	}
+	check_blocks(region_file, blocks);
+
+	// Free sectors are found again when the file is reopened
+	const unsigned int sector_count = region_file.get_sector_count();
+	const unsigned int free_sector_count_before_close = region_file.get_free_sector_count();
+	ZYLANN_TEST_ASSERT(region_file.close() == OK);
+	ZYLANN_TEST_ASSERT(open_region_file(region_file, fpath, false));
+	ZYLANN_TEST_ASSERT(region_file.get_sector_count() == sector_count);
+	ZYLANN_TEST_ASSERT(region_file.get_free_sector_count() == free_sector_count_before_close);
+	check_blocks(region_file, blocks);
+
+	// Compacting removes free sectors and shrinks the file
+	uint64_t file_length_before_compact = 0;
+	{
+		Ref<FileAccess> f = FileAccess::open(fpath, FileAccess::READ);
+		ZYLANN_TEST_ASSERT(f.is_valid());
+		file_length_before_compact = f->get_length();
+	}
+	ZYLANN_TEST_ASSERT(region_file.compact() == OK);
+	ZYLANN_TEST_ASSERT(region_file.get_free_sector_count() == 0);
+	ZYLANN_TEST_ASSERT(region_file.get_sector_count() == sector_count - free_sector_count_before_close);
+	check_blocks(region_file, blocks);
+	ZYLANN_TEST_ASSERT(region_file.close() == OK);
+	{
+		Ref<FileAccess> f = FileAccess::open(fpath, FileAccess::READ);
+		ZYLANN_TEST_ASSERT(f.is_valid());
+		ZYLANN_TEST_ASSERT(f->get_length() < file_length_before_compact);
+	}
+
+	ZYLANN_TEST_ASSERT(open_region_file(region_file, fpath, false));
+	ZYLANN_TEST_ASSERT(region_file.get_free_sector_count() == 0);
+	check_blocks(region_file, blocks);
+}
+
+void test_region_file_mapping() {
+	zylann::testing::TestDirectory test_dir;
+	ZYLANN_TEST_ASSERT(test_dir.is_valid());
+	const String fpath = test_dir.get_path().plus_file("test_region_file_mapping.vxr");
+
+	RegionFileMapping mapping;
+	ZYLANN_TEST_ASSERT(mapping.open(fpath) == ERR_FILE_NOT_FOUND);
+
+	RandomPCG rng;
+	std::unordered_map<Vector3i, VoxelBufferInternal> blocks;
+	RegionFile region_file;
+	ZYLANN_TEST_ASSERT(open_region_file(region_file, fpath, true));
+	const Vector3i region_size = region_file.get_format().region_size;
+	for (unsigned int i = 0; i < 200; ++i) {
+		const Vector3i pos(rng.rand() % region_size.x, rng.rand() % region_size.y, rng.rand() % region_size.z);
+		generate_block(blocks[pos], rng, rng.rand() % 100);
+		ZYLANN_TEST_ASSERT(region_file.save_block(pos, blocks[pos]) == OK);
+	}
+	// The header is only written when the file is flushed or closed
+	ZYLANN_TEST_ASSERT(region_file.flush() == OK);
+
+	const Error open_err = mapping.open(fpath);
+	if (open_err == ERR_UNAVAILABLE) {
+		print_line("Memory mapping is not supported on this platform, skipping");
+		return;
+	}
+	ZYLANN_TEST_ASSERT(open_err == OK);
+	ZYLANN_TEST_ASSERT(mapping.get_format().region_size == region_size);
+
+	for (unsigned int i = 0; i < Vector3iUtil::get_volume(region_size); ++i) {
+		const Vector3i pos = Vector3iUtil::from_zxy_index(i, region_size);
+		VoxelBufferInternal loaded_block;
+		auto it = blocks.find(pos);
+		if (it == blocks.end()) {
+			ZYLANN_TEST_ASSERT(mapping.load_block(pos, loaded_block) == ERR_DOES_NOT_EXIST);
+		} else {
+			ZYLANN_TEST_ASSERT(mapping.load_block(pos, loaded_block) == OK);
+			ZYLANN_TEST_ASSERT(it->second.equals(loaded_block));
+		}
+	}
+}
+
+void test_region_file_save_benchmark() {
+	// Mimics sculpting in a world of 16 regions: some blocks of each region are saved many times, with a size that
+	// changes every time
+	const unsigned int region_count = 16;
+	const unsigned int initial_blocks_per_region = 512;
+	const unsigned int save_count = 2000;
+
+	zylann::testing::TestDirectory test_dir;
+	ZYLANN_TEST_ASSERT(test_dir.is_valid());
+
+	RandomPCG rng;
+	VoxelBufferInternal block;
+
+	std::vector<RegionFile> region_files(region_count);
+	for (unsigned int i = 0; i < region_files.size(); ++i) {
+		const String fpath = test_dir.get_path().plus_file(String("r{0}.vxr").format(varray(i)));
+		ZYLANN_TEST_ASSERT(open_region_file(region_files[i], fpath, true));
+		const Vector3i region_size = region_files[i].get_format().region_size;
+		for (unsigned int j = 0; j < initial_blocks_per_region; ++j) {
+			generate_block(block, rng, rng.rand() % 100);
+			const Vector3i pos = Vector3iUtil::from_zxy_index(j, region_size);
+			ZYLANN_TEST_ASSERT(region_files[i].save_block(pos, block) == OK);
+		}
+	}
+
+	ProfilingClock profiling_clock;
+
+	for (unsigned int i = 0; i < save_count; ++i) {
+		RegionFile &region_file = region_files[rng.rand() % region_files.size()];
+		const Vector3i pos(rng.rand() % 4, rng.rand() % 4, rng.rand() % 4);
+		generate_block(block, rng, rng.rand() % 100);
+		ZYLANN_TEST_ASSERT(region_file.save_block(pos, block) == OK);
+	}
+
+	const uint64_t time_spent = profiling_clock.restart();
+
+	unsigned int sector_count = 0;
+	unsigned int free_sector_count = 0;
+	for (unsigned int i = 0; i < region_files.size(); ++i) {
+		sector_count += region_files[i].get_sector_count();
+		free_sector_count += region_files[i].get_free_sector_count();
+		ZYLANN_TEST_ASSERT(region_files[i].compact() == OK);
+	}
+
+	const uint64_t compact_time = profiling_clock.restart();
+
+	const double saves_per_second = time_spent > 0 ? 1000000.0 * double(save_count) / double(time_spent) : 0.0;
+	print_line(String("RegionFile: {0} saves in {1} regions: {2} us, {3} saves/s, {4} free sectors out of {5}, "
+					  "compacted in {6} us")
+					   .format(varray(save_count, region_count, time_spent, saves_per_second, free_sector_count,
+							   sector_count, compact_time)));
+}
+
+} // namespace zylann::voxel::tests
@@ -0,0 +1,12 @@
+#ifndef TEST_REGION_FILE_H
+#define TEST_REGION_FILE_H
+
+namespace zylann::voxel::tests {
+
+void test_region_file_free_sectors();
+void test_region_file_mapping();
+void test_region_file_save_benchmark();
+
+} // namespace zylann::voxel::tests
+
+#endif // TEST_REGION_FILE_H
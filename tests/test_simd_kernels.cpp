@@ -0,0 +1,335 @@
+#include "test_simd_kernels.h"
+#include "../storage/funcs.h"
+#include "../storage/voxel_buffer_internal.h"
+#include "../util/profiling_clock.h"
+#include "../util/simd_kernels.h"
+#include "testing.h"
+
+#include <core/math/random_pcg.h>
+#include <core/string/print_string.h>
+#include <vector>
+
+namespace zylann::voxel::tests {
+
+namespace {
+
+template <typename T>
+void fill_random(std::vector<T> &items, RandomPCG &rng) {
+	for (unsigned int i = 0; i < items.size(); ++i) {
+		const uint64_t v = rng.rand() | (static_cast<uint64_t>(rng.rand()) << 32);
+		items[i] = static_cast<T>(v);
+	}
+}
+
+void fill_random(std::vector<float> &items, RandomPCG &rng) {
+	for (unsigned int i = 0; i < items.size(); ++i) {
+		items[i] = rng.randf() * 2.f - 1.f;
+	}
+}
+
+// Runs a function once for every SIMD level the CPU supports, then restores the level that was set before.
+template <typename F>
+void for_each_simd_level(F f) {
+	const simd::Level prev_level = simd::get_level();
+	for (int level = 0; level <= simd::get_supported_level(); ++level) {
+		simd::set_level(simd::Level(level));
+		f();
+	}
+	simd::set_level(prev_level);
+}
+
+// Sizes are chosen to cover vector loops, unrolled loops and leftover items
+const unsigned int g_test_sizes[] = { 0, 1, 2, 3, 7, 8, 15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 128, 129, 200, 4096 };
+
+template <typename T>
+bool test_is_uniform_and_fill(RandomPCG &rng) {
+	for (const unsigned int size : g_test_sizes) {
+		std::vector<T> items;
+		// Add an offset so accesses are not aligned
+		items.resize(size + 1);
+		Span<T> span(items.data() + 1, size);
+
+		simd::fill(span, T(0xa5a5a5a5a5a5a5a5ull));
+		for (unsigned int i = 0; i < span.size(); ++i) {
+			ZYLANN_TEST_ASSERT_V(span[i] == T(0xa5a5a5a5a5a5a5a5ull), false);
+		}
+		ZYLANN_TEST_ASSERT_V(simd::is_uniform(to_span_const(span)), false);
+
+		if (span.size() < 2) {
+			continue;
+		}
+		// Changing any item must be detected, including in leftover items
+		for (unsigned int i = 0; i < span.size(); i += 1 + rng.rand() % 5) {
+			const T prev = span[i];
+			span[i] = prev ^ T(1) << (rng.rand() % (sizeof(T) * 8));
+			ZYLANN_TEST_ASSERT_V(!simd::is_uniform(to_span_const(span)), false);
+			span[i] = prev;
+		}
+	}
+	return true;
+}
+
+template <typename T>
+bool test_get_range(RandomPCG &rng) {
+	for (const unsigned int size : g_test_sizes) {
+		if (size == 0) {
+			continue;
+		}
+		std::vector<T> items;
+		items.resize(size + 1);
+		fill_random(items, rng);
+		const Span<const T> span(items.data() + 1, size);
+
+		T expected_min = span[0];
+		T expected_max = span[0];
+		for (unsigned int i = 1; i < span.size(); ++i) {
+			expected_min = math::min(span[i], expected_min);
+			expected_max = math::max(span[i], expected_max);
+		}
+		T min_value;
+		T max_value;
+		simd::get_range(span, min_value, max_value);
+		ZYLANN_TEST_ASSERT_V(min_value == expected_min, false);
+		ZYLANN_TEST_ASSERT_V(max_value == expected_max, false);
+	}
+	return true;
+}
+
+template <typename T>
+bool test_decimate_2x(RandomPCG &rng) {
+	for (const unsigned int size : g_test_sizes) {
+		std::vector<T> src;
+		src.resize(size * 2 + 1);
+		fill_random(src, rng);
+		std::vector<T> dst;
+		// Extra item to check we don't write past the end
+		dst.resize(size + 2, T(0));
+
+		simd::decimate_2x(dst.data() + 1, src.data() + 1, size);
+
+		ZYLANN_TEST_ASSERT_V(dst[0] == T(0), false);
+		ZYLANN_TEST_ASSERT_V(dst[size + 1] == T(0), false);
+		for (unsigned int i = 0; i < size; ++i) {
+			ZYLANN_TEST_ASSERT_V(dst[i + 1] == src[i * 2 + 1], false);
+		}
+	}
+	return true;
+}
+
+bool test_copy_rows(RandomPCG &rng) {
+	const unsigned int row_count = 5;
+	for (unsigned int row_size = 0; row_size <= 80; ++row_size) {
+		const unsigned int src_stride = row_size + 3;
+		const unsigned int dst_stride = row_size + 7;
+		std::vector<uint8_t> src;
+		src.resize(src_stride * row_count + 1);
+		fill_random(src, rng);
+		std::vector<uint8_t> dst;
+		dst.resize(dst_stride * row_count + 1, 0);
+
+		simd::copy_rows(dst.data() + 1, dst_stride, src.data() + 1, src_stride, row_size, row_count);
+
+		for (unsigned int i = 0; i < dst.size(); ++i) {
+			// Bytes between rows must not be touched
+			const unsigned int row_index = (i - 1) / dst_stride;
+			const unsigned int x = (i - 1) % dst_stride;
+			if (i == 0 || x >= row_size) {
+				ZYLANN_TEST_ASSERT_V(dst[i] == 0, false);
+			} else {
+				ZYLANN_TEST_ASSERT_V(dst[i] == src[1 + row_index * src_stride + x], false);
+			}
+		}
+	}
+	return true;
+}
+
+} // namespace
+
+void test_simd_kernels() {
+	RandomPCG rng;
+	rng.seed(131183);
+
+	for_each_simd_level([&rng]() {
+		ZYLANN_TEST_ASSERT(test_is_uniform_and_fill<uint8_t>(rng));
+		ZYLANN_TEST_ASSERT(test_is_uniform_and_fill<uint16_t>(rng));
+		ZYLANN_TEST_ASSERT(test_is_uniform_and_fill<uint32_t>(rng));
+		ZYLANN_TEST_ASSERT(test_is_uniform_and_fill<uint64_t>(rng));
+
+		ZYLANN_TEST_ASSERT(test_get_range<int8_t>(rng));
+		ZYLANN_TEST_ASSERT(test_get_range<int16_t>(rng));
+		ZYLANN_TEST_ASSERT(test_get_range<float>(rng));
+
+		ZYLANN_TEST_ASSERT(test_decimate_2x<uint8_t>(rng));
+		ZYLANN_TEST_ASSERT(test_decimate_2x<uint16_t>(rng));
+		ZYLANN_TEST_ASSERT(test_decimate_2x<uint32_t>(rng));
+		ZYLANN_TEST_ASSERT(test_decimate_2x<uint64_t>(rng));
+
+		ZYLANN_TEST_ASSERT(test_copy_rows(rng));
+	});
+}
+
+void test_voxel_buffer_downscale() {
+	RandomPCG rng;
+	rng.seed(131183);
+
+	const Vector3i src_size(16, 18, 16);
+	VoxelBufferInternal src;
+	src.create(src_size);
+	// Test every depth, using one channel for each
+	static const VoxelBufferInternal::Depth depths[] = { VoxelBufferInternal::DEPTH_8_BIT,
+		VoxelBufferInternal::DEPTH_16_BIT, VoxelBufferInternal::DEPTH_32_BIT, VoxelBufferInternal::DEPTH_64_BIT };
+	static const unsigned int channel_count = 4;
+	for (unsigned int channel_index = 0; channel_index < channel_count; ++channel_index) {
+		src.set_channel_depth(channel_index, depths[channel_index]);
+		Vector3i pos;
+		for (pos.z = 0; pos.z < src_size.z; ++pos.z) {
+			for (pos.x = 0; pos.x < src_size.x; ++pos.x) {
+				for (pos.y = 0; pos.y < src_size.y; ++pos.y) {
+					const uint64_t v = rng.rand() | (static_cast<uint64_t>(rng.rand()) << 32);
+					src.set_voxel(v, pos, channel_index);
+				}
+			}
+		}
+	}
+
+	for_each_simd_level([&src]() {
+		const Vector3i dst_min(2, 3, 1);
+		VoxelBufferInternal dst;
+		dst.create(Vector3i(16, 16, 16));
+		FixedArray<uint64_t, channel_count> default_values;
+		for (unsigned int channel_index = 0; channel_index < channel_count; ++channel_index) {
+			dst.set_channel_depth(channel_index, depths[channel_index]);
+			default_values[channel_index] = dst.get_voxel(Vector3i(), channel_index);
+		}
+		src.downscale_to(dst, Vector3i(), src.get_size(), dst_min);
+
+		const Box3i dst_box(dst_min, src.get_size() >> 1);
+		for (unsigned int channel_index = 0; channel_index < channel_count; ++channel_index) {
+			Vector3i pos;
+			for (pos.z = 0; pos.z < dst.get_size().z; ++pos.z) {
+				for (pos.x = 0; pos.x < dst.get_size().x; ++pos.x) {
+					for (pos.y = 0; pos.y < dst.get_size().y; ++pos.y) {
+						const uint64_t v = dst.get_voxel(pos, channel_index);
+						if (dst_box.contains(pos)) {
+							ZYLANN_TEST_ASSERT(v == src.get_voxel((pos - dst_min) * 2, channel_index));
+						} else {
+							// Outside of the downscaled area, voxels keep their default value
+							ZYLANN_TEST_ASSERT(v == default_values[channel_index]);
+						}
+					}
+				}
+			}
+		}
+	});
+}
+
+namespace {
+
+template <typename T>
+uint64_t bench_is_uniform(Span<T> items, unsigned int iterations) {
+	simd::fill(items, T(1));
+	uint64_t count = 0;
+	for (unsigned int i = 0; i < iterations; ++i) {
+		count += simd::is_uniform(to_span_const(items));
+	}
+	ZYLANN_TEST_ASSERT_V(count == iterations, 0);
+	return items.size() * sizeof(T) * iterations;
+}
+
+template <typename T>
+uint64_t bench_fill(Span<T> items, unsigned int iterations) {
+	for (unsigned int i = 0; i < iterations; ++i) {
+		simd::fill(items, T(i));
+	}
+	return items.size() * sizeof(T) * iterations;
+}
+
+template <typename T>
+uint64_t bench_get_range(Span<T> items, unsigned int iterations) {
+	for (unsigned int i = 0; i < items.size(); ++i) {
+		items[i] = static_cast<T>(i);
+	}
+	for (unsigned int i = 0; i < iterations; ++i) {
+		T min_value;
+		T max_value;
+		simd::get_range(to_span_const(items), min_value, max_value);
+	}
+	return items.size() * sizeof(T) * iterations;
+}
+
+template <typename T>
+uint64_t bench_copy_region(Span<T> items, unsigned int iterations) {
+	// Typical copy of a 16x16x16 block into a padded buffer, like done before meshing
+	const Vector3i src_size(16, 16, 16);
+	const Vector3i dst_size(18, 18, 18);
+	const size_t src_volume = Vector3iUtil::get_volume(src_size);
+	ZYLANN_TEST_ASSERT_V(items.size() >= src_volume + Vector3iUtil::get_volume(dst_size), 0);
+	const Span<const T> src = items.sub(0, src_volume);
+	const Span<T> dst = items.sub(src_volume, Vector3iUtil::get_volume(dst_size));
+	for (unsigned int i = 0; i < iterations; ++i) {
+		copy_3d_region_zxy(dst, dst_size, Vector3i(1, 1, 1), src, src_size, Vector3i(), src_size);
+	}
+	return src_volume * sizeof(T) * iterations;
+}
+
+template <typename T>
+uint64_t bench_decimate_2x(Span<T> items, unsigned int iterations) {
+	const size_t dst_count = items.size() / 3;
+	for (unsigned int i = 0; i < iterations; ++i) {
+		simd::decimate_2x(items.data(), items.data() + dst_count, dst_count);
+	}
+	// Count bytes read from the source row
+	return dst_count * 2 * sizeof(T) * iterations;
+}
+
+// Buffers small enough to stay in cache, because that's how voxel blocks are usually processed
+const unsigned int BENCHMARK_BUFFER_SIZE_IN_BYTES = 64 * 1024;
+const uint64_t BENCHMARK_BYTES_PER_TEST = 1ull << 29;
+
+template <typename T, typename F>
+void run_simd_benchmark(const char *kernel_name, std::vector<uint64_t> &buffer, F bench_func) {
+	const Span<T> items(reinterpret_cast<T *>(buffer.data()), buffer.size() * sizeof(uint64_t) / sizeof(T));
+	const unsigned int iterations = BENCHMARK_BYTES_PER_TEST / (buffer.size() * sizeof(uint64_t));
+
+	for_each_simd_level([kernel_name, items, iterations, &bench_func]() {
+		ProfilingClock profiling_clock;
+		const uint64_t bytes = bench_func(items, iterations);
+		const uint64_t time = math::max(profiling_clock.restart(), uint64_t(1));
+		const double gbps = double(bytes) / (double(time) * 1000.0);
+		print_line(String("SIMD {0} {1}-bit, {2}: {3} GB/s")
+						   .format(varray(kernel_name, int(sizeof(T) * 8), simd::get_level_name(simd::get_level()),
+								   gbps)));
+	});
+}
+
+} // namespace
+
+void test_simd_kernels_benchmark() {
+	std::vector<uint64_t> buffer;
+	buffer.resize(BENCHMARK_BUFFER_SIZE_IN_BYTES / sizeof(uint64_t));
+
+	run_simd_benchmark<uint8_t>("is_uniform", buffer, bench_is_uniform<uint8_t>);
+	run_simd_benchmark<uint16_t>("is_uniform", buffer, bench_is_uniform<uint16_t>);
+	run_simd_benchmark<uint32_t>("is_uniform", buffer, bench_is_uniform<uint32_t>);
+	run_simd_benchmark<uint64_t>("is_uniform", buffer, bench_is_uniform<uint64_t>);
+
+	run_simd_benchmark<uint8_t>("fill", buffer, bench_fill<uint8_t>);
+	run_simd_benchmark<uint16_t>("fill", buffer, bench_fill<uint16_t>);
+	run_simd_benchmark<uint32_t>("fill", buffer, bench_fill<uint32_t>);
+	run_simd_benchmark<uint64_t>("fill", buffer, bench_fill<uint64_t>);
+
+	run_simd_benchmark<int8_t>("get_range", buffer, bench_get_range<int8_t>);
+	run_simd_benchmark<int16_t>("get_range", buffer, bench_get_range<int16_t>);
+	run_simd_benchmark<float>("get_range", buffer, bench_get_range<float>);
+
+	run_simd_benchmark<uint8_t>("copy_3d_region_zxy", buffer, bench_copy_region<uint8_t>);
+	run_simd_benchmark<uint16_t>("copy_3d_region_zxy", buffer, bench_copy_region<uint16_t>);
+	run_simd_benchmark<uint32_t>("copy_3d_region_zxy", buffer, bench_copy_region<uint32_t>);
+
+	run_simd_benchmark<uint8_t>("decimate_2x", buffer, bench_decimate_2x<uint8_t>);
+	run_simd_benchmark<uint16_t>("decimate_2x", buffer, bench_decimate_2x<uint16_t>);
+	run_simd_benchmark<uint32_t>("decimate_2x", buffer, bench_decimate_2x<uint32_t>);
+	run_simd_benchmark<uint64_t>("decimate_2x", buffer, bench_decimate_2x<uint64_t>);
+}
+
+} // namespace zylann::voxel::tests
@@ -0,0 +1,12 @@
+#ifndef TEST_SIMD_KERNELS_H
+#define TEST_SIMD_KERNELS_H
+
+namespace zylann::voxel::tests {
+
+void test_simd_kernels();
+void test_voxel_buffer_downscale();
+void test_simd_kernels_benchmark();
+
+} // namespace zylann::voxel::tests
+
+#endif // TEST_SIMD_KERNELS_H
@@ -0,0 +1,547 @@
+#include "test_threaded_task_runner.h"
+#include "../meshers/transvoxel/transvoxel.h"
+#include "../server/priority_dependency.h"
+#include "../storage/voxel_buffer_internal.h"
+#include "../util/memory.h"
+#include "../util/profiling_clock.h"
+#include "../util/tasks/async_dependency_tracker.h"
+#include "../util/tasks/threaded_task_runner.h"
+#include "../util/thread/thread.h"
+#include "testing.h"
+
+#include <core/string/print_string.h>
+#include <algorithm>
+#include <atomic>
+
+namespace zylann::voxel::tests {
+
+namespace {
+
+// Gives the order in which tasks ran
+std::atomic_uint32_t g_task_run_sequence(0);
+
+class CountingTask : public IThreadedTask {
+public:
+	std::atomic_uint32_t run_count;
+	std::atomic_uint32_t priority_poll_count;
+	uint32_t run_sequence = 0;
+	uint32_t thread_index = 0;
+	int priority = 0;
+	bool cancelled = false;
+	// Tasks to schedule from within `run`
+	ThreadedTaskRunner *runner = nullptr;
+	Span<IThreadedTask *> children;
+
+	// Makes the task take some time
+	uint32_t sleep_usec = 0;
+	// Incremented when the task runs
+	std::atomic_uint32_t *epoch_to_increment = nullptr;
+
+	CountingTask() : run_count(0), priority_poll_count(0) {}
+
+	void run(ThreadedTaskContext ctx) override {
+		++run_count;
+		run_sequence = ++g_task_run_sequence;
+		thread_index = ctx.thread_index;
+		if (epoch_to_increment != nullptr) {
+			++(*epoch_to_increment);
+		}
+		if (sleep_usec > 0) {
+			Thread::sleep_usec(sleep_usec);
+		}
+		if (runner != nullptr && children.size() > 0) {
+			runner->enqueue(children);
+		}
+	}
+
+	void apply_result() override {}
+
+	int get_priority() override {
+		++priority_poll_count;
+		return priority;
+	}
+
+	bool is_cancelled() override {
+		return cancelled;
+	}
+};
+
+// Dequeues completed tasks until the expected amount came back, or times out
+void dequeue_all(ThreadedTaskRunner &runner, std::vector<IThreadedTask *> &out_tasks, size_t expected_count) {
+	const unsigned int max_iterations = 5000;
+	for (unsigned int i = 0; i < max_iterations && out_tasks.size() < expected_count; ++i) {
+		runner.wait_for_all_tasks();
+		runner.dequeue_completed_tasks([&out_tasks](IThreadedTask *task) { out_tasks.push_back(task); });
+		if (out_tasks.size() < expected_count) {
+			Thread::sleep_usec(1000);
+		}
+	}
+}
+
+// Every task must come back exactly once
+void check_completed_tasks(Span<CountingTask> tasks, const std::vector<IThreadedTask *> &completed_tasks) {
+	ZYLANN_TEST_ASSERT(completed_tasks.size() == tasks.size());
+	std::vector<uint8_t> seen;
+	seen.resize(tasks.size(), 0);
+	for (IThreadedTask *task : completed_tasks) {
+		const size_t i = static_cast<CountingTask *>(task) - tasks.data();
+		ZYLANN_TEST_ASSERT(i < tasks.size());
+		ZYLANN_TEST_ASSERT(seen[i] == 0);
+		seen[i] = 1;
+	}
+}
+
+// Runner used by tracker callbacks in tests, since they can't capture anything
+ThreadedTaskRunner *g_graph_test_runner = nullptr;
+
+void schedule_next_tasks(Span<IThreadedTask *> tasks) {
+	g_graph_test_runner->enqueue(tasks);
+}
+
+void schedule_tracked_next_tasks(Span<IThreadedTask *> tasks, std::shared_ptr<AsyncDependencyTracker> tracker) {
+	g_graph_test_runner->enqueue(tasks, tracker);
+}
+
+// Queues tasks one by one from a thread which is not part of the runner
+struct ProducerData {
+	ThreadedTaskRunner *runner = nullptr;
+	Span<IThreadedTask *> tasks;
+};
+
+void producer_thread_func(void *p_data) {
+	ProducerData &data = *static_cast<ProducerData *>(p_data);
+	for (unsigned int i = 0; i < data.tasks.size(); ++i) {
+		data.runner->enqueue(data.tasks[i]);
+		Thread::sleep_usec(20);
+	}
+}
+
+// Has a priority computed like voxel tasks do, from the distance to viewers and the LOD
+class LodTask : public IThreadedTask {
+public:
+	PriorityDependency priority_dependency;
+	uint8_t lod_index = 0;
+	uint32_t run_sequence = 0;
+
+	void run(ThreadedTaskContext ctx) override {
+		run_sequence = ++g_task_run_sequence;
+	}
+
+	void apply_result() override {}
+
+	int get_priority() override {
+		return priority_dependency.evaluate(lod_index, nullptr);
+	}
+
+	bool is_cancelled() override {
+		return false;
+	}
+};
+
+} // namespace
+
+void test_threaded_task_runner_lod_priorities() {
+	// Coarse LODs must run first so the octree can subdivide without cracks, and within a LOD, blocks nearest to the
+	// viewer must run first.
+	std::shared_ptr<PriorityDependency::ViewersData> viewers = make_shared_instance<PriorityDependency::ViewersData>();
+	viewers->viewers.push_back(Vector3(10, 0, 0));
+
+	const unsigned int lod_count = 4;
+	const unsigned int tasks_per_lod = 50;
+	std::vector<LodTask> tasks(lod_count * tasks_per_lod);
+	std::vector<IThreadedTask *> task_ptrs;
+	for (unsigned int i = 0; i < tasks.size(); ++i) {
+		LodTask &task = tasks[i];
+		task.lod_index = i % lod_count;
+		// Not in order of distance. `PriorityDependency` doesn't tell apart distances beyond about 316.
+		const float distance = float(((i / lod_count) * 37) % tasks_per_lod) * 6.f;
+		task.priority_dependency.shared = viewers;
+		task.priority_dependency.world_position = Vector3(10, distance, 0);
+		task.priority_dependency.drop_distance_squared = 1e10f;
+		task_ptrs.push_back(&task);
+	}
+
+	ThreadedTaskRunner runner;
+	runner.set_batch_count(1);
+	// Queued before the thread starts, so it sees all of them when it picks the first one
+	runner.enqueue(to_span(task_ptrs));
+	runner.set_thread_count(1);
+
+	std::vector<IThreadedTask *> completed_tasks;
+	dequeue_all(runner, completed_tasks, tasks.size());
+	ZYLANN_TEST_ASSERT(completed_tasks.size() == tasks.size());
+
+	std::vector<const LodTask *> run_order;
+	for (const LodTask &task : tasks) {
+		run_order.push_back(&task);
+	}
+	std::sort(run_order.begin(), run_order.end(),
+			[](const LodTask *a, const LodTask *b) { return a->run_sequence < b->run_sequence; });
+
+	for (size_t i = 1; i < run_order.size(); ++i) {
+		const LodTask &prev = *run_order[i - 1];
+		const LodTask &task = *run_order[i];
+		ZYLANN_TEST_ASSERT(prev.lod_index >= task.lod_index);
+		if (prev.lod_index == task.lod_index) {
+			ZYLANN_TEST_ASSERT(prev.priority_dependency.world_position.y <= task.priority_dependency.world_position.y);
+		}
+	}
+}
+
+void test_threaded_task_runner() {
+	// More threads than the old limit of 8, with cancelled tasks and tasks scheduling other tasks
+	{
+		const unsigned int thread_count = 12;
+		const unsigned int parent_count = 500;
+		const unsigned int children_per_parent = 3;
+
+		std::vector<CountingTask> tasks(parent_count * (1 + children_per_parent));
+		std::vector<IThreadedTask *> parent_ptrs;
+		std::vector<IThreadedTask *> child_ptrs;
+		for (CountingTask &task : tasks) {
+			child_ptrs.push_back(&task);
+		}
+
+		ThreadedTaskRunner runner;
+		runner.set_name("TestPool");
+		runner.set_thread_count(thread_count);
+		runner.set_batch_count(4);
+		runner.set_priority_update_period(1);
+		ZYLANN_TEST_ASSERT(runner.get_thread_count() == thread_count);
+
+		for (unsigned int i = 0; i < parent_count; ++i) {
+			CountingTask &task = tasks[i];
+			task.priority = (i * 37) % 1000;
+			task.cancelled = (i % 10) == 0;
+			if (!task.cancelled) {
+				task.runner = &runner;
+				task.children = Span<IThreadedTask *>(child_ptrs.data() + parent_count + i * children_per_parent,
+						children_per_parent);
+			}
+			parent_ptrs.push_back(&task);
+		}
+
+		runner.enqueue(to_span(parent_ptrs));
+
+		// Children of cancelled tasks are never scheduled
+		const size_t expected_count = tasks.size() - (parent_count / 10) * children_per_parent;
+		std::vector<IThreadedTask *> completed_tasks;
+		dequeue_all(runner, completed_tasks, expected_count);
+		ZYLANN_TEST_ASSERT(completed_tasks.size() == expected_count);
+		ZYLANN_TEST_ASSERT(runner.get_debug_remaining_tasks() == 0);
+
+		for (unsigned int i = 0; i < parent_count; ++i) {
+			const CountingTask &task = tasks[i];
+			if (task.cancelled) {
+				// Cancelled tasks are given back without running
+				ZYLANN_TEST_ASSERT(task.run_count == 0);
+				for (unsigned int j = 0; j < children_per_parent; ++j) {
+					ZYLANN_TEST_ASSERT(tasks[parent_count + i * children_per_parent + j].run_count == 0);
+				}
+			} else {
+				ZYLANN_TEST_ASSERT(task.run_count == 1);
+				for (unsigned int j = 0; j < children_per_parent; ++j) {
+					ZYLANN_TEST_ASSERT(tasks[parent_count + i * children_per_parent + j].run_count == 1);
+				}
+			}
+		}
+		for (const CountingTask &task : tasks) {
+			ZYLANN_TEST_ASSERT(task.thread_index < thread_count);
+		}
+	}
+
+	// Tasks queued before threads exist, or while the thread count changes, are not lost
+	{
+		std::vector<CountingTask> tasks(200);
+		std::vector<IThreadedTask *> task_ptrs;
+		for (CountingTask &task : tasks) {
+			task_ptrs.push_back(&task);
+		}
+
+		ThreadedTaskRunner runner;
+		runner.enqueue(to_span(task_ptrs).sub(0, 100));
+		runner.set_thread_count(3);
+		runner.enqueue(to_span(task_ptrs).sub(100, 100));
+		runner.set_thread_count(10);
+
+		std::vector<IThreadedTask *> completed_tasks;
+		dequeue_all(runner, completed_tasks, tasks.size());
+		check_completed_tasks(to_span(tasks), completed_tasks);
+		for (const CountingTask &task : tasks) {
+			ZYLANN_TEST_ASSERT(task.run_count == 1);
+		}
+	}
+
+	// Resizing while tasks are queued from another thread and from within the pool
+	{
+		const unsigned int parent_count = 300;
+		std::vector<CountingTask> tasks(parent_count * 2);
+		std::vector<IThreadedTask *> task_ptrs;
+		for (CountingTask &task : tasks) {
+			task_ptrs.push_back(&task);
+		}
+
+		ThreadedTaskRunner runner;
+		runner.set_thread_count(2);
+
+		for (unsigned int i = 0; i < parent_count; ++i) {
+			CountingTask &task = tasks[i];
+			task.runner = &runner;
+			task.children = to_span(task_ptrs).sub(parent_count + i, 1);
+			task.sleep_usec = 50;
+		}
+
+		ProducerData producer_data;
+		producer_data.runner = &runner;
+		producer_data.tasks = to_span(task_ptrs).sub(0, parent_count);
+		Thread producer;
+		producer.start(producer_thread_func, &producer_data);
+
+		const unsigned int thread_counts[] = { 1, 4, 0, 3, 6, 2 };
+		for (const unsigned int thread_count : thread_counts) {
+			runner.set_thread_count(thread_count);
+			ZYLANN_TEST_ASSERT(runner.get_thread_count() == thread_count);
+			Thread::sleep_usec(1000);
+		}
+
+		producer.wait_to_finish();
+
+		std::vector<IThreadedTask *> completed_tasks;
+		dequeue_all(runner, completed_tasks, tasks.size());
+		check_completed_tasks(to_span(tasks), completed_tasks);
+		for (const CountingTask &task : tasks) {
+			ZYLANN_TEST_ASSERT(task.run_count == 1);
+		}
+	}
+
+	// With an epoch, priorities are only polled again when it changes
+	for (const bool change_epoch : { false, true }) {
+		std::atomic_uint32_t epoch(0);
+
+		ThreadedTaskRunner runner;
+		runner.set_priority_update_period(20);
+		runner.set_priority_epoch(&epoch);
+
+		// One thread and one task per batch, so the first task runs alone for longer than the update period
+		std::vector<CountingTask> tasks(10);
+		std::vector<IThreadedTask *> task_ptrs;
+		for (unsigned int i = 0; i < tasks.size(); ++i) {
+			CountingTask &task = tasks[i];
+			task.priority = i == 0 ? 0 : 100 + i;
+			task_ptrs.push_back(&task);
+		}
+		tasks[0].sleep_usec = 60000;
+		if (change_epoch) {
+			tasks[0].epoch_to_increment = &epoch;
+		}
+
+		runner.enqueue(to_span(task_ptrs));
+		runner.set_thread_count(1);
+
+		std::vector<IThreadedTask *> completed_tasks;
+		dequeue_all(runner, completed_tasks, tasks.size());
+		check_completed_tasks(to_span(tasks), completed_tasks);
+
+		// Polled when received, then only if the epoch changed
+		const unsigned int expected_poll_count = change_epoch ? 2 : 1;
+		for (unsigned int i = 1; i < tasks.size(); ++i) {
+			ZYLANN_TEST_ASSERT(tasks[i].priority_poll_count == expected_poll_count);
+		}
+	}
+
+	// Dependencies: A tasks -> C -> D tasks, without going through the calling thread between steps
+	for (const bool cancel_one_dependency : { false, true }) {
+		ThreadedTaskRunner runner;
+		runner.set_thread_count(4);
+		g_graph_test_runner = &runner;
+
+		std::vector<CountingTask> a_tasks(8);
+		std::vector<IThreadedTask *> a_ptrs;
+		for (CountingTask &task : a_tasks) {
+			a_ptrs.push_back(&task);
+		}
+		a_tasks[5].cancelled = cancel_one_dependency;
+
+		// Next tasks are owned by trackers until they get scheduled
+		CountingTask *c_task = ZN_NEW(CountingTask);
+		FixedArray<IThreadedTask *, 2> d_ptrs;
+		d_ptrs[0] = ZN_NEW(CountingTask);
+		d_ptrs[1] = ZN_NEW(CountingTask);
+
+		std::shared_ptr<AsyncDependencyTracker> d_tracker =
+				make_shared_instance<AsyncDependencyTracker>(1, to_span(d_ptrs), schedule_next_tasks);
+		IThreadedTask *c_ptr = c_task;
+		std::shared_ptr<AsyncDependencyTracker> c_tracker = make_shared_instance<AsyncDependencyTracker>(
+				a_ptrs.size(), Span<IThreadedTask *>(&c_ptr, 1), d_tracker, schedule_tracked_next_tasks);
+
+		runner.enqueue(to_span(a_ptrs), c_tracker);
+		c_tracker = nullptr;
+
+		if (cancel_one_dependency) {
+			std::vector<IThreadedTask *> completed_tasks;
+			dequeue_all(runner, completed_tasks, a_tasks.size());
+			ZYLANN_TEST_ASSERT(completed_tasks.size() == a_tasks.size());
+			// Following tasks were destroyed with the tracker, and the abortion went down the chain
+			ZYLANN_TEST_ASSERT(d_tracker->is_aborted());
+			d_tracker = nullptr;
+
+		} else {
+			std::vector<IThreadedTask *> completed_tasks;
+			dequeue_all(runner, completed_tasks, a_tasks.size() + 1 + d_ptrs.size());
+			ZYLANN_TEST_ASSERT(completed_tasks.size() == a_tasks.size() + 1 + d_ptrs.size());
+			ZYLANN_TEST_ASSERT(d_tracker->is_complete());
+
+			const CountingTask &d0 = *static_cast<CountingTask *>(d_ptrs[0]);
+			const CountingTask &d1 = *static_cast<CountingTask *>(d_ptrs[1]);
+			ZYLANN_TEST_ASSERT(c_task->run_count == 1);
+			ZYLANN_TEST_ASSERT(d0.run_count == 1);
+			ZYLANN_TEST_ASSERT(d1.run_count == 1);
+			for (const CountingTask &task : a_tasks) {
+				ZYLANN_TEST_ASSERT(task.run_sequence < c_task->run_sequence);
+			}
+			ZYLANN_TEST_ASSERT(c_task->run_sequence < d0.run_sequence);
+			ZYLANN_TEST_ASSERT(c_task->run_sequence < d1.run_sequence);
+
+			ZN_DELETE(c_task);
+			ZN_DELETE(d_ptrs[0]);
+			ZN_DELETE(d_ptrs[1]);
+		}
+
+		g_graph_test_runner = nullptr;
+	}
+
+	// Every CPU belongs to one NUMA node, and affinity doesn't prevent tasks from running, even with a node mask
+	// matching no node
+	{
+		const unsigned int node_count = Thread::get_numa_node_count();
+		ZYLANN_TEST_ASSERT(node_count >= 1);
+		ZYLANN_TEST_ASSERT(Thread::get_current_numa_node() < node_count);
+		std::vector<uint32_t> cpus;
+		Thread::get_numa_node_cpus(0, cpus);
+		ZYLANN_TEST_ASSERT(cpus.size() > 0);
+
+		const uint32_t node_masks[] = { 0, 1, 0x80000000 };
+		for (unsigned int mode = 0; mode < ThreadedTaskRunner::AFFINITY_MODE_COUNT; ++mode) {
+			for (const uint32_t node_mask : node_masks) {
+				std::vector<CountingTask> tasks(64);
+				std::vector<IThreadedTask *> task_ptrs;
+				for (CountingTask &task : tasks) {
+					task_ptrs.push_back(&task);
+				}
+
+				ThreadedTaskRunner runner;
+				runner.set_name("TestAffinityPool");
+				runner.set_affinity(ThreadedTaskRunner::AffinityMode(mode), node_mask);
+				runner.set_thread_count(3);
+				runner.enqueue(to_span(task_ptrs));
+
+				std::vector<IThreadedTask *> completed_tasks;
+				dequeue_all(runner, completed_tasks, tasks.size());
+				ZYLANN_TEST_ASSERT(completed_tasks.size() == tasks.size());
+				for (const CountingTask &task : tasks) {
+					ZYLANN_TEST_ASSERT(task.run_count == 1);
+				}
+			}
+		}
+	}
+}
+
+namespace {
+
+// Mimics the work done by the engine for each block: generate voxels, then build a mesh from them
+class GenerateAndMeshTask : public IThreadedTask {
+public:
+	Vector3i origin;
+	unsigned int vertex_count = 0;
+
+	void run(ThreadedTaskContext ctx) override {
+		static const int BLOCK_SIZE = 16;
+		// Meshers need one voxel of padding on the negative sides and two on the positive sides
+		static const int PADDED_SIZE = BLOCK_SIZE + 3;
+		static thread_local VoxelBufferInternal tls_voxels;
+		static thread_local transvoxel::Cache tls_cache;
+		static thread_local transvoxel::MeshArrays tls_mesh_arrays;
+
+		VoxelBufferInternal &voxels = tls_voxels;
+		voxels.create(Vector3iUtil::create(PADDED_SIZE));
+		voxels.set_channel_depth(VoxelBufferInternal::CHANNEL_SDF, VoxelBufferInternal::DEPTH_16_BIT);
+		voxels.decompress_channel(VoxelBufferInternal::CHANNEL_SDF);
+
+		Vector3i rpos;
+		for (rpos.z = 0; rpos.z < PADDED_SIZE; ++rpos.z) {
+			for (rpos.x = 0; rpos.x < PADDED_SIZE; ++rpos.x) {
+				for (rpos.y = 0; rpos.y < PADDED_SIZE; ++rpos.y) {
+					const Vector3i pos = origin + rpos;
+					const float height = 4.f * Math::sin(pos.x * 0.31f) * Math::cos(pos.z * 0.27f);
+					voxels.set_voxel_f((pos.y - height) * 0.1f, rpos, VoxelBufferInternal::CHANNEL_SDF);
+				}
+			}
+		}
+
+		tls_mesh_arrays.clear();
+		transvoxel::build_regular_mesh(voxels, VoxelBufferInternal::CHANNEL_SDF, 0, transvoxel::TEXTURES_NONE,
+				tls_cache, tls_mesh_arrays, nullptr);
+		vertex_count = tls_mesh_arrays.vertices.size();
+	}
+
+	void apply_result() override {}
+};
+
+} // namespace
+
+void test_threaded_task_runner_benchmark() {
+	// Measures how throughput scales with the number of threads
+	const unsigned int max_thread_count = math::max(Thread::get_hardware_concurrency(), 1u);
+	const int blocks_per_side = 12;
+
+	std::vector<unsigned int> thread_counts;
+	for (unsigned int thread_count = 1; thread_count < max_thread_count; thread_count *= 2) {
+		thread_counts.push_back(thread_count);
+	}
+	thread_counts.push_back(max_thread_count);
+
+	uint64_t single_thread_time = 0;
+
+	for (const unsigned int thread_count : thread_counts) {
+		// Blocks are laid out on a flat area around the surface
+		std::vector<GenerateAndMeshTask> tasks(blocks_per_side * blocks_per_side * 2);
+		std::vector<IThreadedTask *> task_ptrs;
+		for (unsigned int i = 0; i < tasks.size(); ++i) {
+			GenerateAndMeshTask &task = tasks[i];
+			const int x = i % blocks_per_side;
+			const int z = (i / blocks_per_side) % blocks_per_side;
+			const int y = int(i / (blocks_per_side * blocks_per_side)) - 1;
+			task.origin = Vector3i(x, y, z) * 16;
+			task_ptrs.push_back(&task);
+		}
+
+		ThreadedTaskRunner runner;
+		runner.set_thread_count(thread_count);
+
+		ProfilingClock profiling_clock;
+
+		runner.enqueue(to_span(task_ptrs));
+		std::vector<IThreadedTask *> completed_tasks;
+		dequeue_all(runner, completed_tasks, tasks.size());
+
+		const uint64_t time_spent = profiling_clock.restart();
+		ZYLANN_TEST_ASSERT(completed_tasks.size() == tasks.size());
+
+		unsigned int vertex_count = 0;
+		for (const GenerateAndMeshTask &task : tasks) {
+			vertex_count += task.vertex_count;
+		}
+		ZYLANN_TEST_ASSERT(vertex_count > 0);
+
+		if (thread_count == 1) {
+			single_thread_time = time_spent;
+		}
+		const double tasks_per_second = time_spent > 0 ? 1000000.0 * double(tasks.size()) / double(time_spent) : 0.0;
+		const double speedup = time_spent > 0 ? double(single_thread_time) / double(time_spent) : 0.0;
+
+		print_line(String("ThreadedTaskRunner with {0} threads: {1} us, {2} tasks/s, speedup: {3}, vertices: {4}")
+						   .format(varray(thread_count, time_spent, tasks_per_second, speedup, vertex_count)));
+	}
+}
+
+} // namespace zylann::voxel::tests
@@ -0,0 +1,12 @@
+#ifndef TEST_THREADED_TASK_RUNNER_H
+#define TEST_THREADED_TASK_RUNNER_H
+
+namespace zylann::voxel::tests {
+
+void test_threaded_task_runner();
+void test_threaded_task_runner_lod_priorities();
+void test_threaded_task_runner_benchmark();
+
+} // namespace zylann::voxel::tests
+
+#endif // TEST_THREADED_TASK_RUNNER_H
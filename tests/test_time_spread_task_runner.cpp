@@ -0,0 +1,117 @@
+#include "test_time_spread_task_runner.h"
+#include "../util/memory.h"
+#include "../util/tasks/time_spread_task_runner.h"
+#include "../util/thread/thread.h"
+#include "testing.h"
+
+#include <vector>
+
+namespace zylann::voxel::tests {
+
+namespace {
+
+class RecordingTask : public ITimeSpreadTask {
+public:
+	// Receives the ID of the task when it runs
+	std::vector<int> *run_order = nullptr;
+	int id = 0;
+	uint32_t sleep_usec = 0;
+	// How many times the task asks to run again
+	unsigned int postpone_count = 0;
+
+	void run(TimeSpreadTaskContext &ctx) override {
+		if (run_order != nullptr) {
+			run_order->push_back(id);
+		}
+		if (sleep_usec > 0) {
+			Thread::sleep_usec(sleep_usec);
+		}
+		if (postpone_count > 0) {
+			--postpone_count;
+			ctx.postpone = true;
+		}
+	}
+};
+
+RecordingTask *create_task(std::vector<int> *run_order, int id, uint32_t sleep_usec) {
+	RecordingTask *task = ZN_NEW(RecordingTask);
+	task->run_order = run_order;
+	task->id = id;
+	task->sleep_usec = sleep_usec;
+	return task;
+}
+
+} // namespace
+
+void test_time_spread_task_runner() {
+	const uint64_t large_budget_usec = 1000000;
+
+	// Tasks with the lowest priority run first, in the order they were pushed when equal
+	{
+		std::vector<int> run_order;
+		TimeSpreadTaskRunner runner;
+		const int priorities[] = { 5, 1, 3, 1 };
+		for (unsigned int i = 0; i < 4; ++i) {
+			runner.push(create_task(&run_order, i, 0), 0, priorities[i]);
+		}
+		runner.process(large_budget_usec);
+		ZYLANN_TEST_ASSERT(run_order.size() == 4);
+		ZYLANN_TEST_ASSERT(run_order[0] == 1);
+		ZYLANN_TEST_ASSERT(run_order[1] == 3);
+		ZYLANN_TEST_ASSERT(run_order[2] == 2);
+		ZYLANN_TEST_ASSERT(run_order[3] == 0);
+	}
+
+	// Each kind having tasks runs at least one of them, even when the budget is exceeded
+	{
+		TimeSpreadTaskRunner runner;
+		for (unsigned int i = 0; i < 3; ++i) {
+			runner.push(create_task(nullptr, i, 2000), 0);
+			runner.push(create_task(nullptr, i, 2000), 2);
+		}
+		runner.process(1);
+		ZYLANN_TEST_ASSERT(runner.get_kind_stats(0).processed_count == 1);
+		ZYLANN_TEST_ASSERT(runner.get_kind_stats(1).processed_count == 0);
+		ZYLANN_TEST_ASSERT(runner.get_kind_stats(2).processed_count == 1);
+		ZYLANN_TEST_ASSERT(runner.get_kind_stats(2).pending_count == 2);
+		ZYLANN_TEST_ASSERT(runner.get_kind_stats(2).average_cost_usec >= 2000.f);
+		runner.flush();
+		ZYLANN_TEST_ASSERT(runner.get_pending_count() == 0);
+	}
+
+	// The budget is shared according to ratios
+	{
+		TimeSpreadTaskRunner runner;
+		runner.set_kind_budget_ratio(0, 3.f);
+		runner.set_kind_budget_ratio(1, 1.f);
+		for (unsigned int i = 0; i < 100; ++i) {
+			runner.push(create_task(nullptr, i, 1000), 0);
+			runner.push(create_task(nullptr, i, 1000), 1);
+		}
+		runner.process(80000);
+		const TimeSpreadTaskRunner::KindStats stats0 = runner.get_kind_stats(0);
+		const TimeSpreadTaskRunner::KindStats stats1 = runner.get_kind_stats(1);
+		ZYLANN_TEST_ASSERT(stats0.budget_usec == 60000);
+		ZYLANN_TEST_ASSERT(stats1.budget_usec == 20000);
+		ZYLANN_TEST_ASSERT(stats0.processed_count > stats1.processed_count);
+		runner.flush();
+	}
+
+	// Postponed tasks run again in the next call, not in the same one
+	{
+		std::vector<int> run_order;
+		TimeSpreadTaskRunner runner;
+		RecordingTask *task = create_task(&run_order, 0, 0);
+		task->postpone_count = 2;
+		runner.push(task, 1);
+		runner.process(large_budget_usec);
+		ZYLANN_TEST_ASSERT(run_order.size() == 1);
+		ZYLANN_TEST_ASSERT(runner.get_pending_count() == 1);
+		runner.process(large_budget_usec);
+		runner.process(large_budget_usec);
+		ZYLANN_TEST_ASSERT(run_order.size() == 3);
+		ZYLANN_TEST_ASSERT(runner.get_pending_count() == 0);
+	}
+}
+
+} // namespace zylann::voxel::tests
@@ -0,0 +1,10 @@
+#ifndef TEST_TIME_SPREAD_TASK_RUNNER_H
+#define TEST_TIME_SPREAD_TASK_RUNNER_H
+
+namespace zylann::voxel::tests {
+
+void test_time_spread_task_runner();
+
+} // namespace zylann::voxel::tests
+
+#endif // TEST_TIME_SPREAD_TASK_RUNNER_H
@@ -0,0 +1,163 @@
+#include "test_voxel_downscale.h"
+#include "../storage/funcs.h"
+#include "../storage/voxel_downscale.h"
+#include "testing.h"
+
+namespace zylann::voxel::tests {
+
+namespace {
+
+DownscaleFilters make_filters(unsigned int channel_index, DownscaleFilter filter) {
+	DownscaleFilters filters = get_default_downscale_filters();
+	filters[channel_index] = filter;
+	return filters;
+}
+
+} // namespace
+
+void test_voxel_downscale_filters() {
+	const Vector3i size(8, 8, 8);
+	const Vector3i half_size = size / 2;
+	const unsigned int sdf_channel = VoxelBufferInternal::CHANNEL_SDF;
+	const unsigned int type_channel = VoxelBufferInternal::CHANNEL_TYPE;
+	const unsigned int indices_channel = VoxelBufferInternal::CHANNEL_INDICES;
+	const unsigned int weights_channel = VoxelBufferInternal::CHANNEL_WEIGHTS;
+
+	// SDF min keeps a one-voxel thick wall which nearest-neighbor misses
+	for (unsigned int depth_index = 0; depth_index < VoxelBufferInternal::DEPTH_COUNT; ++depth_index) {
+		const VoxelBufferInternal::Depth depth = VoxelBufferInternal::Depth(depth_index);
+		VoxelBufferInternal src;
+		src.create(size);
+		src.set_channel_depth(sdf_channel, depth);
+		src.clear_channel_f(sdf_channel, 0.5f);
+		src.fill_area_f(-0.5f, Vector3i(0, 0, 3), Vector3i(8, 8, 4), sdf_channel);
+
+		VoxelBufferInternal dst_nearest;
+		dst_nearest.create(half_size);
+		dst_nearest.set_channel_depth(sdf_channel, depth);
+		VoxelBufferInternal dst_min;
+		dst_min.create(half_size);
+		dst_min.set_channel_depth(sdf_channel, depth);
+
+		src.downscale_to(dst_nearest, Vector3i(), size, Vector3i());
+		downscale_voxels(src, dst_min, Vector3i(), size, Vector3i(), make_filters(sdf_channel, DOWNSCALE_SDF_MIN));
+
+		ZYLANN_TEST_ASSERT(dst_nearest.get_voxel_f(1, 1, 1, sdf_channel) > 0.f);
+		ZYLANN_TEST_ASSERT(dst_min.get_voxel_f(1, 1, 1, sdf_channel) < 0.f);
+		ZYLANN_TEST_ASSERT(dst_min.get_voxel_f(1, 1, 0, sdf_channel) > 0.f);
+		ZYLANN_TEST_ASSERT(dst_min.get_voxel_f(1, 1, 2, sdf_channel) > 0.f);
+	}
+
+	// Average, with signed SDF values
+	{
+		VoxelBufferInternal src;
+		src.create(size);
+		src.set_channel_depth(sdf_channel, VoxelBufferInternal::DEPTH_32_BIT);
+		src.clear_channel_f(sdf_channel, -1.f);
+		src.fill_area_f(1.f, Vector3i(0, 0, 0), Vector3i(2, 1, 2), sdf_channel);
+
+		VoxelBufferInternal dst;
+		dst.create(half_size);
+		dst.set_channel_depth(sdf_channel, VoxelBufferInternal::DEPTH_32_BIT);
+		downscale_voxels(src, dst, Vector3i(), size, Vector3i(), make_filters(sdf_channel, DOWNSCALE_AVERAGE));
+
+		ZYLANN_TEST_ASSERT(Math::is_equal_approx(dst.get_voxel_f(0, 0, 0, sdf_channel), 0.f));
+		ZYLANN_TEST_ASSERT(Math::is_equal_approx(dst.get_voxel_f(1, 1, 1, sdf_channel), -1.f));
+	}
+
+	// Majority, with ties going to the first voxel of each group
+	{
+		VoxelBufferInternal src;
+		src.create(size);
+		src.clear_channel(type_channel, 1);
+		src.fill_area(2, Vector3i(0, 0, 0), Vector3i(2, 2, 1), type_channel);
+		src.set_voxel(3, Vector3i(0, 0, 1), type_channel);
+		src.fill_area(5, Vector3i(2, 0, 0), Vector3i(4, 2, 1), type_channel);
+		src.fill_area(6, Vector3i(2, 0, 1), Vector3i(4, 2, 2), type_channel);
+
+		VoxelBufferInternal dst;
+		dst.create(half_size);
+		downscale_voxels(src, dst, Vector3i(), size, Vector3i(), make_filters(type_channel, DOWNSCALE_MAJORITY));
+
+		ZYLANN_TEST_ASSERT(dst.get_voxel(Vector3i(0, 0, 0), type_channel) == 2);
+		ZYLANN_TEST_ASSERT(dst.get_voxel(Vector3i(1, 0, 0), type_channel) == 5);
+		ZYLANN_TEST_ASSERT(dst.get_voxel(Vector3i(2, 2, 2), type_channel) == 1);
+	}
+
+	// Texture blend keeps the strongest textures of a group, with unique indices
+	{
+		VoxelBufferInternal src;
+		src.create(size);
+		src.set_channel_depth(indices_channel, VoxelBufferInternal::DEPTH_16_BIT);
+		src.set_channel_depth(weights_channel, VoxelBufferInternal::DEPTH_16_BIT);
+		src.clear_channel(indices_channel, encode_indices_to_packed_u16(0, 1, 2, 3));
+		src.clear_channel(weights_channel, encode_weights_to_packed_u16(240, 0, 0, 0));
+		// Half of the group uses texture 5, which is not in the indices of the first voxel
+		src.fill_area(encode_indices_to_packed_u16(5, 1, 2, 3), Vector3i(0, 0, 0), Vector3i(2, 2, 1), indices_channel);
+
+		VoxelBufferInternal dst;
+		dst.create(half_size);
+		dst.set_channel_depth(indices_channel, VoxelBufferInternal::DEPTH_16_BIT);
+		dst.set_channel_depth(weights_channel, VoxelBufferInternal::DEPTH_16_BIT);
+		// The filter of the weights channel is ignored
+		DownscaleFilters filters = make_filters(indices_channel, DOWNSCALE_TEXTURE_BLEND);
+		filters[weights_channel] = DOWNSCALE_MAJORITY;
+		downscale_voxels(src, dst, Vector3i(), size, Vector3i(), filters);
+
+		const FixedArray<uint8_t, 4> indices =
+				decode_indices_from_packed_u16(dst.get_voxel(Vector3i(0, 0, 0), indices_channel));
+		const FixedArray<uint8_t, 4> weights =
+				decode_weights_from_packed_u16(dst.get_voxel(Vector3i(0, 0, 0), weights_channel));
+		debug_check_texture_indices(indices);
+		unsigned int weight_0 = 0;
+		unsigned int weight_5 = 0;
+		unsigned int weight_sum = 0;
+		for (unsigned int i = 0; i < indices.size(); ++i) {
+			if (indices[i] == 0) {
+				weight_0 = weights[i];
+			} else if (indices[i] == 5) {
+				weight_5 = weights[i];
+			}
+			weight_sum += weights[i];
+		}
+		ZYLANN_TEST_ASSERT(weight_0 == 112 || weight_0 == 128);
+		ZYLANN_TEST_ASSERT(weight_5 == 112 || weight_5 == 128);
+		ZYLANN_TEST_ASSERT(weight_sum == 240);
+
+		// Groups of identical voxels are preserved
+		ZYLANN_TEST_ASSERT(
+				dst.get_voxel(Vector3i(2, 2, 2), indices_channel) == encode_indices_to_packed_u16(0, 1, 2, 3));
+		ZYLANN_TEST_ASSERT(
+				dst.get_voxel(Vector3i(2, 2, 2), weights_channel) == encode_weights_to_packed_u16(240, 0, 0, 0));
+	}
+
+	// Results can target a part of the destination
+	{
+		VoxelBufferInternal src;
+		src.create(size);
+		src.set_channel_depth(sdf_channel, VoxelBufferInternal::DEPTH_16_BIT);
+		Vector3i pos;
+		for (pos.z = 0; pos.z < size.z; ++pos.z) {
+			for (pos.x = 0; pos.x < size.x; ++pos.x) {
+				for (pos.y = 0; pos.y < size.y; ++pos.y) {
+					src.set_voxel_f(0.1f * (pos.y - 4) + 0.05f * (pos.x % 3), pos, sdf_channel);
+					src.set_voxel((pos.x * 7 + pos.y * 3 + pos.z) % 4, pos, type_channel);
+				}
+			}
+		}
+		DownscaleFilters filters = make_filters(sdf_channel, DOWNSCALE_SDF_MIN);
+		filters[type_channel] = DOWNSCALE_MAJORITY;
+
+		VoxelBufferInternal dst;
+		dst.create(size);
+		dst.set_channel_depth(sdf_channel, VoxelBufferInternal::DEPTH_16_BIT);
+		downscale_voxels(src, dst, Vector3i(), size, half_size, filters);
+
+		// Only the targeted corner changed
+		ZYLANN_TEST_ASSERT(
+				dst.get_voxel(Vector3i(0, 0, 0), sdf_channel) == dst.get_voxel(Vector3i(3, 3, 3), sdf_channel));
+		ZYLANN_TEST_ASSERT(dst.get_voxel_f(4, 4, 4, sdf_channel) < 0.f);
+	}
+}
+
+} // namespace zylann::voxel::tests
@@ -0,0 +1,10 @@
+#ifndef TEST_VOXEL_DOWNSCALE_H
+#define TEST_VOXEL_DOWNSCALE_H
+
+namespace zylann::voxel::tests {
+
+void test_voxel_downscale_filters();
+
+} // namespace zylann::voxel::tests
+
+#endif // TEST_VOXEL_DOWNSCALE_H
@@ -0,0 +1,200 @@
+#include "test_voxel_memory_pool.h"
+#include "../storage/voxel_memory_pool.h"
+#include "../util/fixed_array.h"
+#include "../util/profiling_clock.h"
+#include "../util/thread/thread.h"
+#include "testing.h"
+
+#include <core/string/print_string.h>
+
+namespace zylann::voxel::tests {
+
+namespace {
+
+struct MemoryPoolBenchmarkThread {
+	Thread thread;
+	unsigned int iterations = 0;
+	uint64_t checksum = 0;
+
+	// Mimics what threads do with voxel buffers: allocate a few channels of common sizes, use them, then recycle
+	// them. Sizes are not all powers of two, like padded blocks given to meshers.
+	static void run(void *userdata) {
+		MemoryPoolBenchmarkThread &self = *static_cast<MemoryPoolBenchmarkThread *>(userdata);
+		VoxelMemoryPool &pool = VoxelMemoryPool::get_singleton();
+
+		static const unsigned int BLOCK_COUNT = 8;
+		static const size_t sizes[BLOCK_COUNT] = {
+			16 * 16 * 16, //
+			16 * 16 * 16 * 2, //
+			18 * 18 * 18, //
+			18 * 18 * 18 * 2, //
+			32 * 32 * 32, //
+			34 * 34 * 34, //
+			8 * 8 * 8, //
+			256 //
+		};
+		FixedArray<uint8_t *, BLOCK_COUNT> blocks;
+
+		for (unsigned int iteration = 0; iteration < self.iterations; ++iteration) {
+			for (unsigned int i = 0; i < BLOCK_COUNT; ++i) {
+				uint8_t *block = pool.allocate(sizes[i]);
+				ZYLANN_TEST_ASSERT(block != nullptr);
+				// Touch the memory so the compiler can't optimize everything away
+				block[0] = iteration;
+				block[sizes[i] - 1] = i;
+				blocks[i] = block;
+			}
+			// Recycle in a different order than allocation
+			for (unsigned int i = 0; i < BLOCK_COUNT; ++i) {
+				const unsigned int j = (i * 3) % BLOCK_COUNT;
+				uint8_t *block = blocks[j];
+				self.checksum += block[0] + block[sizes[j] - 1];
+				pool.recycle(block, sizes[j]);
+			}
+		}
+	}
+};
+
+} // namespace
+
+void test_voxel_memory_pool_threads() {
+	// Allocates and recycles blocks from several threads at once, then checks they were all given back.
+	// This also prints throughput, to compare how well the pool scales with the number of threads.
+	VoxelMemoryPool &pool = VoxelMemoryPool::get_singleton();
+	const unsigned int initial_used_blocks = pool.debug_get_used_blocks();
+	const size_t initial_used_memory = pool.debug_get_used_memory();
+
+	static const unsigned int ITERATIONS_PER_THREAD = 20000;
+	static const unsigned int thread_counts[] = { 1, 4, 8 };
+
+	for (const unsigned int thread_count : thread_counts) {
+		FixedArray<MemoryPoolBenchmarkThread, 8> threads;
+
+		ProfilingClock profiling_clock;
+
+		for (unsigned int i = 0; i < thread_count; ++i) {
+			MemoryPoolBenchmarkThread &t = threads[i];
+			t.iterations = ITERATIONS_PER_THREAD;
+			t.thread.start(MemoryPoolBenchmarkThread::run, &t);
+		}
+		uint64_t checksum = 0;
+		for (unsigned int i = 0; i < thread_count; ++i) {
+			MemoryPoolBenchmarkThread &t = threads[i];
+			t.thread.wait_to_finish();
+			checksum += t.checksum;
+		}
+
+		const uint64_t time_spent = profiling_clock.restart();
+		// Each iteration does 8 allocations and 8 recycles
+		const uint64_t op_count = uint64_t(thread_count) * ITERATIONS_PER_THREAD * 16;
+		const double ops_per_second = time_spent > 0 ? 1000000.0 * double(op_count) / double(time_spent) : 0.0;
+
+		print_line(String("VoxelMemoryPool with {0} threads: {1} us, {2} ops/s, checksum: {3}")
+						   .format(varray(thread_count, time_spent, ops_per_second, checksum)));
+
+		ZYLANN_TEST_ASSERT(pool.debug_get_used_blocks() == initial_used_blocks);
+		ZYLANN_TEST_ASSERT(pool.debug_get_used_memory() == initial_used_memory);
+	}
+}
+
+void test_voxel_memory_pool_trim() {
+	// Using a separate pool so it doesn't interfere with the one used by the engine
+	VoxelMemoryPool pool;
+
+	// Large blocks are not cached per thread, so they go straight to the shared pool when recycled
+	static const unsigned int POT = 19;
+	static const size_t BLOCK_SIZE = size_t(1) << POT;
+	ZYLANN_TEST_ASSERT(BLOCK_SIZE * 2 > VoxelMemoryPool::MAGAZINE_MAX_BYTES);
+
+	FixedArray<uint8_t *, 10> blocks;
+	for (unsigned int i = 0; i < blocks.size(); ++i) {
+		blocks[i] = pool.allocate(BLOCK_SIZE);
+		ZYLANN_TEST_ASSERT(blocks[i] != nullptr);
+	}
+	for (unsigned int i = 0; i < blocks.size(); ++i) {
+		pool.recycle(blocks[i], BLOCK_SIZE);
+	}
+	{
+		const VoxelMemoryPool::Stats stats = pool.get_stats();
+		ZYLANN_TEST_ASSERT(stats.total_memory == blocks.size() * BLOCK_SIZE);
+		ZYLANN_TEST_ASSERT(stats.peak_total_memory == blocks.size() * BLOCK_SIZE);
+		ZYLANN_TEST_ASSERT(stats.used_memory == 0);
+		const VoxelMemoryPool::PoolStats &ps = stats.pools[POT];
+		ZYLANN_TEST_ASSERT(ps.misses == blocks.size());
+		ZYLANN_TEST_ASSERT(ps.hits == 0);
+		ZYLANN_TEST_ASSERT(ps.free_blocks == blocks.size());
+		ZYLANN_TEST_ASSERT(ps.peak_used_blocks == blocks.size());
+	}
+
+	// No budget, nothing is released
+	pool.trim();
+	ZYLANN_TEST_ASSERT(pool.get_stats().total_memory == blocks.size() * BLOCK_SIZE);
+
+	// Over the global budget, free blocks get released until usage is a bit lower than the budget
+	const size_t budget = 4 * BLOCK_SIZE;
+	pool.set_memory_budget(budget);
+	pool.trim();
+	{
+		const VoxelMemoryPool::Stats stats = pool.get_stats();
+		ZYLANN_TEST_ASSERT(stats.total_memory < budget);
+		ZYLANN_TEST_ASSERT(stats.total_memory == 3 * BLOCK_SIZE);
+		ZYLANN_TEST_ASSERT(stats.pools[POT].trimmed_blocks == 7);
+		ZYLANN_TEST_ASSERT(stats.pools[POT].free_blocks == 3);
+	}
+
+	// Reuse remaining blocks
+	for (unsigned int i = 0; i < 3; ++i) {
+		blocks[i] = pool.allocate(BLOCK_SIZE);
+	}
+	ZYLANN_TEST_ASSERT(pool.get_stats().pools[POT].hits == 3);
+
+	// Over the budget of this size class, recycled blocks are released immediately
+	pool.set_pool_memory_budget(POT, BLOCK_SIZE);
+	for (unsigned int i = 0; i < 3; ++i) {
+		pool.recycle(blocks[i], BLOCK_SIZE);
+	}
+	{
+		const VoxelMemoryPool::Stats stats = pool.get_stats();
+		ZYLANN_TEST_ASSERT(stats.total_memory == BLOCK_SIZE);
+		ZYLANN_TEST_ASSERT(stats.pools[POT].free_blocks == 1);
+		ZYLANN_TEST_ASSERT(stats.pools[POT].trimmed_blocks == 9);
+	}
+}
+
+void test_voxel_memory_pool_trim_thread_caches() {
+	VoxelMemoryPool pool;
+
+	// Small enough to be cached by threads
+	static const unsigned int POT = 12;
+	static const size_t BLOCK_SIZE = size_t(1) << POT;
+	ZYLANN_TEST_ASSERT(BLOCK_SIZE * 16 <= VoxelMemoryPool::MAGAZINE_MAX_BYTES);
+
+	uint8_t *other_block = pool.allocate(64);
+	ZYLANN_TEST_ASSERT(other_block != nullptr);
+
+	FixedArray<uint8_t *, 16> blocks;
+	for (unsigned int i = 0; i < blocks.size(); ++i) {
+		blocks[i] = pool.allocate(BLOCK_SIZE);
+		ZYLANN_TEST_ASSERT(blocks[i] != nullptr);
+	}
+	for (unsigned int i = 0; i < blocks.size(); ++i) {
+		pool.recycle(blocks[i], BLOCK_SIZE);
+	}
+	// Blocks are cached by this thread, the shared pool doesn't have them
+	ZYLANN_TEST_ASSERT(pool.get_stats().pools[POT].free_blocks == 0);
+
+	// The trim can't reach them
+	const size_t budget = 4 * BLOCK_SIZE;
+	pool.set_memory_budget(budget);
+	pool.trim();
+	ZYLANN_TEST_ASSERT(pool.get_stats().total_memory > budget);
+
+	// Using the pool again gives them back
+	pool.recycle(other_block, 64);
+	ZYLANN_TEST_ASSERT(pool.get_stats().pools[POT].free_blocks == blocks.size());
+
+	pool.trim();
+	ZYLANN_TEST_ASSERT(pool.get_stats().total_memory < budget);
+}
+
+} // namespace zylann::voxel::tests
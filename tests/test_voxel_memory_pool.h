@@ -0,0 +1,12 @@
+#ifndef TEST_VOXEL_MEMORY_POOL_H
+#define TEST_VOXEL_MEMORY_POOL_H
+
+namespace zylann::voxel::tests {
+
+void test_voxel_memory_pool_threads();
+void test_voxel_memory_pool_trim();
+void test_voxel_memory_pool_trim_thread_caches();
+
+} // namespace zylann::voxel::tests
+
+#endif // TEST_VOXEL_MEMORY_POOL_H
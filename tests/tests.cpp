@@ -4,23 +4,38 @@
 #include "../generators/graph/voxel_generator_graph.h"
 #include "../meshers/blocky/voxel_blocky_library.h"
 #include "../meshers/cubes/voxel_mesher_cubes.h"
+#include "../server/block_task_index.h"
+#include "../server/mesh_block_task.h"
 #include "../storage/voxel_buffer_gd.h"
 #include "../storage/voxel_data_map.h"
 #include "../storage/voxel_metadata_variant.h"
+#include "../streams/compressed_data.h"
 #include "../streams/instance_data.h"
 #include "../streams/region/region_file.h"
 #include "../streams/region/voxel_stream_region_files.h"
+#include "../streams/sqlite/voxel_stream_sqlite.h"
 #include "../streams/voxel_block_serializer.h"
 #include "../streams/voxel_block_serializer_gd.h"
+#include "../terrain/variable_lod/voxel_lod_terrain_update_task.h"
+#include "../thirdparty/sqlite/sqlite3.h"
 #include "../util/container_funcs.h"
 #include "../util/expression_parser.h"
 #include "../util/flat_map.h"
 #include "../util/godot/funcs.h"
 #include "../util/island_finder.h"
+#include "../util/log2_histogram.h"
 #include "../util/math/box3i.h"
 #include "../util/noise/fast_noise_lite/fast_noise_lite.h"
 #include "../util/string_funcs.h"
+#include "../util/thread/thread.h"
 #include "test_octree.h"
+#include "test_open_hash_map.h"
+#include "test_region_file.h"
+#include "test_simd_kernels.h"
+#include "test_threaded_task_runner.h"
+#include "test_time_spread_task_runner.h"
+#include "test_voxel_downscale.h"
+#include "test_voxel_memory_pool.h"
 #include "testing.h"
 
 #ifdef VOXEL_ENABLE_FAST_NOISE_2
@@ -29,9 +44,11 @@
 
 #include <core/io/dir_access.h>
 #include <core/io/stream_peer.h>
+#include <core/math/random_pcg.h>
 #include <core/string/print_string.h>
 #include <core/templates/hash_map.h>
 #include <modules/noise/fastnoise_lite.h>
+#include <unordered_map>
 
 namespace zylann::voxel::tests {
 
@@ -1129,6 +1146,518 @@ void test_voxel_buffer_create() {
 	generated_voxels.create(Vector3i(1, 16, 18));
 }
 
+void test_voxel_buffer_palette_compression() {
+	const unsigned int channel = VoxelBufferInternal::CHANNEL_TYPE;
+
+	// A few layers of blocks, like some typical blocky terrain
+	VoxelBufferInternal voxels;
+	voxels.create(Vector3i(16, 16, 16));
+	voxels.fill_area(1, Vector3i(0, 0, 0), Vector3i(16, 8, 16), channel);
+	voxels.fill_area(3, Vector3i(0, 8, 0), Vector3i(16, 10, 16), channel);
+	voxels.set_voxel(4, Vector3i(5, 12, 7), channel);
+
+	VoxelBufferInternal expected;
+	voxels.duplicate_to(expected, false);
+
+	voxels.compress_palette_channels();
+	ZYLANN_TEST_ASSERT(voxels.get_channel_compression(channel) == VoxelBufferInternal::COMPRESSION_PALETTE);
+	ZYLANN_TEST_ASSERT(voxels.equals(expected));
+	ZYLANN_TEST_ASSERT(voxels.is_uniform(channel) == false);
+
+	// Adding values widens the palette
+	for (int i = 0; i < 12; ++i) {
+		voxels.set_voxel(100 + i, Vector3i(i, 15, 0), channel);
+		expected.set_voxel(100 + i, Vector3i(i, 15, 0), channel);
+	}
+	ZYLANN_TEST_ASSERT(voxels.get_channel_compression(channel) == VoxelBufferInternal::COMPRESSION_PALETTE);
+	ZYLANN_TEST_ASSERT(voxels.equals(expected));
+
+	// Copying a region decodes voxels without decompressing the source
+	{
+		VoxelBufferInternal dst;
+		dst.create(Vector3i(10, 10, 10));
+		VoxelBufferInternal expected_dst;
+		expected_dst.create(Vector3i(10, 10, 10));
+		dst.copy_from(voxels, Vector3i(2, 5, 3), Vector3i(14, 13, 9), Vector3i(1, 1, 1), channel);
+		expected_dst.copy_from(expected, Vector3i(2, 5, 3), Vector3i(14, 13, 9), Vector3i(1, 1, 1), channel);
+		ZYLANN_TEST_ASSERT(dst.equals(expected_dst));
+		ZYLANN_TEST_ASSERT(voxels.get_channel_compression(channel) == VoxelBufferInternal::COMPRESSION_PALETTE);
+	}
+
+	// Serialization does not store palettes
+	{
+		BlockSerializer::SerializeResult result = BlockSerializer::serialize(voxels);
+		ZYLANN_TEST_ASSERT(result.success);
+		VoxelBufferInternal deserialized;
+		ZYLANN_TEST_ASSERT(BlockSerializer::deserialize(to_span_const(result.data), deserialized));
+		ZYLANN_TEST_ASSERT(deserialized.equals(expected));
+	}
+
+	// Too many distinct values falls back on dense storage
+	voxels.set_voxel(200, Vector3i(15, 15, 15), channel);
+	expected.set_voxel(200, Vector3i(15, 15, 15), channel);
+	ZYLANN_TEST_ASSERT(voxels.get_channel_compression(channel) == VoxelBufferInternal::COMPRESSION_NONE);
+	ZYLANN_TEST_ASSERT(voxels.equals(expected));
+
+	// Palette channels can become uniform
+	{
+		VoxelBufferInternal vb;
+		vb.create(Vector3i(7, 5, 3));
+		vb.set_voxel(9, Vector3i(6, 4, 2), channel);
+		vb.compress_palette_channels();
+		ZYLANN_TEST_ASSERT(vb.get_channel_compression(channel) == VoxelBufferInternal::COMPRESSION_PALETTE);
+		vb.set_voxel(0, Vector3i(6, 4, 2), channel);
+		ZYLANN_TEST_ASSERT(vb.is_uniform(channel));
+		vb.compress_uniform_channels();
+		ZYLANN_TEST_ASSERT(vb.get_channel_compression(channel) == VoxelBufferInternal::COMPRESSION_UNIFORM);
+		ZYLANN_TEST_ASSERT(vb.get_voxel(Vector3i(6, 4, 2), channel) == 0);
+	}
+}
+
+void test_voxel_buffer_sdf_quantization() {
+	const unsigned int channel = VoxelBufferInternal::CHANNEL_SDF;
+	const Vector3i size(16, 16, 16);
+	const float scale = VoxelBufferInternal::get_sdf_quantization_scale(VoxelBufferInternal::DEPTH_16_BIT);
+
+	// Slightly tilted ground
+	VoxelBufferInternal voxels;
+	voxels.create(size);
+	voxels.set_channel_depth(channel, VoxelBufferInternal::DEPTH_16_BIT);
+	Vector3i pos;
+	for (pos.z = 0; pos.z < size.z; ++pos.z) {
+		for (pos.x = 0; pos.x < size.x; ++pos.x) {
+			for (pos.y = 0; pos.y < size.y; ++pos.y) {
+				voxels.set_voxel_f((pos.y - 8.3f + 0.1f * pos.x) * scale, pos, channel);
+			}
+		}
+	}
+	VoxelBufferInternal expected;
+	voxels.duplicate_to(expected, false);
+
+	// The range of values is too large for this error bound
+	ZYLANN_TEST_ASSERT(voxels.compress_sdf_channel(0.01f) == false);
+	ZYLANN_TEST_ASSERT(voxels.get_channel_compression(channel) == VoxelBufferInternal::COMPRESSION_NONE);
+
+	const float max_error = 0.05f;
+	ZYLANN_TEST_ASSERT(voxels.compress_sdf_channel(max_error));
+	ZYLANN_TEST_ASSERT(voxels.get_channel_compression(channel) == VoxelBufferInternal::COMPRESSION_QUANTIZED);
+
+	// Values are decoded transparently, with a bounded error (plus the precision of 16-bit storage)
+	const float tolerance = max_error * scale + 1.f / 32767.f;
+	for (pos.z = 0; pos.z < size.z; ++pos.z) {
+		for (pos.x = 0; pos.x < size.x; ++pos.x) {
+			for (pos.y = 0; pos.y < size.y; ++pos.y) {
+				const float v = voxels.get_voxel_f(pos, channel);
+				const float ev = expected.get_voxel_f(pos, channel);
+				ZYLANN_TEST_ASSERT(Math::abs(v - ev) <= tolerance);
+				ZYLANN_TEST_ASSERT((v < 0.f) == (ev < 0.f));
+			}
+		}
+	}
+	{
+		float min_value;
+		float max_value;
+		float expected_min_value;
+		float expected_max_value;
+		voxels.get_range_f(min_value, max_value, VoxelBufferInternal::CHANNEL_SDF);
+		expected.get_range_f(expected_min_value, expected_max_value, VoxelBufferInternal::CHANNEL_SDF);
+		ZYLANN_TEST_ASSERT(Math::abs(min_value - expected_min_value) <= tolerance);
+		ZYLANN_TEST_ASSERT(Math::abs(max_value - expected_max_value) <= tolerance);
+	}
+
+	// Serialization keeps quantized values, and they take less space
+	{
+		BlockSerializer::SerializeResult expected_result = BlockSerializer::serialize(expected);
+		ZYLANN_TEST_ASSERT(expected_result.success);
+		const size_t expected_data_size = expected_result.data.size();
+
+		BlockSerializer::SerializeResult result = BlockSerializer::serialize(voxels);
+		ZYLANN_TEST_ASSERT(result.success);
+		// One byte per voxel instead of two, plus the range
+		ZYLANN_TEST_ASSERT(
+				result.data.size() + Vector3iUtil::get_volume(size) == expected_data_size + 2 * sizeof(float));
+
+		VoxelBufferInternal deserialized;
+		ZYLANN_TEST_ASSERT(BlockSerializer::deserialize(to_span_const(result.data), deserialized));
+		ZYLANN_TEST_ASSERT(
+				deserialized.get_channel_compression(channel) == VoxelBufferInternal::COMPRESSION_QUANTIZED);
+		ZYLANN_TEST_ASSERT(deserialized.equals(voxels));
+	}
+
+	// Copies remain quantized
+	{
+		VoxelBufferInternal copy;
+		copy.create(size);
+		copy.set_channel_depth(channel, VoxelBufferInternal::DEPTH_16_BIT);
+		copy.copy_from(voxels, channel);
+		ZYLANN_TEST_ASSERT(copy.get_channel_compression(channel) == VoxelBufferInternal::COMPRESSION_QUANTIZED);
+		ZYLANN_TEST_ASSERT(copy.equals(voxels));
+	}
+
+	// Editing falls back on dense storage
+	VoxelBufferInternal edited;
+	voxels.duplicate_to(edited, false);
+	edited.set_voxel_f(0.5f, Vector3i(1, 2, 3), channel);
+	ZYLANN_TEST_ASSERT(edited.get_channel_compression(channel) == VoxelBufferInternal::COMPRESSION_NONE);
+	ZYLANN_TEST_ASSERT(Math::abs(edited.get_voxel_f(Vector3i(1, 2, 3), channel) - 0.5f) <= 1.f / 32767.f);
+	ZYLANN_TEST_ASSERT(edited.get_voxel(Vector3i(4, 5, 6), channel) == voxels.get_voxel(Vector3i(4, 5, 6), channel));
+}
+
+void test_voxel_buffer_copy_on_write() {
+	const unsigned int channel = VoxelBufferInternal::CHANNEL_SDF;
+
+	VoxelBufferInternal voxels;
+	voxels.create(Vector3i(8, 9, 10));
+	voxels.fill_area(42, Vector3i(1, 2, 3), Vector3i(5, 5, 5), channel);
+	ZYLANN_TEST_ASSERT(voxels.get_channel_compression(channel) == VoxelBufferInternal::COMPRESSION_NONE);
+
+	VoxelBufferInternal snapshot;
+	voxels.duplicate_to(snapshot, false);
+	ZYLANN_TEST_ASSERT(snapshot.equals(voxels));
+
+	Span<uint8_t> data;
+	Span<uint8_t> snapshot_data;
+	ZYLANN_TEST_ASSERT(voxels.get_channel_raw(channel, data));
+	ZYLANN_TEST_ASSERT(snapshot.get_channel_raw(channel, snapshot_data));
+	// Dense data is shared until modified
+	ZYLANN_TEST_ASSERT(data.data() == snapshot_data.data());
+
+	// Modifying the source copies its data, the snapshot remains unchanged
+	const uint64_t old_value = voxels.get_voxel(Vector3i(2, 3, 4), channel);
+	voxels.set_voxel(43, Vector3i(2, 3, 4), channel);
+	ZYLANN_TEST_ASSERT(voxels.get_channel_raw(channel, data));
+	ZYLANN_TEST_ASSERT(data.data() != snapshot_data.data());
+	ZYLANN_TEST_ASSERT(voxels.get_voxel(Vector3i(2, 3, 4), channel) == 43);
+	ZYLANN_TEST_ASSERT(snapshot.get_voxel(Vector3i(2, 3, 4), channel) == old_value);
+
+	// Same when the snapshot is the one getting modified
+	{
+		VoxelBufferInternal snapshot2;
+		snapshot.duplicate_to(snapshot2, false);
+		snapshot2.fill_area(44, Vector3i(0, 0, 0), Vector3i(2, 2, 2), channel);
+		ZYLANN_TEST_ASSERT(snapshot2.get_voxel(Vector3i(1, 1, 1), channel) == 44);
+		ZYLANN_TEST_ASSERT(snapshot.get_voxel(Vector3i(1, 1, 1), channel) != 44);
+		ZYLANN_TEST_ASSERT(snapshot.get_voxel(Vector3i(2, 3, 4), channel) == old_value);
+	}
+
+	// Raw access after decompression must give data that can be written
+	{
+		VoxelBufferInternal snapshot3;
+		snapshot.duplicate_to(snapshot3, false);
+		snapshot3.decompress_channel(channel);
+		Span<uint8_t> snapshot3_data;
+		ZYLANN_TEST_ASSERT(snapshot3.get_channel_raw(channel, snapshot3_data));
+		ZYLANN_TEST_ASSERT(snapshot3_data.data() != snapshot_data.data());
+		const uint64_t first_value = snapshot.get_voxel(Vector3i(), channel);
+		snapshot3_data[0] = 0;
+		ZYLANN_TEST_ASSERT(snapshot3.get_voxel(Vector3i(), channel) != first_value);
+		ZYLANN_TEST_ASSERT(snapshot.get_voxel(Vector3i(), channel) == first_value);
+	}
+
+	// The last reference keeps data alive
+	voxels.clear();
+	ZYLANN_TEST_ASSERT(snapshot.get_voxel(Vector3i(2, 3, 4), channel) == old_value);
+	ZYLANN_TEST_ASSERT(snapshot.get_voxel(Vector3i(1, 2, 3), channel) == 42);
+}
+
+void test_voxel_data_map_uniform_block_sharing() {
+	const unsigned int channel = VoxelBufferInternal::CHANNEL_SDF;
+
+	VoxelDataMap map;
+	map.create(4, 0);
+	map.set_uniform_block_sharing_enabled(true);
+	const int block_size = map.get_block_size();
+
+	// Blocks with the same uniform voxels end up using the same buffer
+	for (int i = 0; i < 3; ++i) {
+		std::shared_ptr<VoxelBufferInternal> voxels = make_shared_instance<VoxelBufferInternal>();
+		voxels->create(Vector3iUtil::create(block_size));
+		voxels->clear_channel_f(channel, 1.f);
+		map.set_block_buffer(Vector3i(i, 0, 0), voxels, true);
+	}
+	// A block with different voxels doesn't share
+	{
+		std::shared_ptr<VoxelBufferInternal> voxels = make_shared_instance<VoxelBufferInternal>();
+		voxels->create(Vector3iUtil::create(block_size));
+		voxels->clear_channel_f(channel, -1.f);
+		map.set_block_buffer(Vector3i(3, 0, 0), voxels, true);
+	}
+	ZYLANN_TEST_ASSERT(map.get_shared_uniform_buffer_count() == 2);
+
+	const VoxelDataBlock *block0 = map.get_block(Vector3i(0, 0, 0));
+	const VoxelDataBlock *block1 = map.get_block(Vector3i(1, 0, 0));
+	const VoxelDataBlock *block3 = map.get_block(Vector3i(3, 0, 0));
+	ZYLANN_TEST_ASSERT(block0 != nullptr && block1 != nullptr && block3 != nullptr);
+	ZYLANN_TEST_ASSERT(block0->has_shared_voxels());
+	ZYLANN_TEST_ASSERT(block0->get_voxels_shared() == block1->get_voxels_shared());
+	ZYLANN_TEST_ASSERT(block0->get_voxels_shared() != block3->get_voxels_shared());
+
+	// Editing a block gives it its own voxels, other blocks remain unchanged
+	const Vector3i edit_pos(block_size + 1, 2, 3);
+	const float initial_value = map.get_voxel_f(edit_pos, channel);
+	map.set_voxel_f(-0.5f, edit_pos, channel);
+	ZYLANN_TEST_ASSERT(!block1->has_shared_voxels());
+	ZYLANN_TEST_ASSERT(block0->get_voxels_shared() != block1->get_voxels_shared());
+	ZYLANN_TEST_ASSERT(initial_value > 0.f);
+	ZYLANN_TEST_ASSERT(map.get_voxel_f(edit_pos, channel) < 0.f);
+	ZYLANN_TEST_ASSERT(map.get_voxel_f(edit_pos - Vector3i(block_size, 0, 0), channel) > 0.f);
+	ZYLANN_TEST_ASSERT(map.get_voxel_f(edit_pos + Vector3i(block_size, 0, 0), channel) > 0.f);
+
+	// Several threads can unshare the same block at once, like tasks editing while the map is locked for reading.
+	// They must all end up using the same copy.
+	{
+		struct UnshareThread {
+			Thread thread;
+			VoxelDataBlock *block = nullptr;
+			const VoxelBufferInternal *voxels = nullptr;
+
+			static void run(void *userdata) {
+				UnshareThread &self = *static_cast<UnshareThread *>(userdata);
+				self.voxels = &self.block->get_voxels();
+			}
+		};
+		VoxelDataBlock *block2 = map.get_block(Vector3i(2, 0, 0));
+		ZYLANN_TEST_ASSERT(block2 != nullptr && block2->has_shared_voxels());
+		FixedArray<UnshareThread, 4> threads;
+		for (unsigned int i = 0; i < threads.size(); ++i) {
+			threads[i].block = block2;
+			threads[i].thread.start(UnshareThread::run, &threads[i]);
+		}
+		for (unsigned int i = 0; i < threads.size(); ++i) {
+			threads[i].thread.wait_to_finish();
+		}
+		ZYLANN_TEST_ASSERT(!block2->has_shared_voxels());
+		ZYLANN_TEST_ASSERT(block2->get_voxels_shared() != block0->get_voxels_shared());
+		for (unsigned int i = 0; i < threads.size(); ++i) {
+			ZYLANN_TEST_ASSERT(threads[i].voxels == block2->get_voxels_shared().get());
+		}
+		ZYLANN_TEST_ASSERT(block0->has_shared_voxels());
+	}
+
+	// Non-uniform buffers are never shared
+	{
+		std::shared_ptr<VoxelBufferInternal> voxels = make_shared_instance<VoxelBufferInternal>();
+		voxels->create(Vector3iUtil::create(block_size));
+		voxels->set_voxel_f(0.5f, 1, 1, 1, channel);
+		map.set_block_buffer(Vector3i(4, 0, 0), voxels, true);
+		ZYLANN_TEST_ASSERT(!map.get_block(Vector3i(4, 0, 0))->has_shared_voxels());
+	}
+
+	map.clear();
+	ZYLANN_TEST_ASSERT(map.get_shared_uniform_buffer_count() == 0);
+}
+
+void test_voxel_lod_edits_with_shared_blocks() {
+	// Edits propagated to a lower LOD must not change other blocks sharing the same uniform voxels
+	const unsigned int channel = VoxelBufferInternal::CHANNEL_SDF;
+	VoxelDataLodMap data;
+	data.lod_count = 2;
+	for (unsigned int lod_index = 0; lod_index < data.lod_count; ++lod_index) {
+		data.lods[lod_index].map.create(4, lod_index);
+		data.lods[lod_index].map.set_uniform_block_sharing_enabled(true);
+	}
+	const int block_size = data.lods[0].map.get_block_size();
+
+	struct L {
+		static void set_uniform_block(VoxelDataMap &map, Vector3i bpos, float sdf) {
+			std::shared_ptr<VoxelBufferInternal> voxels = make_shared_instance<VoxelBufferInternal>();
+			voxels->create(Vector3iUtil::create(map.get_block_size()));
+			voxels->clear_channel_f(VoxelBufferInternal::CHANNEL_SDF, sdf);
+			map.set_block_buffer(bpos, voxels, true);
+		}
+	};
+
+	// Two uniform blocks in LOD1, and the children of the first one in LOD0
+	L::set_uniform_block(data.lods[1].map, Vector3i(0, 0, 0), 1.f);
+	L::set_uniform_block(data.lods[1].map, Vector3i(1, 0, 0), 1.f);
+	Vector3i bpos;
+	for (bpos.z = 0; bpos.z < 2; ++bpos.z) {
+		for (bpos.x = 0; bpos.x < 2; ++bpos.x) {
+			for (bpos.y = 0; bpos.y < 2; ++bpos.y) {
+				L::set_uniform_block(data.lods[0].map, bpos, 1.f);
+			}
+		}
+	}
+	const VoxelDataBlock *parent0 = data.lods[1].map.get_block(Vector3i(0, 0, 0));
+	const VoxelDataBlock *parent1 = data.lods[1].map.get_block(Vector3i(1, 0, 0));
+	ZYLANN_TEST_ASSERT(parent0 != nullptr && parent1 != nullptr);
+	ZYLANN_TEST_ASSERT(parent0->get_voxels_shared() == parent1->get_voxels_shared());
+
+	// Edit a child and propagate it
+	data.lods[0].map.set_voxel_f(-1.f, Vector3i(), channel);
+	VoxelDataBlock *child = data.lods[0].map.get_block(Vector3i());
+	ZYLANN_TEST_ASSERT(child != nullptr);
+	child->set_needs_lodding(true);
+	VoxelLodTerrainUpdateData::State state;
+	state.blocks_pending_lodding_lod0.push_back(Vector3i());
+	std::vector<VoxelLodTerrainUpdateData::BlockToSave> blocks_to_save;
+	VoxelLodTerrainUpdateTask::flush_pending_lod_edits(state, data, Ref<VoxelGenerator>(), false, block_size,
+			get_default_downscale_filters(), nullptr, blocks_to_save);
+	ZYLANN_TEST_ASSERT(blocks_to_save.size() == 0);
+
+	ZYLANN_TEST_ASSERT(!parent0->has_shared_voxels());
+	ZYLANN_TEST_ASSERT(parent0->get_voxels_const().get_voxel_f(Vector3i(), channel) < 0.f);
+	ZYLANN_TEST_ASSERT(parent1->has_shared_voxels());
+	ZYLANN_TEST_ASSERT(parent1->get_voxels_const().get_voxel_f(Vector3i(), channel) > 0.f);
+}
+
+void test_voxel_data_map_get_blocks_in_area() {
+	VoxelDataMap map;
+	map.create(4, 0);
+	const int block_size = map.get_block_size();
+
+	// Checkerboard of blocks, so some lookups find nothing. Enough blocks to need more than one batch.
+	const Box3i area(Vector3i(-3, -2, -4), Vector3i(7, 5, 6));
+	area.for_each_cell([&map, block_size](Vector3i bpos) {
+		if (((bpos.x + bpos.y + bpos.z) & 1) == 0) {
+			std::shared_ptr<VoxelBufferInternal> voxels = make_shared_instance<VoxelBufferInternal>();
+			voxels->create(Vector3iUtil::create(block_size));
+			map.set_block_buffer(bpos, voxels, true);
+		}
+	});
+
+	// Query an area partially outside of the one we filled
+	const Box3i query_box(Vector3i(-4, -3, -2), Vector3i(6, 5, 8));
+	std::vector<const VoxelDataBlock *> blocks;
+	blocks.resize(Vector3iUtil::get_volume(query_box.size));
+	map.get_blocks_in_area(query_box, to_span(blocks));
+
+	unsigned int i = 0;
+	query_box.for_each_cell_zxy([&map, &blocks, &i](Vector3i bpos) {
+		ZYLANN_TEST_ASSERT(blocks[i] == map.get_block(bpos));
+		++i;
+	});
+	ZYLANN_TEST_ASSERT(i == blocks.size());
+
+	// Surrounded blocks need all their neighbors, but not themselves
+	const Vector3i center(20, 20, 20);
+	Box3i(center - Vector3i(1, 1, 1), Vector3i(3, 3, 3)).for_each_cell([&map, block_size](Vector3i bpos) {
+		std::shared_ptr<VoxelBufferInternal> voxels = make_shared_instance<VoxelBufferInternal>();
+		voxels->create(Vector3iUtil::create(block_size));
+		map.set_block_buffer(bpos, voxels, true);
+	});
+	ZYLANN_TEST_ASSERT(map.is_block_surrounded(center));
+	map.remove_block(center, VoxelDataMap::NoAction());
+	ZYLANN_TEST_ASSERT(map.is_block_surrounded(center));
+	map.remove_block(center + Vector3i(1, 0, -1), VoxelDataMap::NoAction());
+	ZYLANN_TEST_ASSERT(!map.is_block_surrounded(center));
+	ZYLANN_TEST_ASSERT(!map.is_block_surrounded(Vector3i(0, 0, 0)));
+}
+
+void test_copy_block_and_neighbors_batch() {
+	// Gathering voxels of a region of mesh blocks at once must give the same voxels as gathering them for each block
+	const int block_size = 8;
+	const int min_padding = 1;
+	const int max_padding = 2;
+	const int region_size = 2;
+	const int edge_size = region_size + 2;
+	const int channels_mask = 1 << VoxelBufferInternal::CHANNEL_SDF;
+
+	RandomPCG rng;
+	rng.seed(131183);
+
+	std::vector<std::shared_ptr<VoxelBufferInternal>> blocks;
+	Box3i(Vector3i(), Vector3iUtil::create(edge_size)).for_each_cell_zxy([&blocks, &rng](Vector3i bpos) {
+		std::shared_ptr<VoxelBufferInternal> voxels = make_shared_instance<VoxelBufferInternal>();
+		voxels->create(Vector3iUtil::create(block_size));
+		Box3i(Vector3i(), voxels->get_size()).for_each_cell_zxy([&voxels, &rng](Vector3i pos) {
+			voxels->set_voxel_f(rng.randf() * 2.f - 1.f, pos, VoxelBufferInternal::CHANNEL_SDF);
+		});
+		blocks.push_back(voxels);
+	});
+
+	const Vector3i region_origin(-2, 4, 0);
+	VoxelBufferInternal region_voxels;
+	copy_block_and_neighbors(to_span(blocks), region_voxels, min_padding, max_padding, channels_mask,
+			Ref<VoxelGenerator>(), block_size, 0, region_origin * block_size);
+	ZYLANN_TEST_ASSERT(
+			region_voxels.get_size() == Vector3iUtil::create(region_size * block_size + min_padding + max_padding));
+
+	Box3i(Vector3i(), Vector3iUtil::create(region_size)).for_each_cell_zxy([&](Vector3i rpos) {
+		// Neighborhood of that block within the region's grid
+		FixedArray<std::shared_ptr<VoxelBufferInternal>, 3 * 3 * 3> nblocks;
+		unsigned int i = 0;
+		Box3i(rpos, Vector3i(3, 3, 3)).for_each_cell_zxy([&nblocks, &blocks, &i](Vector3i bpos) {
+			nblocks[i] = blocks[Vector3iUtil::get_zxy_index(bpos, Vector3iUtil::create(edge_size))];
+			++i;
+		});
+
+		VoxelBufferInternal block_voxels;
+		copy_block_and_neighbors(to_span(nblocks), block_voxels, min_padding, max_padding, channels_mask,
+				Ref<VoxelGenerator>(), block_size, 0, (region_origin + rpos) * block_size);
+
+		const Vector3i offset = rpos * block_size;
+		Box3i(Vector3i(), block_voxels.get_size()).for_each_cell_zxy([&](Vector3i pos) {
+			ZYLANN_TEST_ASSERT(block_voxels.get_voxel(pos, VoxelBufferInternal::CHANNEL_SDF) ==
+					region_voxels.get_voxel(pos + offset, VoxelBufferInternal::CHANNEL_SDF));
+		});
+	});
+}
+
+void test_block_task_index() {
+	BlockTaskIndex index;
+	const BlockTaskIndex::Key key_a{ 1, Vector3i(2, -3, 4), 0, BlockTaskIndex::TASK_MESH };
+	const BlockTaskIndex::Key key_b{ 1, Vector3i(2, -3, 4), 1, BlockTaskIndex::TASK_MESH };
+	const BlockTaskIndex::Key key_c{ 2, Vector3i(2, -3, 4), 0, BlockTaskIndex::TASK_MESH };
+
+	std::shared_ptr<BlockTaskIndex::Slot> a1 = index.add(key_a);
+	std::shared_ptr<BlockTaskIndex::Slot> b1 = index.add(key_b);
+	std::shared_ptr<BlockTaskIndex::Slot> c1 = index.add(key_c);
+	ZYLANN_TEST_ASSERT(!a1->superseded && !b1->superseded && !c1->superseded);
+
+	// A newer request only supersedes the one with the same key
+	std::shared_ptr<BlockTaskIndex::Slot> a2 = index.add(key_a);
+	ZYLANN_TEST_ASSERT(a1->superseded);
+	ZYLANN_TEST_ASSERT(!a2->superseded && !b1->superseded && !c1->superseded);
+	ZYLANN_TEST_ASSERT(index.get_superseded_count() == 1);
+
+	// Completing the superseded request must not forget the newer one
+	index.remove(key_a, a1);
+	std::shared_ptr<BlockTaskIndex::Slot> a3 = index.add(key_a);
+	ZYLANN_TEST_ASSERT(a2->superseded);
+	ZYLANN_TEST_ASSERT(index.get_superseded_count() == 2);
+
+	// Once completed, a new request has nothing to supersede
+	index.remove(key_a, a3);
+	std::shared_ptr<BlockTaskIndex::Slot> a4 = index.add(key_a);
+	ZYLANN_TEST_ASSERT(!a3->superseded);
+	ZYLANN_TEST_ASSERT(index.get_superseded_count() == 2);
+}
+
+void test_log2_histogram() {
+	ZYLANN_TEST_ASSERT(Log2Histogram::get_bucket_index(0) == 0);
+	ZYLANN_TEST_ASSERT(Log2Histogram::get_bucket_index(1) == 1);
+	ZYLANN_TEST_ASSERT(Log2Histogram::get_bucket_index(2) == 2);
+	ZYLANN_TEST_ASSERT(Log2Histogram::get_bucket_index(3) == 2);
+	ZYLANN_TEST_ASSERT(Log2Histogram::get_bucket_index(1000) == 10);
+	ZYLANN_TEST_ASSERT(Log2Histogram::get_bucket_index(0xffffffffffffffff) == Log2Histogram::BUCKET_COUNT - 1);
+
+	Log2Histogram histogram;
+	ZYLANN_TEST_ASSERT(histogram.get_snapshot().get_percentile(0.5f) == 0);
+
+	// 90 small values and 10 large ones
+	for (unsigned int i = 0; i < 90; ++i) {
+		histogram.add(5);
+	}
+	for (unsigned int i = 0; i < 10; ++i) {
+		histogram.add(1000);
+	}
+	const Log2Histogram::Snapshot s = histogram.get_snapshot();
+	ZYLANN_TEST_ASSERT(s.count == 100);
+	ZYLANN_TEST_ASSERT(s.sum == 90 * 5 + 10 * 1000);
+	ZYLANN_TEST_ASSERT(s.max == 1000);
+	ZYLANN_TEST_ASSERT(Math::is_equal_approx(s.get_mean(), 104.5f));
+	// Percentiles are rounded up to the end of their bucket, but never exceed the maximum
+	ZYLANN_TEST_ASSERT(s.get_percentile(0.5f) == 7);
+	ZYLANN_TEST_ASSERT(s.get_percentile(0.9f) == 7);
+	ZYLANN_TEST_ASSERT(s.get_percentile(0.95f) == 1000);
+	ZYLANN_TEST_ASSERT(s.get_percentile(1.f) == 1000);
+
+	histogram.reset();
+	ZYLANN_TEST_ASSERT(histogram.get_snapshot().count == 0);
+	ZYLANN_TEST_ASSERT(histogram.get_snapshot().max == 0);
+}
+
 void test_block_serializer() {
 	// Create an example buffer
 	const Vector3i block_size(8, 9, 10);
@@ -1153,6 +1682,12 @@ void test_block_serializer() {
 
 		// Must be equal
 		ZYLANN_TEST_ASSERT(voxel_buffer.equals(deserialized_voxel_buffer));
+
+		// Blocks saved with version 4 must still load
+		data[0] = 4;
+		VoxelBufferInternal v4_voxel_buffer;
+		ZYLANN_TEST_ASSERT(BlockSerializer::deserialize(to_span_const(data), v4_voxel_buffer));
+		ZYLANN_TEST_ASSERT(voxel_buffer.equals(v4_voxel_buffer));
 	}
 	{
 		// Serialize
@@ -1208,6 +1743,62 @@ void test_block_serializer_stream_peer() {
 	ZYLANN_TEST_ASSERT(voxel_buffer2->get_buffer().equals(voxel_buffer->get_buffer()));
 }
 
+void test_block_serializer_zstd() {
+	// Blocks which look alike, so a dictionary can be trained from them
+	std::vector<VoxelBufferInternal> voxel_buffers;
+	voxel_buffers.resize(32);
+	std::vector<std::vector<uint8_t>> samples;
+	RandomPCG rng;
+	rng.seed(131183);
+	for (VoxelBufferInternal &voxel_buffer : voxel_buffers) {
+		voxel_buffer.create(Vector3i(16, 16, 16));
+		const int height = rng.rand() % 16;
+		voxel_buffer.fill_area(1, Vector3i(0, 0, 0), Vector3i(16, height, 16), 0);
+		for (int i = 0; i < 20; ++i) {
+			voxel_buffer.set_voxel(2 + rng.rand() % 3, rng.rand() % 16, rng.rand() % 16, rng.rand() % 16, 0);
+		}
+		BlockSerializer::SerializeResult result = BlockSerializer::serialize(voxel_buffer);
+		ZYLANN_TEST_ASSERT(result.success);
+		samples.push_back(result.data);
+	}
+
+	std::vector<uint8_t> dictionary_data;
+	ZYLANN_TEST_ASSERT(CompressedData::train_zstd_dictionary(samples, 4096, dictionary_data));
+	ZYLANN_TEST_ASSERT(dictionary_data.size() > 0 && dictionary_data.size() <= 4096);
+
+	CompressedData::Settings settings;
+	settings.compression = CompressedData::COMPRESSION_ZSTD;
+
+	for (int use_dictionary = 0; use_dictionary < 2; ++use_dictionary) {
+		if (use_dictionary == 1) {
+			settings.zstd_dictionary = CompressedData::ZstdDictionary::create(
+					to_span_const(dictionary_data), CompressedData::DEFAULT_ZSTD_LEVEL);
+			ZYLANN_TEST_ASSERT(settings.zstd_dictionary != nullptr);
+		}
+		for (const VoxelBufferInternal &voxel_buffer : voxel_buffers) {
+			BlockSerializer::SerializeResult result = BlockSerializer::serialize_and_compress(voxel_buffer, settings);
+			ZYLANN_TEST_ASSERT(result.success);
+			ZYLANN_TEST_ASSERT(result.data.size() > 0);
+			ZYLANN_TEST_ASSERT(result.data[0] == CompressedData::COMPRESSION_ZSTD);
+			const std::vector<uint8_t> data = result.data;
+
+			VoxelBufferInternal deserialized_voxel_buffer;
+			ZYLANN_TEST_ASSERT(BlockSerializer::decompress_and_deserialize(
+					to_span_const(data), deserialized_voxel_buffer, settings.zstd_dictionary.get()));
+			ZYLANN_TEST_ASSERT(voxel_buffer.equals(deserialized_voxel_buffer));
+		}
+	}
+
+	// Data compressed with a dictionary can't be decompressed without it
+	std::vector<uint8_t> compressed_data;
+	ZYLANN_TEST_ASSERT(CompressedData::compress(to_span_const(samples[0]), compressed_data, settings));
+	std::vector<uint8_t> decompressed_data;
+	ZYLANN_TEST_ASSERT(!CompressedData::decompress(to_span_const(compressed_data), decompressed_data, nullptr));
+	ZYLANN_TEST_ASSERT(CompressedData::decompress(
+			to_span_const(compressed_data), decompressed_data, settings.zstd_dictionary.get()));
+	ZYLANN_TEST_ASSERT(decompressed_data == samples[0]);
+}
+
 void test_region_file() {
 	const int block_size_po2 = 4;
 	const int block_size = 1 << block_size_po2;
@@ -1372,6 +1963,89 @@ void test_voxel_stream_region_files() {
 	}
 }
 
+void test_voxel_stream_sqlite_key_migration() {
+	const int block_size = 1 << constants::DEFAULT_BLOCK_SIZE_PO2;
+
+	zylann::testing::TestDirectory test_dir;
+	ZYLANN_TEST_ASSERT(test_dir.is_valid());
+	const String fpath = test_dir.get_path().plus_file("test_voxel_stream_sqlite_key_migration.sqlite");
+	const CharString fpath_utf8 = fpath.utf8();
+
+	const Vector3i positions[] = { Vector3i(0, 0, 0), Vector3i(1, 0, 0), Vector3i(-1, 2, -3), Vector3i(-40, -1, 35) };
+	const unsigned int position_count = 4;
+
+	// Blocks differ by their position, to check they don't get mixed up
+	std::vector<VoxelBufferInternal> buffers;
+	buffers.resize(position_count);
+	for (unsigned int i = 0; i < position_count; ++i) {
+		buffers[i].create(block_size, block_size, block_size);
+		buffers[i].fill_area(i + 1, Vector3i(0, 0, 0), Vector3i(i + 2, 4, 4), 0);
+	}
+
+	// Create a database of version 0, in which locations were encoded as `0LXXYYZZ`
+	{
+		sqlite3 *db = nullptr;
+		ZYLANN_TEST_ASSERT(sqlite3_open(fpath_utf8.get_data(), &db) == SQLITE_OK);
+		ZYLANN_TEST_ASSERT(sqlite3_exec(db,
+								   "CREATE TABLE meta (version INTEGER, block_size_po2 INTEGER);"
+								   "CREATE TABLE blocks (loc INTEGER PRIMARY KEY, vb BLOB, instances BLOB);"
+								   "CREATE TABLE channels (idx INTEGER PRIMARY KEY, depth INTEGER);"
+								   "INSERT INTO meta VALUES (0, 4);",
+								   nullptr, nullptr, nullptr) == SQLITE_OK);
+		sqlite3_stmt *statement = nullptr;
+		ZYLANN_TEST_ASSERT(
+				sqlite3_prepare_v2(db, "INSERT INTO blocks VALUES (?, ?, null)", -1, &statement, nullptr) == SQLITE_OK);
+		for (unsigned int i = 0; i < position_count; ++i) {
+			const Vector3i pos = positions[i];
+			const uint64_t loc = ((static_cast<uint64_t>(pos.x) & 0xffff) << 32) |
+					((static_cast<uint64_t>(pos.y) & 0xffff) << 16) | (static_cast<uint64_t>(pos.z) & 0xffff);
+			BlockSerializer::SerializeResult result = BlockSerializer::serialize_and_compress(buffers[i]);
+			ZYLANN_TEST_ASSERT(result.success);
+			sqlite3_reset(statement);
+			sqlite3_bind_int64(statement, 1, loc);
+			sqlite3_bind_blob(statement, 2, result.data.data(), result.data.size(), SQLITE_TRANSIENT);
+			ZYLANN_TEST_ASSERT(sqlite3_step(statement) == SQLITE_DONE);
+		}
+		sqlite3_finalize(statement);
+		sqlite3_close(db);
+	}
+
+	{
+		Ref<VoxelStreamSQLite> stream;
+		stream.instantiate();
+		stream->set_database_path(fpath);
+
+		// Load all blocks in one batch, in a different order, with one which doesn't exist
+		std::vector<VoxelBufferInternal> loaded_buffers;
+		loaded_buffers.resize(position_count + 1);
+		std::vector<VoxelStream::VoxelQueryData> queries;
+		for (unsigned int i = 0; i < loaded_buffers.size(); ++i) {
+			const Vector3i pos = i < position_count ? positions[position_count - i - 1] : Vector3i(2, 0, 0);
+			queries.push_back(VoxelStream::VoxelQueryData{
+					loaded_buffers[i], pos * block_size, 0, VoxelStream::RESULT_ERROR });
+		}
+		stream->load_voxel_blocks(to_span(queries));
+
+		for (unsigned int i = 0; i < position_count; ++i) {
+			ZYLANN_TEST_ASSERT(queries[i].result == VoxelStream::RESULT_BLOCK_FOUND);
+			ZYLANN_TEST_ASSERT(loaded_buffers[i].equals(buffers[position_count - i - 1]));
+		}
+		ZYLANN_TEST_ASSERT(queries[position_count].result == VoxelStream::RESULT_BLOCK_NOT_FOUND);
+	}
+
+	// The database was upgraded
+	{
+		sqlite3 *db = nullptr;
+		ZYLANN_TEST_ASSERT(sqlite3_open(fpath_utf8.get_data(), &db) == SQLITE_OK);
+		sqlite3_stmt *statement = nullptr;
+		ZYLANN_TEST_ASSERT(sqlite3_prepare_v2(db, "SELECT version FROM meta", -1, &statement, nullptr) == SQLITE_OK);
+		ZYLANN_TEST_ASSERT(sqlite3_step(statement) == SQLITE_ROW);
+		ZYLANN_TEST_ASSERT(sqlite3_column_int(statement, 0) == 1);
+		sqlite3_finalize(statement);
+		sqlite3_close(db);
+	}
+}
+
 #ifdef VOXEL_ENABLE_FAST_NOISE_2
 
 void test_fast_noise_2() {
@@ -2124,10 +2798,32 @@ void run_voxel_tests() {
 	VOXEL_TEST(test_octree_find_in_box);
 	VOXEL_TEST(test_get_curve_monotonic_sections);
 	VOXEL_TEST(test_voxel_buffer_create);
+	VOXEL_TEST(test_voxel_buffer_palette_compression);
+	VOXEL_TEST(test_voxel_buffer_sdf_quantization);
+	VOXEL_TEST(test_voxel_buffer_copy_on_write);
+	VOXEL_TEST(test_voxel_data_map_uniform_block_sharing);
+	VOXEL_TEST(test_voxel_lod_edits_with_shared_blocks);
+	VOXEL_TEST(test_voxel_data_map_get_blocks_in_area);
+	VOXEL_TEST(test_copy_block_and_neighbors_batch);
+	VOXEL_TEST(test_block_task_index);
+	VOXEL_TEST(test_log2_histogram);
+	VOXEL_TEST(test_voxel_memory_pool_trim);
+	VOXEL_TEST(test_voxel_memory_pool_trim_thread_caches);
+	VOXEL_TEST(test_open_hash_map);
+	VOXEL_TEST(test_simd_kernels);
+	VOXEL_TEST(test_voxel_buffer_downscale);
+	VOXEL_TEST(test_voxel_downscale_filters);
+	VOXEL_TEST(test_threaded_task_runner);
+	VOXEL_TEST(test_threaded_task_runner_lod_priorities);
+	VOXEL_TEST(test_time_spread_task_runner);
 	VOXEL_TEST(test_block_serializer);
 	VOXEL_TEST(test_block_serializer_stream_peer);
+	VOXEL_TEST(test_block_serializer_zstd);
 	VOXEL_TEST(test_region_file);
+	VOXEL_TEST(test_region_file_free_sectors);
+	VOXEL_TEST(test_region_file_mapping);
 	VOXEL_TEST(test_voxel_stream_region_files);
+	VOXEL_TEST(test_voxel_stream_sqlite_key_migration);
 #ifdef VOXEL_ENABLE_FAST_NOISE_2
 	VOXEL_TEST(test_fast_noise_2);
 #endif
@@ -2141,4 +2837,16 @@ void run_voxel_tests() {
 	print_line("------------ Voxel tests end -------------");
 }
 
+void run_voxel_benchmarks() {
+	print_line("------------ Voxel benchmarks begin -------------");
+
+	VOXEL_TEST(test_voxel_memory_pool_threads);
+	VOXEL_TEST(test_open_hash_map_benchmark);
+	VOXEL_TEST(test_simd_kernels_benchmark);
+	VOXEL_TEST(test_threaded_task_runner_benchmark);
+	VOXEL_TEST(test_region_file_save_benchmark);
+
+	print_line("------------ Voxel benchmarks end -------------");
+}
+
 } // namespace zylann::voxel::tests
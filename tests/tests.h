@@ -3,6 +3,9 @@
 
 namespace zylann::voxel::tests {
 void run_voxel_tests();
+// Measures performance of some parts of the engine. Not part of the tests, since they take longer and their results
+// depend on the machine.
+void run_voxel_benchmarks();
 } // namespace zylann::voxel::tests
 
 namespace zylann::voxel::noise_tests {
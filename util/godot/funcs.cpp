@@ -29,10 +29,10 @@ bool is_mesh_empty(const Mesh &mesh) {
 	return false;
 }
 
-// Faster version of Mesh::create_trimesh_shape()
+// Faster version of the triangle soup built by Mesh::create_trimesh_shape()
 // See https://github.com/Zylann/godot_voxel/issues/54
 //
-Ref<ConcavePolygonShape3D> create_concave_polygon_shape(Span<const Array> surfaces) {
+PackedVector3Array deindex_concave_polygon_faces(Span<const Array> surfaces) {
 	ZN_PROFILE_SCOPE();
 
 	PackedVector3Array face_points;
@@ -53,7 +53,7 @@ Ref<ConcavePolygonShape3D> create_concave_polygon_shape(Span<const Array> surfac
 	face_points.resize(face_points_size);
 
 	if (face_points_size < 3) {
-		return Ref<ConcavePolygonShape3D>();
+		return PackedVector3Array();
 	}
 
 	// Deindex surfaces into a single one
@@ -66,9 +66,9 @@ Ref<ConcavePolygonShape3D> create_concave_polygon_shape(Span<const Array> surfac
 		PackedVector3Array positions = surface_arrays[Mesh::ARRAY_VERTEX];
 		PackedInt32Array indices = surface_arrays[Mesh::ARRAY_INDEX];
 
-		ERR_FAIL_COND_V(positions.size() < 3, Ref<ConcavePolygonShape3D>());
-		ERR_FAIL_COND_V(indices.size() < 3, Ref<ConcavePolygonShape3D>());
-		ERR_FAIL_COND_V(indices.size() % 3 != 0, Ref<ConcavePolygonShape3D>());
+		ERR_FAIL_COND_V(positions.size() < 3, PackedVector3Array());
+		ERR_FAIL_COND_V(indices.size() < 3, PackedVector3Array());
+		ERR_FAIL_COND_V(indices.size() % 3 != 0, PackedVector3Array());
 
 		unsigned int face_points_count = face_points_offset + indices.size();
 
@@ -93,29 +93,23 @@ Ref<ConcavePolygonShape3D> create_concave_polygon_shape(Span<const Array> surfac
 		face_points_offset += indices.size();
 	}
 
-	Ref<ConcavePolygonShape3D> shape;
-	{
-		ZN_PROFILE_SCOPE_NAMED("Godot shape");
-		shape.instantiate();
-		shape->set_faces(face_points);
-	}
-	return shape;
+	return face_points;
 }
 
-Ref<ConcavePolygonShape3D> create_concave_polygon_shape(Span<const Vector3f> positions, Span<const int> indices) {
+PackedVector3Array deindex_concave_polygon_faces(Span<const Vector3f> positions, Span<const int> indices) {
 	ZN_PROFILE_SCOPE();
 
 	PackedVector3Array face_points;
 
 	if (indices.size() < 3) {
-		return Ref<ConcavePolygonShape3D>();
+		return PackedVector3Array();
 	}
 
 	face_points.resize(indices.size());
 
-	ERR_FAIL_COND_V(positions.size() < 3, Ref<ConcavePolygonShape3D>());
-	ERR_FAIL_COND_V(indices.size() < 3, Ref<ConcavePolygonShape3D>());
-	ERR_FAIL_COND_V(indices.size() % 3 != 0, Ref<ConcavePolygonShape3D>());
+	ERR_FAIL_COND_V(positions.size() < 3, PackedVector3Array());
+	ERR_FAIL_COND_V(indices.size() < 3, PackedVector3Array());
+	ERR_FAIL_COND_V(indices.size() % 3 != 0, PackedVector3Array());
 
 	// Deindex mesh
 	{
@@ -126,12 +120,19 @@ Ref<ConcavePolygonShape3D> create_concave_polygon_shape(Span<const Vector3f> pos
 		}
 	}
 
-	Ref<ConcavePolygonShape3D> shape;
-	{
-		ZN_PROFILE_SCOPE_NAMED("Godot shape");
-		shape.instantiate();
-		shape->set_faces(face_points);
+	return face_points;
+}
+
+Ref<ConcavePolygonShape3D> create_concave_polygon_shape(const PackedVector3Array &faces) {
+	ZN_PROFILE_SCOPE();
+
+	if (faces.size() < 3) {
+		return Ref<ConcavePolygonShape3D>();
 	}
+
+	Ref<ConcavePolygonShape3D> shape;
+	shape.instantiate();
+	shape->set_faces(faces);
 	return shape;
 }
 
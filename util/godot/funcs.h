@@ -21,8 +21,12 @@ namespace zylann {
 bool is_surface_triangulated(Array surface);
 bool is_mesh_empty(const Mesh &mesh);
 
-Ref<ConcavePolygonShape3D> create_concave_polygon_shape(Span<const Array> surfaces);
-Ref<ConcavePolygonShape3D> create_concave_polygon_shape(Span<const Vector3f> positions, Span<const int> indices);
+// Builds the triangle soup expected by `ConcavePolygonShape3D::set_faces`. Doesn't create any resource, so it can be
+// called from a thread.
+PackedVector3Array deindex_concave_polygon_faces(Span<const Array> surfaces);
+PackedVector3Array deindex_concave_polygon_faces(Span<const Vector3f> positions, Span<const int> indices);
+// Returns null if there are no faces.
+Ref<ConcavePolygonShape3D> create_concave_polygon_shape(const PackedVector3Array &faces);
 
 // This API can be confusing so I made a wrapper
 int get_visible_instance_count(const MultiMesh &mm);
@@ -0,0 +1,107 @@
+#ifndef ZN_LOG2_HISTOGRAM_H
+#define ZN_LOG2_HISTOGRAM_H
+
+#include "fixed_array.h"
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+namespace zylann {
+
+// Counts values into buckets of increasing powers of two. Adding a value only takes a few relaxed atomic operations,
+// so it can be fed from multiple threads and left on in release builds. Percentiles are approximate, they are
+// rounded up to the end of the bucket they fall in.
+class Log2Histogram {
+public:
+	// Bucket 0 counts zeros, bucket `i` counts values in [2^(i-1), 2^i). The last one also counts greater values.
+	static const unsigned int BUCKET_COUNT = 40;
+
+	struct Snapshot {
+		FixedArray<uint64_t, BUCKET_COUNT> buckets;
+		uint64_t count = 0;
+		uint64_t sum = 0;
+		uint64_t max = 0;
+
+		Snapshot() {
+			fill(buckets, uint64_t(0));
+		}
+
+		inline float get_mean() const {
+			return count == 0 ? 0.f : float(double(sum) / double(count));
+		}
+
+		// `ratio` is between 0 and 1
+		uint64_t get_percentile(float ratio) const {
+			if (count == 0) {
+				return 0;
+			}
+			// Nearest rank, starting from 1
+			uint64_t rank = std::ceil(double(ratio) * double(count));
+			if (rank == 0) {
+				rank = 1;
+			}
+			uint64_t cumulated = 0;
+			for (unsigned int i = 0; i < buckets.size(); ++i) {
+				cumulated += buckets[i];
+				if (cumulated >= rank) {
+					const uint64_t bucket_end = i == 0 ? 0 : (uint64_t(1) << i) - 1;
+					return bucket_end < max ? bucket_end : max;
+				}
+			}
+			return max;
+		}
+	};
+
+	Log2Histogram() {
+		reset();
+	}
+
+	static inline unsigned int get_bucket_index(uint64_t value) {
+		// Number of significant bits
+		unsigned int i = 0;
+		for (; value != 0 && i < BUCKET_COUNT - 1; value >>= 1) {
+			++i;
+		}
+		return i;
+	}
+
+	void add(uint64_t value) {
+		_buckets[get_bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+		_count.fetch_add(1, std::memory_order_relaxed);
+		_sum.fetch_add(value, std::memory_order_relaxed);
+		uint64_t prev_max = _max.load(std::memory_order_relaxed);
+		while (value > prev_max && !_max.compare_exchange_weak(prev_max, value, std::memory_order_relaxed)) {
+		}
+	}
+
+	// Values added concurrently may be partially accounted for
+	Snapshot get_snapshot() const {
+		Snapshot s;
+		for (unsigned int i = 0; i < _buckets.size(); ++i) {
+			s.buckets[i] = _buckets[i].load(std::memory_order_relaxed);
+		}
+		s.count = _count.load(std::memory_order_relaxed);
+		s.sum = _sum.load(std::memory_order_relaxed);
+		s.max = _max.load(std::memory_order_relaxed);
+		return s;
+	}
+
+	void reset() {
+		for (unsigned int i = 0; i < _buckets.size(); ++i) {
+			_buckets[i].store(0, std::memory_order_relaxed);
+		}
+		_count.store(0, std::memory_order_relaxed);
+		_sum.store(0, std::memory_order_relaxed);
+		_max.store(0, std::memory_order_relaxed);
+	}
+
+private:
+	FixedArray<std::atomic_uint64_t, BUCKET_COUNT> _buckets;
+	std::atomic_uint64_t _count;
+	std::atomic_uint64_t _sum;
+	std::atomic_uint64_t _max;
+};
+
+} // namespace zylann
+
+#endif // ZN_LOG2_HISTOGRAM_H
@@ -9,6 +9,13 @@
 
 #define ZN_ARRAY_LENGTH(a) (sizeof(a) / sizeof(a[0]))
 
+// Hints the CPU to start loading memory at the given address into cache, if the compiler supports it.
+#if defined(__GNUC__)
+#define ZN_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define ZN_PREFETCH(p)
+#endif
+
 // Godot does not define the TTR macro for translation of messages in release builds. However, there are some non-editor
 // code that can produce errors in this module, and we still want them to compile properly.
 #if defined(ZN_GODOT) && defined(TOOLS_ENABLED)
@@ -0,0 +1,109 @@
+#include "memory_mapped_file.h"
+
+#include <core/config/project_settings.h>
+#include <core/string/ustring.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace zylann {
+
+MemoryMappedFile::~MemoryMappedFile() {
+	close();
+}
+
+Error MemoryMappedFile::open(const String &fpath) {
+	close();
+
+	const String os_path = ProjectSettings::get_singleton()->globalize_path(fpath);
+
+#if defined(_WIN32)
+	const Char16String os_path_utf16 = os_path.utf16();
+	HANDLE file_handle = CreateFileW(reinterpret_cast<LPCWSTR>(os_path_utf16.get_data()), GENERIC_READ,
+			FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+			nullptr);
+	if (file_handle == INVALID_HANDLE_VALUE) {
+		const DWORD err = GetLastError();
+		return err == ERROR_FILE_NOT_FOUND || err == ERROR_PATH_NOT_FOUND ? ERR_FILE_NOT_FOUND : ERR_FILE_CANT_OPEN;
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0) {
+		// Empty files can't be mapped
+		CloseHandle(file_handle);
+		return ERR_FILE_CANT_READ;
+	}
+
+	HANDLE mapping_handle = CreateFileMappingW(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	// The mapping keeps a reference to the file
+	CloseHandle(file_handle);
+	if (mapping_handle == nullptr) {
+		return ERR_FILE_CANT_READ;
+	}
+
+	const void *p = MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+	// The view keeps a reference to the mapping
+	CloseHandle(mapping_handle);
+	if (p == nullptr) {
+		return ERR_FILE_CANT_READ;
+	}
+
+	_data = static_cast<const uint8_t *>(p);
+	_size = file_size.QuadPart;
+	return OK;
+
+#elif defined(__unix__) || defined(__APPLE__)
+	const CharString os_path_utf8 = os_path.utf8();
+	const int fd = ::open(os_path_utf8.get_data(), O_RDONLY);
+	if (fd == -1) {
+		return errno == ENOENT ? ERR_FILE_NOT_FOUND : ERR_FILE_CANT_OPEN;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		// Empty files can't be mapped
+		::close(fd);
+		return ERR_FILE_CANT_READ;
+	}
+
+	void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	// The mapping keeps a reference to the file
+	::close(fd);
+	if (p == MAP_FAILED) {
+		return ERR_FILE_CANT_READ;
+	}
+
+	_data = static_cast<const uint8_t *>(p);
+	_size = st.st_size;
+	return OK;
+
+#else
+	return ERR_UNAVAILABLE;
+#endif
+}
+
+void MemoryMappedFile::close() {
+	if (_data == nullptr) {
+		return;
+	}
+#if defined(_WIN32)
+	UnmapViewOfFile(_data);
+#elif defined(__unix__) || defined(__APPLE__)
+	munmap(const_cast<uint8_t *>(_data), _size);
+#endif
+	_data = nullptr;
+	_size = 0;
+}
+
+bool MemoryMappedFile::is_open() const {
+	return _data != nullptr;
+}
+
+} // namespace zylann
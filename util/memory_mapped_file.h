@@ -0,0 +1,40 @@
+#ifndef ZN_MEMORY_MAPPED_FILE_H
+#define ZN_MEMORY_MAPPED_FILE_H
+
+#include "non_copyable.h"
+#include "span.h"
+
+#include <core/error/error_list.h>
+#include <cstdint>
+
+class String;
+
+namespace zylann {
+
+// Maps a whole file in memory, read-only. Pages are loaded by the OS when they are first accessed, and are shared
+// with the OS file cache, so reading doesn't need system calls or copies. Multiple threads can read at the same time.
+//
+// The mapping has the size the file had when it was opened: writes done later within that size through other file
+// handles are visible, but it won't grow with the file. The file must not be truncated while it is mapped.
+class MemoryMappedFile : public NonCopyable {
+public:
+	~MemoryMappedFile();
+
+	// Only works with files the OS can open directly, such as under `user://`. Files inside a PCK can't be mapped.
+	// Returns `ERR_FILE_NOT_FOUND` if the file doesn't exist, and `ERR_UNAVAILABLE` if the platform is not supported.
+	Error open(const String &fpath);
+	void close();
+	bool is_open() const;
+
+	inline Span<const uint8_t> get_data() const {
+		return Span<const uint8_t>(_data, _size);
+	}
+
+private:
+	const uint8_t *_data = nullptr;
+	size_t _size = 0;
+};
+
+} // namespace zylann
+
+#endif // ZN_MEMORY_MAPPED_FILE_H
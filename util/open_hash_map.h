@@ -0,0 +1,341 @@
+#ifndef ZN_OPEN_HASH_MAP_H
+#define ZN_OPEN_HASH_MAP_H
+
+#include "errors.h"
+#include "log.h"
+#include "macros.h"
+#include "math/funcs.h"
+#include "math/vector3i.h"
+#include "span.h"
+#include <cstdint>
+#include <vector>
+
+namespace zylann {
+
+template <typename T>
+struct OpenHashMapDefaultHasher {
+	static inline uint64_t hash(const T &v) {
+		return std::hash<T>()(v);
+	}
+};
+
+template <>
+struct OpenHashMapDefaultHasher<Vector3i> {
+	static inline uint64_t hash(const Vector3i &v) {
+		// Only packs the low 21 bits of each coordinate, which is plenty for block positions. Mixing is done by the
+		// map with Fibonacci hashing, whose high bits depend on all bits of the key.
+		static const uint64_t MASK = (uint64_t(1) << 21) - 1;
+		return (static_cast<uint64_t>(v.x) & MASK) | ((static_cast<uint64_t>(v.y) & MASK) << 21) |
+				((static_cast<uint64_t>(v.z) & MASK) << 42);
+	}
+};
+
+// Associative container using open addressing with linear probing (Robin Hood), designed for fast lookups of small
+// keys such as block positions. Keys and values are stored inline in a single array, without any per-item
+// allocation. Removal uses backward-shifting, so it doesn't leave tombstones behind and doesn't degrade lookups over
+// time.
+// The address of keys and values is not stable: it can change after an insertion or a removal.
+// Values must be default-constructible and movable.
+template <typename K, typename T, typename Hasher_T = OpenHashMapDefaultHasher<K>>
+class OpenHashMap {
+public:
+	// Capacity is always a power of two
+	static const unsigned int MIN_CAPACITY = 16;
+
+	OpenHashMap() {}
+
+	OpenHashMap(const OpenHashMap &other) = default;
+	OpenHashMap(OpenHashMap &&other) = default;
+	OpenHashMap &operator=(const OpenHashMap &other) = default;
+	OpenHashMap &operator=(OpenHashMap &&other) = default;
+
+	inline unsigned int size() const {
+		return _size;
+	}
+
+	inline unsigned int get_capacity() const {
+		return _slots.size();
+	}
+
+	// Makes sure the given amount of items can be stored without having to resize the map.
+	void reserve(unsigned int count) {
+		const unsigned int capacity = get_capacity_for_count(count);
+		if (capacity > get_capacity()) {
+			rehash(capacity);
+		}
+	}
+
+	// Resizes internal storage to the given capacity, rounded up to the next power of two.
+	// The capacity cannot become too small to hold existing items. Can be used to shrink memory usage.
+	void rehash(unsigned int capacity) {
+		capacity = math::max(capacity, get_capacity_for_count(_size));
+		capacity = get_next_power_of_two(capacity);
+		if (capacity == get_capacity()) {
+			return;
+		}
+
+		std::vector<Slot> old_slots;
+		old_slots.swap(_slots);
+
+		_slots.resize(capacity);
+		_shift = 64 - get_po2(capacity);
+		_mask = capacity - 1;
+		_size = 0;
+
+		for (unsigned int i = 0; i < old_slots.size(); ++i) {
+			if (old_slots[i].distance != 0) {
+				Slot &slot = old_slots[i];
+				insert_new(slot.key, std::move(slot.value));
+			}
+		}
+	}
+
+	// Removes all items. Memory is kept allocated, see `rehash` or `clear_and_free` to release it.
+	void clear() {
+		if (_size == 0) {
+			return;
+		}
+		for (unsigned int i = 0; i < _slots.size(); ++i) {
+			if (_slots[i].distance != 0) {
+				_slots[i].distance = 0;
+				_slots[i].value = T();
+			}
+		}
+		_size = 0;
+	}
+
+	void clear_and_free() {
+		_slots = std::vector<Slot>();
+		_size = 0;
+		_shift = 64;
+		_mask = 0;
+	}
+
+	// If the key already exists, the item is not inserted and returns false.
+	// If insertion was successful, returns true.
+	bool insert(const K &key, T value) {
+		if (find_index(key) != NOT_FOUND) {
+			return false;
+		}
+		insert_new(key, std::move(value));
+		return true;
+	}
+
+	// If the key already exists, the item will replace the previous value.
+	T &insert_or_assign(const K &key, T value) {
+		const unsigned int i = find_index(key);
+		if (i != NOT_FOUND) {
+			_slots[i].value = std::move(value);
+			return _slots[i].value;
+		}
+		return _slots[insert_new(key, std::move(value))].value;
+	}
+
+	inline T *find(const K &key) {
+		const unsigned int i = find_index(key);
+		return i != NOT_FOUND ? &_slots[i].value : nullptr;
+	}
+
+	inline const T *find(const K &key) const {
+		const unsigned int i = find_index(key);
+		return i != NOT_FOUND ? &_slots[i].value : nullptr;
+	}
+
+	inline bool has(const K &key) const {
+		return find_index(key) != NOT_FOUND;
+	}
+
+	// Looks up several keys at once. `out_values` receives a pointer to the value of each key, or null if not found.
+	// This is faster than individual lookups when gathering many keys, such as neighbors of a block.
+	void find_many(Span<const K> keys, Span<T *> out_values) {
+		ZN_ASSERT_RETURN(keys.size() == out_values.size());
+		find_many_internal(keys, out_values.data());
+	}
+
+	void find_many(Span<const K> keys, Span<const T *> out_values) const {
+		ZN_ASSERT_RETURN(keys.size() == out_values.size());
+		// Values are not modified
+		find_many_internal(keys, const_cast<T **>(out_values.data()));
+	}
+
+	// Returns true if an item was removed.
+	bool erase(const K &key) {
+		unsigned int i = find_index(key);
+		if (i == NOT_FOUND) {
+			return false;
+		}
+		const unsigned int mask = _mask;
+		// Backward-shift following items, until we find an empty slot or an item already at its ideal position
+		unsigned int next = (i + 1) & mask;
+		while (_slots[next].distance > 1) {
+			_slots[i] = std::move(_slots[next]);
+			_slots[i].distance = _slots[next].distance - 1;
+			i = next;
+			next = (next + 1) & mask;
+		}
+		_slots[i].distance = 0;
+		_slots[i].value = T();
+		--_size;
+		return true;
+	}
+
+	// `void f(const K &key, T &value)`
+	template <typename F>
+	inline void for_each(F f) {
+		for (unsigned int i = 0; i < _slots.size(); ++i) {
+			if (_slots[i].distance != 0) {
+				Slot &slot = _slots[i];
+				f(slot.key, slot.value);
+			}
+		}
+	}
+
+	// `void f(const K &key, const T &value)`
+	template <typename F>
+	inline void for_each(F f) const {
+		for (unsigned int i = 0; i < _slots.size(); ++i) {
+			if (_slots[i].distance != 0) {
+				const Slot &slot = _slots[i];
+				f(slot.key, slot.value);
+			}
+		}
+	}
+
+private:
+	struct Slot {
+		K key;
+		T value;
+		// Distance from the ideal slot of the key, plus one. 0 means the slot is empty.
+		uint8_t distance = 0;
+	};
+
+	static const unsigned int NOT_FOUND = 0xffffffff;
+	// Distances are stored with an offset of 1, 0 meaning the slot is empty.
+	// If a probe gets that long, the hash function is very bad, and we force the map to grow.
+	static const unsigned int MAX_DISTANCE = 255;
+
+	static inline unsigned int get_capacity_for_count(unsigned int count) {
+		// Maximum load factor of 3/4. Robin Hood hashing would allow more, but probes get longer, and lookups of
+		// missing keys are common (neighbors of blocks at the edge of loaded areas)
+		return math::max(MIN_CAPACITY, count + count / 3 + 1);
+	}
+
+	static inline unsigned int get_next_power_of_two(unsigned int v) {
+		unsigned int p = MIN_CAPACITY;
+		while (p < v) {
+			p <<= 1;
+		}
+		return p;
+	}
+
+	static inline unsigned int get_po2(unsigned int v) {
+		unsigned int p = 0;
+		while ((1u << p) < v) {
+			++p;
+		}
+		return p;
+	}
+
+	inline unsigned int get_home_index(const K &key) const {
+		// Fibonacci hashing: keep the high bits, which are the best mixed
+		return static_cast<unsigned int>((Hasher_T::hash(key) * 0x9e3779b97f4a7c15ull) >> _shift);
+	}
+
+	inline unsigned int find_index_from(const K &key, unsigned int i) const {
+		const unsigned int mask = _mask;
+		// Robin Hood invariant: once we meet an item closer to its home than we are, the key cannot be further
+		for (unsigned int distance = 1; distance <= _slots[i].distance; ++distance) {
+			if (_slots[i].key == key) {
+				return i;
+			}
+			i = (i + 1) & mask;
+		}
+		return NOT_FOUND;
+	}
+
+	inline unsigned int find_index(const K &key) const {
+		if (_size == 0) {
+			return NOT_FOUND;
+		}
+		return find_index_from(key, get_home_index(key));
+	}
+
+	void find_many_internal(Span<const K> keys, T **out_values) const {
+		if (_size == 0) {
+			for (unsigned int i = 0; i < keys.size(); ++i) {
+				out_values[i] = nullptr;
+			}
+			return;
+		}
+		// Compute hashes of a whole batch and prefetch their slots first, so memory accesses can happen in parallel
+		// instead of waiting for each of them in turn. Then probe.
+		const unsigned int BATCH_SIZE = 64;
+		unsigned int home_indices[BATCH_SIZE];
+		for (unsigned int batch_begin = 0; batch_begin < keys.size(); batch_begin += BATCH_SIZE) {
+			const unsigned int batch_end = math::min(batch_begin + BATCH_SIZE, static_cast<unsigned int>(keys.size()));
+			for (unsigned int i = batch_begin; i < batch_end; ++i) {
+				const unsigned int home_index = get_home_index(keys[i]);
+				home_indices[i - batch_begin] = home_index;
+				ZN_PREFETCH(&_slots[home_index]);
+			}
+			for (unsigned int i = batch_begin; i < batch_end; ++i) {
+				const unsigned int si = find_index_from(keys[i], home_indices[i - batch_begin]);
+				out_values[i] = si != NOT_FOUND ? const_cast<T *>(&_slots[si].value) : nullptr;
+			}
+		}
+	}
+
+	// Assumes the key is not present. Returns the index where the item was placed.
+	unsigned int insert_new(const K &p_key, T value) {
+		if (get_capacity_for_count(_size + 1) > get_capacity()) {
+			rehash(get_capacity() * 2);
+		}
+		const unsigned int mask = _mask;
+		K key = p_key;
+		unsigned int i = get_home_index(key);
+		unsigned int distance = 1;
+		unsigned int inserted_index = NOT_FOUND;
+
+		while (true) {
+			if (_slots[i].distance == 0) {
+				_slots[i].key = key;
+				_slots[i].value = std::move(value);
+				_slots[i].distance = distance;
+				++_size;
+				return inserted_index != NOT_FOUND ? inserted_index : i;
+			}
+			if (_slots[i].distance < distance) {
+				// The item in this slot is closer to its home than the one we are placing: take its place
+				std::swap(_slots[i].key, key);
+				std::swap(_slots[i].value, value);
+				const unsigned int d = _slots[i].distance;
+				_slots[i].distance = distance;
+				distance = d;
+				if (inserted_index == NOT_FOUND) {
+					inserted_index = i;
+				}
+			}
+			i = (i + 1) & mask;
+			++distance;
+			if (distance == MAX_DISTANCE) {
+				// Very unlikely. Grow and start over with the item we are currently holding.
+				ZN_PRINT_VERBOSE("OpenHashMap probe too long, growing");
+				rehash(get_capacity() * 2);
+				const unsigned int index = insert_new(key, std::move(value));
+				// The item we wanted to insert may have moved
+				return inserted_index == NOT_FOUND ? index : find_index(p_key);
+			}
+		}
+	}
+
+	// Keys, values and probe distances are stored together so a lookup usually touches a single cache line
+	std::vector<Slot> _slots;
+	unsigned int _size = 0;
+	// Right shift turning a 64-bit hash into an index within capacity
+	unsigned int _shift = 64;
+	unsigned int _mask = 0;
+};
+
+} // namespace zylann
+
+#endif // ZN_OPEN_HASH_MAP_H
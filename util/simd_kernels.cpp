@@ -0,0 +1,710 @@
+#include "simd_kernels.h"
+#include "errors.h"
+#include "math/funcs.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+// SSE2 is part of the x86-64 baseline, so it can always be used there
+#define ZN_SIMD_X86_64
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+// Allows to use AVX2 instructions in specific functions, without compiling the whole engine with AVX2 enabled.
+// These functions must only be called after checking the CPU supports it.
+#define ZN_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+// MSVC allows intrinsics of any instruction set without flags
+#define ZN_TARGET_AVX2
+#endif
+
+namespace zylann::simd {
+
+namespace {
+
+Level detect_supported_level() {
+#ifdef ZN_SIMD_X86_64
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return LEVEL_SSE2;
+	}
+	__cpuid(info, 1);
+	const bool has_osxsave = (info[2] & (1 << 27)) != 0;
+	const bool has_avx = (info[2] & (1 << 28)) != 0;
+	// The OS must also save AVX registers on context switches
+	if (!has_osxsave || !has_avx || (_xgetbv(0) & 0x6) != 0x6) {
+		return LEVEL_SSE2;
+	}
+	__cpuidex(info, 7, 0);
+	const bool has_avx2 = (info[1] & (1 << 5)) != 0;
+	return has_avx2 ? LEVEL_AVX2 : LEVEL_SSE2;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") ? LEVEL_AVX2 : LEVEL_SSE2;
+#endif
+#else
+	return LEVEL_SCALAR;
+#endif
+}
+
+// If a kernel gets called during static initialization before these are set, they will be zero, so scalar code will
+// be used, which is still correct
+Level g_supported_level = detect_supported_level();
+Level g_level = g_supported_level;
+
+// Fills 32 bytes with repetitions of the given item
+template <typename T>
+inline void make_pattern(T v, uint8_t *pattern) {
+	static_assert(32 % sizeof(T) == 0, "Item size must divide pattern size");
+	for (unsigned int i = 0; i < 32; i += sizeof(T)) {
+		memcpy(pattern + i, &v, sizeof(T));
+	}
+}
+
+// Copies a row smaller than 16 bytes using as few accesses as possible. Accesses may overlap.
+inline void copy_small_row(uint8_t *dst, const uint8_t *src, size_t size) {
+	if (size >= 8) {
+		uint64_t a;
+		uint64_t b;
+		memcpy(&a, src, 8);
+		memcpy(&b, src + size - 8, 8);
+		memcpy(dst, &a, 8);
+		memcpy(dst + size - 8, &b, 8);
+	} else if (size >= 4) {
+		uint32_t a;
+		uint32_t b;
+		memcpy(&a, src, 4);
+		memcpy(&b, src + size - 4, 4);
+		memcpy(dst, &a, 4);
+		memcpy(dst + size - 4, &b, 4);
+	} else {
+		for (size_t i = 0; i < size; ++i) {
+			dst[i] = src[i];
+		}
+	}
+}
+
+namespace scalar {
+
+template <typename T>
+bool is_uniform(const T *items, size_t count) {
+	const T v = items[0];
+	for (size_t i = 1; i < count; ++i) {
+		if (items[i] != v) {
+			return false;
+		}
+	}
+	return true;
+}
+
+template <typename T>
+void fill(T *items, size_t count, T value) {
+	for (size_t i = 0; i < count; ++i) {
+		items[i] = value;
+	}
+}
+
+template <typename T>
+void get_range(const T *items, size_t count, T &out_min, T &out_max) {
+	T min_value = items[0];
+	T max_value = items[0];
+	for (size_t i = 1; i < count; ++i) {
+		const T v = items[i];
+		min_value = math::min(v, min_value);
+		max_value = math::max(v, max_value);
+	}
+	out_min = min_value;
+	out_max = max_value;
+}
+
+void copy_rows(uint8_t *dst, size_t dst_stride, const uint8_t *src, size_t src_stride, size_t row_size,
+		size_t row_count) {
+	for (size_t i = 0; i < row_count; ++i) {
+		memcpy(dst, src, row_size);
+		dst += dst_stride;
+		src += src_stride;
+	}
+}
+
+template <typename T>
+void decimate_2x(T *dst, const T *src, size_t dst_count) {
+	for (size_t i = 0; i < dst_count; ++i) {
+		dst[i] = src[i * 2];
+	}
+}
+
+} // namespace scalar
+
+#ifdef ZN_SIMD_X86_64
+
+namespace sse2 {
+
+// Item size must be a power of two up to 16, and `size` must be a multiple of it
+bool is_uniform_bytes(const uint8_t *data, size_t size, const uint8_t *pattern) {
+	const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern));
+	size_t i = 0;
+	for (; i + 64 <= size; i += 64) {
+		const __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i)), p);
+		const __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 16)), p);
+		const __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 32)), p);
+		const __m128i d = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 48)), p);
+		if (_mm_movemask_epi8(_mm_and_si128(_mm_and_si128(a, b), _mm_and_si128(c, d))) != 0xffff) {
+			return false;
+		}
+	}
+	for (; i + 16 <= size; i += 16) {
+		const __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i)), p);
+		if (_mm_movemask_epi8(a) != 0xffff) {
+			return false;
+		}
+	}
+	// The pattern repeats every 16 bytes
+	for (; i < size; ++i) {
+		if (data[i] != pattern[i & 15]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void fill_bytes(uint8_t *data, size_t size, const uint8_t *pattern) {
+	const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern));
+	size_t i = 0;
+	for (; i + 16 <= size; i += 16) {
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(data + i), p);
+	}
+	for (; i < size; ++i) {
+		data[i] = pattern[i & 15];
+	}
+}
+
+void get_range(const int8_t *items, size_t count, int8_t &out_min, int8_t &out_max) {
+	// There is no signed 8-bit min/max in SSE2. Flipping the sign bit maps signed order to unsigned order.
+	const __m128i bias = _mm_set1_epi8(-128);
+	__m128i vmin = _mm_xor_si128(_mm_set1_epi8(items[0]), bias);
+	__m128i vmax = vmin;
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		const __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(items + i)), bias);
+		vmin = _mm_min_epu8(vmin, v);
+		vmax = _mm_max_epu8(vmax, v);
+	}
+	alignas(16) int8_t mins[16];
+	alignas(16) int8_t maxs[16];
+	_mm_store_si128(reinterpret_cast<__m128i *>(mins), _mm_xor_si128(vmin, bias));
+	_mm_store_si128(reinterpret_cast<__m128i *>(maxs), _mm_xor_si128(vmax, bias));
+	int8_t min_value = mins[0];
+	int8_t max_value = maxs[0];
+	for (unsigned int j = 1; j < 16; ++j) {
+		min_value = math::min(mins[j], min_value);
+		max_value = math::max(maxs[j], max_value);
+	}
+	for (; i < count; ++i) {
+		min_value = math::min(items[i], min_value);
+		max_value = math::max(items[i], max_value);
+	}
+	out_min = min_value;
+	out_max = max_value;
+}
+
+void get_range(const int16_t *items, size_t count, int16_t &out_min, int16_t &out_max) {
+	__m128i vmin = _mm_set1_epi16(items[0]);
+	__m128i vmax = vmin;
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(items + i));
+		vmin = _mm_min_epi16(vmin, v);
+		vmax = _mm_max_epi16(vmax, v);
+	}
+	alignas(16) int16_t mins[8];
+	alignas(16) int16_t maxs[8];
+	_mm_store_si128(reinterpret_cast<__m128i *>(mins), vmin);
+	_mm_store_si128(reinterpret_cast<__m128i *>(maxs), vmax);
+	int16_t min_value = mins[0];
+	int16_t max_value = maxs[0];
+	for (unsigned int j = 1; j < 8; ++j) {
+		min_value = math::min(mins[j], min_value);
+		max_value = math::max(maxs[j], max_value);
+	}
+	for (; i < count; ++i) {
+		min_value = math::min(items[i], min_value);
+		max_value = math::max(items[i], max_value);
+	}
+	out_min = min_value;
+	out_max = max_value;
+}
+
+void get_range(const float *items, size_t count, float &out_min, float &out_max) {
+	__m128 vmin = _mm_set1_ps(items[0]);
+	__m128 vmax = vmin;
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		const __m128 v = _mm_loadu_ps(items + i);
+		vmin = _mm_min_ps(vmin, v);
+		vmax = _mm_max_ps(vmax, v);
+	}
+	alignas(16) float mins[4];
+	alignas(16) float maxs[4];
+	_mm_store_ps(mins, vmin);
+	_mm_store_ps(maxs, vmax);
+	float min_value = mins[0];
+	float max_value = maxs[0];
+	for (unsigned int j = 1; j < 4; ++j) {
+		min_value = math::min(mins[j], min_value);
+		max_value = math::max(maxs[j], max_value);
+	}
+	for (; i < count; ++i) {
+		min_value = math::min(items[i], min_value);
+		max_value = math::max(items[i], max_value);
+	}
+	out_min = min_value;
+	out_max = max_value;
+}
+
+void copy_rows(uint8_t *dst, size_t dst_stride, const uint8_t *src, size_t src_stride, size_t row_size,
+		size_t row_count) {
+	if (row_size < 16) {
+		for (size_t i = 0; i < row_count; ++i) {
+			copy_small_row(dst, src, row_size);
+			dst += dst_stride;
+			src += src_stride;
+		}
+	} else if (row_size <= 32) {
+		// Two possibly overlapping accesses cover the whole row
+		for (size_t i = 0; i < row_count; ++i) {
+			const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+			const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + row_size - 16));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), a);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + row_size - 16), b);
+			dst += dst_stride;
+			src += src_stride;
+		}
+	} else {
+		scalar::copy_rows(dst, dst_stride, src, src_stride, row_size, row_count);
+	}
+}
+
+void decimate_2x(uint8_t *dst, const uint8_t *src, size_t dst_count) {
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+	size_t i = 0;
+	for (; i + 16 <= dst_count; i += 16) {
+		const __m128i a = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 2)), mask);
+		const __m128i b = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 2 + 16)), mask);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packus_epi16(a, b));
+	}
+	scalar::decimate_2x(dst + i, src + i * 2, dst_count - i);
+}
+
+void decimate_2x(uint16_t *dst, const uint16_t *src, size_t dst_count) {
+	size_t i = 0;
+	for (; i + 8 <= dst_count; i += 8) {
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 2));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 2 + 8));
+		// There is no unsigned 32-bit pack in SSE2. Sign-extend low halves so the signed pack never saturates.
+		a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+		b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packs_epi32(a, b));
+	}
+	scalar::decimate_2x(dst + i, src + i * 2, dst_count - i);
+}
+
+void decimate_2x(uint32_t *dst, const uint32_t *src, size_t dst_count) {
+	size_t i = 0;
+	for (; i + 4 <= dst_count; i += 4) {
+		const __m128 a = _mm_loadu_ps(reinterpret_cast<const float *>(src + i * 2));
+		const __m128 b = _mm_loadu_ps(reinterpret_cast<const float *>(src + i * 2 + 4));
+		_mm_storeu_ps(reinterpret_cast<float *>(dst + i), _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+	}
+	scalar::decimate_2x(dst + i, src + i * 2, dst_count - i);
+}
+
+void decimate_2x(uint64_t *dst, const uint64_t *src, size_t dst_count) {
+	size_t i = 0;
+	for (; i + 2 <= dst_count; i += 2) {
+		const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 2));
+		const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 2 + 2));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_unpacklo_epi64(a, b));
+	}
+	scalar::decimate_2x(dst + i, src + i * 2, dst_count - i);
+}
+
+} // namespace sse2
+
+namespace avx2 {
+
+ZN_TARGET_AVX2 bool is_uniform_bytes(const uint8_t *data, size_t size, const uint8_t *pattern) {
+	const __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pattern));
+	size_t i = 0;
+	for (; i + 128 <= size; i += 128) {
+		const __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i)), p);
+		const __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + 32)), p);
+		const __m256i c = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + 64)), p);
+		const __m256i d = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + 96)), p);
+		if (_mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, d))) != -1) {
+			return false;
+		}
+	}
+	for (; i + 32 <= size; i += 32) {
+		const __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i)), p);
+		if (_mm256_movemask_epi8(a) != -1) {
+			return false;
+		}
+	}
+	for (; i < size; ++i) {
+		if (data[i] != pattern[i & 31]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+ZN_TARGET_AVX2 void fill_bytes(uint8_t *data, size_t size, const uint8_t *pattern) {
+	const __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pattern));
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32) {
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(data + i), p);
+	}
+	for (; i < size; ++i) {
+		data[i] = pattern[i & 31];
+	}
+}
+
+ZN_TARGET_AVX2 void get_range(const int8_t *items, size_t count, int8_t &out_min, int8_t &out_max) {
+	__m256i vmin = _mm256_set1_epi8(items[0]);
+	__m256i vmax = vmin;
+	size_t i = 0;
+	for (; i + 32 <= count; i += 32) {
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(items + i));
+		vmin = _mm256_min_epi8(vmin, v);
+		vmax = _mm256_max_epi8(vmax, v);
+	}
+	alignas(32) int8_t mins[32];
+	alignas(32) int8_t maxs[32];
+	_mm256_store_si256(reinterpret_cast<__m256i *>(mins), vmin);
+	_mm256_store_si256(reinterpret_cast<__m256i *>(maxs), vmax);
+	int8_t min_value = mins[0];
+	int8_t max_value = maxs[0];
+	for (unsigned int j = 1; j < 32; ++j) {
+		min_value = math::min(mins[j], min_value);
+		max_value = math::max(maxs[j], max_value);
+	}
+	for (; i < count; ++i) {
+		min_value = math::min(items[i], min_value);
+		max_value = math::max(items[i], max_value);
+	}
+	out_min = min_value;
+	out_max = max_value;
+}
+
+ZN_TARGET_AVX2 void get_range(const int16_t *items, size_t count, int16_t &out_min, int16_t &out_max) {
+	__m256i vmin = _mm256_set1_epi16(items[0]);
+	__m256i vmax = vmin;
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(items + i));
+		vmin = _mm256_min_epi16(vmin, v);
+		vmax = _mm256_max_epi16(vmax, v);
+	}
+	alignas(32) int16_t mins[16];
+	alignas(32) int16_t maxs[16];
+	_mm256_store_si256(reinterpret_cast<__m256i *>(mins), vmin);
+	_mm256_store_si256(reinterpret_cast<__m256i *>(maxs), vmax);
+	int16_t min_value = mins[0];
+	int16_t max_value = maxs[0];
+	for (unsigned int j = 1; j < 16; ++j) {
+		min_value = math::min(mins[j], min_value);
+		max_value = math::max(maxs[j], max_value);
+	}
+	for (; i < count; ++i) {
+		min_value = math::min(items[i], min_value);
+		max_value = math::max(items[i], max_value);
+	}
+	out_min = min_value;
+	out_max = max_value;
+}
+
+ZN_TARGET_AVX2 void get_range(const float *items, size_t count, float &out_min, float &out_max) {
+	__m256 vmin = _mm256_set1_ps(items[0]);
+	__m256 vmax = vmin;
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		const __m256 v = _mm256_loadu_ps(items + i);
+		vmin = _mm256_min_ps(vmin, v);
+		vmax = _mm256_max_ps(vmax, v);
+	}
+	alignas(32) float mins[8];
+	alignas(32) float maxs[8];
+	_mm256_store_ps(mins, vmin);
+	_mm256_store_ps(maxs, vmax);
+	float min_value = mins[0];
+	float max_value = maxs[0];
+	for (unsigned int j = 1; j < 8; ++j) {
+		min_value = math::min(mins[j], min_value);
+		max_value = math::max(maxs[j], max_value);
+	}
+	for (; i < count; ++i) {
+		min_value = math::min(items[i], min_value);
+		max_value = math::max(items[i], max_value);
+	}
+	out_min = min_value;
+	out_max = max_value;
+}
+
+ZN_TARGET_AVX2 void copy_rows(uint8_t *dst, size_t dst_stride, const uint8_t *src, size_t src_stride,
+		size_t row_size, size_t row_count) {
+	if (row_size > 32 && row_size <= 64) {
+		// Two possibly overlapping accesses cover the whole row
+		for (size_t i = 0; i < row_count; ++i) {
+			const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+			const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + row_size - 32));
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), a);
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + row_size - 32), b);
+			dst += dst_stride;
+			src += src_stride;
+		}
+	} else {
+		sse2::copy_rows(dst, dst_stride, src, src_stride, row_size, row_count);
+	}
+}
+
+// AVX2 packs and shuffles operate within each 128-bit lane, so results come out as [a0, b0, a1, b1] in 64-bit
+// quarters. This puts them back in order.
+#define ZN_AVX2_FIX_LANES(v) _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 1, 2, 0))
+
+ZN_TARGET_AVX2 void decimate_2x(uint8_t *dst, const uint8_t *src, size_t dst_count) {
+	const __m256i mask = _mm256_set1_epi16(0x00ff);
+	size_t i = 0;
+	for (; i + 32 <= dst_count; i += 32) {
+		const __m256i a =
+				_mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i * 2)), mask);
+		const __m256i b =
+				_mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i * 2 + 32)), mask);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), ZN_AVX2_FIX_LANES(_mm256_packus_epi16(a, b)));
+	}
+	sse2::decimate_2x(dst + i, src + i * 2, dst_count - i);
+}
+
+ZN_TARGET_AVX2 void decimate_2x(uint16_t *dst, const uint16_t *src, size_t dst_count) {
+	const __m256i mask = _mm256_set1_epi32(0x0000ffff);
+	size_t i = 0;
+	for (; i + 16 <= dst_count; i += 16) {
+		const __m256i a =
+				_mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i * 2)), mask);
+		const __m256i b =
+				_mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i * 2 + 16)), mask);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), ZN_AVX2_FIX_LANES(_mm256_packus_epi32(a, b)));
+	}
+	sse2::decimate_2x(dst + i, src + i * 2, dst_count - i);
+}
+
+ZN_TARGET_AVX2 void decimate_2x(uint32_t *dst, const uint32_t *src, size_t dst_count) {
+	size_t i = 0;
+	for (; i + 8 <= dst_count; i += 8) {
+		const __m256 a = _mm256_loadu_ps(reinterpret_cast<const float *>(src + i * 2));
+		const __m256 b = _mm256_loadu_ps(reinterpret_cast<const float *>(src + i * 2 + 8));
+		const __m256i r = _mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), ZN_AVX2_FIX_LANES(r));
+	}
+	sse2::decimate_2x(dst + i, src + i * 2, dst_count - i);
+}
+
+ZN_TARGET_AVX2 void decimate_2x(uint64_t *dst, const uint64_t *src, size_t dst_count) {
+	size_t i = 0;
+	for (; i + 4 <= dst_count; i += 4) {
+		const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i * 2));
+		const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i * 2 + 4));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), ZN_AVX2_FIX_LANES(_mm256_unpacklo_epi64(a, b)));
+	}
+	sse2::decimate_2x(dst + i, src + i * 2, dst_count - i);
+}
+
+#undef ZN_AVX2_FIX_LANES
+
+} // namespace avx2
+
+#endif // ZN_SIMD_X86_64
+
+template <typename T>
+inline bool is_uniform_t(Span<const T> items) {
+	if (items.size() <= 1) {
+		return true;
+	}
+#ifdef ZN_SIMD_X86_64
+	if (g_level >= LEVEL_SSE2) {
+		uint8_t pattern[32];
+		make_pattern(items[0], pattern);
+		const uint8_t *data = reinterpret_cast<const uint8_t *>(items.data());
+		const size_t size = items.size() * sizeof(T);
+		if (g_level == LEVEL_AVX2) {
+			return avx2::is_uniform_bytes(data, size, pattern);
+		}
+		return sse2::is_uniform_bytes(data, size, pattern);
+	}
+#endif
+	return scalar::is_uniform(items.data(), items.size());
+}
+
+template <typename T>
+inline void fill_t(Span<T> items, T value) {
+#ifdef ZN_SIMD_X86_64
+	if (g_level >= LEVEL_SSE2) {
+		uint8_t pattern[32];
+		make_pattern(value, pattern);
+		uint8_t *data = reinterpret_cast<uint8_t *>(items.data());
+		const size_t size = items.size() * sizeof(T);
+		if (g_level == LEVEL_AVX2) {
+			avx2::fill_bytes(data, size, pattern);
+		} else {
+			sse2::fill_bytes(data, size, pattern);
+		}
+		return;
+	}
+#endif
+	scalar::fill(items.data(), items.size(), value);
+}
+
+template <typename T>
+inline void get_range_t(Span<const T> items, T &out_min, T &out_max) {
+	if (items.size() == 0) {
+		return;
+	}
+#ifdef ZN_SIMD_X86_64
+	if (g_level == LEVEL_AVX2) {
+		avx2::get_range(items.data(), items.size(), out_min, out_max);
+		return;
+	}
+	if (g_level == LEVEL_SSE2) {
+		sse2::get_range(items.data(), items.size(), out_min, out_max);
+		return;
+	}
+#endif
+	scalar::get_range(items.data(), items.size(), out_min, out_max);
+}
+
+template <typename T>
+inline void decimate_2x_t(T *dst, const T *src, size_t dst_count) {
+#ifdef ZN_SIMD_X86_64
+	if (g_level == LEVEL_AVX2) {
+		avx2::decimate_2x(dst, src, dst_count);
+		return;
+	}
+	if (g_level == LEVEL_SSE2) {
+		sse2::decimate_2x(dst, src, dst_count);
+		return;
+	}
+#endif
+	scalar::decimate_2x(dst, src, dst_count);
+}
+
+} // namespace
+
+Level get_supported_level() {
+	return g_supported_level;
+}
+
+Level get_level() {
+	return g_level;
+}
+
+void set_level(Level level) {
+	ZN_ASSERT_RETURN(level >= LEVEL_SCALAR && level < LEVEL_COUNT);
+	g_level = math::min(level, g_supported_level);
+}
+
+const char *get_level_name(Level level) {
+	switch (level) {
+		case LEVEL_SCALAR:
+			return "Scalar";
+		case LEVEL_SSE2:
+			return "SSE2";
+		case LEVEL_AVX2:
+			return "AVX2";
+		default:
+			ZN_PRINT_ERROR("Unknown SIMD level");
+			return "Unknown";
+	}
+}
+
+bool is_uniform(Span<const uint8_t> items) {
+	return is_uniform_t(items);
+}
+
+bool is_uniform(Span<const uint16_t> items) {
+	return is_uniform_t(items);
+}
+
+bool is_uniform(Span<const uint32_t> items) {
+	return is_uniform_t(items);
+}
+
+bool is_uniform(Span<const uint64_t> items) {
+	return is_uniform_t(items);
+}
+
+void fill(Span<uint8_t> items, uint8_t value) {
+	// Compilers already turn this into vectorized code
+	memset(items.data(), value, items.size());
+}
+
+void fill(Span<uint16_t> items, uint16_t value) {
+	fill_t(items, value);
+}
+
+void fill(Span<uint32_t> items, uint32_t value) {
+	fill_t(items, value);
+}
+
+void fill(Span<uint64_t> items, uint64_t value) {
+	fill_t(items, value);
+}
+
+void get_range(Span<const int8_t> items, int8_t &out_min, int8_t &out_max) {
+	get_range_t(items, out_min, out_max);
+}
+
+void get_range(Span<const int16_t> items, int16_t &out_min, int16_t &out_max) {
+	get_range_t(items, out_min, out_max);
+}
+
+void get_range(Span<const float> items, float &out_min, float &out_max) {
+	get_range_t(items, out_min, out_max);
+}
+
+void copy_rows(uint8_t *dst, size_t dst_stride, const uint8_t *src, size_t src_stride, size_t row_size,
+		size_t row_count) {
+#ifdef ZN_SIMD_X86_64
+	if (g_level == LEVEL_AVX2) {
+		avx2::copy_rows(dst, dst_stride, src, src_stride, row_size, row_count);
+		return;
+	}
+	if (g_level == LEVEL_SSE2) {
+		sse2::copy_rows(dst, dst_stride, src, src_stride, row_size, row_count);
+		return;
+	}
+#endif
+	scalar::copy_rows(dst, dst_stride, src, src_stride, row_size, row_count);
+}
+
+void decimate_2x(uint8_t *dst, const uint8_t *src, size_t dst_count) {
+	decimate_2x_t(dst, src, dst_count);
+}
+
+void decimate_2x(uint16_t *dst, const uint16_t *src, size_t dst_count) {
+	decimate_2x_t(dst, src, dst_count);
+}
+
+void decimate_2x(uint32_t *dst, const uint32_t *src, size_t dst_count) {
+	decimate_2x_t(dst, src, dst_count);
+}
+
+void decimate_2x(uint64_t *dst, const uint64_t *src, size_t dst_count) {
+	decimate_2x_t(dst, src, dst_count);
+}
+
+} // namespace zylann::simd
@@ -0,0 +1,60 @@
+#ifndef ZN_SIMD_KERNELS_H
+#define ZN_SIMD_KERNELS_H
+
+#include "span.h"
+#include <cstddef>
+#include <cstdint>
+
+// Vectorized versions of bulk operations done on voxel data.
+// On x86-64, SSE2 is always available, and AVX2 is used if the CPU supports it. The choice is made at runtime, so
+// the engine doesn't have to be compiled with special flags. Other architectures use scalar code.
+namespace zylann::simd {
+
+enum Level {
+	LEVEL_SCALAR = 0,
+	LEVEL_SSE2,
+	LEVEL_AVX2,
+	LEVEL_COUNT
+};
+
+// Gets the best level supported by the CPU the program runs on.
+Level get_supported_level();
+Level get_level();
+// Forces kernels to use a lower level than the supported one. The level is clamped to what is supported.
+// This is meant for testing and benchmarking, and is not thread-safe.
+void set_level(Level level);
+const char *get_level_name(Level level);
+
+// Returns true if all items are equal.
+bool is_uniform(Span<const uint8_t> items);
+bool is_uniform(Span<const uint16_t> items);
+bool is_uniform(Span<const uint32_t> items);
+bool is_uniform(Span<const uint64_t> items);
+
+// Sets all items to the same value.
+void fill(Span<uint8_t> items, uint8_t value);
+void fill(Span<uint16_t> items, uint16_t value);
+void fill(Span<uint32_t> items, uint32_t value);
+void fill(Span<uint64_t> items, uint64_t value);
+
+// Gets the minimum and maximum of items. Does nothing if there are no items.
+// NaNs are not handled.
+void get_range(Span<const int8_t> items, int8_t &out_min, int8_t &out_max);
+void get_range(Span<const int16_t> items, int16_t &out_min, int16_t &out_max);
+void get_range(Span<const float> items, float &out_min, float &out_max);
+
+// Copies `row_count` rows of `row_size` bytes, each row starting `stride` bytes after the previous one.
+// Source and destination must not overlap. Faster than calling `memcpy` for each row when rows are short.
+void copy_rows(uint8_t *dst, size_t dst_stride, const uint8_t *src, size_t src_stride, size_t row_size,
+		size_t row_count);
+
+// Keeps one item out of two: `dst[i] = src[i * 2]`, for `i` in `[0..dst_count)`.
+// This is used to downscale a row of voxels by a factor of two using nearest-neighbor.
+void decimate_2x(uint8_t *dst, const uint8_t *src, size_t dst_count);
+void decimate_2x(uint16_t *dst, const uint16_t *src, size_t dst_count);
+void decimate_2x(uint32_t *dst, const uint32_t *src, size_t dst_count);
+void decimate_2x(uint64_t *dst, const uint64_t *src, size_t dst_count);
+
+} // namespace zylann::simd
+
+#endif // ZN_SIMD_KERNELS_H
@@ -11,7 +11,22 @@ AsyncDependencyTracker::AsyncDependencyTracker(
 		_count(initial_count), _aborted(false), _next_tasks_schedule_callback(scheduler_cb) {
 	//
 	ZN_ASSERT(scheduler_cb != nullptr);
+	set_next_tasks(next_tasks);
+}
 
+AsyncDependencyTracker::AsyncDependencyTracker(int initial_count, Span<IThreadedTask *> next_tasks,
+		std::shared_ptr<AsyncDependencyTracker> next_tracker, ScheduleTrackedNextTasksCallback scheduler_cb) :
+		_count(initial_count),
+		_aborted(false),
+		_next_tasks_tracker(next_tracker),
+		_tracked_next_tasks_schedule_callback(scheduler_cb) {
+	//
+	ZN_ASSERT(scheduler_cb != nullptr);
+	ZN_ASSERT(next_tracker != nullptr);
+	set_next_tasks(next_tasks);
+}
+
+void AsyncDependencyTracker::set_next_tasks(Span<IThreadedTask *> next_tasks) {
 	_next_tasks.resize(next_tasks.size());
 
 	for (unsigned int i = 0; i < next_tasks.size(); ++i) {
@@ -27,6 +42,10 @@ AsyncDependencyTracker::AsyncDependencyTracker(
 }
 
 AsyncDependencyTracker::~AsyncDependencyTracker() {
+	if (_next_tasks.size() > 0 && _next_tasks_tracker != nullptr) {
+		// Next tasks will never run, so whatever depends on them won't either
+		_next_tasks_tracker->abort();
+	}
 	for (auto it = _next_tasks.begin(); it != _next_tasks.end(); ++it) {
 		IThreadedTask *task = *it;
 		// TODO Might want to allow customizing that, maybe calling a `->dispose()` function instead?
@@ -37,10 +56,14 @@ AsyncDependencyTracker::~AsyncDependencyTracker() {
 void AsyncDependencyTracker::post_complete() {
 	ZN_ASSERT_RETURN_MSG(_count > 0, "post_complete() called more times than expected");
 	ZN_ASSERT_RETURN_MSG(_aborted == false, "post_complete() called after abortion");
-	--_count;
-	// Note, this class only allows decrementing this counter up to zero
-	if (_count == 0) {
-		_next_tasks_schedule_callback(to_span(_next_tasks));
+	// Note, this class only allows decrementing this counter up to zero.
+	// Testing the result of the decrement ensures only the last thread to complete schedules next tasks.
+	if (--_count == 0) {
+		if (_tracked_next_tasks_schedule_callback != nullptr) {
+			_tracked_next_tasks_schedule_callback(to_span(_next_tasks), _next_tasks_tracker);
+		} else if (_next_tasks_schedule_callback != nullptr) {
+			_next_tasks_schedule_callback(to_span(_next_tasks));
+		}
 		_next_tasks.clear();
 	}
 	// The idea of putting next tasks inside this class instead of the tasks directly,
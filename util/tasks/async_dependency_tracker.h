@@ -3,6 +3,7 @@
 
 #include "../span.h"
 #include <atomic>
+#include <memory>
 #include <vector>
 
 namespace zylann {
@@ -23,6 +24,15 @@ public:
 	// If a dependency is aborted, these tasks will be destroyed instead.
 	AsyncDependencyTracker(int initial_count, Span<IThreadedTask *> next_tasks, ScheduleNextTasksCallback scheduler_cb);
 
+	typedef void (*ScheduleTrackedNextTasksCallback)(
+			Span<IThreadedTask *> tasks, std::shared_ptr<AsyncDependencyTracker> tracker);
+
+	// Alternate constructor where the next tasks will themselves be tracked by `next_tracker`, which allows to build
+	// chains of tasks. The callback is expected to schedule them such that they notify `next_tracker` (see
+	// `ThreadedTaskRunner::enqueue`). If a dependency is aborted, `next_tracker` gets aborted too.
+	AsyncDependencyTracker(int initial_count, Span<IThreadedTask *> next_tasks,
+			std::shared_ptr<AsyncDependencyTracker> next_tracker, ScheduleTrackedNextTasksCallback scheduler_cb);
+
 	~AsyncDependencyTracker();
 
 	// Call this when one of the tracked dependencies is complete
@@ -53,10 +63,14 @@ public:
 	}
 
 private:
+	void set_next_tasks(Span<IThreadedTask *> next_tasks);
+
 	std::atomic_int _count;
 	std::atomic_bool _aborted;
 	std::vector<IThreadedTask *> _next_tasks;
 	ScheduleNextTasksCallback _next_tasks_schedule_callback = nullptr;
+	std::shared_ptr<AsyncDependencyTracker> _next_tasks_tracker;
+	ScheduleTrackedNextTasksCallback _tracked_next_tasks_schedule_callback = nullptr;
 };
 
 } // namespace zylann
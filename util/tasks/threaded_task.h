@@ -6,7 +6,7 @@
 namespace zylann {
 
 struct ThreadedTaskContext {
-	uint8_t thread_index;
+	uint32_t thread_index;
 };
 
 // Interface for a task that will run in `ThreadedTaskRunner`.
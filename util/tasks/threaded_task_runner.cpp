@@ -1,25 +1,47 @@
 #include "threaded_task_runner.h"
+#include "../math/funcs.h"
+#include "async_dependency_tracker.h"
 #include "../profiling.h"
 #include "../string_funcs.h"
 
 #include <core/os/time.h>
+#include <algorithm>
 
 namespace zylann {
 
-// template <typename T>
-// static bool contains(const std::vector<T> vec, T v) {
-// 	for (size_t i = 0; i < vec.size(); ++i) {
-// 		if (vec[i] == v) {
-// 			return true;
-// 		}
-// 	}
-// 	return false;
-// }
+namespace {
+// Allows tasks queued from within a thread of the pool to go in the queue of that thread
+thread_local const ThreadedTaskRunner *tls_current_pool = nullptr;
+thread_local uint32_t tls_current_thread_index = 0;
+} // namespace
 
-ThreadedTaskRunner::ThreadedTaskRunner() {}
+void ThreadedTaskRunner::TaskQueue::push(TaskItem &&item) {
+	item.order = next_order++;
+	sorted.push_back(std::move(item));
+	std::push_heap(sorted.begin(), sorted.end(), TaskItemComparator());
+}
+
+bool ThreadedTaskRunner::TaskQueue::pop(TaskItem &out_item) {
+	if (sorted.empty()) {
+		return false;
+	}
+	std::pop_heap(sorted.begin(), sorted.end(), TaskItemComparator());
+	out_item = std::move(sorted.back());
+	sorted.pop_back();
+	--size;
+	return true;
+}
+
+ThreadedTaskRunner::ThreadedTaskRunner() :
+		_next_thread_index(0), _queued_task_count(0), _debug_received_tasks(0), _debug_completed_tasks(0) {}
 
 ThreadedTaskRunner::~ThreadedTaskRunner() {
-	destroy_all_threads();
+	std::vector<TaskItem> remaining_tasks;
+	destroy_all_threads(remaining_tasks);
+
+	if (remaining_tasks.size() != 0 || _tasks_without_thread.size() != 0) {
+		ZN_PRINT_ERROR("There are queued tasks remaining!");
+	}
 
 	if (_completed_tasks.size() != 0) {
 		// We don't have ownership over tasks, so it's an error to destroy the pool without handling them
@@ -32,28 +54,93 @@ void ThreadedTaskRunner::create_thread(ThreadData &d, uint32_t i) {
 	d.stop = false;
 	d.waiting = false;
 	d.index = i;
+	d.random_state = i + 1;
 	if (!_name.empty()) {
 		d.name = format("{} {}", _name, i);
 	}
+	d.cpus.clear();
+	get_thread_cpus(i, d.cpus);
 	d.thread.start(thread_func_static, &d);
 }
 
-void ThreadedTaskRunner::destroy_all_threads() {
+void ThreadedTaskRunner::get_thread_cpus(uint32_t thread_index, std::vector<uint32_t> &out_cpus) const {
+	if (_affinity_mode == AFFINITY_NONE) {
+		return;
+	}
+
+	FixedArray<uint32_t, 32> nodes;
+	unsigned int node_count = 0;
+	const unsigned int available_node_count = math::min(Thread::get_numa_node_count(), nodes.size());
+	for (unsigned int node = 0; node < available_node_count; ++node) {
+		if (_affinity_numa_node_mask == 0 || (_affinity_numa_node_mask & (1u << node)) != 0) {
+			nodes[node_count] = node;
+			++node_count;
+		}
+	}
+	if (node_count == 0) {
+		// Warned about in `set_affinity`
+		return;
+	}
+
+	switch (_affinity_mode) {
+		case AFFINITY_NUMA_NODES:
+			Thread::get_numa_node_cpus(nodes[thread_index % node_count], out_cpus);
+			break;
+
+		case AFFINITY_CPUS: {
+			static thread_local std::vector<uint32_t> tls_cpus;
+			tls_cpus.clear();
+			for (unsigned int i = 0; i < node_count; ++i) {
+				Thread::get_numa_node_cpus(nodes[i], tls_cpus);
+			}
+			if (tls_cpus.size() > 0) {
+				out_cpus.push_back(tls_cpus[thread_index % tls_cpus.size()]);
+			}
+		} break;
+
+		default:
+			ZN_PRINT_ERROR("Unknown affinity mode");
+			break;
+	}
+}
+
+void ThreadedTaskRunner::destroy_all_threads(std::vector<TaskItem> &out_remaining_tasks) {
 	// We have only one semaphore to signal threads to resume, and one `post()` lets only one pass.
 	// We cannot tell one single thread to stop, because when we post and other threads are waiting, we can't guarantee
 	// the one to pass will be the one we want.
 	// So we can only choose to stop ALL threads, and then start them again if we want to adjust their count.
-	// Also, it shouldn't drop tasks. Any tasks the thread was working on should still complete normally.
-	for (size_t i = 0; i < _thread_count; ++i) {
-		ThreadData &d = _threads[i];
+	// Also, it shouldn't drop tasks. Any tasks the thread was working on should still complete normally, and tasks
+	// left in queues are given back so they can be queued again.
+	// Threads are detached from the pool first, so tasks queued meanwhile (including by the threads being stopped) go
+	// to `_tasks_without_thread` instead of queues that are about to be destroyed.
+	std::vector<UniquePtr<ThreadData>> threads;
+	{
+		RWLockWrite wlock(_threads_lock);
+		threads = std::move(_threads);
+		_threads.clear();
+	}
+	for (size_t i = 0; i < threads.size(); ++i) {
+		ThreadData &d = *threads[i];
 		d.stop = true;
 	}
-	for (size_t i = 0; i < _thread_count; ++i) {
+	for (size_t i = 0; i < threads.size(); ++i) {
 		_tasks_semaphore.post();
 	}
-	for (size_t i = 0; i < _thread_count; ++i) {
-		ThreadData &d = _threads[i];
-		d.wait_to_finish_and_reset();
+	for (size_t i = 0; i < threads.size(); ++i) {
+		ThreadData &d = *threads[i];
+		d.thread.wait_to_finish();
+
+		TaskQueue &queue = d.queue;
+		MutexLock lock(queue.mutex);
+		for (TaskItem &item : queue.incoming) {
+			out_remaining_tasks.push_back(std::move(item));
+		}
+		queue.incoming.clear();
+		TaskItem item;
+		while (queue.pop(item)) {
+			out_remaining_tasks.push_back(std::move(item));
+		}
+		queue.size = 0;
 	}
 }
 
@@ -61,16 +148,56 @@ void ThreadedTaskRunner::set_name(const char *name) {
 	_name = name;
 }
 
+void ThreadedTaskRunner::set_affinity(AffinityMode mode, uint32_t numa_node_mask) {
+	ZN_ASSERT_RETURN(mode >= 0 && mode < AFFINITY_MODE_COUNT);
+	_affinity_mode = mode;
+	_affinity_numa_node_mask = numa_node_mask;
+	if (mode != AFFINITY_NONE && numa_node_mask != 0) {
+		const unsigned int node_count = math::min(Thread::get_numa_node_count(), 32u);
+		if ((numa_node_mask & (0xffffffffu >> (32 - node_count))) == 0) {
+			ZN_PRINT_WARNING("No NUMA node matches the affinity mask, threads will not be restricted");
+		}
+	}
+}
+
 void ThreadedTaskRunner::set_thread_count(uint32_t count) {
-	if (count > MAX_THREADS) {
-		count = MAX_THREADS;
+	// The calling thread would wait for itself to finish
+	ZN_ASSERT_RETURN_MSG(tls_current_pool != this, "Can't change thread count from a thread of the same pool");
+
+	MutexLock count_lock(_thread_count_mutex);
+
+	std::vector<TaskItem> remaining_tasks;
+	destroy_all_threads(remaining_tasks);
+
+	{
+		// Threads can only start once they are all in the list, since they may look for others to steal from
+		RWLockWrite wlock(_threads_lock);
+		for (uint32_t i = 0; i < count; ++i) {
+			_threads.push_back(make_unique_instance<ThreadData>());
+		}
+	}
+	for (uint32_t i = 0; i < count; ++i) {
+		create_thread(*_threads[i], i);
+	}
+
+	{
+		// Tasks queued while there was no thread are all in there, since they were queued with `_threads_lock` held
+		MutexLock lock(_tasks_without_thread_mutex);
+		for (TaskItem &item : _tasks_without_thread) {
+			remaining_tasks.push_back(std::move(item));
+		}
+		_tasks_without_thread.clear();
 	}
-	destroy_all_threads();
-	for (uint32_t i = _thread_count; i < count; ++i) {
-		ThreadData &d = _threads[i];
-		create_thread(d, i);
+
+	// Tasks are still counted as queued, they just need to find a thread
+	if (remaining_tasks.size() > 0) {
+		enqueue_to_threads(to_span(remaining_tasks));
 	}
-	_thread_count = count;
+}
+
+uint32_t ThreadedTaskRunner::get_thread_count() const {
+	RWLockRead rlock(_threads_lock);
+	return _threads.size();
 }
 
 void ThreadedTaskRunner::set_batch_count(uint32_t count) {
@@ -81,42 +208,80 @@ void ThreadedTaskRunner::set_priority_update_period(uint32_t milliseconds) {
 	_priority_update_period = milliseconds;
 }
 
+void ThreadedTaskRunner::set_priority_epoch(const std::atomic_uint32_t *epoch) {
+	_priority_epoch = epoch;
+}
+
 void ThreadedTaskRunner::enqueue(IThreadedTask *task) {
 	ZN_ASSERT(task != nullptr);
-	{
-		MutexLock lock(_tasks_mutex);
-		TaskItem t;
-		t.task = task;
-		_tasks.push_back(t);
-		++_debug_received_tasks;
-	}
-	// TODO Do I need to post a certain amount of times?
-	_tasks_semaphore.post();
+	enqueue(Span<IThreadedTask *>(&task, 1));
 }
 
 void ThreadedTaskRunner::enqueue(Span<IThreadedTask *> new_tasks) {
-#ifdef DEBUG_ENABLED
+	enqueue(new_tasks, nullptr);
+}
+
+void ThreadedTaskRunner::enqueue(Span<IThreadedTask *> new_tasks, std::shared_ptr<AsyncDependencyTracker> tracker) {
+	static thread_local std::vector<TaskItem> tls_items;
+	tls_items.clear();
+
 	for (size_t i = 0; i < new_tasks.size(); ++i) {
+#ifdef DEBUG_ENABLED
 		ZN_ASSERT(new_tasks[i] != nullptr);
-	}
 #endif
-	{
-		MutexLock lock(_tasks_mutex);
-		const size_t dst_begin = _tasks.size();
-		_tasks.resize(_tasks.size() + new_tasks.size());
-		for (size_t i = 0; i < new_tasks.size(); ++i) {
-			TaskItem t;
-			t.task = new_tasks[i];
-			_tasks[dst_begin + i] = t;
+		TaskItem item;
+		item.task = new_tasks[i];
+		item.tracker = tracker;
+		tls_items.push_back(std::move(item));
+	}
+
+	_debug_received_tasks += tls_items.size();
+	_queued_task_count += tls_items.size();
+	enqueue_to_threads(to_span(tls_items));
+
+	tls_items.clear();
+}
+
+void ThreadedTaskRunner::enqueue_to_threads(Span<TaskItem> items) {
+	RWLockRead rlock(_threads_lock);
+	const uint32_t thread_count = _threads.size();
+
+	if (thread_count == 0) {
+		MutexLock lock(_tasks_without_thread_mutex);
+		for (size_t i = 0; i < items.size(); ++i) {
+			_tasks_without_thread.push_back(std::move(items[i]));
 		}
-		_debug_received_tasks += new_tasks.size();
+		return;
 	}
-	// TODO Do I need to post a certain amount of times?
-	for (size_t i = 0; i < new_tasks.size(); ++i) {
+
+	if (tls_current_pool == this && tls_current_thread_index < thread_count) {
+		// Keep them local, idle threads will steal them if needed
+		enqueue_to_thread(tls_current_thread_index, items);
+
+	} else {
+		// Spread tasks in contiguous chunks, so threads start with similar amounts of work
+		const size_t chunk_size = (items.size() + thread_count - 1) / thread_count;
+		for (size_t begin = 0; begin < items.size(); begin += chunk_size) {
+			const size_t end = math::min(begin + chunk_size, items.size());
+			enqueue_to_thread(_next_thread_index++ % thread_count, items.sub(begin, end - begin));
+		}
+	}
+
+	// One post per task, so as many threads as needed can wake up
+	for (size_t i = 0; i < items.size(); ++i) {
 		_tasks_semaphore.post();
 	}
 }
 
+void ThreadedTaskRunner::enqueue_to_thread(uint32_t thread_index, Span<TaskItem> items) {
+	TaskQueue &queue = _threads[thread_index]->queue;
+	MutexLock lock(queue.mutex);
+	for (size_t i = 0; i < items.size(); ++i) {
+		queue.incoming.push_back(std::move(items[i]));
+	}
+	queue.size += items.size();
+}
+
 void ThreadedTaskRunner::thread_func_static(void *p_data) {
 	ThreadData &data = *static_cast<ThreadData *>(p_data);
 	ThreadedTaskRunner &pool = *data.pool;
@@ -129,76 +294,164 @@ void ThreadedTaskRunner::thread_func_static(void *p_data) {
 #endif
 	}
 
+	if (data.cpus.size() > 0 && !Thread::set_affinity(to_span_const(data.cpus))) {
+		ZN_PRINT_VERBOSE(format("Could not set affinity of thread {}", data.name));
+	}
+
+	tls_current_pool = &pool;
+	tls_current_thread_index = data.index;
+
 	pool.thread_func(data);
+
+	tls_current_pool = nullptr;
+}
+
+void ThreadedTaskRunner::update_priorities(TaskQueue &queue, uint64_t now, std::vector<TaskItem> &cancelled_tasks) {
+	// Called with the queue locked
+
+	const uint64_t time_since_update = now - queue.last_priority_update_time_ms;
+	bool update = time_since_update > _priority_update_period;
+
+	if (update && _priority_epoch != nullptr) {
+		// Nothing is expected to have changed if the epoch is the same, but still poll from time to time in case some
+		// tasks depend on something else
+		const uint32_t epoch = *_priority_epoch;
+		update = epoch != queue.last_priority_epoch ||
+				time_since_update > _priority_update_period * STALE_PRIORITY_PERIOD_MULTIPLIER;
+		queue.last_priority_epoch = epoch;
+	}
+
+	if (update) {
+		// Priorities may have changed, so the heap is rebuilt. This is also where far tasks get cancelled, all at once.
+		// Tasks keep their order, so those with equal priority still run in the order they were sorted.
+		std::vector<TaskItem> &sorted = queue.sorted;
+		size_t kept_count = 0;
+		for (size_t i = 0; i < sorted.size(); ++i) {
+			TaskItem &item = sorted[i];
+			// Calling `get_priority()` first since it can update cancellation
+			// (not clear API tho, might review that in the future)
+			item.cached_priority = item.task->get_priority();
+			if (item.task->is_cancelled()) {
+				cancelled_tasks.push_back(std::move(item));
+				--queue.size;
+				--_queued_task_count;
+			} else {
+				if (kept_count != i) {
+					sorted[kept_count] = std::move(item);
+				}
+				++kept_count;
+			}
+		}
+		sorted.resize(kept_count);
+		std::make_heap(sorted.begin(), sorted.end(), TaskItemComparator());
+		queue.last_priority_update_time_ms = now;
+	}
+
+	// Incoming tasks are already counted in `size`
+	for (TaskItem &item : queue.incoming) {
+		item.cached_priority = item.task->get_priority();
+		if (item.task->is_cancelled()) {
+			cancelled_tasks.push_back(std::move(item));
+			--queue.size;
+			--_queued_task_count;
+			continue;
+		}
+		queue.push(std::move(item));
+	}
+	queue.incoming.clear();
+}
+
+bool ThreadedTaskRunner::pick_own_tasks(
+		ThreadData &data, std::vector<TaskItem> &tasks, std::vector<TaskItem> &cancelled_tasks) {
+	TaskQueue &queue = data.queue;
+	if (queue.size == 0) {
+		return false;
+	}
+
+	const uint64_t now = Time::get_singleton()->get_ticks_msec();
+
+	MutexLock lock(queue.mutex);
+	update_priorities(queue, now, cancelled_tasks);
+
+	TaskItem item;
+	for (uint32_t bi = 0; bi < _batch_count && queue.pop(item); ++bi) {
+		tasks.push_back(std::move(item));
+		--_queued_task_count;
+	}
+
+	return tasks.size() > 0;
+}
+
+bool ThreadedTaskRunner::steal_tasks(ThreadData &data, std::vector<TaskItem> &tasks) {
+	RWLockRead rlock(_threads_lock);
+	const uint32_t thread_count = _threads.size();
+	if (thread_count <= 1) {
+		return false;
+	}
+
+	// Start from a random thread so thieves don't all go to the same one
+	uint32_t &rs = data.random_state;
+	rs ^= rs << 13;
+	rs ^= rs >> 17;
+	rs ^= rs << 5;
+	const uint32_t first = rs % thread_count;
+
+	for (uint32_t i = 0; i < thread_count; ++i) {
+		const uint32_t victim_index = (first + i) % thread_count;
+		if (victim_index == data.index) {
+			continue;
+		}
+		TaskQueue &queue = _threads[victim_index]->queue;
+		if (queue.size == 0) {
+			continue;
+		}
+
+		MutexLock lock(queue.mutex);
+
+		// Take the most important tasks first. Those which were not sorted yet are taken as they come.
+		TaskItem item;
+		for (uint32_t bi = 0; bi < _batch_count; ++bi) {
+			if (queue.pop(item)) {
+				tasks.push_back(std::move(item));
+			} else if (queue.incoming.size() > 0) {
+				tasks.push_back(std::move(queue.incoming.back()));
+				queue.incoming.pop_back();
+				--queue.size;
+			} else {
+				break;
+			}
+			--_queued_task_count;
+		}
+
+		if (tasks.size() > 0) {
+			return true;
+		}
+	}
+
+	return false;
 }
 
 void ThreadedTaskRunner::thread_func(ThreadData &data) {
 	data.debug_state = STATE_RUNNING;
 
 	std::vector<TaskItem> tasks;
-	std::vector<IThreadedTask *> cancelled_tasks;
+	std::vector<TaskItem> cancelled_tasks;
 
 	while (!data.stop) {
 		{
 			ZN_PROFILE_SCOPE_NAMED("Task pickup");
 
 			data.debug_state = STATE_PICKING;
-			const uint64_t now = Time::get_singleton()->get_ticks_msec();
-
-			MutexLock lock(_tasks_mutex);
-
-			// Pick best tasks
-			for (uint32_t bi = 0; bi < _batch_count && _tasks.size() != 0; ++bi) {
-				size_t best_index = 0; // Take first by default, this is a valid index
-				int best_priority = 999999;
-
-				// TODO This takes a lot of time when there are many queued tasks. Use a better container?
-				for (size_t i = 0; i < _tasks.size(); ++i) {
-					TaskItem &item = _tasks[i];
-					ZN_ASSERT(item.task != nullptr);
-
-					if (now - item.last_priority_update_time_ms > _priority_update_period) {
-						// Calling `get_priority()` first since it can update cancellation
-						// (not clear API tho, might review that in the future)
-						item.cached_priority = item.task->get_priority();
-
-						if (item.task->is_cancelled()) {
-							cancelled_tasks.push_back(item.task);
-							_tasks[i] = _tasks.back();
-							_tasks.pop_back();
-							--i;
-							continue;
-						}
-
-						item.last_priority_update_time_ms = now;
-					}
-
-					if (item.cached_priority < best_priority) {
-						best_priority = item.cached_priority;
-						best_index = i;
-					}
-				}
 
-				// If not all tasks were cancelled
-				if (_tasks.size() != 0) {
-					tasks.push_back(_tasks[best_index]);
-					ZN_ASSERT(best_index < _tasks.size());
-					_tasks[best_index] = _tasks.back();
-					_tasks.pop_back();
-				}
+			if (!pick_own_tasks(data, tasks, cancelled_tasks)) {
+				steal_tasks(data, tasks);
 			}
 		}
 
 		if (cancelled_tasks.size() > 0) {
-			MutexLock lock(_completed_tasks_mutex);
-			for (size_t i = 0; i < cancelled_tasks.size(); ++i) {
-				_completed_tasks.push_back(cancelled_tasks[i]);
-				++_debug_completed_tasks;
-			}
+			complete_tasks(to_span(cancelled_tasks), true);
+			cancelled_tasks.clear();
 		}
-		cancelled_tasks.clear();
-
-		//print_line(String("Processing {0} tasks").format(varray(tasks.size())));
 
 		if (tasks.empty()) {
 			data.debug_state = STATE_WAITING;
@@ -213,18 +466,13 @@ void ThreadedTaskRunner::thread_func(ThreadData &data) {
 
 			for (size_t i = 0; i < tasks.size(); ++i) {
 				TaskItem &item = tasks[i];
-				if (!item.task->is_cancelled()) {
+				if (item.task->is_cancelled()) {
+					complete_tasks(Span<TaskItem>(&item, 1), true);
+				} else {
 					ThreadedTaskContext ctx;
 					ctx.thread_index = data.index;
 					item.task->run(ctx);
-				}
-			}
-			{
-				MutexLock lock(_completed_tasks_mutex);
-				for (size_t i = 0; i < tasks.size(); ++i) {
-					TaskItem &item = tasks[i];
-					_completed_tasks.push_back(item.task);
-					++_debug_completed_tasks;
+					complete_tasks(Span<TaskItem>(&item, 1), false);
 				}
 			}
 
@@ -235,6 +483,26 @@ void ThreadedTaskRunner::thread_func(ThreadData &data) {
 	data.debug_state = STATE_STOPPED;
 }
 
+void ThreadedTaskRunner::complete_tasks(Span<TaskItem> items, bool cancelled) {
+	// Dependents are notified first, so they can start as soon as possible
+	for (size_t i = 0; i < items.size(); ++i) {
+		TaskItem &item = items[i];
+		if (item.tracker != nullptr) {
+			if (cancelled) {
+				item.tracker->abort();
+			} else if (!item.tracker->is_aborted()) {
+				item.tracker->post_complete();
+			}
+			item.tracker = nullptr;
+		}
+	}
+	MutexLock lock(_completed_tasks_mutex);
+	for (size_t i = 0; i < items.size(); ++i) {
+		_completed_tasks.push_back(items[i].task);
+		++_debug_completed_tasks;
+	}
+}
+
 void ThreadedTaskRunner::wait_for_all_tasks() {
 	const uint32_t suspicious_delay_msec = 10000;
 
@@ -242,14 +510,7 @@ void ThreadedTaskRunner::wait_for_all_tasks() {
 	bool error1_reported = false;
 
 	// Wait until all tasks have been taken
-	while (true) {
-		{
-			MutexLock lock(_tasks_mutex);
-			if (_tasks.size() == 0) {
-				break;
-			}
-		}
-
+	while (_queued_task_count > 0 && get_thread_count() > 0) {
 		Thread::sleep_usec(2000);
 
 		if (!error1_reported && Time::get_singleton()->get_ticks_msec() - before > suspicious_delay_msec) {
@@ -265,11 +526,14 @@ void ThreadedTaskRunner::wait_for_all_tasks() {
 	bool any_working_thread = true;
 	while (any_working_thread) {
 		any_working_thread = false;
-		for (size_t i = 0; i < _thread_count; ++i) {
-			const ThreadData &t = _threads[i];
-			if (t.waiting == false) {
-				any_working_thread = true;
-				break;
+		{
+			RWLockRead rlock(_threads_lock);
+			for (size_t i = 0; i < _threads.size(); ++i) {
+				const ThreadData &t = *_threads[i];
+				if (t.waiting == false) {
+					any_working_thread = true;
+					break;
+				}
 			}
 		}
 
@@ -287,7 +551,12 @@ void ThreadedTaskRunner::wait_for_all_tasks() {
 // Thought it wasnt worth locking for debugging.
 
 ThreadedTaskRunner::State ThreadedTaskRunner::get_thread_debug_state(uint32_t i) const {
-	return _threads[i].debug_state;
+	RWLockRead rlock(_threads_lock);
+	// The thread count may have changed since the caller got it
+	if (i >= _threads.size()) {
+		return STATE_STOPPED;
+	}
+	return _threads[i]->debug_state;
 }
 
 unsigned int ThreadedTaskRunner::get_debug_remaining_tasks() const {
@@ -2,21 +2,39 @@
 #define ZYLANN_THREADED_TASK_RUNNER_H
 
 #include "../fixed_array.h"
+#include "../memory.h"
 #include "../span.h"
 #include "../thread/mutex.h"
+#include "../thread/rw_lock.h"
 #include "../thread/semaphore.h"
 #include "../thread/thread.h"
 #include "threaded_task.h"
 
-#include <queue>
+#include <atomic>
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace zylann {
 
-// Generic thread pool that performs batches of tasks based on dynamic priority
+class AsyncDependencyTracker;
+
+// Generic thread pool that performs batches of tasks based on dynamic priority.
+// Each thread has its own queue, and threads having nothing left to do steal tasks from the others. Each queue is a
+// heap ordered by priority, so a thread always picks its most important tasks first.
 class ThreadedTaskRunner {
 public:
-	static const uint32_t MAX_THREADS = 8;
+	static const unsigned int STALE_PRIORITY_PERIOD_MULTIPLIER = 10;
+
+	enum AffinityMode { //
+		// Threads can run on any CPU
+		AFFINITY_NONE = 0,
+		// Each thread runs on the CPUs of one NUMA node. Threads are assigned to nodes in turn.
+		AFFINITY_NUMA_NODES,
+		// Each thread is pinned to one CPU. CPUs are taken node by node, so consecutive threads share a node.
+		AFFINITY_CPUS,
+		AFFINITY_MODE_COUNT
+	};
 
 	enum State { //
 		STATE_RUNNING = 0,
@@ -32,12 +50,15 @@ public:
 	// Must be called before configuring thread count.
 	void set_name(const char *name);
 
-	// TODO Add ability to change it while running without skipping tasks
-	// Can't be changed after tasks have been queued
+	// Restricts which CPUs threads of the pool can run on. `numa_node_mask` has one bit per NUMA node threads can use,
+	// 0 means all of them. Only applies to threads started afterwards, so it should be called before configuring
+	// thread count. Platforms not supporting it leave threads unrestricted.
+	void set_affinity(AffinityMode mode, uint32_t numa_node_mask = 0);
+
+	// Threads are all restarted when this is called. Tasks they were running complete normally, and tasks that were
+	// queued are kept. Can be called while tasks are being queued, but not from a thread of the pool.
 	void set_thread_count(uint32_t count);
-	uint32_t get_thread_count() const {
-		return _thread_count;
-	}
+	uint32_t get_thread_count() const;
 
 	// TODO Add ability to change it while running
 	// Sets how many tasks each thread will attempt to dequeue on each iteration.
@@ -50,13 +71,23 @@ public:
 	// Can't be changed after tasks have been queued.
 	void set_priority_update_period(uint32_t milliseconds);
 
+	// Optional counter expected to change when priorities of tasks may have changed. When set, queued tasks only get
+	// their priority polled again after it changed, or after `STALE_PRIORITY_PERIOD_MULTIPLIER` periods otherwise.
+	// The counter must outlive the runner. Can't be changed after tasks have been queued.
+	void set_priority_epoch(const std::atomic_uint32_t *epoch);
+
 	// TODO Expect tasks to be unique ptrs?
 
 	// Schedules a task.
 	// Ownership is NOT passed to the pool, so make sure you get them back when completed if you want to delete them.
+	// When called from a thread of the pool, the task is queued on that thread.
 	void enqueue(IThreadedTask *task);
 	// Schedules multiple tasks at once. Involves less internal locking.
 	void enqueue(Span<IThreadedTask *> new_tasks);
+	// Schedules tasks which notify `tracker` when they complete, or abort it if they get cancelled.
+	// This is how dependencies are expressed: tasks waiting on the tracker get scheduled by the thread which completed
+	// the last dependency, so chains of tasks can run without going through the main thread.
+	void enqueue(Span<IThreadedTask *> new_tasks, std::shared_ptr<AsyncDependencyTracker> tracker);
 
 	// TODO Lambda might not be the best API. memcpying to a vector would ensure we lock for a shorter time.
 	template <typename F>
@@ -79,41 +110,87 @@ private:
 	struct TaskItem {
 		IThreadedTask *task = nullptr;
 		int cached_priority = 99999;
+		// Keeps tasks of equal priority in the order they were sorted
+		uint32_t order = 0;
+		// Notified when the task is done, if any
+		std::shared_ptr<AsyncDependencyTracker> tracker;
+	};
+
+	struct TaskItemComparator {
+		// Heap functions put the greatest item first, so this is reversed
+		inline bool operator()(const TaskItem &a, const TaskItem &b) const {
+			if (a.cached_priority != b.cached_priority) {
+				return a.cached_priority > b.cached_priority;
+			}
+			// Wrapping difference, so the order stays correct when the counter overflows
+			return int32_t(a.order - b.order) > 0;
+		}
+	};
+
+	struct TaskQueue {
+		// Tasks whose priority has not been evaluated yet. The thread owning the queue sorts them into `sorted`.
+		std::vector<TaskItem> incoming;
+		// Heap of tasks, lowest priority value first. Using `std::*_heap` functions rather than
+		// `std::priority_queue`, because priorities are re-evaluated in place from time to time.
+		std::vector<TaskItem> sorted;
+		uint32_t next_order = 0;
 		uint64_t last_priority_update_time_ms = 0;
+		uint32_t last_priority_epoch = 0;
+		Mutex mutex;
+		// Can be read without locking, to skip empty queues quickly
+		std::atomic_uint32_t size;
+
+		TaskQueue() : size(0) {}
+
+		// Does not change `size`, which is updated when tasks enter or leave the queue
+		void push(TaskItem &&item);
+		bool pop(TaskItem &out_item);
 	};
 
 	struct ThreadData {
 		Thread thread;
 		ThreadedTaskRunner *pool = nullptr;
 		uint32_t index = 0;
-		bool stop = false;
-		bool waiting = false;
+		std::atomic_bool stop;
+		std::atomic_bool waiting;
 		State debug_state = STATE_STOPPED;
 		std::string name;
+		TaskQueue queue;
+		// For picking threads to steal from
+		uint32_t random_state = 0;
+		// CPUs the thread is restricted to. Empty means any.
+		std::vector<uint32_t> cpus;
 
-		void wait_to_finish_and_reset() {
-			thread.wait_to_finish();
-			pool = nullptr;
-			index = 0;
-			stop = false;
-			waiting = false;
-			debug_state = STATE_STOPPED;
-			name.clear();
-		}
+		ThreadData() : stop(false), waiting(false) {}
 	};
 
 	static void thread_func_static(void *p_data);
 	void thread_func(ThreadData &data);
 
-	void create_thread(ThreadData &d, uint32_t i);
-	void destroy_all_threads();
-
-	FixedArray<ThreadData, MAX_THREADS> _threads;
-	uint32_t _thread_count = 0;
+	bool pick_own_tasks(ThreadData &data, std::vector<TaskItem> &tasks, std::vector<TaskItem> &cancelled_tasks);
+	bool steal_tasks(ThreadData &data, std::vector<TaskItem> &tasks);
+	void update_priorities(TaskQueue &queue, uint64_t now, std::vector<TaskItem> &cancelled_tasks);
+	void enqueue_to_threads(Span<TaskItem> items);
+	void enqueue_to_thread(uint32_t thread_index, Span<TaskItem> items);
+	void complete_tasks(Span<TaskItem> items, bool cancelled);
 
-	// TODO Optimization: use a less naive design? Maybe moodycamel
-	std::vector<TaskItem> _tasks;
-	Mutex _tasks_mutex;
+	void create_thread(ThreadData &d, uint32_t i);
+	void get_thread_cpus(uint32_t thread_index, std::vector<uint32_t> &out_cpus) const;
+	void destroy_all_threads(std::vector<TaskItem> &out_remaining_tasks);
+
+	// Only changes when the thread count is set. Threads of the pool lock it for reading when they steal tasks.
+	std::vector<UniquePtr<ThreadData>> _threads;
+	RWLock _threads_lock;
+	// Serializes changes of thread count
+	Mutex _thread_count_mutex;
+	// Used to spread tasks queued from outside of the pool
+	std::atomic_uint32_t _next_thread_index;
+	// Tasks queued while there is no thread to run them
+	std::vector<TaskItem> _tasks_without_thread;
+	Mutex _tasks_without_thread_mutex;
+
+	// Counts tasks which have not been picked by a thread yet
+	std::atomic_uint32_t _queued_task_count;
 	Semaphore _tasks_semaphore;
 
 	std::vector<IThreadedTask *> _completed_tasks;
@@ -121,11 +198,14 @@ private:
 
 	uint32_t _batch_count = 1;
 	uint32_t _priority_update_period = 32;
+	const std::atomic_uint32_t *_priority_epoch = nullptr;
+	AffinityMode _affinity_mode = AFFINITY_NONE;
+	uint32_t _affinity_numa_node_mask = 0;
 
 	std::string _name;
 
-	unsigned int _debug_received_tasks = 0;
-	unsigned int _debug_completed_tasks = 0;
+	std::atomic_uint32_t _debug_received_tasks;
+	std::atomic_uint32_t _debug_completed_tasks;
 };
 
 } // namespace zylann
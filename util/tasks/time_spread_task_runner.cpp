@@ -1,4 +1,6 @@
 #include "time_spread_task_runner.h"
+#include "../errors.h"
+#include "../math/funcs.h"
 #include "../memory.h"
 #include "../profiling.h"
 
@@ -10,54 +12,132 @@ TimeSpreadTaskRunner::~TimeSpreadTaskRunner() {
 	flush();
 }
 
-void TimeSpreadTaskRunner::push(ITimeSpreadTask *task) {
-	MutexLock lock(_tasks_mutex);
-	_tasks.push(task);
+void TimeSpreadTaskRunner::push(ITimeSpreadTask *task, unsigned int kind, int priority) {
+	push(Span<ITimeSpreadTask *>(&task, 1), kind, priority);
 }
 
-void TimeSpreadTaskRunner::push(Span<ITimeSpreadTask *> tasks) {
+void TimeSpreadTaskRunner::push(Span<ITimeSpreadTask *> tasks, unsigned int kind, int priority) {
+	ZN_ASSERT_RETURN(kind < MAX_KINDS);
 	MutexLock lock(_tasks_mutex);
 	for (unsigned int i = 0; i < tasks.size(); ++i) {
-		_tasks.push(tasks[i]);
+		_kinds[kind].tasks.push(TaskItem{ tasks[i], priority, _next_order++ });
 	}
 }
 
+void TimeSpreadTaskRunner::set_kind_budget_ratio(unsigned int kind, float ratio) {
+	ZN_ASSERT_RETURN(kind < MAX_KINDS);
+	_kinds[kind].budget_ratio = math::max(ratio, 0.f);
+}
+
+bool TimeSpreadTaskRunner::run_next_task(unsigned int kind_index, std::vector<TaskItem> &postponed_tasks) {
+	// Weight of the last task in the cost estimate
+	static const float COST_SMOOTHING = 0.1f;
+
+	Kind &kind = _kinds[kind_index];
+	TaskItem item;
+	{
+		MutexLock lock(_tasks_mutex);
+		if (kind.tasks.empty()) {
+			return false;
+		}
+		item = kind.tasks.top();
+		kind.tasks.pop();
+	}
+
+	const Time &time = *Time::get_singleton();
+	const uint64_t time_before = time.get_ticks_usec();
+
+	TimeSpreadTaskContext ctx;
+	item.task->run(ctx);
+
+	if (ctx.postpone) {
+		postponed_tasks.push_back(item);
+	} else {
+		// TODO Call recycling function instead?
+		ZN_DELETE(item.task);
+	}
+
+	const uint64_t cost_usec = time.get_ticks_usec() - time_before;
+	kind.last_spent_usec += cost_usec;
+	++kind.last_processed_count;
+	if (kind.average_cost_usec == 0.f) {
+		kind.average_cost_usec = cost_usec;
+	} else {
+		kind.average_cost_usec = Math::lerp(kind.average_cost_usec, float(cost_usec), COST_SMOOTHING);
+	}
+
+	return true;
+}
+
 void TimeSpreadTaskRunner::process(uint64_t time_budget_usec) {
 	ZN_PROFILE_SCOPE();
 	const Time &time = *Time::get_singleton();
 
-	static thread_local std::vector<ITimeSpreadTask *> tls_postponed_tasks;
-	ZN_ASSERT(tls_postponed_tasks.size() == 0);
+	// Postponed tasks are queued again at the end, so they don't run twice in the same call
+	static thread_local FixedArray<std::vector<TaskItem>, MAX_KINDS> tls_postponed_tasks;
+
+	// Share the budget between kinds having tasks
+	FixedArray<bool, MAX_KINDS> has_tasks;
+	float ratio_sum = 0.f;
+	{
+		MutexLock lock(_tasks_mutex);
+		for (unsigned int kind_index = 0; kind_index < _kinds.size(); ++kind_index) {
+			const Kind &kind = _kinds[kind_index];
+			has_tasks[kind_index] = !kind.tasks.empty();
+			if (has_tasks[kind_index]) {
+				ratio_sum += kind.budget_ratio;
+			}
+		}
+	}
+	for (unsigned int kind_index = 0; kind_index < _kinds.size(); ++kind_index) {
+		Kind &kind = _kinds[kind_index];
+		kind.last_budget_usec = 0;
+		kind.last_spent_usec = 0;
+		kind.last_processed_count = 0;
+		if (has_tasks[kind_index] && ratio_sum > 0.f) {
+			kind.last_budget_usec = time_budget_usec * (kind.budget_ratio / ratio_sum);
+		}
+	}
 
 	const uint64_t time_before = time.get_ticks_usec();
 
-	// Do at least one task
-	do {
-		ITimeSpreadTask *task;
-		{
-			MutexLock lock(_tasks_mutex);
-			if (_tasks.size() == 0) {
+	// Do at least one task of each kind, then continue as long as the next one is expected to fit in the share
+	for (unsigned int kind_index = 0; kind_index < _kinds.size(); ++kind_index) {
+		if (!has_tasks[kind_index]) {
+			continue;
+		}
+		Kind &kind = _kinds[kind_index];
+		while (run_next_task(kind_index, tls_postponed_tasks[kind_index])) {
+			if (kind.last_spent_usec + uint64_t(kind.average_cost_usec) > kind.last_budget_usec) {
 				break;
 			}
-			task = _tasks.front();
-			_tasks.pop();
 		}
+	}
 
-		TimeSpreadTaskContext ctx;
-		task->run(ctx);
-
-		if (ctx.postpone) {
-			tls_postponed_tasks.push_back(task);
-		} else {
-			// TODO Call recycling function instead?
-			ZN_DELETE(task);
+	// Time left by kinds which didn't need their whole share can be used by the others
+	bool ran_any_task = true;
+	while (ran_any_task) {
+		ran_any_task = false;
+		for (unsigned int kind_index = 0; kind_index < _kinds.size(); ++kind_index) {
+			const uint64_t spent_usec = time.get_ticks_usec() - time_before;
+			if (spent_usec + uint64_t(_kinds[kind_index].average_cost_usec) > time_budget_usec) {
+				continue;
+			}
+			if (run_next_task(kind_index, tls_postponed_tasks[kind_index])) {
+				ran_any_task = true;
+			}
 		}
+	}
 
-	} while (time.get_ticks_usec() - time_before < time_budget_usec);
-
-	if (tls_postponed_tasks.size() > 0) {
-		push(to_span(tls_postponed_tasks));
-		tls_postponed_tasks.clear();
+	for (unsigned int kind_index = 0; kind_index < tls_postponed_tasks.size(); ++kind_index) {
+		std::vector<TaskItem> &postponed_tasks = tls_postponed_tasks[kind_index];
+		if (postponed_tasks.size() > 0) {
+			MutexLock lock(_tasks_mutex);
+			for (unsigned int i = 0; i < postponed_tasks.size(); ++i) {
+				_kinds[kind_index].tasks.push(postponed_tasks[i]);
+			}
+			postponed_tasks.clear();
+		}
 	}
 }
 
@@ -72,7 +152,26 @@ void TimeSpreadTaskRunner::flush() {
 
 unsigned int TimeSpreadTaskRunner::get_pending_count() const {
 	MutexLock lock(_tasks_mutex);
-	return _tasks.size();
+	unsigned int count = 0;
+	for (unsigned int kind_index = 0; kind_index < _kinds.size(); ++kind_index) {
+		count += _kinds[kind_index].tasks.size();
+	}
+	return count;
+}
+
+TimeSpreadTaskRunner::KindStats TimeSpreadTaskRunner::get_kind_stats(unsigned int kind) const {
+	ZN_ASSERT_RETURN_V(kind < MAX_KINDS, KindStats());
+	const Kind &k = _kinds[kind];
+	KindStats stats;
+	stats.budget_usec = k.last_budget_usec;
+	stats.spent_usec = k.last_spent_usec;
+	stats.processed_count = k.last_processed_count;
+	stats.average_cost_usec = k.average_cost_usec;
+	{
+		MutexLock lock(_tasks_mutex);
+		stats.pending_count = k.tasks.size();
+	}
+	return stats;
 }
 
 } // namespace zylann
@@ -1,10 +1,12 @@
 #ifndef ZYLANN_TIME_SPREAD_TASK_RUNNER_H
 #define ZYLANN_TIME_SPREAD_TASK_RUNNER_H
 
+#include "../fixed_array.h"
 #include "../span.h"
 #include "../thread/mutex.h"
 #include <cstdint>
 #include <queue>
+#include <vector>
 
 namespace zylann {
 
@@ -22,21 +24,74 @@ public:
 };
 
 // Runs tasks in the caller thread, within a time budget per call. Kind of like coroutines.
+// Tasks are grouped by kind, each getting a share of the budget, so a burst of one kind of task doesn't delay the
+// others. Within a kind, tasks with the lowest priority value run first.
 class TimeSpreadTaskRunner {
 public:
+	static const unsigned int MAX_KINDS = 4;
+
+	struct KindStats {
+		// Time tasks of this kind were allowed to use during the last call to `process`
+		uint64_t budget_usec = 0;
+		// Time tasks of this kind actually used during the last call to `process`
+		uint64_t spent_usec = 0;
+		// Tasks of this kind which ran during the last call to `process`
+		unsigned int processed_count = 0;
+		unsigned int pending_count = 0;
+		// Estimated time a task of this kind takes to run
+		float average_cost_usec = 0.f;
+	};
+
 	~TimeSpreadTaskRunner();
 
 	// Pushing is thread-safe.
-	void push(ITimeSpreadTask *task);
-	void push(Span<ITimeSpreadTask *> tasks);
+	void push(ITimeSpreadTask *task, unsigned int kind = 0, int priority = 0);
+	void push(Span<ITimeSpreadTask *> tasks, unsigned int kind = 0, int priority = 0);
+
+	// Sets the portion of the time budget tasks of a kind can use, relative to other kinds. When a kind doesn't use
+	// all of its share, the remaining time can be used by other kinds.
+	void set_kind_budget_ratio(unsigned int kind, float ratio);
 
 	void process(uint64_t time_budget_usec);
 	void flush();
 	unsigned int get_pending_count() const;
+	KindStats get_kind_stats(unsigned int kind) const;
 
 private:
-	// TODO Optimization: naive thread safety. Should be enough for now.
-	std::queue<ITimeSpreadTask *> _tasks;
+	struct TaskItem {
+		ITimeSpreadTask *task;
+		int priority;
+		// Keeps tasks of equal priority in the order they were pushed
+		uint32_t order;
+	};
+
+	struct TaskItemComparator {
+		// `std::priority_queue` puts the greatest item first, so this is reversed
+		inline bool operator()(const TaskItem &a, const TaskItem &b) const {
+			if (a.priority != b.priority) {
+				return a.priority > b.priority;
+			}
+			// Handles wrapping of the counter
+			return int32_t(a.order - b.order) > 0;
+		}
+	};
+
+	struct Kind {
+		// TODO Optimization: naive thread safety. Should be enough for now.
+		std::priority_queue<TaskItem, std::vector<TaskItem>, TaskItemComparator> tasks;
+		float budget_ratio = 1.f;
+		// Exponentially-weighted moving average of how long tasks take, so we can tell if another one fits in the
+		// remaining time before running it
+		float average_cost_usec = 0.f;
+		uint64_t last_budget_usec = 0;
+		uint64_t last_spent_usec = 0;
+		unsigned int last_processed_count = 0;
+	};
+
+	bool run_next_task(unsigned int kind_index, std::vector<TaskItem> &postponed_tasks);
+
+	FixedArray<Kind, MAX_KINDS> _kinds;
+	uint32_t _next_order = 0;
 	BinaryMutex _tasks_mutex;
 };
 
@@ -1,12 +1,145 @@
 #include "thread.h"
+#include "../errors.h"
 #include "../memory.h"
 
 #include <core/os/os.h>
 #include <core/os/thread.h>
 #include <core/string/ustring.h>
 
+#include <cstdio>
+#include <cstdlib>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
 namespace zylann {
 
+namespace {
+
+struct CpuTopology {
+	// CPUs of each NUMA node. There is always at least one node.
+	std::vector<std::vector<uint32_t>> node_cpus;
+	// NUMA node of each CPU
+	std::vector<uint8_t> cpu_nodes;
+};
+
+// Set when the affinity of the current thread is restricted to CPUs of a single node
+thread_local int tls_affinity_numa_node = -1;
+
+#if defined(__linux__)
+
+// Parses lists such as "0-3,8,10-11", as found in sysfs
+bool read_sysfs_list(const char *fpath, std::vector<uint32_t> &out_values) {
+	FILE *f = fopen(fpath, "r");
+	if (f == nullptr) {
+		return false;
+	}
+	char buffer[4096];
+	const bool read = fgets(buffer, sizeof(buffer), f) != nullptr;
+	fclose(f);
+	if (!read) {
+		return false;
+	}
+	const char *p = buffer;
+	while (*p >= '0' && *p <= '9') {
+		char *end;
+		const uint32_t first = strtoul(p, &end, 10);
+		uint32_t last = first;
+		p = end;
+		if (*p == '-') {
+			last = strtoul(p + 1, &end, 10);
+			p = end;
+		}
+		for (uint32_t v = first; v <= last; ++v) {
+			out_values.push_back(v);
+		}
+		if (*p == ',') {
+			++p;
+		}
+	}
+	return true;
+}
+
+#endif
+
+CpuTopology load_cpu_topology() {
+	CpuTopology topology;
+
+#if defined(__linux__)
+	std::vector<uint32_t> node_ids;
+	if (read_sysfs_list("/sys/devices/system/node/online", node_ids)) {
+		for (const uint32_t node_id : node_ids) {
+			char fpath[64];
+			snprintf(fpath, sizeof(fpath), "/sys/devices/system/node/node%u/cpulist", node_id);
+			std::vector<uint32_t> cpus;
+			// Nodes can have memory but no CPU
+			if (read_sysfs_list(fpath, cpus) && cpus.size() > 0) {
+				topology.node_cpus.push_back(std::move(cpus));
+			}
+		}
+	}
+
+#elif defined(_WIN32)
+	// Only the first processor group is supported, which has up to 64 CPUs
+	ULONG highest_node_id = 0;
+	if (GetNumaHighestNodeNumber(&highest_node_id)) {
+		for (ULONG node_id = 0; node_id <= highest_node_id; ++node_id) {
+			ULONGLONG mask = 0;
+			if (!GetNumaNodeProcessorMask(UCHAR(node_id), &mask)) {
+				continue;
+			}
+			std::vector<uint32_t> cpus;
+			for (uint32_t cpu = 0; cpu < 64; ++cpu) {
+				if ((mask & (ULONGLONG(1) << cpu)) != 0) {
+					cpus.push_back(cpu);
+				}
+			}
+			if (cpus.size() > 0) {
+				topology.node_cpus.push_back(std::move(cpus));
+			}
+		}
+	}
+#endif
+
+	// Node indices are stored in 8 bits
+	if (topology.node_cpus.size() > 255) {
+		topology.node_cpus.resize(255);
+	}
+
+	if (topology.node_cpus.size() <= 1) {
+		// Single node, or unknown topology
+		topology.node_cpus.clear();
+		std::vector<uint32_t> cpus;
+		for (uint32_t cpu = 0; cpu < Thread::get_hardware_concurrency(); ++cpu) {
+			cpus.push_back(cpu);
+		}
+		topology.node_cpus.push_back(std::move(cpus));
+	}
+
+	for (unsigned int node = 0; node < topology.node_cpus.size(); ++node) {
+		for (const uint32_t cpu : topology.node_cpus[node]) {
+			if (cpu >= topology.cpu_nodes.size()) {
+				topology.cpu_nodes.resize(cpu + 1, 0);
+			}
+			topology.cpu_nodes[cpu] = node;
+		}
+	}
+
+	return topology;
+}
+
+const CpuTopology &get_cpu_topology() {
+	// Initialized once, thread-safe
+	static const CpuTopology s_topology = load_cpu_topology();
+	return s_topology;
+}
+
+} // namespace
+
 struct ThreadImpl {
 	::Thread thread;
 };
@@ -45,4 +178,81 @@ unsigned int Thread::get_hardware_concurrency() {
 	return std::thread::hardware_concurrency();
 }
 
+bool Thread::set_affinity(Span<const uint32_t> cpus) {
+	ZN_ASSERT_RETURN_V(cpus.size() > 0, false);
+
+#if defined(__linux__)
+	cpu_set_t cpu_set;
+	CPU_ZERO(&cpu_set);
+	for (unsigned int i = 0; i < cpus.size(); ++i) {
+		ZN_ASSERT_CONTINUE(cpus[i] < CPU_SETSIZE);
+		CPU_SET(cpus[i], &cpu_set);
+	}
+	const bool success = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0;
+
+#elif defined(_WIN32)
+	DWORD_PTR mask = 0;
+	for (unsigned int i = 0; i < cpus.size(); ++i) {
+		ZN_ASSERT_CONTINUE(cpus[i] < sizeof(DWORD_PTR) * 8);
+		mask |= DWORD_PTR(1) << cpus[i];
+	}
+	const bool success = SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+
+#else
+	const bool success = false;
+#endif
+
+	if (!success) {
+		return false;
+	}
+
+	// Remember the node if all CPUs belong to the same one
+	const CpuTopology &topology = get_cpu_topology();
+	int node = -1;
+	for (unsigned int i = 0; i < cpus.size(); ++i) {
+		const int cpu_node = cpus[i] < topology.cpu_nodes.size() ? topology.cpu_nodes[cpus[i]] : 0;
+		if (node == -1) {
+			node = cpu_node;
+		} else if (node != cpu_node) {
+			node = -1;
+			break;
+		}
+	}
+	tls_affinity_numa_node = node;
+
+	return true;
+}
+
+unsigned int Thread::get_numa_node_count() {
+	return get_cpu_topology().node_cpus.size();
+}
+
+void Thread::get_numa_node_cpus(unsigned int node, std::vector<uint32_t> &out_cpus) {
+	const CpuTopology &topology = get_cpu_topology();
+	ZN_ASSERT_RETURN(node < topology.node_cpus.size());
+	const std::vector<uint32_t> &cpus = topology.node_cpus[node];
+	out_cpus.insert(out_cpus.end(), cpus.begin(), cpus.end());
+}
+
+unsigned int Thread::get_current_numa_node() {
+	const CpuTopology &topology = get_cpu_topology();
+	if (topology.node_cpus.size() <= 1) {
+		return 0;
+	}
+	if (tls_affinity_numa_node >= 0) {
+		return tls_affinity_numa_node;
+	}
+#if defined(__linux__)
+	const int cpu = sched_getcpu();
+#elif defined(_WIN32)
+	const int cpu = GetCurrentProcessorNumber();
+#else
+	const int cpu = -1;
+#endif
+	if (cpu >= 0 && cpu < int(topology.cpu_nodes.size())) {
+		return topology.cpu_nodes[cpu];
+	}
+	return 0;
+}
+
 } // namespace zylann
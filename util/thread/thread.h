@@ -1,7 +1,9 @@
 #ifndef ZN_THREAD_H
 #define ZN_THREAD_H
 
+#include "../span.h"
 #include <cstdint>
+#include <vector>
 
 namespace zylann {
 
@@ -30,6 +32,18 @@ public:
 	// Targets the current thread
 	static void set_name(const char *name);
 	static void sleep_usec(uint32_t microseconds);
+	// Restricts the current thread to run on the given CPUs. Returns false if it isn't supported on this platform.
+	static bool set_affinity(Span<const uint32_t> cpus);
+
+	// NUMA nodes are groups of CPUs sharing the same memory controller. Memory is slower to access from other nodes.
+	// Nodes are numbered from 0 to count - 1, even if the system numbers them differently. Platforms not supporting
+	// this report a single node.
+	static unsigned int get_numa_node_count();
+	// Appends indices of CPUs belonging to a NUMA node
+	static void get_numa_node_cpus(unsigned int node, std::vector<uint32_t> &out_cpus);
+	// Gets the NUMA node the current thread runs on. If its affinity was set to CPUs of one node, that node is
+	// returned directly. Otherwise it is the node of the CPU the thread is running on right now.
+	static unsigned int get_current_numa_node();
 
 private:
 	ThreadImpl *_impl = nullptr;